@@ -0,0 +1,470 @@
+#include "Allocator.hpp"
+#include "VulkanError.hpp"
+#include <iostream>
+
+#include <algorithm>
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+    if (alignment <= 1) return value;
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// MemoryBlock
+MemoryBlock::MemoryBlock(VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryType, bool linear, void* mapped) {
+    this->memory = memory;
+    this->size = size;
+    this->memoryType = memoryType;
+    this->linear = linear;
+    this->mapped = mapped;
+
+    Range range;
+    range.offset = 0;
+    range.size = size;
+    freeRanges.push_back(range);
+}
+
+bool MemoryBlock::allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset) {
+    // Best fit: the smallest free range that still holds the aligned request.
+    size_t best = freeRanges.size();
+    VkDeviceSize bestWaste = UINT64_MAX;
+
+    for (size_t i = 0; i < freeRanges.size(); ++i) {
+        VkDeviceSize aligned = alignUp(freeRanges[i].offset, alignment);
+        VkDeviceSize padding = aligned - freeRanges[i].offset;
+        if (padding + size > freeRanges[i].size) continue;
+
+        VkDeviceSize waste = freeRanges[i].size - size;
+        if (waste < bestWaste) {
+            best = i;
+            bestWaste = waste;
+            if (waste == padding) break;
+        }
+    }
+
+    if (best == freeRanges.size()) return false;
+
+    Range range = freeRanges[best];
+    VkDeviceSize aligned = alignUp(range.offset, alignment);
+    VkDeviceSize padding = aligned - range.offset;
+    VkDeviceSize tail = range.size - padding - size;
+
+    // Keep the alignment padding and the tail as free ranges, sorted by offset.
+    freeRanges.erase(freeRanges.begin() + best);
+    if (tail > 0) {
+        Range after;
+        after.offset = aligned + size;
+        after.size = tail;
+        freeRanges.insert(freeRanges.begin() + best, after);
+    }
+    if (padding > 0) {
+        Range before;
+        before.offset = range.offset;
+        before.size = padding;
+        freeRanges.insert(freeRanges.begin() + best, before);
+    }
+
+    offset = aligned;
+    used += size;
+    allocationCount++;
+    return true;
+}
+
+void MemoryBlock::free(VkDeviceSize offset, VkDeviceSize size) {
+    Range range;
+    range.offset = offset;
+    range.size = size;
+
+    auto it = std::lower_bound(freeRanges.begin(), freeRanges.end(), range,
+        [](const Range& a, const Range& b) { return a.offset < b.offset; });
+    it = freeRanges.insert(it, range);
+
+    // Merge with the following range, then with the preceding one.
+    auto next = it + 1;
+    if (next != freeRanges.end() && it->offset + it->size == next->offset) {
+        it->size += next->size;
+        freeRanges.erase(next);
+    }
+    if (it != freeRanges.begin()) {
+        auto prev = it - 1;
+        if (prev->offset + prev->size == it->offset) {
+            prev->size += it->size;
+            freeRanges.erase(it);
+        }
+    }
+
+    used -= size;
+    allocationCount--;
+}
+
+VkDeviceSize MemoryBlock::getLargestFreeRange() const {
+    VkDeviceSize largest = 0;
+    for (const Range& range: freeRanges) {
+        largest = std::max(largest, range.size);
+    }
+    return largest;
+}
+
+// Allocator
+bool Allocator::init(VkPhysicalDevice gpu, VkDevice device, VkDeviceSize blockSize) {
+    this->device = device;
+    this->blockSize = blockSize;
+
+    vkGetPhysicalDeviceMemoryProperties(gpu, &memoryProperties);
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(gpu, &properties);
+    maxAllocationCount = properties.limits.maxMemoryAllocationCount;
+
+    return true;
+}
+
+void Allocator::destroy() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (MemoryBlock* block: blocks) {
+        if (block->allocationCount > 0) {
+            std::cout << "Memory block of type " << block->memoryType << " still has "
+                      << block->allocationCount << " allocations" << std::endl;
+        }
+        destroyBlock(block);
+    }
+    blocks.clear();
+
+    if (device != VK_NULL_HANDLE) {
+        std::cout << "Allocator deleted" << std::endl;
+    }
+}
+
+uint32_t Allocator::findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags required,
+        VkMemoryPropertyFlags preferred) const {
+    uint32_t fallback = UINT32_MAX;
+
+    for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
+        if (!(typeBits & (1u << i))) continue;
+
+        VkMemoryPropertyFlags flags = memoryProperties.memoryTypes[i].propertyFlags;
+        if ((flags & required) != required) continue;
+
+        if ((flags & preferred) == preferred) return i;
+        if (fallback == UINT32_MAX) fallback = i;
+    }
+
+    return fallback;
+}
+
+MemoryBlock* Allocator::createBlock(VkDeviceSize size, uint32_t memoryType, bool linear) {
+    if (deviceAllocationCount >= maxAllocationCount) {
+        std::cout << "Failed to allocate memory: maxMemoryAllocationCount reached" << std::endl;
+        return NULL;
+    }
+
+    VkMemoryAllocateInfo memoryAllocateInfo {};
+    memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memoryAllocateInfo.allocationSize = size;
+    memoryAllocateInfo.memoryTypeIndex = memoryType;
+
+    VkDeviceMemory memory;
+    VkResult result = vkAllocateMemory(device, &memoryAllocateInfo, NULL, &memory);
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to allocate memory block of " << size << " bytes: " << getVulkanErrorString(result) << std::endl;
+        return NULL;
+    }
+
+    void* mapped = NULL;
+    if (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        result = vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &mapped);
+        if (result != VK_SUCCESS) {
+            std::cout << "Failed to map memory block: " << getVulkanErrorString(result) << std::endl;
+            vkFreeMemory(device, memory, NULL);
+            return NULL;
+        }
+    }
+
+    deviceAllocationCount++;
+
+    MemoryBlock* block = new MemoryBlock(memory, size, memoryType, linear, mapped);
+    blocks.push_back(block);
+    return block;
+}
+
+void Allocator::destroyBlock(MemoryBlock* block) {
+    if (block->mapped != NULL) {
+        vkUnmapMemory(device, block->memory);
+    }
+    vkFreeMemory(device, block->memory, NULL);
+    deviceAllocationCount--;
+
+    delete(block);
+}
+
+bool Allocator::allocate(const VkMemoryRequirements& requirements, Usage usage, bool linear, Allocation& allocation) {
+    VkMemoryPropertyFlags required = 0;
+    VkMemoryPropertyFlags preferred = 0;
+
+    switch (usage) {
+        case GPU_ONLY:
+            preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+            break;
+        case CPU_TO_GPU:
+            required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+            break;
+        case GPU_TO_CPU:
+            required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+            preferred = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+            break;
+        case GPU_LAZY:
+            preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+            break;
+    }
+
+    uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, required, preferred);
+    if (usage == GPU_LAZY && memoryType != UINT32_MAX && !(memoryProperties.memoryTypes[memoryType].propertyFlags &
+            VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)) {
+        memoryType = findMemoryType(requirements.memoryTypeBits, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    }
+    if (memoryType == UINT32_MAX) {
+        std::cout << "Failed to allocate memory: no suitable memory type" << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Large resources get their own VkDeviceMemory instead of eating a block.
+    if (requirements.size > blockSize / 2) {
+        MemoryBlock* block = createBlock(requirements.size, memoryType, linear);
+        if (block == NULL) return false;
+
+        block->dedicated = true;
+        block->allocate(requirements.size, requirements.alignment, allocation.offset);
+        allocation.block = block;
+    } else {
+        allocation.block = NULL;
+        for (MemoryBlock* block: blocks) {
+            if (block->dedicated || block->memoryType != memoryType || block->linear != linear) continue;
+
+            if (block->allocate(requirements.size, requirements.alignment, allocation.offset)) {
+                allocation.block = block;
+                break;
+            }
+        }
+
+        if (allocation.block == NULL) {
+            MemoryBlock* block = createBlock(blockSize, memoryType, linear);
+            if (block == NULL) return false;
+
+            block->allocate(requirements.size, requirements.alignment, allocation.offset);
+            allocation.block = block;
+        }
+    }
+
+    allocation.memory = allocation.block->memory;
+    allocation.size = requirements.size;
+    allocation.memoryType = memoryType;
+    allocation.mapped = allocation.block->mapped != NULL ?
+        (char*)allocation.block->mapped + allocation.offset : NULL;
+
+    totalAllocations++;
+    return true;
+}
+
+void Allocator::free(Allocation& allocation) {
+    if (allocation.block == NULL) return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    MemoryBlock* block = allocation.block;
+    block->free(allocation.offset, allocation.size);
+    totalFrees++;
+
+    // Dedicated memory goes straight back to the driver; pooled blocks are
+    // kept around for reuse.
+    if (block->dedicated) {
+        blocks.erase(std::find(blocks.begin(), blocks.end(), block));
+        destroyBlock(block);
+    }
+
+    allocation = Allocation();
+}
+
+bool Allocator::createBuffer(VkDeviceSize size, VkBufferUsageFlags bufferUsage, Usage usage,
+        VkBuffer& buffer, Allocation& allocation, const std::vector<uint32_t>& queueFamilies) {
+    VkBufferCreateInfo bufferCreateInfo {};
+    bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferCreateInfo.size = size;
+    bufferCreateInfo.usage = bufferUsage;
+    bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if (queueFamilies.size() > 1) {
+        bufferCreateInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bufferCreateInfo.queueFamilyIndexCount = (uint32_t)queueFamilies.size();
+        bufferCreateInfo.pQueueFamilyIndices = queueFamilies.data();
+    }
+
+    VkResult result = vkCreateBuffer(device, &bufferCreateInfo, NULL, &buffer);
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create buffer: " << getVulkanErrorString(result) << std::endl;
+        return false;
+    }
+
+    VkMemoryRequirements memoryRequirements;
+    vkGetBufferMemoryRequirements(device, buffer, &memoryRequirements);
+
+    if (!allocate(memoryRequirements, usage, true, allocation)) {
+        vkDestroyBuffer(device, buffer, NULL);
+        buffer = VK_NULL_HANDLE;
+        return false;
+    }
+
+    vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset);
+    return true;
+}
+
+void Allocator::destroyBuffer(VkBuffer& buffer, Allocation& allocation) {
+    if (buffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(device, buffer, NULL);
+        buffer = VK_NULL_HANDLE;
+    }
+    free(allocation);
+}
+
+bool Allocator::createImage(const VkImageCreateInfo& imageCreateInfo, Usage usage,
+        VkImage& image, Allocation& allocation) {
+    VkResult result = vkCreateImage(device, &imageCreateInfo, NULL, &image);
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create image: " << getVulkanErrorString(result) << std::endl;
+        return false;
+    }
+
+    VkMemoryRequirements memoryRequirements;
+    vkGetImageMemoryRequirements(device, image, &memoryRequirements);
+
+    bool linear = imageCreateInfo.tiling == VK_IMAGE_TILING_LINEAR;
+    if (!allocate(memoryRequirements, usage, linear, allocation)) {
+        vkDestroyImage(device, image, NULL);
+        image = VK_NULL_HANDLE;
+        return false;
+    }
+
+    vkBindImageMemory(device, image, allocation.memory, allocation.offset);
+    return true;
+}
+
+void Allocator::destroyImage(VkImage& image, Allocation& allocation) {
+    if (image != VK_NULL_HANDLE) {
+        vkDestroyImage(device, image, NULL);
+        image = VK_NULL_HANDLE;
+    }
+    free(allocation);
+}
+
+bool Allocator::isLazilyAllocated(const Allocation& allocation) const {
+    if (allocation.memoryType == UINT32_MAX) return false;
+
+    return (memoryProperties.memoryTypes[allocation.memoryType].propertyFlags &
+        VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0;
+}
+
+Allocator::Stats Allocator::getStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Stats stats;
+    VkDeviceSize freeBytes = 0;
+
+    for (MemoryBlock* block: blocks) {
+        stats.reservedBytes += block->size;
+        stats.usedBytes += block->used;
+        stats.allocationCount += block->allocationCount;
+        stats.largestFreeRange = std::max(stats.largestFreeRange, block->getLargestFreeRange());
+        freeBytes += block->size - block->used;
+
+        if (block->dedicated) {
+            stats.dedicatedCount++;
+        } else {
+            stats.blockCount++;
+        }
+    }
+
+    stats.deviceAllocationCount = deviceAllocationCount;
+    stats.totalAllocations = totalAllocations;
+    stats.totalFrees = totalFrees;
+    stats.fragmentation = freeBytes > 0 ?
+        1.0 - (double)stats.largestFreeRange / (double)freeBytes : 0.0;
+
+    return stats;
+}
+
+void Allocator::printStats() {
+    Stats stats = getStats();
+
+    std::cout << "Device memory: " << stats.usedBytes / 1024 << " KiB used of "
+              << stats.reservedBytes / 1024 << " KiB reserved in "
+              << stats.blockCount << " blocks + " << stats.dedicatedCount << " dedicated, "
+              << stats.allocationCount << " live allocations, "
+              << "fragmentation " << stats.fragmentation << std::endl;
+}
+
+// LinearArena
+bool LinearArena::init(Allocator& allocator, VkDeviceSize frameSize, uint32_t framesInFlight, VkBufferUsageFlags usage) {
+    this->allocator = &allocator;
+    this->frameSize = alignUp(frameSize, 256);
+
+    if (!allocator.createBuffer(this->frameSize * framesInFlight, usage, Allocator::CPU_TO_GPU, buffer, allocation)) {
+        return false;
+    }
+
+    frameBegin = 0;
+    frameOffset = 0;
+    return true;
+}
+
+void LinearArena::destroy() {
+    if (allocator != NULL) {
+        allocator->destroyBuffer(buffer, allocation);
+    }
+}
+
+void LinearArena::beginFrame(uint32_t frameIndex) {
+    frameBegin = frameSize * frameIndex;
+    frameOffset = frameBegin;
+}
+
+bool LinearArena::allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset, void*& ptr) {
+    VkDeviceSize aligned = alignUp(frameOffset, alignment);
+    if (aligned + size > frameBegin + frameSize) return false;
+
+    offset = aligned;
+    ptr = (char*)allocation.mapped + aligned;
+    frameOffset = aligned + size;
+    highWater = std::max(highWater, frameOffset - frameBegin);
+    return true;
+}
+
+// UniformRing
+bool UniformRing::init(VkPhysicalDevice gpu, Allocator& allocator, VkDeviceSize frameSize, uint32_t framesInFlight) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(gpu, &properties);
+    alignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 16);
+
+    return arena.init(allocator, frameSize, framesInFlight, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+}
+
+void UniformRing::destroy() {
+    arena.destroy();
+}
+
+void UniformRing::beginFrame(uint32_t frameIndex) {
+    arena.beginFrame(frameIndex);
+    frameBytes = 0;
+    frameBlocks = 0;
+}
+
+void* UniformRing::allocate(VkDeviceSize size, uint32_t& dynamicOffset) {
+    VkDeviceSize offset;
+    void* ptr;
+    if (!arena.allocate(size, alignment, offset, ptr)) return NULL;
+
+    // Dynamic offsets are 32 bits; the ring is far smaller than that.
+    dynamicOffset = (uint32_t)offset;
+    frameBytes += size;
+    frameBlocks++;
+    return ptr;
+}
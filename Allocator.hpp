@@ -0,0 +1,197 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+class MemoryBlock;
+
+// A suballocated range of device memory. Host-visible memory stays mapped
+// for the lifetime of its block, mapped points at the start of the range.
+struct Allocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    void* mapped = NULL;
+    uint32_t memoryType = UINT32_MAX;
+    MemoryBlock* block = NULL;
+};
+
+// One VkDeviceMemory carved up with a best-fit free list. Neighbouring free
+// ranges are merged on free() so long-lived resources do not fragment it.
+class MemoryBlock {
+    private:
+        struct Range {
+            VkDeviceSize offset;
+            VkDeviceSize size;
+        };
+
+        std::vector<Range> freeRanges = {};
+
+    public:
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        VkDeviceSize used = 0;
+        uint32_t memoryType = 0;
+        uint32_t allocationCount = 0;
+        bool linear = true;
+        bool dedicated = false;
+        void* mapped = NULL;
+
+        MemoryBlock(VkDeviceMemory memory, VkDeviceSize size, uint32_t memoryType, bool linear, void* mapped);
+
+        bool allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+        void free(VkDeviceSize offset, VkDeviceSize size);
+
+        VkDeviceSize getLargestFreeRange() const;
+};
+
+class Allocator {
+    public:
+        enum Usage {
+            GPU_ONLY,       // device local, never touched by the host
+            CPU_TO_GPU,     // host visible and coherent, for uploads and per-frame data
+            GPU_TO_CPU,     // host visible, cached if possible, for readback
+            GPU_LAZY        // lazily allocated if available, for transient attachments
+        };
+
+        struct Stats {
+            VkDeviceSize reservedBytes = 0;
+            VkDeviceSize usedBytes = 0;
+            VkDeviceSize largestFreeRange = 0;
+            uint32_t blockCount = 0;
+            uint32_t dedicatedCount = 0;
+            uint32_t allocationCount = 0;
+            uint32_t deviceAllocationCount = 0;
+            uint64_t totalAllocations = 0;
+            uint64_t totalFrees = 0;
+
+            // 0 when all free space is one contiguous range, close to 1 when
+            // it is scattered across many small holes.
+            double fragmentation = 0.0;
+        };
+
+    private:
+        VkDevice device = VK_NULL_HANDLE;
+        VkPhysicalDeviceMemoryProperties memoryProperties = {};
+        uint32_t maxAllocationCount = 4096;
+
+        VkDeviceSize blockSize = 64 * 1024 * 1024;
+
+        std::mutex mutex;
+        std::vector<MemoryBlock*> blocks = {};
+        uint32_t deviceAllocationCount = 0;
+        uint64_t totalAllocations = 0;
+        uint64_t totalFrees = 0;
+
+        MemoryBlock* createBlock(VkDeviceSize size, uint32_t memoryType, bool linear);
+        void destroyBlock(MemoryBlock* block);
+
+    public:
+        bool init(VkPhysicalDevice gpu, VkDevice device, VkDeviceSize blockSize = 64 * 1024 * 1024);
+        void destroy();
+
+        // Returns the first memory type allowed by typeBits that has all the
+        // required flags, preferring one that also has the preferred flags.
+        uint32_t findMemoryType(uint32_t typeBits, VkMemoryPropertyFlags required,
+            VkMemoryPropertyFlags preferred = 0) const;
+
+        // linear is false for optimally tiled images, they are kept in
+        // separate blocks so bufferImageGranularity never has to be honoured.
+        bool allocate(const VkMemoryRequirements& requirements, Usage usage, bool linear, Allocation& allocation);
+        void free(Allocation& allocation);
+
+        // A buffer used by more than one of queueFamilies is created
+        // concurrent, so it needs no ownership transfers between them.
+        bool createBuffer(VkDeviceSize size, VkBufferUsageFlags bufferUsage, Usage usage,
+            VkBuffer& buffer, Allocation& allocation, const std::vector<uint32_t>& queueFamilies = {});
+        void destroyBuffer(VkBuffer& buffer, Allocation& allocation);
+
+        bool createImage(const VkImageCreateInfo& imageCreateInfo, Usage usage,
+            VkImage& image, Allocation& allocation);
+        void destroyImage(VkImage& image, Allocation& allocation);
+
+        bool isLazilyAllocated(const Allocation& allocation) const;
+
+        Stats getStats();
+        void printStats();
+};
+
+// Per-frame bump allocator over one persistently mapped buffer split into
+// framesInFlight regions. beginFrame() recycles the region of a frame whose
+// fence has been waited on, so allocations are never freed individually.
+class LinearArena {
+    private:
+        Allocator* allocator = NULL;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        Allocation allocation = {};
+
+        VkDeviceSize frameSize = 0;
+        VkDeviceSize frameBegin = 0;
+        VkDeviceSize frameOffset = 0;
+        VkDeviceSize highWater = 0;
+
+    public:
+        bool init(Allocator& allocator, VkDeviceSize frameSize, uint32_t framesInFlight, VkBufferUsageFlags usage);
+        void destroy();
+
+        void beginFrame(uint32_t frameIndex);
+
+        // offset is relative to getBuffer(), ptr is the mapped address.
+        bool allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset, void*& ptr);
+
+        VkBuffer getBuffer() const {
+            return buffer;
+        }
+        VkDeviceSize getFrameUsed() const {
+            return frameOffset - frameBegin;
+        }
+        VkDeviceSize getHighWater() const {
+            return highWater;
+        }
+};
+
+// Uniform blocks of the frame being recorded, bump allocated from a
+// LinearArena at minUniformBufferOffsetAlignment. A block is bound through a
+// UNIFORM_BUFFER_DYNAMIC descriptor covering getBuffer() with the block size
+// as range, so writing one only changes the offset passed at bind time.
+class UniformRing {
+    private:
+        LinearArena arena;
+        VkDeviceSize alignment = 256;
+        VkDeviceSize frameBytes = 0;
+        uint32_t frameBlocks = 0;
+
+    public:
+        bool init(VkPhysicalDevice gpu, Allocator& allocator, VkDeviceSize frameSize, uint32_t framesInFlight);
+        void destroy();
+
+        void beginFrame(uint32_t frameIndex);
+
+        // Returns the mapped block, or NULL when the frame's region is full.
+        void* allocate(VkDeviceSize size, uint32_t& dynamicOffset);
+
+        template<typename T>
+        bool push(const T& data, uint32_t& dynamicOffset) {
+            void* ptr = allocate(sizeof(T), dynamicOffset);
+            if (ptr == NULL) return false;
+            memcpy(ptr, &data, sizeof(T));
+            return true;
+        }
+
+        VkBuffer getBuffer() const {
+            return arena.getBuffer();
+        }
+        // Bytes written and blocks allocated since beginFrame().
+        VkDeviceSize getFrameBytes() const {
+            return frameBytes;
+        }
+        uint32_t getFrameBlocks() const {
+            return frameBlocks;
+        }
+        VkDeviceSize getHighWater() const {
+            return arena.getHighWater();
+        }
+};
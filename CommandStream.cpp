@@ -0,0 +1,273 @@
+#include "CommandStream.hpp"
+
+#include <iostream>
+#include <cstring>
+
+#include "Renderer.hpp"
+
+// Commands are written to the file in blocks of about this size.
+static const size_t FLUSH_SIZE = 1 << 20;
+
+CommandStream::Layout CommandStream::getLayout(uint8_t op) {
+    switch (op) {
+        case OP_POLL_EVENTS:
+        case OP_UPDATE:
+        case OP_CULL:
+        case OP_DRAW:
+            return LAYOUT_NONE;
+        case OP_SET_INSTANCE_COUNT:
+        case OP_SET_INSTANCES_PER_DRAW:
+        case OP_SET_ANIMATED_INSTANCES:
+        case OP_SET_ANIMATION_FRAME:
+        case OP_SET_CULLING_MODE:
+        case OP_SET_SHADING_MODE:
+        case OP_SET_ASYNC_COMPUTE:
+            return LAYOUT_VALUE;
+        case OP_SET_INSTANCE:
+        case OP_SET_INSTANCE_TRANSFORM:
+        case OP_SET_INSTANCES:
+        case OP_SET_VIEW_PROJECTION:
+        case OP_LOAD_MESH:
+        case OP_STREAMED_MESH:
+            return LAYOUT_PAYLOAD;
+        default:
+            return LAYOUT_UNKNOWN;
+    }
+}
+
+const char* CommandStream::getOpName(Op op) {
+    switch (op) {
+        case OP_POLL_EVENTS: return "poll_events";
+        case OP_UPDATE: return "update";
+        case OP_CULL: return "cull";
+        case OP_DRAW: return "draw";
+        case OP_SET_INSTANCE_COUNT: return "set_instance_count";
+        case OP_SET_INSTANCES_PER_DRAW: return "set_instances_per_draw";
+        case OP_SET_ANIMATED_INSTANCES: return "set_animated_instances";
+        case OP_SET_ANIMATION_FRAME: return "set_animation_frame";
+        case OP_SET_CULLING_MODE: return "set_culling_mode";
+        case OP_SET_SHADING_MODE: return "set_shading_mode";
+        case OP_SET_ASYNC_COMPUTE: return "set_async_compute";
+        case OP_SET_INSTANCE: return "set_instance";
+        case OP_SET_INSTANCE_TRANSFORM: return "set_instance_transform";
+        case OP_SET_INSTANCES: return "set_instances";
+        case OP_SET_VIEW_PROJECTION: return "set_view_projection";
+        case OP_LOAD_MESH: return "load_mesh";
+        case OP_STREAMED_MESH: return "streamed_mesh";
+    }
+    return "unknown";
+}
+
+bool CommandStream::open(const std::string& path, uint32_t width, uint32_t height, uint32_t framesInFlight) {
+    close();
+    commands.clear();
+    position = 0;
+    failed = false;
+
+    file = fopen(path.c_str(), "wb");
+    if (file == NULL) {
+        std::cout << "Failed to create command stream " << path << std::endl;
+        return false;
+    }
+
+    this->path = path;
+    header = {};
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.width = width;
+    header.height = height;
+    header.framesInFlight = framesInFlight;
+    header.headerSize = sizeof(Header);
+
+    // The counts are only known at the end, the header is written again
+    // by close().
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        std::cout << "Failed to write command stream " << path << std::endl;
+        fclose(file);
+        file = NULL;
+        return false;
+    }
+
+    buffer.clear();
+    buffer.reserve(FLUSH_SIZE + 4096);
+    return true;
+}
+
+void CommandStream::close() {
+    if (file == NULL) return;
+
+    flush();
+    if (fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1) {
+        std::cout << "Failed to write command stream header of " << path << std::endl;
+    }
+    fclose(file);
+    file = NULL;
+
+    buffer.clear();
+    buffer.shrink_to_fit();
+}
+
+void CommandStream::put(const void* data, size_t size) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    buffer.insert(buffer.end(), bytes, bytes + size);
+    header.commandBytes += size;
+}
+
+void CommandStream::beginCommand(Op op) {
+    if (buffer.size() >= FLUSH_SIZE) {
+        flush();
+    }
+
+    uint8_t byte = (uint8_t)op;
+    put(&byte, 1);
+}
+
+void CommandStream::flush() {
+    if (buffer.empty()) return;
+
+    if (fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size()) {
+        std::cout << "Failed to write command stream " << path << std::endl;
+    }
+    buffer.clear();
+}
+
+void CommandStream::record(Op op, uint32_t value, const void* payload, uint32_t size) {
+    beginCommand(op);
+    put(value);
+    put(size);
+    put(payload, size);
+}
+
+void CommandStream::recordInstance(uint32_t index, const InstanceData& data) {
+    record(OP_SET_INSTANCE, index, &data, sizeof(data));
+}
+
+void CommandStream::recordInstanceTransform(uint32_t index, const Math::Vec3& position, const Math::Quat& rotation, float scale) {
+    float transform[8] {
+        position.x, position.y, position.z,
+        rotation.x, rotation.y, rotation.z, rotation.w,
+        scale
+    };
+    record(OP_SET_INSTANCE_TRANSFORM, index, transform, sizeof(transform));
+}
+
+// The transform arrays one after the other, in TransformArrays order.
+void CommandStream::recordInstances(const Math::TransformArrays& transforms, const std::vector<InstanceData>& instances) {
+    uint32_t count = (uint32_t)instances.size();
+    const std::vector<float>* arrays[8] {
+        &transforms.positionX, &transforms.positionY, &transforms.positionZ,
+        &transforms.rotationX, &transforms.rotationY, &transforms.rotationZ, &transforms.rotationW,
+        &transforms.scale
+    };
+
+    beginCommand(OP_SET_INSTANCES);
+    put(count);
+    put((uint32_t)(count * (8 * sizeof(float) + sizeof(InstanceData))));
+    for (const std::vector<float>* array: arrays) {
+        put(array->data(), count * sizeof(float));
+    }
+    put(instances.data(), count * sizeof(InstanceData));
+}
+
+bool CommandStream::load(const std::string& path) {
+    close();
+    this->path = path;
+    commands.clear();
+    position = 0;
+    failed = false;
+
+    FILE* input = fopen(path.c_str(), "rb");
+    if (input == NULL) {
+        std::cout << "Failed to open command stream " << path << std::endl;
+        return false;
+    }
+
+    bool valid = fread(&header, sizeof(header), 1, input) == 1 &&
+        header.magic == MAGIC && header.version == VERSION && header.headerSize >= sizeof(Header);
+    if (!valid) {
+        std::cout << path << " is not a command stream of version " << VERSION << std::endl;
+        fclose(input);
+        return false;
+    }
+
+    // A recording that was never closed has no counts in its header, its
+    // commands run up to the end of the file.
+    fseek(input, 0, SEEK_END);
+    long end = ftell(input);
+    uint64_t available = end > (long)header.headerSize ? (uint64_t)end - header.headerSize : 0;
+    uint64_t size = header.commandBytes > 0 && header.commandBytes <= available ? header.commandBytes : available;
+
+    commands.resize((size_t)size);
+    fseek(input, (long)header.headerSize, SEEK_SET);
+    if (size > 0 && fread(commands.data(), 1, (size_t)size, input) != size) {
+        std::cout << "Failed to read command stream " << path << std::endl;
+        fclose(input);
+        commands.clear();
+        return false;
+    }
+    fclose(input);
+
+    if (header.commandBytes == 0) {
+        Command command;
+        while (read(command)) {
+            if (command.op == OP_DRAW) header.frames++;
+        }
+        header.commandBytes = position;
+        commands.resize(position);
+        position = 0;
+        failed = false;
+        std::cout << "Command stream " << path << " was not closed, using its first " << header.frames
+                  << " frames" << std::endl;
+    }
+
+    return true;
+}
+
+bool CommandStream::read(Command& command) {
+    if (failed || position >= commands.size()) return false;
+
+    uint8_t op = commands[position];
+    const uint8_t* data = commands.data() + position + 1;
+    size_t remaining = commands.size() - position - 1;
+
+    Layout layout = getLayout(op);
+    command.op = (Op)op;
+    command.value = 0;
+    command.payload = NULL;
+    command.size = 0;
+    size_t length = 0;
+
+    bool valid = layout != LAYOUT_UNKNOWN;
+    if (valid && layout != LAYOUT_NONE) {
+        valid = remaining >= sizeof(uint32_t);
+        if (valid) {
+            memcpy(&command.value, data, sizeof(uint32_t));
+            length = sizeof(uint32_t);
+        }
+    }
+    if (valid && layout == LAYOUT_PAYLOAD) {
+        valid = remaining >= 2 * sizeof(uint32_t);
+        if (valid) {
+            memcpy(&command.size, data + sizeof(uint32_t), sizeof(uint32_t));
+            valid = remaining - 2 * sizeof(uint32_t) >= command.size;
+            command.payload = data + 2 * sizeof(uint32_t);
+            length = 2 * sizeof(uint32_t) + command.size;
+        }
+    }
+
+    if (!valid) {
+        std::cout << "Malformed command stream " << path << " at byte " << header.headerSize + position << std::endl;
+        failed = true;
+        return false;
+    }
+
+    position += 1 + length;
+    return true;
+}
+
+bool CommandStream::peek(Command& command) {
+    size_t current = position;
+    bool result = read(command);
+    position = current;
+    return result;
+}
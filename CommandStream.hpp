@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "Math.hpp"
+
+struct InstanceData;
+
+// Binary trace of the calls made on a Renderer: frames, instance and camera
+// changes, settings and mesh loads, in call order. A trace starts with a
+// snapshot of the renderer's state, so it can be replayed on a fresh
+// headless renderer, and replayed again from the start, with the same
+// result every time.
+//
+// The file is a Header followed by the commands. A command is an Op byte,
+// then a 32-bit value for the value ops, then for the payload ops a 32-bit
+// value, the payload size and the payload. Everything is in host byte
+// order; Header::frames and commandBytes are filled in when recording
+// stops.
+class CommandStream {
+    public:
+        enum Op {
+            // Once per frame, in call order.
+            OP_POLL_EVENTS = 1,
+            OP_UPDATE,
+            OP_CULL,
+            OP_DRAW,
+
+            // value
+            OP_SET_INSTANCE_COUNT = 16,
+            OP_SET_INSTANCES_PER_DRAW,
+            OP_SET_ANIMATED_INSTANCES,
+            OP_SET_ANIMATION_FRAME,
+            OP_SET_CULLING_MODE,
+            OP_SET_SHADING_MODE,
+            OP_SET_ASYNC_COMPUTE,
+
+            // value and payload
+            OP_SET_INSTANCE = 64,           // index, InstanceData
+            OP_SET_INSTANCE_TRANSFORM,      // index, position, rotation and scale
+            OP_SET_INSTANCES,               // count, TransformArrays, then InstanceData
+            OP_SET_VIEW_PROJECTION,         // 0, Mat4
+            OP_LOAD_MESH,                   // 0, path
+            OP_STREAMED_MESH                // 0, path; follows the draw it was swapped in by
+        };
+
+        struct Header {
+            uint32_t magic;                 // MAGIC
+            uint32_t version;
+            uint32_t width;
+            uint32_t height;
+            uint32_t framesInFlight;
+            uint32_t headerSize;
+            uint64_t frames;                // OP_DRAW commands
+            uint64_t commandBytes;
+        };
+        static const uint32_t MAGIC = 0x444d4356;      // "VCMD"
+        static const uint32_t VERSION = 1;
+
+        // Points into the loaded stream, valid until the next load().
+        struct Command {
+            Op op;
+            uint32_t value;
+            const uint8_t* payload;
+            uint32_t size;
+        };
+
+    private:
+        enum Layout {
+            LAYOUT_NONE,
+            LAYOUT_VALUE,
+            LAYOUT_PAYLOAD,
+            LAYOUT_UNKNOWN
+        };
+        static Layout getLayout(uint8_t op);
+
+        std::string path = "";
+        Header header = {};
+
+        // Recording: commands are collected in buffer and written in blocks.
+        FILE* file = NULL;
+        std::vector<uint8_t> buffer = {};
+        void put(const void* data, size_t size);
+        void put(uint32_t value) {
+            put(&value, sizeof(value));
+        }
+        void beginCommand(Op op);
+        void flush();
+
+        // Replay.
+        std::vector<uint8_t> commands = {};
+        size_t position = 0;
+        bool failed = false;
+
+    public:
+        ~CommandStream() {
+            close();
+        }
+
+        // Starts a new trace file, replacing an open one.
+        bool open(const std::string& path, uint32_t width, uint32_t height, uint32_t framesInFlight);
+        // Writes the remaining commands and the final header.
+        void close();
+        bool isRecording() const {
+            return file != NULL;
+        }
+
+        void record(Op op) {
+            beginCommand(op);
+            if (op == OP_DRAW) header.frames++;
+        }
+        void record(Op op, uint32_t value) {
+            beginCommand(op);
+            put(value);
+        }
+        void record(Op op, uint32_t value, const void* payload, uint32_t size);
+        void recordInstance(uint32_t index, const InstanceData& data);
+        void recordInstanceTransform(uint32_t index, const Math::Vec3& position, const Math::Quat& rotation, float scale);
+        void recordInstances(const Math::TransformArrays& transforms, const std::vector<InstanceData>& instances);
+        void recordViewProjection(const Math::Mat4& viewProjection) {
+            record(OP_SET_VIEW_PROJECTION, 0, viewProjection.m, sizeof(viewProjection.m));
+        }
+        void recordPath(Op op, const std::string& path) {
+            record(op, 0, path.data(), (uint32_t)path.size());
+        }
+
+        // Reads a whole trace into memory, so replaying it does no I/O.
+        bool load(const std::string& path);
+        const Header& getHeader() const {
+            return header;
+        }
+        // Returns false at the end of the stream, or if the stream is
+        // malformed, in which case hasFailed() is set.
+        bool read(Command& command);
+        bool peek(Command& command);
+        void rewind() {
+            position = 0;
+        }
+        bool hasFailed() const {
+            return failed;
+        }
+        const std::string& getPath() const {
+            return path;
+        }
+
+        static const char* getOpName(Op op);
+};
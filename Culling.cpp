@@ -0,0 +1,598 @@
+#include "Culling.hpp"
+
+#include <algorithm>
+#include <cfloat>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CULLING_X86 1
+#include <immintrin.h>
+#define CULLING_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+namespace Culling {
+    Frustum Frustum::fromMatrix(const Math::Mat4& m) {
+        // Gribb-Hartmann: every plane is the last row plus or minus one of
+        // the others. Vulkan's depth range starts at 0, so near is row 2.
+        float rows[4][4];
+        for (int r = 0; r < 4; ++r) {
+            for (int c = 0; c < 4; ++c) {
+                rows[r][c] = m.at(c, r);
+            }
+        }
+
+        Frustum frustum;
+        for (int c = 0; c < 4; ++c) {
+            frustum.planes[0][c] = rows[3][c] + rows[0][c];
+            frustum.planes[1][c] = rows[3][c] - rows[0][c];
+            frustum.planes[2][c] = rows[3][c] + rows[1][c];
+            frustum.planes[3][c] = rows[3][c] - rows[1][c];
+            frustum.planes[4][c] = rows[2][c];
+            frustum.planes[5][c] = rows[3][c] - rows[2][c];
+        }
+
+        for (int p = 0; p < 6; ++p) {
+            float* plane = frustum.planes[p];
+            float l = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+            if (l > 0.0f) {
+                for (int c = 0; c < 4; ++c) plane[c] /= l;
+            }
+        }
+        return frustum;
+    }
+
+    void BoundsArrays::resize(size_t count) {
+        minX.resize(count);
+        minY.resize(count);
+        minZ.resize(count);
+        maxX.resize(count);
+        maxY.resize(count);
+        maxZ.resize(count);
+    }
+
+    void BoundsArrays::set(size_t index, const Math::Vec3& min, const Math::Vec3& max) {
+        minX[index] = min.x;
+        minY[index] = min.y;
+        minZ[index] = min.z;
+        maxX[index] = max.x;
+        maxY[index] = max.y;
+        maxZ[index] = max.z;
+    }
+
+    void SphereArrays::resize(size_t count) {
+        centerX.resize(count);
+        centerY.resize(count);
+        centerZ.resize(count);
+        radius.resize(count);
+    }
+
+    void SphereArrays::set(size_t index, const Math::Vec3& center, float radius) {
+        centerX[index] = center.x;
+        centerY[index] = center.y;
+        centerZ[index] = center.z;
+        this->radius[index] = radius;
+    }
+
+    static inline uint32_t objectId(const uint32_t* ids, size_t index) {
+        return ids != NULL ? ids[index] : (uint32_t)index;
+    }
+
+    // For a box only the corner furthest along the plane normal matters. The
+    // normal is the same for every box, so the corner is picked per plane by
+    // choosing the min or max array instead of per element.
+    struct BoxPlane {
+        const float* x;
+        const float* y;
+        const float* z;
+        float normal[3];
+        float distance;
+    };
+
+    static void selectBoxPlanes(const Frustum& frustum, const BoundsArrays& bounds, BoxPlane planes[6]) {
+        for (int p = 0; p < 6; ++p) {
+            const float* plane = frustum.planes[p];
+            planes[p].x = plane[0] >= 0.0f ? bounds.maxX.data() : bounds.minX.data();
+            planes[p].y = plane[1] >= 0.0f ? bounds.maxY.data() : bounds.minY.data();
+            planes[p].z = plane[2] >= 0.0f ? bounds.maxZ.data() : bounds.minZ.data();
+            planes[p].normal[0] = plane[0];
+            planes[p].normal[1] = plane[1];
+            planes[p].normal[2] = plane[2];
+            planes[p].distance = plane[3];
+        }
+    }
+
+    // Scalar kernels, also used for the tails of the SIMD ones.
+    static size_t cullBoxesScalar(const Frustum& frustum, const BoundsArrays& bounds, size_t first, size_t count,
+            const uint32_t* ids, uint32_t* out) {
+        BoxPlane planes[6];
+        selectBoxPlanes(frustum, bounds, planes);
+
+        size_t visibleCount = 0;
+        for (size_t i = first; i < first + count; ++i) {
+            bool visible = true;
+            for (int p = 0; p < 6; ++p) {
+                const BoxPlane& plane = planes[p];
+                float d = plane.normal[0] * plane.x[i] + plane.normal[1] * plane.y[i] +
+                          plane.normal[2] * plane.z[i] + plane.distance;
+                visible &= d >= 0.0f;
+            }
+            if (visible) out[visibleCount++] = objectId(ids, i);
+        }
+        return visibleCount;
+    }
+
+    static size_t cullSpheresScalar(const Frustum& frustum, const SphereArrays& spheres, size_t first, size_t count,
+            const uint32_t* ids, uint32_t* out) {
+        size_t visibleCount = 0;
+        for (size_t i = first; i < first + count; ++i) {
+            bool visible = true;
+            for (int p = 0; p < 6; ++p) {
+                const float* plane = frustum.planes[p];
+                float d = plane[0] * spheres.centerX[i] + plane[1] * spheres.centerY[i] +
+                          plane[2] * spheres.centerZ[i] + plane[3] + spheres.radius[i];
+                visible &= d >= 0.0f;
+            }
+            if (visible) out[visibleCount++] = objectId(ids, i);
+        }
+        return visibleCount;
+    }
+
+    // Appends the ids of the set bits of a lane mask.
+    static inline size_t emitMask(uint32_t mask, const uint32_t* ids, size_t base, uint32_t* out) {
+        size_t visibleCount = 0;
+        while (mask != 0) {
+            out[visibleCount++] = objectId(ids, base + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+        return visibleCount;
+    }
+
+#ifdef CULLING_X86
+    // SSE kernels, 4 objects per iteration.
+    static size_t cullBoxesSse(const Frustum& frustum, const BoundsArrays& bounds, size_t first, size_t count,
+            const uint32_t* ids, uint32_t* out) {
+        BoxPlane planes[6];
+        selectBoxPlanes(frustum, bounds, planes);
+
+        __m128 nx[6], ny[6], nz[6], w[6];
+        for (int p = 0; p < 6; ++p) {
+            nx[p] = _mm_set1_ps(planes[p].normal[0]);
+            ny[p] = _mm_set1_ps(planes[p].normal[1]);
+            nz[p] = _mm_set1_ps(planes[p].normal[2]);
+            w[p] = _mm_set1_ps(planes[p].distance);
+        }
+        __m128 zero = _mm_setzero_ps();
+
+        size_t end = first + count;
+        size_t i = first;
+        size_t visibleCount = 0;
+        for (; i + 4 <= end; i += 4) {
+            __m128 visible = _mm_cmpeq_ps(zero, zero);
+            for (int p = 0; p < 6; ++p) {
+                __m128 d = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(nx[p], _mm_loadu_ps(planes[p].x + i)), _mm_mul_ps(ny[p], _mm_loadu_ps(planes[p].y + i))),
+                    _mm_add_ps(_mm_mul_ps(nz[p], _mm_loadu_ps(planes[p].z + i)), w[p]));
+                visible = _mm_and_ps(visible, _mm_cmpge_ps(d, zero));
+            }
+            visibleCount += emitMask((uint32_t)_mm_movemask_ps(visible), ids, i, out + visibleCount);
+        }
+        if (i < end) {
+            visibleCount += cullBoxesScalar(frustum, bounds, i, end - i, ids, out + visibleCount);
+        }
+        return visibleCount;
+    }
+
+    static size_t cullSpheresSse(const Frustum& frustum, const SphereArrays& spheres, size_t first, size_t count,
+            const uint32_t* ids, uint32_t* out) {
+        __m128 nx[6], ny[6], nz[6], w[6];
+        for (int p = 0; p < 6; ++p) {
+            nx[p] = _mm_set1_ps(frustum.planes[p][0]);
+            ny[p] = _mm_set1_ps(frustum.planes[p][1]);
+            nz[p] = _mm_set1_ps(frustum.planes[p][2]);
+            w[p] = _mm_set1_ps(frustum.planes[p][3]);
+        }
+        __m128 zero = _mm_setzero_ps();
+
+        size_t end = first + count;
+        size_t i = first;
+        size_t visibleCount = 0;
+        for (; i + 4 <= end; i += 4) {
+            __m128 x = _mm_loadu_ps(&spheres.centerX[i]);
+            __m128 y = _mm_loadu_ps(&spheres.centerY[i]);
+            __m128 z = _mm_loadu_ps(&spheres.centerZ[i]);
+            __m128 radius = _mm_loadu_ps(&spheres.radius[i]);
+
+            __m128 visible = _mm_cmpeq_ps(zero, zero);
+            for (int p = 0; p < 6; ++p) {
+                __m128 d = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(nx[p], x), _mm_mul_ps(ny[p], y)),
+                    _mm_add_ps(_mm_mul_ps(nz[p], z), _mm_add_ps(w[p], radius)));
+                visible = _mm_and_ps(visible, _mm_cmpge_ps(d, zero));
+            }
+            visibleCount += emitMask((uint32_t)_mm_movemask_ps(visible), ids, i, out + visibleCount);
+        }
+        if (i < end) {
+            visibleCount += cullSpheresScalar(frustum, spheres, i, end - i, ids, out + visibleCount);
+        }
+        return visibleCount;
+    }
+
+    // AVX2 + FMA kernels, 8 objects per iteration.
+    CULLING_AVX2 static size_t cullBoxesAvx2(const Frustum& frustum, const BoundsArrays& bounds, size_t first, size_t count,
+            const uint32_t* ids, uint32_t* out) {
+        BoxPlane planes[6];
+        selectBoxPlanes(frustum, bounds, planes);
+
+        __m256 nx[6], ny[6], nz[6], w[6];
+        for (int p = 0; p < 6; ++p) {
+            nx[p] = _mm256_set1_ps(planes[p].normal[0]);
+            ny[p] = _mm256_set1_ps(planes[p].normal[1]);
+            nz[p] = _mm256_set1_ps(planes[p].normal[2]);
+            w[p] = _mm256_set1_ps(planes[p].distance);
+        }
+        __m256 zero = _mm256_setzero_ps();
+
+        size_t end = first + count;
+        size_t i = first;
+        size_t visibleCount = 0;
+        for (; i + 8 <= end; i += 8) {
+            __m256 visible = _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ);
+            for (int p = 0; p < 6; ++p) {
+                __m256 d = _mm256_fmadd_ps(nx[p], _mm256_loadu_ps(planes[p].x + i),
+                    _mm256_fmadd_ps(ny[p], _mm256_loadu_ps(planes[p].y + i),
+                    _mm256_fmadd_ps(nz[p], _mm256_loadu_ps(planes[p].z + i), w[p])));
+                visible = _mm256_and_ps(visible, _mm256_cmp_ps(d, zero, _CMP_GE_OQ));
+            }
+            visibleCount += emitMask((uint32_t)_mm256_movemask_ps(visible), ids, i, out + visibleCount);
+        }
+        if (i < end) {
+            visibleCount += cullBoxesSse(frustum, bounds, i, end - i, ids, out + visibleCount);
+        }
+        return visibleCount;
+    }
+
+    CULLING_AVX2 static size_t cullSpheresAvx2(const Frustum& frustum, const SphereArrays& spheres, size_t first, size_t count,
+            const uint32_t* ids, uint32_t* out) {
+        __m256 nx[6], ny[6], nz[6], w[6];
+        for (int p = 0; p < 6; ++p) {
+            nx[p] = _mm256_set1_ps(frustum.planes[p][0]);
+            ny[p] = _mm256_set1_ps(frustum.planes[p][1]);
+            nz[p] = _mm256_set1_ps(frustum.planes[p][2]);
+            w[p] = _mm256_set1_ps(frustum.planes[p][3]);
+        }
+        __m256 zero = _mm256_setzero_ps();
+
+        size_t end = first + count;
+        size_t i = first;
+        size_t visibleCount = 0;
+        for (; i + 8 <= end; i += 8) {
+            __m256 x = _mm256_loadu_ps(&spheres.centerX[i]);
+            __m256 y = _mm256_loadu_ps(&spheres.centerY[i]);
+            __m256 z = _mm256_loadu_ps(&spheres.centerZ[i]);
+            __m256 radius = _mm256_loadu_ps(&spheres.radius[i]);
+
+            __m256 visible = _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ);
+            for (int p = 0; p < 6; ++p) {
+                __m256 d = _mm256_fmadd_ps(nx[p], x, _mm256_fmadd_ps(ny[p], y,
+                    _mm256_fmadd_ps(nz[p], z, _mm256_add_ps(w[p], radius))));
+                visible = _mm256_and_ps(visible, _mm256_cmp_ps(d, zero, _CMP_GE_OQ));
+            }
+            visibleCount += emitMask((uint32_t)_mm256_movemask_ps(visible), ids, i, out + visibleCount);
+        }
+        if (i < end) {
+            visibleCount += cullSpheresSse(frustum, spheres, i, end - i, ids, out + visibleCount);
+        }
+        return visibleCount;
+    }
+#endif
+
+    struct Kernels {
+        size_t (*cullBoxes)(const Frustum&, const BoundsArrays&, size_t, size_t, const uint32_t*, uint32_t*);
+        size_t (*cullSpheres)(const Frustum&, const SphereArrays&, size_t, size_t, const uint32_t*, uint32_t*);
+    };
+
+    static const Kernels kernels[] = {
+        { cullBoxesScalar, cullSpheresScalar },
+#ifdef CULLING_X86
+        { cullBoxesSse, cullSpheresSse },
+        { cullBoxesAvx2, cullSpheresAvx2 },
+#endif
+    };
+
+    size_t cullBoxes(const Frustum& frustum, const BoundsArrays& bounds, size_t first, size_t count,
+            const uint32_t* ids, uint32_t* out) {
+        return kernels[Math::getSimdLevel()].cullBoxes(frustum, bounds, first, count, ids, out);
+    }
+
+    size_t cullSpheres(const Frustum& frustum, const SphereArrays& spheres, size_t first, size_t count,
+            const uint32_t* ids, uint32_t* out) {
+        return kernels[Math::getSimdLevel()].cullSpheres(frustum, spheres, first, count, ids, out);
+    }
+
+    enum BoxClass {
+        BOX_OUTSIDE,
+        BOX_INTERSECTS,
+        BOX_INSIDE
+    };
+
+    // A box is outside if its furthest corner along some plane normal is
+    // behind that plane, and inside if even its nearest corner is in front
+    // of every plane.
+    static BoxClass classifyBox(const Frustum& frustum, const float* min, const float* max) {
+        BoxClass result = BOX_INSIDE;
+        for (int p = 0; p < 6; ++p) {
+            const float* plane = frustum.planes[p];
+            float furthest = plane[3];
+            float nearest = plane[3];
+            for (int c = 0; c < 3; ++c) {
+                furthest += plane[c] * (plane[c] >= 0.0f ? max[c] : min[c]);
+                nearest += plane[c] * (plane[c] >= 0.0f ? min[c] : max[c]);
+            }
+            if (furthest < 0.0f) return BOX_OUTSIDE;
+            if (nearest < 0.0f) result = BOX_INTERSECTS;
+        }
+        return result;
+    }
+
+    void Bvh::clear() {
+        nodes.clear();
+        objects.clear();
+        bounds.resize(0);
+        slots.clear();
+        leafNodes.clear();
+    }
+
+    // Leaves are filled to LEAF_SIZE where possible so a leaf test is a
+    // single AVX2 iteration.
+    uint32_t Bvh::buildNode(std::vector<float>& centroids, uint32_t first, uint32_t count) {
+        uint32_t index = (uint32_t)nodes.size();
+        Node node {};
+        node.first = first;
+        node.count = count;
+        node.right = 0;
+        nodes.push_back(node);
+
+        if (count <= LEAF_SIZE) return index;
+
+        float low[3] { FLT_MAX, FLT_MAX, FLT_MAX };
+        float high[3] { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        for (uint32_t i = first; i < first + count; ++i) {
+            const float* centroid = &centroids[(size_t)objects[i] * 3];
+            for (int c = 0; c < 3; ++c) {
+                low[c] = std::min(low[c], centroid[c]);
+                high[c] = std::max(high[c], centroid[c]);
+            }
+        }
+
+        int axis = 0;
+        if (high[1] - low[1] > high[axis] - low[axis]) axis = 1;
+        if (high[2] - low[2] > high[axis] - low[axis]) axis = 2;
+
+        uint32_t half = (count / 2 + LEAF_SIZE - 1) / LEAF_SIZE * LEAF_SIZE;
+        std::nth_element(objects.begin() + first, objects.begin() + first + half, objects.begin() + first + count,
+            [&](uint32_t a, uint32_t b) {
+                return centroids[(size_t)a * 3 + axis] < centroids[(size_t)b * 3 + axis];
+            });
+
+        buildNode(centroids, first, half);
+        uint32_t right = buildNode(centroids, first + half, count - half);
+        nodes[index].right = right;
+        return index;
+    }
+
+    void Bvh::fitNode(uint32_t index) {
+        Node& node = nodes[index];
+
+        if (node.right == 0) {
+            node.min[0] = node.min[1] = node.min[2] = FLT_MAX;
+            node.max[0] = node.max[1] = node.max[2] = -FLT_MAX;
+            for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                node.min[0] = std::min(node.min[0], bounds.minX[i]);
+                node.min[1] = std::min(node.min[1], bounds.minY[i]);
+                node.min[2] = std::min(node.min[2], bounds.minZ[i]);
+                node.max[0] = std::max(node.max[0], bounds.maxX[i]);
+                node.max[1] = std::max(node.max[1], bounds.maxY[i]);
+                node.max[2] = std::max(node.max[2], bounds.maxZ[i]);
+            }
+            return;
+        }
+
+        const Node& left = nodes[index + 1];
+        const Node& right = nodes[node.right];
+        for (int c = 0; c < 3; ++c) {
+            node.min[c] = std::min(left.min[c], right.min[c]);
+            node.max[c] = std::max(left.max[c], right.max[c]);
+        }
+    }
+
+    void Bvh::build(const BoundsArrays& source) {
+        uint32_t count = (uint32_t)source.size();
+
+        nodes.clear();
+        objects.resize(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            objects[i] = i;
+        }
+        if (count == 0) {
+            bounds.resize(0);
+            return;
+        }
+
+        std::vector<float> centroids((size_t)count * 3);
+        for (uint32_t i = 0; i < count; ++i) {
+            centroids[(size_t)i * 3 + 0] = (source.minX[i] + source.maxX[i]) * 0.5f;
+            centroids[(size_t)i * 3 + 1] = (source.minY[i] + source.maxY[i]) * 0.5f;
+            centroids[(size_t)i * 3 + 2] = (source.minZ[i] + source.maxZ[i]) * 0.5f;
+        }
+
+        nodes.reserve((size_t)count / LEAF_SIZE * 2 + 1);
+        buildNode(centroids, 0, count);
+
+        slots.resize(count);
+        leafNodes.resize(count);
+        for (uint32_t i = 0; i < (uint32_t)nodes.size(); ++i) {
+            const Node& node = nodes[i];
+            if (node.right != 0) continue;
+            for (uint32_t j = node.first; j < node.first + node.count; ++j) {
+                slots[objects[j]] = j;
+                leafNodes[j] = i;
+            }
+        }
+
+        // Bounds are filled in bottom-up by refit().
+        refit(source);
+    }
+
+    void Bvh::refit(const BoundsArrays& source) {
+        if (source.size() != objects.size()) {
+            build(source);
+            return;
+        }
+
+        size_t count = objects.size();
+        bounds.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            uint32_t object = objects[i];
+            bounds.minX[i] = source.minX[object];
+            bounds.minY[i] = source.minY[object];
+            bounds.minZ[i] = source.minZ[object];
+            bounds.maxX[i] = source.maxX[object];
+            bounds.maxY[i] = source.maxY[object];
+            bounds.maxZ[i] = source.maxZ[object];
+        }
+
+        // Children are always stored after their parent.
+        for (size_t i = nodes.size(); i > 0; --i) {
+            fitNode((uint32_t)(i - 1));
+        }
+    }
+
+    void Bvh::refit(const BoundsArrays& source, const std::vector<uint32_t>& changed) {
+        if (source.size() != objects.size()) {
+            build(source);
+            return;
+        }
+        if (changed.empty()) return;
+
+        nodeDirty.assign(nodes.size(), 0);
+        for (size_t i = 0; i < changed.size(); ++i) {
+            uint32_t object = changed[i];
+            uint32_t slot = slots[object];
+            bounds.minX[slot] = source.minX[object];
+            bounds.minY[slot] = source.minY[object];
+            bounds.minZ[slot] = source.minZ[object];
+            bounds.maxX[slot] = source.maxX[object];
+            bounds.maxY[slot] = source.maxY[object];
+            bounds.maxZ[slot] = source.maxZ[object];
+            nodeDirty[leafNodes[slot]] = 1;
+        }
+
+        for (size_t i = nodes.size(); i > 0; --i) {
+            uint32_t index = (uint32_t)(i - 1);
+            const Node& node = nodes[index];
+            if (node.right != 0) {
+                nodeDirty[index] = nodeDirty[index + 1] | nodeDirty[node.right];
+            }
+            if (nodeDirty[index]) fitNode(index);
+        }
+    }
+
+    void Bvh::cullTask(const Frustum& frustum, const Task& task, std::vector<uint32_t>& out) const {
+        if (task.inside) {
+            const Node& node = nodes[task.node];
+            out.insert(out.end(), objects.begin() + node.first, objects.begin() + node.first + node.count);
+            return;
+        }
+
+        // The tree is balanced, so its depth stays far below the stack size.
+        uint32_t stack[64];
+        uint32_t stackSize = 0;
+        stack[stackSize++] = task.node;
+
+        while (stackSize > 0) {
+            uint32_t index = stack[--stackSize];
+            const Node& node = nodes[index];
+
+            BoxClass boxClass = classifyBox(frustum, node.min, node.max);
+            if (boxClass == BOX_OUTSIDE) continue;
+
+            if (boxClass == BOX_INSIDE) {
+                out.insert(out.end(), objects.begin() + node.first, objects.begin() + node.first + node.count);
+            } else if (node.right == 0) {
+                size_t begin = out.size();
+                out.resize(begin + node.count);
+                size_t visibleCount = cullBoxes(frustum, bounds, node.first, node.count, objects.data(), &out[begin]);
+                out.resize(begin + visibleCount);
+            } else {
+                stack[stackSize++] = node.right;
+                stack[stackSize++] = index + 1;
+            }
+        }
+    }
+
+    size_t Bvh::cull(const Frustum& frustum, ThreadPool* pool, std::vector<uint32_t>& visible) {
+        visible.clear();
+        tasks.clear();
+        if (nodes.empty()) return 0;
+
+        // Classify the top levels here until there are enough subtrees to
+        // keep every thread busy; each subtree becomes one task.
+        uint32_t threadCount = pool != NULL ? pool->getThreadCount() : 1;
+        size_t targetTasks = threadCount > 1 ? (size_t)threadCount * 16 : 1;
+
+        frontier.assign(1, 0);
+        while (!frontier.empty() && tasks.size() + frontier.size() < targetTasks) {
+            nextFrontier.clear();
+            for (size_t i = 0; i < frontier.size(); ++i) {
+                uint32_t index = frontier[i];
+                const Node& node = nodes[index];
+
+                if (node.right == 0) {
+                    tasks.push_back({ index, false });
+                    continue;
+                }
+
+                BoxClass boxClass = classifyBox(frustum, node.min, node.max);
+                if (boxClass == BOX_OUTSIDE) continue;
+                if (boxClass == BOX_INSIDE) {
+                    tasks.push_back({ index, true });
+                    continue;
+                }
+
+                nextFrontier.push_back(index + 1);
+                nextFrontier.push_back(node.right);
+            }
+            frontier.swap(nextFrontier);
+        }
+        for (size_t i = 0; i < frontier.size(); ++i) {
+            tasks.push_back({ frontier[i], false });
+        }
+
+        if (taskResults.size() < tasks.size()) {
+            taskResults.resize(tasks.size());
+        }
+
+        // Every task writes its own list, so the result does not depend on
+        // which thread ran what.
+        ThreadPool::RangeTask runTasks = [&](uint32_t, uint32_t begin, uint32_t end) {
+            for (uint32_t i = begin; i < end; ++i) {
+                taskResults[i].clear();
+                cullTask(frustum, tasks[i], taskResults[i]);
+            }
+        };
+        if (pool != NULL && tasks.size() > 1) {
+            pool->parallelFor((uint32_t)tasks.size(), 1, runTasks);
+        } else {
+            runTasks(0, 0, (uint32_t)tasks.size());
+        }
+
+        size_t visibleCount = 0;
+        for (size_t i = 0; i < tasks.size(); ++i) {
+            visibleCount += taskResults[i].size();
+        }
+        visible.reserve(visibleCount);
+        for (size_t i = 0; i < tasks.size(); ++i) {
+            visible.insert(visible.end(), taskResults[i].begin(), taskResults[i].end());
+        }
+        return visible.size();
+    }
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Math.hpp"
+#include "ThreadPool.hpp"
+
+// CPU visibility determination. Bounds are kept as structure-of-arrays so the
+// box and sphere tests can check 4 (SSE) or 8 (AVX2) objects against a plane
+// at once; the kernel follows Math::getSimdLevel().
+namespace Culling {
+    // Six normalized planes, a point p is inside when
+    // dot(plane.xyz, p) + plane.w >= 0 for all of them.
+    struct Frustum {
+        float planes[6][4] = {};
+
+        // Extracts the planes of a Vulkan clip space (depth 0..1) matrix.
+        static Frustum fromMatrix(const Math::Mat4& viewProjection);
+    };
+
+    struct BoundsArrays {
+        std::vector<float> minX, minY, minZ;
+        std::vector<float> maxX, maxY, maxZ;
+
+        void resize(size_t count);
+        size_t size() const {
+            return minX.size();
+        }
+
+        void set(size_t index, const Math::Vec3& min, const Math::Vec3& max);
+    };
+
+    struct SphereArrays {
+        std::vector<float> centerX, centerY, centerZ;
+        std::vector<float> radius;
+
+        void resize(size_t count);
+        size_t size() const {
+            return radius.size();
+        }
+
+        void set(size_t index, const Math::Vec3& center, float radius);
+    };
+
+    // Test objects [first, first + count) and write the ids of those that
+    // touch the frustum to out, returning how many were written. The id of
+    // object i is ids[i], or i itself when ids is NULL. out needs room for
+    // count entries.
+    size_t cullBoxes(const Frustum& frustum, const BoundsArrays& bounds, size_t first, size_t count,
+        const uint32_t* ids, uint32_t* out);
+    size_t cullSpheres(const Frustum& frustum, const SphereArrays& spheres, size_t first, size_t count,
+        const uint32_t* ids, uint32_t* out);
+
+    // Bounding volume hierarchy over a set of boxes, split at the median of
+    // the longest centroid axis. Nodes are stored depth-first so every
+    // subtree covers a contiguous range of objects; a node that is entirely
+    // inside the frustum emits that range without further tests, leaves
+    // that straddle a plane test their objects with cullBoxes().
+    class Bvh {
+        public:
+            static const uint32_t LEAF_SIZE = 8;
+
+            struct Node {
+                float min[3];
+                float max[3];
+                // Objects below this node, in BVH order.
+                uint32_t first;
+                uint32_t count;
+                // Right child, 0 for leaves. The left child follows the node.
+                uint32_t right;
+            };
+
+        private:
+            struct Task {
+                uint32_t node;
+                bool inside;
+            };
+
+            std::vector<Node> nodes = {};
+            // BVH order to source index, and the source bounds in BVH order.
+            std::vector<uint32_t> objects = {};
+            BoundsArrays bounds;
+            // Source index to BVH order, and the leaf holding each slot.
+            std::vector<uint32_t> slots = {};
+            std::vector<uint32_t> leafNodes = {};
+            std::vector<uint8_t> nodeDirty = {};
+
+            std::vector<Task> tasks = {};
+            std::vector<uint32_t> frontier = {};
+            std::vector<uint32_t> nextFrontier = {};
+            std::vector<std::vector<uint32_t>> taskResults = {};
+
+            uint32_t buildNode(std::vector<float>& centroids, uint32_t first, uint32_t count);
+            void fitNode(uint32_t index);
+            void cullTask(const Frustum& frustum, const Task& task, std::vector<uint32_t>& out) const;
+
+        public:
+            void build(const BoundsArrays& source);
+            // Updates the node bounds after objects moved. The tree keeps
+            // its shape, so it should be rebuilt if objects travel far.
+            void refit(const BoundsArrays& source);
+            // Same, but only reads the bounds of the changed objects and
+            // refits the nodes above them.
+            void refit(const BoundsArrays& source, const std::vector<uint32_t>& changed);
+            void clear();
+
+            // Fills visible with the source indices of the boxes touching
+            // the frustum. The top of the tree is split into independent
+            // subtrees that are culled on pool, which may be NULL.
+            size_t cull(const Frustum& frustum, ThreadPool* pool, std::vector<uint32_t>& visible);
+
+            size_t getNodeCount() const {
+                return nodes.size();
+            }
+            size_t getObjectCount() const {
+                return objects.size();
+            }
+    };
+};
@@ -0,0 +1,98 @@
+#include "DescriptorAllocator.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+// Every new pool doubles the sets of the previous one up to this many, so a
+// frame that outgrows its pools settles on a handful of them.
+static const uint32_t MAX_SETS_PER_POOL = 4096;
+
+bool DescriptorAllocator::init(VkDevice device, const std::vector<VkDescriptorPoolSize>& setSizes, uint32_t setsPerPool) {
+    this->device = device;
+    this->setSizes = setSizes;
+    this->setsPerPool = std::max<uint32_t>(setsPerPool, 1);
+
+    currentPool = 0;
+    frameSets = 0;
+    return createPool(this->setsPerPool);
+}
+
+void DescriptorAllocator::destroy() {
+    for (const Pool& pool: pools) {
+        vkDestroyDescriptorPool(device, pool.pool, NULL);
+    }
+    pools.clear();
+    currentPool = 0;
+}
+
+bool DescriptorAllocator::createPool(uint32_t maxSets) {
+    std::vector<VkDescriptorPoolSize> poolSizes = setSizes;
+    for (VkDescriptorPoolSize& poolSize: poolSizes) {
+        poolSize.descriptorCount *= maxSets;
+    }
+
+    VkDescriptorPoolCreateInfo poolCreateInfo {};
+    poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolCreateInfo.maxSets = maxSets;
+    poolCreateInfo.poolSizeCount = (uint32_t)poolSizes.size();
+    poolCreateInfo.pPoolSizes = poolSizes.data();
+
+    Pool pool { VK_NULL_HANDLE, maxSets, 0 };
+    if (vkCreateDescriptorPool(device, &poolCreateInfo, NULL, &pool.pool) != VK_SUCCESS) {
+        std::cout << "Failed to create descriptor pool of " << maxSets << " sets" << std::endl;
+        return false;
+    }
+
+    pools.push_back(pool);
+    return true;
+}
+
+void DescriptorAllocator::reset() {
+    // Pools past currentPool were not touched since the last reset.
+    for (uint32_t i = 0; i <= currentPool && i < pools.size(); ++i) {
+        vkResetDescriptorPool(device, pools[i].pool, 0);
+        pools[i].usedSets = 0;
+    }
+    currentPool = 0;
+    frameSets = 0;
+}
+
+bool DescriptorAllocator::allocate(VkDescriptorSetLayout layout, VkDescriptorSet& set) {
+    VkDescriptorSetAllocateInfo allocateInfo {};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocateInfo.descriptorSetCount = 1;
+    allocateInfo.pSetLayouts = &layout;
+
+    // Pools are sized so that counting sets is enough to never overrun one,
+    // which Vulkan 1.0 does not report reliably. A failure is still treated
+    // as a full pool in case the layout is larger than setSizes claims.
+    while (true) {
+        if (currentPool == pools.size() &&
+                !createPool(std::min(pools.back().maxSets * 2, MAX_SETS_PER_POOL))) {
+            return false;
+        }
+
+        Pool& pool = pools[currentPool];
+        if (pool.usedSets < pool.maxSets) {
+            allocateInfo.descriptorPool = pool.pool;
+
+            VkResult result = vkAllocateDescriptorSets(device, &allocateInfo, &set);
+            if (result == VK_SUCCESS) {
+                pool.usedSets++;
+                frameSets++;
+                totalSets++;
+                return true;
+            }
+            if (result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL) {
+                std::cout << "Failed to allocate descriptor set" << std::endl;
+                return false;
+            }
+            if (pool.usedSets == 0) {
+                std::cout << "Descriptor set layout does not fit an empty pool" << std::endl;
+                return false;
+            }
+        }
+
+        currentPool++;
+    }
+}
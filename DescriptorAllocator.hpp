@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <vector>
+
+// Transient descriptor sets for one frame in flight. Sets are carved out of
+// a list of pools that grows whenever the current pool is full; reset()
+// recycles every pool at once after the frame's fence has been waited on,
+// so sets are never freed individually. Pools are kept across resets, a
+// frame that needed three once gets three from then on.
+class DescriptorAllocator {
+    private:
+        struct Pool {
+            VkDescriptorPool pool;
+            uint32_t maxSets;
+            uint32_t usedSets;
+        };
+
+        VkDevice device = VK_NULL_HANDLE;
+        // Upper bound of descriptors of each type in one set; a pool of n
+        // sets holds n times as many.
+        std::vector<VkDescriptorPoolSize> setSizes = {};
+        std::vector<Pool> pools = {};
+        uint32_t currentPool = 0;
+        uint32_t setsPerPool = 0;
+        uint32_t frameSets = 0;
+        uint64_t totalSets = 0;
+
+        bool createPool(uint32_t maxSets);
+
+    public:
+        bool init(VkDevice device, const std::vector<VkDescriptorPoolSize>& setSizes, uint32_t setsPerPool = 64);
+        void destroy();
+
+        void reset();
+
+        // layout may use at most setSizes descriptors of each type.
+        bool allocate(VkDescriptorSetLayout layout, VkDescriptorSet& set);
+
+        uint32_t getFrameSetCount() const {
+            return frameSets;
+        }
+        uint64_t getTotalSetCount() const {
+            return totalSets;
+        }
+        uint32_t getPoolCount() const {
+            return (uint32_t)pools.size();
+        }
+};
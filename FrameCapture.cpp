@@ -0,0 +1,467 @@
+#include "FrameCapture.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+typedef std::chrono::steady_clock Clock;
+
+static const uint8_t PNG_SIGNATURE[8] = { 0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A };
+static const uint32_t STORED_BLOCK_SIZE = 65535;
+
+static double elapsedMs(Clock::time_point begin) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+}
+
+static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t size) {
+    static const std::vector<uint32_t> table = []() {
+        std::vector<uint32_t> values(256);
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t value = i;
+            for (uint32_t bit = 0; bit < 8; ++bit) {
+                value = (value & 1) ? 0xEDB88320 ^ (value >> 1) : value >> 1;
+            }
+            values[i] = value;
+        }
+        return values;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t adler32(const uint8_t* data, size_t size) {
+    // 5552 bytes is the most that can be summed before b could overflow.
+    uint32_t a = 1;
+    uint32_t b = 0;
+    while (size > 0) {
+        size_t count = std::min(size, (size_t)5552);
+        size -= count;
+        while (count-- > 0) {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+static void putBigEndian(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back((uint8_t)(value >> 24));
+    out.push_back((uint8_t)(value >> 16));
+    out.push_back((uint8_t)(value >> 8));
+    out.push_back((uint8_t)value);
+}
+
+static void putChunk(std::vector<uint8_t>& out, const char* type, const uint8_t* data, size_t size) {
+    putBigEndian(out, (uint32_t)size);
+    size_t begin = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + size);
+    putBigEndian(out, crc32(0, out.data() + begin, size + 4));
+}
+
+bool FrameCapture::isFormatSupported(VkFormat format) {
+    switch (format) {
+        case VK_FORMAT_R8G8B8A8_UNORM:
+        case VK_FORMAT_R8G8B8A8_SRGB:
+        case VK_FORMAT_B8G8R8A8_UNORM:
+        case VK_FORMAT_B8G8R8A8_SRGB:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool FrameCapture::parseFormat(const char* name, Format& format) {
+    if (strcmp(name, "png") == 0) {
+        format = FORMAT_PNG;
+    } else if (strcmp(name, "raw") == 0) {
+        format = FORMAT_RAW;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool FrameCapture::init(Allocator& allocator, const Settings& settings, VkExtent2D extent, VkFormat format,
+        uint32_t framesInFlight) {
+    destroy();
+
+    if (!isFormatSupported(format)) {
+        std::cout << "Cannot capture images of format " << format << std::endl;
+        return false;
+    }
+
+    this->allocator = &allocator;
+    this->settings = settings;
+    this->settings.interval = std::max(settings.interval, 1u);
+    this->settings.threads = std::max(settings.threads, 1u);
+    this->extent = extent;
+    this->format = format;
+    frameBytes = (VkDeviceSize)extent.width * extent.height * 4;
+    recordSize = sizeof(uint64_t) + frameBytes;
+    frame = 0;
+    nextRecord = 0;
+    current = UINT32_MAX;
+
+    uint32_t bufferCount = settings.buffers > 0 ? settings.buffers : framesInFlight + 2 * this->settings.threads;
+    slots.resize(bufferCount);
+    for (Slot& slot: slots) {
+        if (!allocator.createBuffer(frameBytes, VK_BUFFER_USAGE_TRANSFER_DST_BIT, Allocator::GPU_TO_CPU,
+                slot.buffer, slot.memory)) {
+            std::cout << "Failed to create capture buffers" << std::endl;
+            destroy();
+            return false;
+        }
+    }
+
+    if (this->settings.format == FORMAT_RAW && !openRaw()) {
+        destroy();
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = false;
+        stats = Stats();
+        stats.buffers = bufferCount;
+    }
+
+    try {
+        for (uint32_t i = 0; i < this->settings.threads; ++i) {
+            workers.push_back(std::thread(&FrameCapture::workerMain, this));
+        }
+    } catch (const std::system_error& error) {
+        std::cout << "Failed to start capture thread: " << error.what() << std::endl;
+        destroy();
+        return false;
+    }
+
+    active = true;
+    return true;
+}
+
+void FrameCapture::destroy() {
+    // Every recorded copy has completed once the device is idle; the
+    // workers drain the queue before they stop.
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (uint32_t i = 0; i < slots.size(); ++i) {
+            if (slots[i].state == SLOT_RECORDED) {
+                slots[i].state = SLOT_ENCODING;
+                queued.push_back(i);
+            }
+        }
+        stopping = true;
+    }
+    slotQueued.notify_all();
+    for (std::thread& worker: workers) {
+        worker.join();
+    }
+    workers.clear();
+    queued.clear();
+
+    closeRaw();
+
+    for (Slot& slot: slots) {
+        if (slot.buffer != VK_NULL_HANDLE) {
+            allocator->destroyBuffer(slot.buffer, slot.memory);
+        }
+    }
+    slots.clear();
+    current = UINT32_MAX;
+    active = false;
+}
+
+void FrameCapture::collect(uint32_t frameSlot) {
+    if (!active) return;
+
+    Clock::time_point begin = Clock::now();
+    uint32_t count = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (uint32_t i = 0; i < slots.size(); ++i) {
+            if (slots[i].state == SLOT_RECORDED && slots[i].frameSlot == frameSlot) {
+                slots[i].state = SLOT_ENCODING;
+                queued.push_back(i);
+                count++;
+            }
+        }
+        stats.renderThreadTime += elapsedMs(begin);
+    }
+    if (count > 0) {
+        slotQueued.notify_all();
+    }
+}
+
+VkBuffer FrameCapture::begin(uint32_t frameSlot) {
+    current = UINT32_MAX;
+    if (!active) return VK_NULL_HANDLE;
+
+    Clock::time_point begin = Clock::now();
+    uint64_t number = frame++;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    stats.frames++;
+    if (number % settings.interval == 0) {
+        for (uint32_t i = 0; i < slots.size(); ++i) {
+            if (slots[i].state == SLOT_FREE) {
+                current = i;
+                break;
+            }
+        }
+
+        if (current == UINT32_MAX) {
+            stats.dropped++;
+        } else {
+            Slot& slot = slots[current];
+            slot.state = SLOT_RECORDED;
+            slot.frameSlot = frameSlot;
+            slot.frame = number;
+            slot.record = nextRecord++;
+            stats.captured++;
+        }
+    }
+    stats.renderThreadTime += elapsedMs(begin);
+
+    return current != UINT32_MAX ? slots[current].buffer : VK_NULL_HANDLE;
+}
+
+void FrameCapture::recordCopy(VkCommandBuffer cmdBuffer, VkImage image) {
+    if (current == UINT32_MAX) return;
+
+    VkBufferImageCopy region {};
+    region.bufferOffset = 0;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent.width = extent.width;
+    region.imageExtent.height = extent.height;
+    region.imageExtent.depth = 1;
+
+    vkCmdCopyImageToBuffer(cmdBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slots[current].buffer, 1, &region);
+}
+
+FrameCapture::Stats FrameCapture::getStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+void FrameCapture::workerMain() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true) {
+        slotQueued.wait(lock, [this]() { return stopping || !queued.empty(); });
+        if (queued.empty()) return;
+
+        uint32_t index = queued.front();
+        queued.pop_front();
+        // The buffer stays this worker's until the slot is freed below.
+        Slot slot = slots[index];
+
+        Clock::time_point begin = Clock::now();
+        uint64_t bytes = recordSize;
+        bool written;
+        if (settings.format == FORMAT_RAW) {
+            written = writeRaw(slot, lock);
+        } else {
+            lock.unlock();
+            written = writePng(slot, bytes);
+            lock.lock();
+        }
+
+        stats.encodeTime += elapsedMs(begin);
+        if (written) {
+            stats.written++;
+            stats.bytesWritten += bytes;
+        } else {
+            stats.failed++;
+        }
+        slots[index].state = SLOT_FREE;
+    }
+}
+
+// RGB without alpha, filter type None on every row, and a zlib stream of
+// stored blocks: encoding costs about as much as copying the frame, which
+// keeps the workers ahead of the frame loop. Files are as large as the
+// pixels.
+bool FrameCapture::writePng(const Slot& slot, uint64_t& bytes) {
+    const uint8_t* pixels = (const uint8_t*)slot.memory.mapped;
+    bool bgra = format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB;
+    uint32_t width = extent.width;
+    uint32_t height = extent.height;
+
+    size_t rowSize = 1 + (size_t)width * 3;
+    std::vector<uint8_t> rows(rowSize * height);
+    for (uint32_t y = 0; y < height; ++y) {
+        uint8_t* row = rows.data() + rowSize * y;
+        const uint8_t* source = pixels + (size_t)width * 4 * y;
+        *row++ = 0;
+        for (uint32_t x = 0; x < width; ++x, source += 4) {
+            *row++ = source[bgra ? 2 : 0];
+            *row++ = source[1];
+            *row++ = source[bgra ? 0 : 2];
+        }
+    }
+
+    std::vector<uint8_t> zlib;
+    size_t blocks = (rows.size() + STORED_BLOCK_SIZE - 1) / STORED_BLOCK_SIZE;
+    zlib.reserve(2 + rows.size() + std::max(blocks, (size_t)1) * 5 + 4);
+    zlib.push_back(0x78);
+    zlib.push_back(0x01);
+    size_t offset = 0;
+    do {
+        uint32_t size = (uint32_t)std::min(rows.size() - offset, (size_t)STORED_BLOCK_SIZE);
+        bool last = offset + size == rows.size();
+        zlib.push_back(last ? 1 : 0);
+        zlib.push_back((uint8_t)size);
+        zlib.push_back((uint8_t)(size >> 8));
+        zlib.push_back((uint8_t)~size);
+        zlib.push_back((uint8_t)(~size >> 8));
+        zlib.insert(zlib.end(), rows.begin() + offset, rows.begin() + offset + size);
+        offset += size;
+    } while (offset < rows.size());
+    putBigEndian(zlib, adler32(rows.data(), rows.size()));
+
+    std::vector<uint8_t> header;
+    putBigEndian(header, width);
+    putBigEndian(header, height);
+    header.push_back(8);    // bit depth
+    header.push_back(2);    // truecolour
+    header.push_back(0);    // deflate
+    header.push_back(0);    // adaptive filtering
+    header.push_back(0);    // no interlace
+
+    std::vector<uint8_t> png(PNG_SIGNATURE, PNG_SIGNATURE + sizeof(PNG_SIGNATURE));
+    png.reserve(zlib.size() + 64);
+    putChunk(png, "IHDR", header.data(), header.size());
+    putChunk(png, "IDAT", zlib.data(), zlib.size());
+    putChunk(png, "IEND", NULL, 0);
+
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "_%06llu.png", (unsigned long long)slot.frame);
+    std::string path = settings.path + suffix;
+
+    std::ofstream file(path, std::ios::binary);
+    file.write((const char*)png.data(), png.size());
+    if (!file) {
+        std::cout << "Failed to write capture " << path << std::endl;
+        return false;
+    }
+    bytes = png.size();
+    return true;
+}
+
+// Entered and left with the lock held. Records are written in place
+// through the mapping, so workers finish frames in any order; only growing
+// the file waits for the other writers.
+bool FrameCapture::writeRaw(const Slot& slot, std::unique_lock<std::mutex>& lock) {
+    while (slot.record >= capacity) {
+        writersDone.wait(lock, [this]() { return writers == 0; });
+        if (slot.record >= capacity && !growRaw(slot.record + 1)) return false;
+    }
+
+    char* record = mapped + sizeof(RawHeader) + slot.record * recordSize;
+    writers++;
+    lock.unlock();
+
+    memcpy(record, &slot.frame, sizeof(uint64_t));
+    memcpy(record + sizeof(uint64_t), slot.memory.mapped, frameBytes);
+
+    lock.lock();
+    writers--;
+    if (writers == 0) {
+        writersDone.notify_all();
+    }
+    recordsWritten = std::max(recordsWritten, slot.record + 1);
+    return true;
+}
+
+bool FrameCapture::openRaw() {
+    fd = ::open(settings.path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cout << "Failed to open capture file " << settings.path << std::endl;
+        return false;
+    }
+
+    capacity = 0;
+    recordsWritten = 0;
+    writers = 0;
+    return growRaw(16);
+}
+
+// Doubles the file at least; the header is written again with every
+// mapping, recordCount only when the file is closed.
+bool FrameCapture::growRaw(uint64_t records) {
+    uint64_t newCapacity = std::max(records, capacity * 2);
+    size_t size = sizeof(RawHeader) + newCapacity * recordSize;
+
+    if (mapped != NULL) {
+        munmap(mapped, mappedSize);
+        mapped = NULL;
+        mappedSize = 0;
+        capacity = 0;
+    }
+
+    if (ftruncate(fd, (off_t)size) != 0) {
+        std::cout << "Failed to grow capture file " << settings.path << " to " << size << " bytes" << std::endl;
+        return false;
+    }
+
+    void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        std::cout << "Failed to map capture file " << settings.path << std::endl;
+        return false;
+    }
+    mapped = (char*)data;
+    mappedSize = size;
+    capacity = newCapacity;
+
+    RawHeader header {};
+    header.magic = RAW_MAGIC;
+    header.version = RAW_VERSION;
+    header.width = extent.width;
+    header.height = extent.height;
+    header.format = (uint32_t)format;
+    header.headerSize = sizeof(RawHeader);
+    header.recordSize = recordSize;
+    header.recordCount = 0;
+    memcpy(mapped, &header, sizeof(header));
+    return true;
+}
+
+// Trims the file to the records written. A record whose write failed
+// leaves a gap of zeroes.
+void FrameCapture::closeRaw() {
+    if (fd < 0) return;
+
+    if (mapped != NULL) {
+        RawHeader* header = (RawHeader*)mapped;
+        header->recordCount = recordsWritten;
+        munmap(mapped, mappedSize);
+        mapped = NULL;
+        mappedSize = 0;
+    }
+    if (ftruncate(fd, (off_t)(sizeof(RawHeader) + recordsWritten * recordSize)) != 0) {
+        std::cout << "Failed to trim capture file " << settings.path << std::endl;
+    }
+    ::close(fd);
+    fd = -1;
+    capacity = 0;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Allocator.hpp"
+
+// Copies rendered frames back to the host without stalling the frame loop.
+// A captured frame's image is copied into one buffer of a ring of
+// host-visible buffers; once the fence of that frame slot has been waited
+// on, framesInFlight frames later, the buffer is handed to a worker thread
+// that encodes it and then returns it to the ring. When every buffer is
+// still busy the frame is dropped instead of waiting.
+//
+// Workers either write one PNG per frame, <path>_<frame>.png, or append the
+// frames to a single raw file that is memory-mapped and grown as needed: a
+// RawHeader followed by records of the frame number and the pixels, rows
+// tightly packed in the image's format.
+class FrameCapture {
+    public:
+        enum Format {
+            FORMAT_PNG,
+            FORMAT_RAW
+        };
+
+        struct Settings {
+            Format format = FORMAT_PNG;
+            std::string path = "capture";
+            uint32_t interval = 1;          // capture every Nth frame
+            uint32_t threads = 2;
+            uint32_t buffers = 0;           // 0: framesInFlight + 2 per thread
+        };
+
+        struct RawHeader {
+            uint32_t magic;                 // RAW_MAGIC
+            uint32_t version;
+            uint32_t width;
+            uint32_t height;
+            uint32_t format;                // VkFormat
+            uint32_t headerSize;
+            uint64_t recordSize;            // frame number, then the pixels
+            uint64_t recordCount;
+        };
+        static const uint32_t RAW_MAGIC = 0x4d524656;  // "VFRM"
+        static const uint32_t RAW_VERSION = 1;
+
+        struct Stats {
+            uint64_t frames = 0;            // frames seen while capturing
+            uint64_t captured = 0;          // copies recorded
+            uint64_t dropped = 0;           // no free buffer
+            uint64_t written = 0;
+            uint64_t failed = 0;
+            uint64_t bytesWritten = 0;
+            uint32_t buffers = 0;
+            double renderThreadTime = 0.0;  // ms spent in begin() and collect()
+            double encodeTime = 0.0;        // ms, summed over the workers
+        };
+
+    private:
+        enum SlotState {
+            SLOT_FREE,
+            SLOT_RECORDED,                  // copy submitted with frameSlot
+            SLOT_ENCODING                   // queued for or held by a worker
+        };
+
+        struct Slot {
+            VkBuffer buffer = VK_NULL_HANDLE;
+            Allocation memory = {};
+            SlotState state = SLOT_FREE;
+            uint32_t frameSlot = 0;
+            uint64_t frame = 0;
+            uint64_t record = 0;            // position in the raw file
+        };
+
+        Allocator* allocator = NULL;
+        Settings settings;
+        VkExtent2D extent = {};
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        VkDeviceSize frameBytes = 0;
+        uint64_t recordSize = 0;
+        bool active = false;
+
+        // Only used by the render thread.
+        uint64_t frame = 0;
+        uint64_t nextRecord = 0;
+        uint32_t current = UINT32_MAX;      // slot begin() handed out
+
+        // Guards everything below that workers touch.
+        std::mutex mutex;
+        std::condition_variable slotQueued;
+        std::condition_variable writersDone;
+        std::vector<std::thread> workers = {};
+        bool stopping = false;
+        std::vector<Slot> slots = {};
+        std::deque<uint32_t> queued = {};
+        Stats stats;
+
+        // The raw file, remapped when it grows while no worker writes.
+        int fd = -1;
+        char* mapped = NULL;
+        size_t mappedSize = 0;
+        uint64_t capacity = 0;              // records
+        uint64_t recordsWritten = 0;
+        uint32_t writers = 0;
+
+        void workerMain();
+        bool writePng(const Slot& slot, uint64_t& bytes);
+        bool writeRaw(const Slot& slot, std::unique_lock<std::mutex>& lock);
+        bool openRaw();
+        bool growRaw(uint64_t records);
+        void closeRaw();
+
+    public:
+        ~FrameCapture() {
+            destroy();
+        }
+
+        // Only 8-bit RGBA and BGRA images can be captured.
+        bool init(Allocator& allocator, const Settings& settings, VkExtent2D extent, VkFormat format,
+            uint32_t framesInFlight);
+        // The device has to be idle; frames still in the ring are written
+        // before this returns.
+        void destroy();
+
+        bool isActive() const {
+            return active;
+        }
+        VkExtent2D getExtent() const {
+            return extent;
+        }
+
+        // Called after the fence of frameSlot has been waited on: hands the
+        // frames that slot copied to the workers.
+        void collect(uint32_t frameSlot);
+        // Decides whether the frame recorded next in frameSlot is captured.
+        // Returns the buffer recordCopy() copies into, or VK_NULL_HANDLE.
+        VkBuffer begin(uint32_t frameSlot);
+        // Copies a colour image in TRANSFER_SRC_OPTIMAL into the buffer
+        // returned by begin().
+        void recordCopy(VkCommandBuffer cmdBuffer, VkImage image);
+
+        Stats getStats();
+        static bool isFormatSupported(VkFormat format);
+        static bool parseFormat(const char* name, Format& format);
+};
@@ -0,0 +1,89 @@
+#include "FramePacer.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+static double milliseconds(std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+void FramePacer::setTargetFps(double fps) {
+    targetFps = std::max(fps, 0.0);
+    scheduled = false;
+}
+
+void FramePacer::wait() {
+    Clock::time_point begin = Clock::now();
+    current.waited = 0.0;
+    if (targetFps <= 0.0) return;
+
+    Clock::duration period = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1.0 / targetFps));
+    if (!scheduled) {
+        nextFrame = begin;
+        scheduled = true;
+    }
+
+    Clock::duration margin = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double, std::milli>(spinMargin));
+    if (nextFrame - begin > margin) {
+        std::this_thread::sleep_until(nextFrame - margin);
+    }
+    while (Clock::now() < nextFrame) {
+        std::this_thread::yield();
+    }
+
+    Clock::time_point end = Clock::now();
+    nextFrame += period;
+    if (nextFrame < end) {
+        nextFrame = end;
+    }
+
+    current.waited = milliseconds(end - begin);
+}
+
+void FramePacer::markInput() {
+    input = Clock::now();
+    hasInput = true;
+    submitted = false;
+}
+
+void FramePacer::markSubmit() {
+    submit = Clock::now();
+    submitted = true;
+}
+
+void FramePacer::markPresent() {
+    if (!hasInput || !submitted) return;
+
+    Clock::time_point present = Clock::now();
+    current.inputToSubmit = milliseconds(submit - input);
+    current.inputToPresent = milliseconds(present - input);
+    last = current;
+
+    stats.frames++;
+    stats.waited += current.waited;
+    stats.inputToSubmit += current.inputToSubmit;
+    stats.inputToPresent += current.inputToPresent;
+    stats.maxInputToPresent = std::max(stats.maxInputToPresent, current.inputToPresent);
+
+    hasInput = false;
+    current = Sample();
+}
+
+void FramePacer::printStats() const {
+    if (stats.frames == 0) {
+        std::cout << "Latency: no frames measured" << std::endl;
+        return;
+    }
+
+    double frames = (double)stats.frames;
+    std::cout << "Latency over " << stats.frames << " frames: input to submit " << stats.inputToSubmit / frames
+              << " ms, input to present " << stats.inputToPresent / frames << " ms (max "
+              << stats.maxInputToPresent << " ms), paced " << stats.waited / frames << " ms per frame";
+    if (targetFps > 0.0) {
+        std::cout << " for " << targetFps << " fps";
+    }
+    std::cout << std::endl;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// Frame rate limiter and latency probe. The application calls wait() before
+// it polls input and markInput() right after; the renderer marks submit and
+// present. Each frame's latencies are measured from its markInput().
+//
+// wait() sleeps until shortly before the frame is due and spins the rest,
+// since sleeps overshoot by up to the scheduler's granularity. A frame that
+// comes in late moves the schedule instead of being caught up with a burst.
+class FramePacer {
+    public:
+        struct Sample {
+            double waited = 0.0;            // ms spent in wait()
+            double inputToSubmit = 0.0;     // ms
+            double inputToPresent = 0.0;    // ms, until vkQueuePresentKHR returned
+        };
+
+        struct Stats {
+            uint64_t frames = 0;
+            double waited = 0.0;
+            double inputToSubmit = 0.0;
+            double inputToPresent = 0.0;
+            double maxInputToPresent = 0.0;
+        };
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        double targetFps = 0.0;
+        double spinMargin = 2.0;        // ms
+        Clock::time_point nextFrame;
+        bool scheduled = false;
+
+        Clock::time_point input;
+        Clock::time_point submit;
+        bool hasInput = false;
+        bool submitted = false;
+
+        Sample current;
+        Sample last;
+        Stats stats;
+
+    public:
+        // 0 disables the limiter.
+        void setTargetFps(double fps);
+        double getTargetFps() const {
+            return targetFps;
+        }
+        // How long before a deadline wait() stops sleeping and spins.
+        void setSpinMargin(double milliseconds) {
+            spinMargin = milliseconds;
+        }
+
+        void wait();
+
+        void markInput();
+        void markSubmit();
+        // Completes the frame's sample. Headless renderers present nothing
+        // and call it right after markSubmit().
+        void markPresent();
+
+        const Sample& getLastSample() const {
+            return last;
+        }
+        const Stats& getStats() const {
+            return stats;
+        }
+        void resetStats() {
+            stats = Stats();
+        }
+        void printStats() const;
+};
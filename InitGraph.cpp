@@ -0,0 +1,225 @@
+#include "InitGraph.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+// The task the current thread is running, tasks it adds depend on it.
+static thread_local const InitGraph* currentGraph = NULL;
+static thread_local InitGraph::Task currentTask = InitGraph::NO_TASK;
+
+InitGraph::Task InitGraph::add(const std::string& name, Function function, const std::vector<Task>& dependencies,
+        Affinity affinity) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    Task task = (Task)entries.size();
+    entries.push_back(Entry());
+    timings.push_back(Timing());
+
+    Entry& entry = entries[task];
+    entry.function = function;
+    entry.affinity = affinity;
+    entry.dependencies = dependencies;
+    if (currentGraph == this && currentTask != NO_TASK) {
+        entry.dependencies.push_back(currentTask);
+    }
+    timings[task].name = name;
+
+    for (Task dependency: entry.dependencies) {
+        if (timings[dependency].state == STATE_SUCCEEDED) continue;
+        entries[dependency].dependents.push_back(task);
+        entry.pending++;
+    }
+
+    unfinished++;
+    if (entry.pending == 0) {
+        makeReady(task);
+    }
+    return task;
+}
+
+void InitGraph::makeReady(Task task) {
+    Timing& timing = timings[task];
+    for (Task dependency: entries[task].dependencies) {
+        if (timing.critical == NO_TASK || timings[dependency].end > timings[timing.critical].end) {
+            timing.critical = dependency;
+        }
+    }
+
+    if (entries[task].affinity == MAIN_THREAD) {
+        readyMain.push_back(task);
+    } else {
+        ready.push_back(task);
+    }
+    wake.notify_all();
+}
+
+// Nothing new is started after a failure.
+InitGraph::Task InitGraph::take(uint32_t threadIndex) {
+    if (failed) return NO_TASK;
+
+    std::deque<Task>* queue = NULL;
+    if (threadIndex == 0 && !readyMain.empty()) {
+        queue = &readyMain;
+    } else if (!ready.empty()) {
+        queue = &ready;
+    }
+    if (queue == NULL) return NO_TASK;
+
+    Task task = queue->front();
+    queue->pop_front();
+    return task;
+}
+
+void InitGraph::work(uint32_t threadIndex) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (;;) {
+        Task task = NO_TASK;
+        wake.wait(lock, [&] {
+            task = take(threadIndex);
+            return task != NO_TASK || unfinished == 0 || (failed && running == 0);
+        });
+        if (task == NO_TASK) return;
+
+        // entries may grow while the task runs, nothing is used through a
+        // reference to it.
+        Function function = std::move(entries[task].function);
+        std::string name = timings[task].name;
+        double begin = std::chrono::duration<double, std::milli>(Clock::now() - epoch).count();
+        timings[task].state = STATE_RUNNING;
+        timings[task].thread = threadIndex;
+        timings[task].begin = begin;
+        running++;
+        lock.unlock();
+
+        currentGraph = this;
+        currentTask = task;
+        bool succeeded = function();
+        currentGraph = NULL;
+        currentTask = NO_TASK;
+
+        double end = std::chrono::duration<double, std::milli>(Clock::now() - epoch).count();
+        if (profiler != NULL) {
+            profiler->addStartupTime(name, profilerOffset + begin, profilerOffset + end);
+        }
+
+        lock.lock();
+        running--;
+        unfinished--;
+        timings[task].end = end;
+        timings[task].state = succeeded ? STATE_SUCCEEDED : STATE_FAILED;
+        if (succeeded) {
+            for (Task dependent: entries[task].dependents) {
+                if (--entries[dependent].pending == 0) {
+                    makeReady(dependent);
+                }
+            }
+        } else {
+            std::cout << "Startup task " << name << " failed" << std::endl;
+            failed = true;
+        }
+        wake.notify_all();
+    }
+}
+
+// One work loop per thread of the pool, each of them takes ready tasks
+// until the graph is done.
+bool InitGraph::run(ThreadPool& threadPool, Profiler* profiler) {
+    epoch = Clock::now();
+    this->profiler = profiler;
+    profilerOffset = profiler != NULL ? profiler->now() : 0.0;
+    threadCount = threadPool.getThreadCount();
+
+    threadPool.parallelFor(threadCount, 1, [this](uint32_t threadIndex, uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+            work(threadIndex);
+        }
+    });
+
+    totalTime = std::chrono::duration<double, std::milli>(Clock::now() - epoch).count();
+    for (Timing& timing: timings) {
+        if (timing.state == STATE_WAITING) timing.state = STATE_SKIPPED;
+    }
+    ready.clear();
+    readyMain.clear();
+
+    return !failed;
+}
+
+double InitGraph::getWorkTime() const {
+    double time = 0.0;
+    for (const Timing& timing: timings) {
+        if (timing.state == STATE_SUCCEEDED || timing.state == STATE_FAILED) {
+            time += timing.end - timing.begin;
+        }
+    }
+    return time;
+}
+
+std::vector<InitGraph::Task> InitGraph::getCriticalPath() const {
+    std::vector<Task> path;
+
+    Task last = NO_TASK;
+    for (Task task = 0; task < timings.size(); ++task) {
+        if (timings[task].state != STATE_SUCCEEDED && timings[task].state != STATE_FAILED) continue;
+        if (last == NO_TASK || timings[task].end > timings[last].end) last = task;
+    }
+
+    for (Task task = last; task != NO_TASK; task = timings[task].critical) {
+        path.push_back(task);
+    }
+    std::reverse(path.begin(), path.end());
+    return path;
+}
+
+// Tasks in the order they started, the skipped ones last; the ones on the
+// critical path are marked.
+void InitGraph::printStats() const {
+    std::vector<Task> order;
+    for (Task task = 0; task < timings.size(); ++task) {
+        order.push_back(task);
+    }
+    std::stable_sort(order.begin(), order.end(), [this](Task a, Task b) {
+        bool skippedA = timings[a].state == STATE_SKIPPED;
+        bool skippedB = timings[b].state == STATE_SKIPPED;
+        if (skippedA != skippedB) return skippedB;
+        return timings[a].begin < timings[b].begin;
+    });
+
+    std::vector<Task> criticalPath = getCriticalPath();
+    size_t nameWidth = 0;
+    for (const Timing& timing: timings) {
+        nameWidth = std::max(nameWidth, timing.name.size());
+    }
+
+    std::cout << "Startup: " << timings.size() << " tasks in " << totalTime << " ms on " << threadCount
+              << (threadCount == 1 ? " thread, " : " threads, ") << getWorkTime() << " ms of work" << std::endl;
+
+    std::ios::fmtflags flags = std::cout.flags();
+    std::streamsize precision = std::cout.precision();
+    std::cout << std::fixed << std::setprecision(2);
+    for (Task task: order) {
+        const Timing& timing = timings[task];
+        bool critical = std::find(criticalPath.begin(), criticalPath.end(), task) != criticalPath.end();
+
+        std::cout << "  " << (critical ? "* " : "  ") << std::left << std::setw((int)nameWidth) << timing.name
+                  << std::right;
+        if (timing.state == STATE_SKIPPED) {
+            std::cout << "  skipped" << std::endl;
+            continue;
+        }
+        std::cout << std::setw(10) << timing.begin << " ms +" << std::setw(9) << timing.end - timing.begin
+                  << " ms  thread " << timing.thread
+                  << (timing.state == STATE_FAILED ? "  failed" : "") << std::endl;
+    }
+    std::cout.flags(flags);
+    std::cout.precision(precision);
+
+    std::cout << "Startup critical path:";
+    for (size_t i = 0; i < criticalPath.size(); ++i) {
+        const Timing& timing = timings[criticalPath[i]];
+        std::cout << (i == 0 ? " " : ", ") << timing.name << " " << timing.end - timing.begin << " ms";
+    }
+    std::cout << std::endl;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Profiler.hpp"
+#include "ThreadPool.hpp"
+
+// Start-up work as a graph of named tasks. A task starts once every task it
+// depends on has succeeded, so tasks without a path between them run at the
+// same time on the threads of a ThreadPool. MAIN_THREAD tasks only run on
+// the thread calling run(), for the GLFW calls that require it.
+//
+// A running task may add more tasks, e.g. one per entry of a list it has
+// just read; they depend on it implicitly. The first failure stops new
+// tasks from being started and run() returns once the running ones have
+// finished.
+//
+// The start and end of every task are kept for printStats() and, when run()
+// is given a Profiler, added to its trace on the thread that ran the task.
+class InitGraph {
+    public:
+        typedef uint32_t Task;
+        typedef std::function<bool()> Function;
+
+        static const Task NO_TASK = UINT32_MAX;
+
+        enum Affinity {
+            ANY_THREAD,
+            MAIN_THREAD
+        };
+
+        enum State {
+            STATE_WAITING,
+            STATE_RUNNING,
+            STATE_SUCCEEDED,
+            STATE_FAILED,
+            STATE_SKIPPED               // not started because a task failed
+        };
+
+        struct Timing {
+            std::string name;
+            State state = STATE_WAITING;
+            uint32_t thread = 0;        // ThreadPool index, 0 is the thread calling run()
+            double begin = 0.0;         // ms since run() started
+            double end = 0.0;           // ms
+            // The dependency that finished last, NO_TASK if there was none.
+            // Followed back from the last task to finish it gives the
+            // critical path.
+            Task critical = NO_TASK;
+        };
+
+    private:
+        struct Entry {
+            Function function;
+            Affinity affinity = ANY_THREAD;
+            std::vector<Task> dependencies = {};
+            std::vector<Task> dependents = {};
+            uint32_t pending = 0;       // unfinished dependencies
+        };
+
+        typedef std::chrono::steady_clock Clock;
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::vector<Entry> entries = {};
+        std::vector<Timing> timings = {};
+        std::deque<Task> ready = {};
+        std::deque<Task> readyMain = {};
+        uint32_t unfinished = 0;
+        uint32_t running = 0;
+        bool failed = false;
+
+        Clock::time_point epoch;
+        Profiler* profiler = NULL;
+        double profilerOffset = 0.0;
+        uint32_t threadCount = 0;
+        double totalTime = 0.0;
+
+        void makeReady(Task task);
+        Task take(uint32_t threadIndex);
+        void work(uint32_t threadIndex);
+
+    public:
+        Task add(const std::string& name, Function function, const std::vector<Task>& dependencies = {},
+            Affinity affinity = ANY_THREAD);
+
+        // Runs every task on threadPool and returns whether all of them
+        // succeeded. No task may use threadPool itself.
+        bool run(ThreadPool& threadPool, Profiler* profiler = NULL);
+
+        const std::vector<Timing>& getTimings() const {
+            return timings;
+        }
+        // ms, the wall time of run().
+        double getTotalTime() const {
+            return totalTime;
+        }
+        // ms, the sum of all task durations.
+        double getWorkTime() const;
+        uint32_t getThreadCount() const {
+            return threadCount;
+        }
+        std::vector<Task> getCriticalPath() const;
+
+        void printStats() const;
+};
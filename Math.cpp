@@ -0,0 +1,457 @@
+#include "Math.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MATH_X86 1
+#include <immintrin.h>
+#define MATH_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+namespace Math {
+    Quat normalize(const Quat& q) {
+        float l = std::sqrt(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+        if (l <= 0.0f) return Quat();
+        float inv = 1.0f / l;
+        return Quat(q.x * inv, q.y * inv, q.z * inv, q.w * inv);
+    }
+
+    Quat operator*(const Quat& a, const Quat& b) {
+        return Quat(
+            a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+            a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+            a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+            a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z);
+    }
+
+    Quat fromAxisAngle(const Vec3& axis, float angle) {
+        Vec3 n = normalize(axis);
+        float s = std::sin(angle * 0.5f);
+        return Quat(n.x * s, n.y * s, n.z * s, std::cos(angle * 0.5f));
+    }
+
+    Vec3 rotate(const Quat& q, const Vec3& v) {
+        Vec3 u(q.x, q.y, q.z);
+        Vec3 t = cross(u, v) * 2.0f;
+        return v + t * q.w + cross(u, t);
+    }
+
+    Mat4 operator*(const Mat4& a, const Mat4& b) {
+        Mat4 result;
+        for (int c = 0; c < 4; ++c) {
+            for (int r = 0; r < 4; ++r) {
+                result.at(c, r) = a.at(0, r) * b.at(c, 0) + a.at(1, r) * b.at(c, 1) +
+                                  a.at(2, r) * b.at(c, 2) + a.at(3, r) * b.at(c, 3);
+            }
+        }
+        return result;
+    }
+
+    Vec4 operator*(const Mat4& m, const Vec4& v) {
+        return Vec4(
+            m.m[0] * v.x + m.m[4] * v.y + m.m[8] * v.z + m.m[12] * v.w,
+            m.m[1] * v.x + m.m[5] * v.y + m.m[9] * v.z + m.m[13] * v.w,
+            m.m[2] * v.x + m.m[6] * v.y + m.m[10] * v.z + m.m[14] * v.w,
+            m.m[3] * v.x + m.m[7] * v.y + m.m[11] * v.z + m.m[15] * v.w);
+    }
+
+    Mat4 translation(const Vec3& t) {
+        Mat4 result;
+        result.m[12] = t.x;
+        result.m[13] = t.y;
+        result.m[14] = t.z;
+        return result;
+    }
+
+    Mat4 scaling(const Vec3& s) {
+        Mat4 result;
+        result.m[0] = s.x;
+        result.m[5] = s.y;
+        result.m[10] = s.z;
+        return result;
+    }
+
+    Mat4 rotation(const Quat& q) {
+        return compose(Vec3(), q, 1.0f);
+    }
+
+    Mat4 transpose(const Mat4& m) {
+        Mat4 result;
+        for (int c = 0; c < 4; ++c) {
+            for (int r = 0; r < 4; ++r) {
+                result.at(c, r) = m.at(r, c);
+            }
+        }
+        return result;
+    }
+
+    Mat4 lookAt(const Vec3& eye, const Vec3& center, const Vec3& up) {
+        Vec3 f = normalize(center - eye);
+        Vec3 s = normalize(cross(f, up));
+        Vec3 u = cross(s, f);
+
+        Mat4 result;
+        result.at(0, 0) = s.x;  result.at(1, 0) = s.y;  result.at(2, 0) = s.z;
+        result.at(0, 1) = u.x;  result.at(1, 1) = u.y;  result.at(2, 1) = u.z;
+        result.at(0, 2) = -f.x; result.at(1, 2) = -f.y; result.at(2, 2) = -f.z;
+        result.at(3, 0) = -dot(s, eye);
+        result.at(3, 1) = -dot(u, eye);
+        result.at(3, 2) = dot(f, eye);
+        return result;
+    }
+
+    Mat4 perspective(float fovY, float aspect, float zNear, float zFar) {
+        float f = 1.0f / std::tan(fovY * 0.5f);
+
+        Mat4 result;
+        memset(result.m, 0, sizeof(result.m));
+        result.at(0, 0) = f / aspect;
+        result.at(1, 1) = -f;
+        result.at(2, 2) = zFar / (zNear - zFar);
+        result.at(2, 3) = -1.0f;
+        result.at(3, 2) = zNear * zFar / (zNear - zFar);
+        return result;
+    }
+
+    void TransformArrays::resize(size_t count) {
+        positionX.resize(count, 0.0f);
+        positionY.resize(count, 0.0f);
+        positionZ.resize(count, 0.0f);
+        rotationX.resize(count, 0.0f);
+        rotationY.resize(count, 0.0f);
+        rotationZ.resize(count, 0.0f);
+        rotationW.resize(count, 1.0f);
+        scale.resize(count, 1.0f);
+    }
+
+    void TransformArrays::set(size_t index, const Vec3& position, const Quat& rotation, float scale) {
+        positionX[index] = position.x;
+        positionY[index] = position.y;
+        positionZ[index] = position.z;
+        rotationX[index] = rotation.x;
+        rotationY[index] = rotation.y;
+        rotationZ[index] = rotation.z;
+        rotationW[index] = rotation.w;
+        this->scale[index] = scale;
+    }
+
+    // Scalar kernels, also used for the tails of the SIMD ones.
+
+    static void transformPointsScalar(const Mat4& m,
+            const float* inX, const float* inY, const float* inZ,
+            float* outX, float* outY, float* outZ, size_t count) {
+        const float* a = m.m;
+        for (size_t i = 0; i < count; ++i) {
+            float x = inX[i];
+            float y = inY[i];
+            float z = inZ[i];
+            outX[i] = a[0] * x + a[4] * y + a[8] * z + a[12];
+            outY[i] = a[1] * x + a[5] * y + a[9] * z + a[13];
+            outZ[i] = a[2] * x + a[6] * y + a[10] * z + a[14];
+        }
+    }
+
+    static void composeTransformsScalar(const TransformArrays& t, size_t first, size_t count,
+            float* out, size_t outStride) {
+        for (size_t i = first; i < first + count; ++i, out += outStride) {
+            float x = t.rotationX[i], y = t.rotationY[i], z = t.rotationZ[i], w = t.rotationW[i];
+            float s = t.scale[i];
+
+            float xx = x * x, yy = y * y, zz = z * z;
+            float xy = x * y, xz = x * z, yz = y * z;
+            float wx = w * x, wy = w * y, wz = w * z;
+
+            out[0] = (1.0f - 2.0f * (yy + zz)) * s;
+            out[1] = 2.0f * (xy + wz) * s;
+            out[2] = 2.0f * (xz - wy) * s;
+            out[3] = 0.0f;
+            out[4] = 2.0f * (xy - wz) * s;
+            out[5] = (1.0f - 2.0f * (xx + zz)) * s;
+            out[6] = 2.0f * (yz + wx) * s;
+            out[7] = 0.0f;
+            out[8] = 2.0f * (xz + wy) * s;
+            out[9] = 2.0f * (yz - wx) * s;
+            out[10] = (1.0f - 2.0f * (xx + yy)) * s;
+            out[11] = 0.0f;
+            out[12] = t.positionX[i];
+            out[13] = t.positionY[i];
+            out[14] = t.positionZ[i];
+            out[15] = 1.0f;
+        }
+    }
+
+    static void multiplyMatricesScalar(const Mat4& m, const float* in, size_t inStride,
+            float* out, size_t outStride, size_t count) {
+        const float* a = m.m;
+        for (size_t i = 0; i < count; ++i, in += inStride, out += outStride) {
+            // Each result column only depends on the same column of in, so
+            // in and out may alias.
+            for (int c = 0; c < 4; ++c) {
+                const float* b = in + c * 4;
+                float column[4];
+                for (int r = 0; r < 4; ++r) {
+                    column[r] = a[r] * b[0] + a[4 + r] * b[1] + a[8 + r] * b[2] + a[12 + r] * b[3];
+                }
+                memcpy(out + c * 4, column, sizeof(column));
+            }
+        }
+    }
+
+    Mat4 compose(const Vec3& position, const Quat& rotation, float scale) {
+        TransformArrays transform;
+        transform.resize(1);
+        transform.set(0, position, rotation, scale);
+
+        Mat4 result;
+        composeTransformsScalar(transform, 0, 1, result.m, 16);
+        return result;
+    }
+
+#ifdef MATH_X86
+    // SSE kernels, 4 elements per iteration. SSE2 is part of x86-64 so no
+    // target attribute is needed.
+
+    static void transformPointsSse(const Mat4& m,
+            const float* inX, const float* inY, const float* inZ,
+            float* outX, float* outY, float* outZ, size_t count) {
+        const float* a = m.m;
+        __m128 m0 = _mm_set1_ps(a[0]), m1 = _mm_set1_ps(a[1]), m2 = _mm_set1_ps(a[2]);
+        __m128 m4 = _mm_set1_ps(a[4]), m5 = _mm_set1_ps(a[5]), m6 = _mm_set1_ps(a[6]);
+        __m128 m8 = _mm_set1_ps(a[8]), m9 = _mm_set1_ps(a[9]), m10 = _mm_set1_ps(a[10]);
+        __m128 m12 = _mm_set1_ps(a[12]), m13 = _mm_set1_ps(a[13]), m14 = _mm_set1_ps(a[14]);
+
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4) {
+            __m128 x = _mm_loadu_ps(inX + i);
+            __m128 y = _mm_loadu_ps(inY + i);
+            __m128 z = _mm_loadu_ps(inZ + i);
+
+            __m128 ox = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, x), _mm_mul_ps(m4, y)), _mm_add_ps(_mm_mul_ps(m8, z), m12));
+            __m128 oy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m1, x), _mm_mul_ps(m5, y)), _mm_add_ps(_mm_mul_ps(m9, z), m13));
+            __m128 oz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m2, x), _mm_mul_ps(m6, y)), _mm_add_ps(_mm_mul_ps(m10, z), m14));
+
+            _mm_storeu_ps(outX + i, ox);
+            _mm_storeu_ps(outY + i, oy);
+            _mm_storeu_ps(outZ + i, oz);
+        }
+
+        transformPointsScalar(m, inX + i, inY + i, inZ + i, outX + i, outY + i, outZ + i, count - i);
+    }
+
+    // Turns four SoA rows (one value per instance) into one column for each
+    // of four consecutive output matrices.
+    static inline void storeColumnsSse(float* out, size_t outStride, size_t column,
+            __m128 a, __m128 b, __m128 c, __m128 d) {
+        _MM_TRANSPOSE4_PS(a, b, c, d);
+        _mm_storeu_ps(out + column * 4, a);
+        _mm_storeu_ps(out + outStride + column * 4, b);
+        _mm_storeu_ps(out + 2 * outStride + column * 4, c);
+        _mm_storeu_ps(out + 3 * outStride + column * 4, d);
+    }
+
+    static void composeTransformsSse(const TransformArrays& t, size_t first, size_t count,
+            float* out, size_t outStride) {
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 two = _mm_set1_ps(2.0f);
+        const __m128 zero = _mm_setzero_ps();
+
+        size_t i = first;
+        for (; i + 4 <= first + count; i += 4, out += 4 * outStride) {
+            __m128 x = _mm_loadu_ps(&t.rotationX[i]);
+            __m128 y = _mm_loadu_ps(&t.rotationY[i]);
+            __m128 z = _mm_loadu_ps(&t.rotationZ[i]);
+            __m128 w = _mm_loadu_ps(&t.rotationW[i]);
+            __m128 s = _mm_loadu_ps(&t.scale[i]);
+            __m128 s2 = _mm_mul_ps(s, two);
+
+            __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+            __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+            __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+            __m128 r00 = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), s);
+            __m128 r10 = _mm_mul_ps(_mm_add_ps(xy, wz), s2);
+            __m128 r20 = _mm_mul_ps(_mm_sub_ps(xz, wy), s2);
+            __m128 r01 = _mm_mul_ps(_mm_sub_ps(xy, wz), s2);
+            __m128 r11 = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), s);
+            __m128 r21 = _mm_mul_ps(_mm_add_ps(yz, wx), s2);
+            __m128 r02 = _mm_mul_ps(_mm_add_ps(xz, wy), s2);
+            __m128 r12 = _mm_mul_ps(_mm_sub_ps(yz, wx), s2);
+            __m128 r22 = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), s);
+
+            storeColumnsSse(out, outStride, 0, r00, r10, r20, zero);
+            storeColumnsSse(out, outStride, 1, r01, r11, r21, zero);
+            storeColumnsSse(out, outStride, 2, r02, r12, r22, zero);
+            storeColumnsSse(out, outStride, 3, _mm_loadu_ps(&t.positionX[i]),
+                _mm_loadu_ps(&t.positionY[i]), _mm_loadu_ps(&t.positionZ[i]), one);
+        }
+
+        composeTransformsScalar(t, i, first + count - i, out, outStride);
+    }
+
+    static void multiplyMatricesSse(const Mat4& m, const float* in, size_t inStride,
+            float* out, size_t outStride, size_t count) {
+        __m128 a0 = _mm_loadu_ps(m.m);
+        __m128 a1 = _mm_loadu_ps(m.m + 4);
+        __m128 a2 = _mm_loadu_ps(m.m + 8);
+        __m128 a3 = _mm_loadu_ps(m.m + 12);
+
+        for (size_t i = 0; i < count; ++i, in += inStride, out += outStride) {
+            for (int c = 0; c < 4; ++c) {
+                __m128 b = _mm_loadu_ps(in + c * 4);
+                __m128 r = _mm_mul_ps(a0, _mm_shuffle_ps(b, b, _MM_SHUFFLE(0, 0, 0, 0)));
+                r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 1, 1, 1))));
+                r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 2, 2, 2))));
+                r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 3, 3, 3))));
+                _mm_storeu_ps(out + c * 4, r);
+            }
+        }
+    }
+
+    // AVX2 + FMA kernels, 8 elements per iteration.
+
+    static const int32_t tailMask[16] = { -1, -1, -1, -1, -1, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+    // The first few points go through the SSE kernel until the output is
+    // 32-byte aligned, since 256-bit stores that split cache lines cost
+    // more than the wider registers save. The last few go through masked
+    // loads and stores.
+    MATH_AVX2 static void transformPointsAvx2(const Mat4& m,
+            const float* inX, const float* inY, const float* inZ,
+            float* outX, float* outY, float* outZ, size_t count) {
+        const float* a = m.m;
+        __m256 m0 = _mm256_set1_ps(a[0]), m1 = _mm256_set1_ps(a[1]), m2 = _mm256_set1_ps(a[2]);
+        __m256 m4 = _mm256_set1_ps(a[4]), m5 = _mm256_set1_ps(a[5]), m6 = _mm256_set1_ps(a[6]);
+        __m256 m8 = _mm256_set1_ps(a[8]), m9 = _mm256_set1_ps(a[9]), m10 = _mm256_set1_ps(a[10]);
+        __m256 m12 = _mm256_set1_ps(a[12]), m13 = _mm256_set1_ps(a[13]), m14 = _mm256_set1_ps(a[14]);
+
+        size_t i = ((32 - ((uintptr_t)outX & 31)) & 31) / sizeof(float);
+        if (i < count) {
+            transformPointsSse(m, inX, inY, inZ, outX, outY, outZ, i);
+        } else {
+            i = 0;
+        }
+
+        for (; i < count; i += 8) {
+            size_t remaining = count - i;
+            __m256i mask = _mm256_loadu_si256((const __m256i*)(tailMask + 8 - (remaining < 8 ? remaining : 8)));
+
+            __m256 x, y, z;
+            if (remaining >= 8) {
+                x = _mm256_loadu_ps(inX + i);
+                y = _mm256_loadu_ps(inY + i);
+                z = _mm256_loadu_ps(inZ + i);
+            } else {
+                x = _mm256_maskload_ps(inX + i, mask);
+                y = _mm256_maskload_ps(inY + i, mask);
+                z = _mm256_maskload_ps(inZ + i, mask);
+            }
+
+            __m256 ox = _mm256_fmadd_ps(m0, x, _mm256_fmadd_ps(m4, y, _mm256_fmadd_ps(m8, z, m12)));
+            __m256 oy = _mm256_fmadd_ps(m1, x, _mm256_fmadd_ps(m5, y, _mm256_fmadd_ps(m9, z, m13)));
+            __m256 oz = _mm256_fmadd_ps(m2, x, _mm256_fmadd_ps(m6, y, _mm256_fmadd_ps(m10, z, m14)));
+
+            if (remaining >= 8) {
+                _mm256_storeu_ps(outX + i, ox);
+                _mm256_storeu_ps(outY + i, oy);
+                _mm256_storeu_ps(outZ + i, oz);
+            } else {
+                _mm256_maskstore_ps(outX + i, mask, ox);
+                _mm256_maskstore_ps(outY + i, mask, oy);
+                _mm256_maskstore_ps(outZ + i, mask, oz);
+            }
+        }
+    }
+
+    // Two result columns per 256-bit register: shuffles broadcast within
+    // each 128-bit lane, which is exactly one input column per lane.
+    MATH_AVX2 static void multiplyMatricesAvx2(const Mat4& m, const float* in, size_t inStride,
+            float* out, size_t outStride, size_t count) {
+        __m256 a0 = _mm256_broadcast_ps((const __m128*)(m.m));
+        __m256 a1 = _mm256_broadcast_ps((const __m128*)(m.m + 4));
+        __m256 a2 = _mm256_broadcast_ps((const __m128*)(m.m + 8));
+        __m256 a3 = _mm256_broadcast_ps((const __m128*)(m.m + 12));
+
+        for (size_t i = 0; i < count; ++i, in += inStride, out += outStride) {
+            for (int half = 0; half < 2; ++half) {
+                __m256 b = _mm256_loadu_ps(in + half * 8);
+                __m256 r = _mm256_mul_ps(a0, _mm256_shuffle_ps(b, b, _MM_SHUFFLE(0, 0, 0, 0)));
+                r = _mm256_fmadd_ps(a1, _mm256_shuffle_ps(b, b, _MM_SHUFFLE(1, 1, 1, 1)), r);
+                r = _mm256_fmadd_ps(a2, _mm256_shuffle_ps(b, b, _MM_SHUFFLE(2, 2, 2, 2)), r);
+                r = _mm256_fmadd_ps(a3, _mm256_shuffle_ps(b, b, _MM_SHUFFLE(3, 3, 3, 3)), r);
+                _mm256_storeu_ps(out + half * 8, r);
+            }
+        }
+    }
+#endif
+
+    // Runtime dispatch.
+
+    struct Kernels {
+        void (*transformPoints)(const Mat4&, const float*, const float*, const float*,
+            float*, float*, float*, size_t);
+        void (*composeTransforms)(const TransformArrays&, size_t, size_t, float*, size_t);
+        void (*multiplyMatrices)(const Mat4&, const float*, size_t, float*, size_t, size_t);
+    };
+
+    static const Kernels kernels[] = {
+        { transformPointsScalar, composeTransformsScalar, multiplyMatricesScalar },
+#ifdef MATH_X86
+        { transformPointsSse, composeTransformsSse, multiplyMatricesSse },
+        // Composing is bound by the 64 bytes stored per matrix; 256-bit
+        // stores of matrices that are rarely 32-byte aligned lose to SSE.
+        { transformPointsAvx2, composeTransformsSse, multiplyMatricesAvx2 },
+#endif
+    };
+
+    static SimdLevel detectSimdLevel() {
+#ifdef MATH_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return SIMD_AVX2;
+        return SIMD_SSE;
+#else
+        return SIMD_SCALAR;
+#endif
+    }
+
+    static SimdLevel activeLevel = getSupportedSimdLevel();
+
+    SimdLevel getSupportedSimdLevel() {
+        static SimdLevel supported = detectSimdLevel();
+        return supported;
+    }
+
+    SimdLevel getSimdLevel() {
+        return activeLevel;
+    }
+
+    SimdLevel setSimdLevel(SimdLevel level) {
+        activeLevel = level < getSupportedSimdLevel() ? level : getSupportedSimdLevel();
+        return activeLevel;
+    }
+
+    const char* getSimdLevelName(SimdLevel level) {
+        switch (level) {
+            case SIMD_SCALAR: return "scalar";
+            case SIMD_SSE: return "sse";
+            case SIMD_AVX2: return "avx2";
+        }
+        return "unknown";
+    }
+
+    void transformPoints(const Mat4& m,
+            const float* inX, const float* inY, const float* inZ,
+            float* outX, float* outY, float* outZ, size_t count) {
+        kernels[activeLevel].transformPoints(m, inX, inY, inZ, outX, outY, outZ, count);
+    }
+
+    void composeTransforms(const TransformArrays& transforms, size_t first, size_t count,
+            float* out, size_t outStride) {
+        kernels[activeLevel].composeTransforms(transforms, first, count, out, outStride);
+    }
+
+    void multiplyMatrices(const Mat4& m, const float* in, size_t inStride,
+            float* out, size_t outStride, size_t count) {
+        kernels[activeLevel].multiplyMatrices(m, in, inStride, out, outStride, count);
+    }
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// Small vector/matrix/quaternion library. Matrices are column-major like
+// GLSL, so a Mat4 can be copied straight into a buffer or push constant.
+//
+// The batch functions work on structure-of-arrays data and come in scalar,
+// SSE and AVX2+FMA versions; the widest one the CPU supports is picked at
+// startup and can be overridden with setSimdLevel() for benchmarking.
+namespace Math {
+    struct Vec3 {
+        float x = 0.0f;
+        float y = 0.0f;
+        float z = 0.0f;
+
+        Vec3() {}
+        Vec3(float x, float y, float z) : x(x), y(y), z(z) {}
+
+        Vec3 operator+(const Vec3& v) const { return Vec3(x + v.x, y + v.y, z + v.z); }
+        Vec3 operator-(const Vec3& v) const { return Vec3(x - v.x, y - v.y, z - v.z); }
+        Vec3 operator*(float s) const { return Vec3(x * s, y * s, z * s); }
+        Vec3 operator-() const { return Vec3(-x, -y, -z); }
+    };
+
+    struct Vec4 {
+        float x = 0.0f;
+        float y = 0.0f;
+        float z = 0.0f;
+        float w = 0.0f;
+
+        Vec4() {}
+        Vec4(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) {}
+        Vec4(const Vec3& v, float w) : x(v.x), y(v.y), z(v.z), w(w) {}
+    };
+
+    // Unit quaternion for rotations, w is the real part.
+    struct Quat {
+        float x = 0.0f;
+        float y = 0.0f;
+        float z = 0.0f;
+        float w = 1.0f;
+
+        Quat() {}
+        Quat(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) {}
+    };
+
+    struct Mat4 {
+        float m[16] = {
+            1.0f, 0.0f, 0.0f, 0.0f,
+            0.0f, 1.0f, 0.0f, 0.0f,
+            0.0f, 0.0f, 1.0f, 0.0f,
+            0.0f, 0.0f, 0.0f, 1.0f
+        };
+
+        // Element in column c, row r.
+        float& at(int c, int r) { return m[c * 4 + r]; }
+        float at(int c, int r) const { return m[c * 4 + r]; }
+    };
+
+    inline float dot(const Vec3& a, const Vec3& b) {
+        return a.x * b.x + a.y * b.y + a.z * b.z;
+    }
+    inline Vec3 cross(const Vec3& a, const Vec3& b) {
+        return Vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+    }
+    inline float length(const Vec3& v) {
+        return std::sqrt(dot(v, v));
+    }
+    inline Vec3 normalize(const Vec3& v) {
+        float l = length(v);
+        return l > 0.0f ? v * (1.0f / l) : v;
+    }
+
+    Quat normalize(const Quat& q);
+    Quat operator*(const Quat& a, const Quat& b);
+    Quat fromAxisAngle(const Vec3& axis, float angle);
+    Vec3 rotate(const Quat& q, const Vec3& v);
+
+    Mat4 operator*(const Mat4& a, const Mat4& b);
+    Vec4 operator*(const Mat4& m, const Vec4& v);
+    Mat4 translation(const Vec3& t);
+    Mat4 scaling(const Vec3& s);
+    Mat4 rotation(const Quat& q);
+    Mat4 compose(const Vec3& position, const Quat& rotation, float scale);
+    Mat4 transpose(const Mat4& m);
+
+    // Right-handed view looking from eye to center.
+    Mat4 lookAt(const Vec3& eye, const Vec3& center, const Vec3& up);
+    // Vulkan clip space: y points down, depth goes from 0 to 1.
+    Mat4 perspective(float fovY, float aspect, float zNear, float zFar);
+
+    // Owning structure-of-arrays storage for translation, rotation and
+    // uniform scale of many objects.
+    struct TransformArrays {
+        std::vector<float> positionX, positionY, positionZ;
+        std::vector<float> rotationX, rotationY, rotationZ, rotationW;
+        std::vector<float> scale;
+
+        void resize(size_t count);
+        size_t size() const {
+            return scale.size();
+        }
+
+        void set(size_t index, const Vec3& position, const Quat& rotation, float scale);
+    };
+
+    enum SimdLevel {
+        SIMD_SCALAR,
+        SIMD_SSE,
+        SIMD_AVX2
+    };
+
+    SimdLevel getSupportedSimdLevel();
+    SimdLevel getSimdLevel();
+    // Clamped to what the CPU supports, returns the level actually used.
+    SimdLevel setSimdLevel(SimdLevel level);
+    const char* getSimdLevelName(SimdLevel level);
+
+    // out = (m * (in, 1)).xyz for count points. Input and output arrays may
+    // be the same.
+    void transformPoints(const Mat4& m,
+        const float* inX, const float* inY, const float* inZ,
+        float* outX, float* outY, float* outZ, size_t count);
+
+    // Writes compose() of transforms [first, first + count) into consecutive
+    // matrices outStride floats apart, so they can land directly in an
+    // interleaved instance array.
+    void composeTransforms(const TransformArrays& transforms, size_t first, size_t count,
+        float* out, size_t outStride);
+
+    // out[i] = m * in[i] for count matrices, strides in floats.
+    void multiplyMatrices(const Mat4& m, const float* in, size_t inStride,
+        float* out, size_t outStride, size_t count);
+};
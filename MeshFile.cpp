@@ -0,0 +1,198 @@
+#include "MeshFile.hpp"
+#include "MeshOptimizer.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <cfloat>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+bool MeshFile::open(const std::string& path) {
+    close();
+
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat status;
+    if (fstat(fd, &status) != 0 || (size_t)status.st_size < sizeof(Header)) {
+        std::cout << "Mesh file " << path << " is too small" << std::endl;
+        close();
+        return false;
+    }
+    size = (size_t)status.st_size;
+
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        std::cout << "Failed to map mesh file " << path << std::endl;
+        data = NULL;
+        close();
+        return false;
+    }
+
+    // Everything is read once, front to back, right after opening.
+    madvise(data, size, MADV_SEQUENTIAL);
+    madvise(data, size, MADV_WILLNEED);
+
+    header = (const Header*)data;
+    if (!validate(path)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool MeshFile::validate(const std::string& path) const {
+    const char* error = NULL;
+
+    if (header->magic != MAGIC) {
+        error = "not a mesh file";
+    } else if (header->version != VERSION) {
+        error = "unsupported version";
+    } else if (header->vertexFormat >= FORMAT_COUNT || header->vertexStride != getVertexStride(header->vertexFormat) ||
+            (header->indexSize != 2 && header->indexSize != 4)) {
+        error = "unsupported vertex or index format";
+    } else if (header->vertexBytes != (uint64_t)header->vertexCount * header->vertexStride ||
+            header->indexBytes != (uint64_t)header->indexCount * header->indexSize) {
+        error = "stream sizes do not match the counts";
+    } else if (header->vertexOffset % ALIGNMENT != 0 || header->indexOffset % ALIGNMENT != 0) {
+        error = "misaligned streams";
+    } else if (header->vertexOffset > size || header->vertexBytes > size - header->vertexOffset ||
+            header->indexOffset > size || header->indexBytes > size - header->indexOffset ||
+            header->vertexOffset < sizeof(Header) || header->indexOffset < sizeof(Header)) {
+        error = "streams outside the file";
+    } else if (!indicesInRange()) {
+        error = "index out of range";
+    }
+
+    if (error != NULL) {
+        std::cout << "Mesh file " << path << " rejected: " << error << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Indices come from the file as well; one out of range would make the
+// GPU fetch past the vertex buffer.
+bool MeshFile::indicesInRange() const {
+    const void* indices = getIndexData();
+    uint32_t vertexCount = header->vertexCount;
+
+    if (header->indexSize == 2) {
+        for (uint32_t i = 0; i < header->indexCount; ++i) {
+            uint16_t index;
+            memcpy(&index, (const uint16_t*)indices + i, sizeof(index));
+            if (index >= vertexCount) return false;
+        }
+    } else {
+        for (uint32_t i = 0; i < header->indexCount; ++i) {
+            uint32_t index;
+            memcpy(&index, (const uint32_t*)indices + i, sizeof(index));
+            if (index >= vertexCount) return false;
+        }
+    }
+    return true;
+}
+
+void MeshFile::close() {
+    if (data != NULL) {
+        munmap(data, size);
+        data = NULL;
+    }
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    size = 0;
+    header = NULL;
+}
+
+bool MeshFile::write(const std::string& path, const float* positions, uint32_t vertexCount,
+        const uint32_t* indices, uint32_t indexCount, uint32_t vertexFormat) {
+    Header header {};
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.vertexFormat = vertexFormat;
+    header.vertexStride = getVertexStride(vertexFormat);
+    header.vertexCount = vertexCount;
+    header.indexSize = vertexCount <= 65536 ? 2 : 4;
+    header.indexCount = indexCount;
+
+    // Bounds are taken after rounding so culling stays conservative.
+    std::vector<uint16_t> halfPositions;
+    std::vector<float> roundedPositions;
+    if (vertexFormat == FORMAT_HALF4) {
+        halfPositions.resize((size_t)vertexCount * 4);
+        MeshOptimizer::quantizeHalf(positions, vertexCount, halfPositions.data());
+
+        roundedPositions.resize((size_t)vertexCount * 3);
+        for (uint32_t i = 0; i < vertexCount; ++i) {
+            for (int c = 0; c < 3; ++c) {
+                roundedPositions[i * 3 + c] = MeshOptimizer::halfToFloat(halfPositions[i * 4 + c]);
+            }
+        }
+        positions = roundedPositions.data();
+    }
+
+    for (int c = 0; c < 3; ++c) {
+        header.boundsMin[c] = vertexCount > 0 ? FLT_MAX : 0.0f;
+        header.boundsMax[c] = vertexCount > 0 ? -FLT_MAX : 0.0f;
+    }
+    for (uint32_t i = 0; i < vertexCount; ++i) {
+        for (int c = 0; c < 3; ++c) {
+            header.boundsMin[c] = std::min(header.boundsMin[c], positions[i * 3 + c]);
+            header.boundsMax[c] = std::max(header.boundsMax[c], positions[i * 3 + c]);
+        }
+    }
+
+    header.vertexOffset = alignUp(sizeof(Header), ALIGNMENT);
+    header.vertexBytes = (uint64_t)vertexCount * header.vertexStride;
+    header.indexOffset = alignUp(header.vertexOffset + header.vertexBytes, ALIGNMENT);
+    header.indexBytes = (uint64_t)indexCount * header.indexSize;
+
+    std::vector<char> indexData(header.indexBytes);
+    if (header.indexSize == 2) {
+        uint16_t* shortIndices = (uint16_t*)indexData.data();
+        for (uint32_t i = 0; i < indexCount; ++i) {
+            shortIndices[i] = (uint16_t)indices[i];
+        }
+    } else if (indexCount > 0) {
+        memcpy(indexData.data(), indices, header.indexBytes);
+    }
+
+    // Written next to the target and renamed, so a reader never maps a
+    // half-written file.
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        std::vector<char> padding(ALIGNMENT, 0);
+
+        file.write((const char*)&header, sizeof(header));
+        file.write(padding.data(), header.vertexOffset - sizeof(header));
+        file.write(vertexFormat == FORMAT_HALF4 ? (const char*)halfPositions.data() : (const char*)positions, header.vertexBytes);
+        file.write(padding.data(), header.indexOffset - header.vertexOffset - header.vertexBytes);
+        file.write(indexData.data(), header.indexBytes);
+
+        if (!file) {
+            std::cout << "Failed to write " << tempPath << std::endl;
+            return false;
+        }
+    }
+
+    if (std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        std::cout << "Failed to rename " << tempPath << " to " << path << std::endl;
+        std::remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
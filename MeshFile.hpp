@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Binary mesh container that is memory-mapped and handed to the GPU upload
+// as is. A fixed header is followed by the vertex and index streams, each
+// starting at a multiple of ALIGNMENT so they can be copied straight into
+// staging memory. Vertices are tightly packed positions, either floats or
+// half floats padded to 4 components; indices are 16-bit when the vertex
+// count allows it. All values are little-endian.
+class MeshFile {
+    public:
+        static const uint32_t MAGIC = 0x4853454D;      // "MESH"
+        static const uint32_t VERSION = 2;
+        static const uint64_t ALIGNMENT = 256;
+
+        enum VertexFormat {
+            FORMAT_FLOAT3 = 0,          // R32G32B32_SFLOAT, 12 bytes
+            FORMAT_HALF4 = 1,           // R16G16B16A16_SFLOAT, 8 bytes, w is 1
+            FORMAT_COUNT
+        };
+
+        static uint32_t getVertexStride(uint32_t vertexFormat) {
+            return vertexFormat == FORMAT_HALF4 ? 4 * sizeof(uint16_t) : 3 * sizeof(float);
+        }
+        static const char* getVertexFormatName(uint32_t vertexFormat) {
+            return vertexFormat == FORMAT_HALF4 ? "half4" : "float3";
+        }
+
+        struct Header {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t vertexFormat;
+            uint32_t vertexStride;      // bytes, position at offset 0
+            uint32_t vertexCount;
+            uint32_t indexSize;         // 2 or 4 bytes
+            uint32_t indexCount;
+            float boundsMin[3];
+            float boundsMax[3];
+            uint32_t reserved;
+            uint64_t vertexOffset;
+            uint64_t vertexBytes;
+            uint64_t indexOffset;
+            uint64_t indexBytes;
+        };
+
+    private:
+        int fd = -1;
+        void* data = NULL;
+        size_t size = 0;
+        const Header* header = NULL;
+
+        bool validate(const std::string& path) const;
+        bool indicesInRange() const;
+
+    public:
+        ~MeshFile() {
+            close();
+        }
+
+        // Maps the file and checks the header and that every index refers to
+        // a vertex, so the streams can go to the GPU as they are. They stay
+        // valid until close().
+        bool open(const std::string& path);
+        void close();
+
+        const Header& getHeader() const {
+            return *header;
+        }
+        const void* getVertexData() const {
+            return (const char*)data + header->vertexOffset;
+        }
+        const void* getIndexData() const {
+            return (const char*)data + header->indexOffset;
+        }
+
+        // positions holds 3 floats per vertex and is encoded in vertexFormat.
+        // Computes the bounds of the encoded positions and picks the smallest
+        // index size that fits.
+        static bool write(const std::string& path, const float* positions, uint32_t vertexCount,
+            const uint32_t* indices, uint32_t indexCount, uint32_t vertexFormat = FORMAT_FLOAT3);
+};
@@ -0,0 +1,342 @@
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace MeshOptimizer {
+    static uint32_t hashPosition(const float* position) {
+        uint32_t words[3];
+        memcpy(words, position, sizeof(words));
+
+        // Murmur3 style mixing of the three words.
+        uint32_t hash = 0;
+        for (int i = 0; i < 3; ++i) {
+            uint32_t k = words[i] * 0xCC9E2D51u;
+            k = (k << 15) | (k >> 17);
+            hash ^= k * 0x1B873593u;
+            hash = ((hash << 13) | (hash >> 19)) * 5 + 0xE6546B64u;
+        }
+        hash ^= hash >> 16;
+        hash *= 0x85EBCA6Bu;
+        hash ^= hash >> 13;
+        return hash;
+    }
+
+    Mesh fromTriangles(const float* positions, size_t vertexCount) {
+        Mesh mesh;
+        mesh.positions.assign(positions, positions + vertexCount * 3);
+        mesh.indices.resize(vertexCount);
+        for (size_t i = 0; i < vertexCount; ++i) {
+            mesh.indices[i] = (uint32_t)i;
+        }
+        weldVertices(mesh);
+        return mesh;
+    }
+
+    // Open addressing over the new vertex indices; positions are compared
+    // bitwise, so -0 and 0 stay apart.
+    void weldVertices(Mesh& mesh) {
+        size_t vertexCount = mesh.getVertexCount();
+
+        size_t tableSize = 16;
+        while (tableSize < vertexCount * 2) tableSize *= 2;
+        std::vector<uint32_t> table(tableSize, UINT32_MAX);
+
+        std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+        std::vector<float> positions;
+        positions.reserve(mesh.positions.size());
+
+        for (uint32_t& index: mesh.indices) {
+            if (remap[index] == UINT32_MAX) {
+                const float* position = &mesh.positions[(size_t)index * 3];
+                size_t slot = hashPosition(position) & (tableSize - 1);
+
+                while (table[slot] != UINT32_MAX &&
+                        memcmp(&positions[(size_t)table[slot] * 3], position, 3 * sizeof(float)) != 0) {
+                    slot = (slot + 1) & (tableSize - 1);
+                }
+                if (table[slot] == UINT32_MAX) {
+                    table[slot] = (uint32_t)(positions.size() / 3);
+                    positions.insert(positions.end(), position, position + 3);
+                }
+                remap[index] = table[slot];
+            }
+            index = remap[index];
+        }
+
+        mesh.positions.swap(positions);
+    }
+
+    // Scores from Tom Forsyth, "Linear-Speed Vertex Cache Optimisation". The
+    // three vertices of the last triangle get a fixed score so strips are not
+    // favoured over fans, older cache entries fall off with a power curve and
+    // vertices with few remaining triangles get a bonus so they are finished
+    // before they leave the cache.
+    static const int CACHE_SIZE = 32;
+    static const int VALENCE_TABLE_SIZE = 32;
+
+    struct ScoreTables {
+        float cache[CACHE_SIZE];
+        float valence[VALENCE_TABLE_SIZE];
+
+        ScoreTables() {
+            for (int i = 0; i < CACHE_SIZE; ++i) {
+                cache[i] = i < 3 ? 0.75f : powf(1.0f - (float)(i - 3) / (float)(CACHE_SIZE - 3), 1.5f);
+            }
+            valence[0] = 0.0f;
+            for (int i = 1; i < VALENCE_TABLE_SIZE; ++i) {
+                valence[i] = 2.0f / sqrtf((float)i);
+            }
+        }
+    };
+
+    static float vertexScore(const ScoreTables& tables, int cachePosition, uint32_t valence) {
+        if (valence == 0) return -1.0f;
+
+        float score = cachePosition >= 0 ? tables.cache[cachePosition] : 0.0f;
+        score += valence < (uint32_t)VALENCE_TABLE_SIZE ? tables.valence[valence] : 2.0f / sqrtf((float)valence);
+        return score;
+    }
+
+    void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount) {
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0) return;
+        static const ScoreTables tables;
+
+        // Triangles around each vertex; the first valence[v] entries of a
+        // vertex's range are the ones not emitted yet.
+        std::vector<uint32_t> valence(vertexCount, 0);
+        for (uint32_t index: indices) {
+            valence[index]++;
+        }
+        std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+        for (size_t v = 0; v < vertexCount; ++v) {
+            adjacencyOffsets[v + 1] = adjacencyOffsets[v] + valence[v];
+        }
+        std::vector<uint32_t> adjacency(indices.size());
+        std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (size_t t = 0; t < triangleCount; ++t) {
+            for (int c = 0; c < 3; ++c) {
+                adjacency[fill[indices[t * 3 + c]]++] = (uint32_t)t;
+            }
+        }
+
+        std::vector<int> cachePositions(vertexCount, -1);
+        std::vector<float> vertexScores(vertexCount);
+        for (size_t v = 0; v < vertexCount; ++v) {
+            vertexScores[v] = vertexScore(tables, -1, valence[v]);
+        }
+
+        std::vector<float> triangleScores(triangleCount);
+        std::vector<uint8_t> emitted(triangleCount, 0);
+        size_t bestTriangle = 0;
+        for (size_t t = 0; t < triangleCount; ++t) {
+            triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+            if (triangleScores[t] > triangleScores[bestTriangle]) {
+                bestTriangle = t;
+            }
+        }
+
+        std::vector<uint32_t> output;
+        output.reserve(indices.size());
+
+        uint32_t cache[CACHE_SIZE + 3];
+        uint32_t newCache[CACHE_SIZE + 3];
+        int cacheCount = 0;
+        size_t cursor = 0;
+
+        for (size_t emittedCount = 0; emittedCount < triangleCount; ++emittedCount) {
+            // Nothing in the cache has triangles left: continue with the next
+            // triangle in input order.
+            if (bestTriangle == SIZE_MAX) {
+                while (emitted[cursor]) cursor++;
+                bestTriangle = cursor;
+            }
+
+            const uint32_t* triangle = &indices[bestTriangle * 3];
+            output.insert(output.end(), triangle, triangle + 3);
+            emitted[bestTriangle] = 1;
+
+            for (int c = 0; c < 3; ++c) {
+                uint32_t v = triangle[c];
+                uint32_t* begin = &adjacency[adjacencyOffsets[v]];
+                uint32_t* last = begin + valence[v] - 1;
+                *std::find(begin, last, (uint32_t)bestTriangle) = *last;
+                valence[v]--;
+            }
+
+            // The new triangle moves to the front, everything else shifts back.
+            int newCount = 0;
+            for (int c = 0; c < 3; ++c) {
+                newCache[newCount++] = triangle[c];
+            }
+            for (int i = 0; i < cacheCount; ++i) {
+                uint32_t v = cache[i];
+                if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+                    newCache[newCount++] = v;
+                }
+            }
+
+            for (int i = 0; i < newCount; ++i) {
+                uint32_t v = newCache[i];
+                cachePositions[v] = i < CACHE_SIZE ? i : -1;
+                vertexScores[v] = vertexScore(tables, cachePositions[v], valence[v]);
+            }
+
+            bestTriangle = SIZE_MAX;
+            float bestScore = -1.0f;
+            for (int i = 0; i < newCount; ++i) {
+                uint32_t v = newCache[i];
+                for (uint32_t a = adjacencyOffsets[v]; a < adjacencyOffsets[v] + valence[v]; ++a) {
+                    uint32_t t = adjacency[a];
+                    const uint32_t* other = &indices[(size_t)t * 3];
+                    triangleScores[t] = vertexScores[other[0]] + vertexScores[other[1]] + vertexScores[other[2]];
+                    if (triangleScores[t] > bestScore) {
+                        bestScore = triangleScores[t];
+                        bestTriangle = t;
+                    }
+                }
+            }
+
+            cacheCount = std::min(newCount, CACHE_SIZE);
+            memcpy(cache, newCache, cacheCount * sizeof(uint32_t));
+        }
+
+        indices.swap(output);
+    }
+
+    void optimizeVertexFetch(Mesh& mesh) {
+        size_t vertexCount = mesh.getVertexCount();
+        std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+        std::vector<float> positions;
+        positions.reserve(mesh.positions.size());
+
+        for (uint32_t& index: mesh.indices) {
+            if (remap[index] == UINT32_MAX) {
+                remap[index] = (uint32_t)(positions.size() / 3);
+                const float* position = &mesh.positions[(size_t)index * 3];
+                positions.insert(positions.end(), position, position + 3);
+            }
+            index = remap[index];
+        }
+
+        mesh.positions.swap(positions);
+    }
+
+    void optimize(Mesh& mesh) {
+        weldVertices(mesh);
+        optimizeVertexCache(mesh.indices, mesh.getVertexCount());
+        optimizeVertexFetch(mesh);
+    }
+
+    CacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize) {
+        CacheStats stats;
+        if (indexCount < 3) return stats;
+
+        // A vertex is still cached if fewer than cacheSize misses happened
+        // since it was last loaded.
+        std::vector<uint64_t> loadedAt(vertexCount, 0);
+        std::vector<uint8_t> used(vertexCount, 0);
+        uint64_t misses = 0;
+        size_t uniqueCount = 0;
+
+        for (size_t i = 0; i < indexCount; ++i) {
+            uint32_t v = indices[i];
+            if (!used[v] || misses - loadedAt[v] >= cacheSize) {
+                loadedAt[v] = misses;
+                misses++;
+            }
+            if (!used[v]) {
+                used[v] = 1;
+                uniqueCount++;
+            }
+        }
+
+        stats.acmr = (double)misses / (double)(indexCount / 3);
+        stats.atvr = (double)misses / (double)uniqueCount;
+        return stats;
+    }
+
+    FetchStats analyzeVertexFetch(const uint32_t* indices, size_t indexCount, size_t vertexCount, size_t vertexStride) {
+        FetchStats stats;
+        if (vertexCount == 0) return stats;
+
+        // 128 KiB of direct-mapped 64 byte lines, roughly what sits in front
+        // of vertex fetch on current GPUs.
+        const size_t LINE_SIZE = 64;
+        const size_t LINE_COUNT = 2048;
+        std::vector<size_t> lines(LINE_COUNT, SIZE_MAX);
+        size_t fetched = 0;
+
+        for (size_t i = 0; i < indexCount; ++i) {
+            size_t begin = (size_t)indices[i] * vertexStride / LINE_SIZE;
+            size_t end = ((size_t)indices[i] * vertexStride + vertexStride - 1) / LINE_SIZE;
+            for (size_t line = begin; line <= end; ++line) {
+                if (lines[line % LINE_COUNT] != line) {
+                    lines[line % LINE_COUNT] = line;
+                    fetched += LINE_SIZE;
+                }
+            }
+        }
+
+        stats.overfetch = (double)fetched / (double)(vertexCount * vertexStride);
+        return stats;
+    }
+
+    uint16_t floatToHalf(float value) {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+
+        uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+        uint32_t magnitude = bits & 0x7FFFFFFF;
+
+        if (magnitude >= 0x7F800000) {
+            // Infinity stays infinity, NaN stays a quiet NaN.
+            return sign | 0x7C00 | (magnitude > 0x7F800000 ? 0x200 : 0);
+        }
+        if (magnitude >= 0x477FF000) {
+            return sign | 0x7C00;
+        }
+        if (magnitude < 0x38800000) {
+            // Subnormal halves are multiples of 2^-24.
+            float absolute;
+            memcpy(&absolute, &magnitude, sizeof(absolute));
+            return sign | (uint16_t)lrintf(absolute * 16777216.0f);
+        }
+
+        // Rebias the exponent from 127 to 15 and round the mantissa to 10
+        // bits, ties to even; a carry correctly bumps the exponent.
+        uint32_t rebiased = magnitude - 0x38000000;
+        return sign | (uint16_t)((rebiased + 0xFFF + ((rebiased >> 13) & 1)) >> 13);
+    }
+
+    float halfToFloat(uint16_t value) {
+        uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+        uint32_t exponent = (value >> 10) & 0x1F;
+        uint32_t mantissa = value & 0x3FF;
+
+        if (exponent == 0) {
+            float result = (float)mantissa / 16777216.0f;
+            return sign ? -result : result;
+        }
+
+        uint32_t bits = exponent == 31 ?
+            sign | 0x7F800000 | (mantissa << 13) :
+            sign | ((exponent + 112) << 23) | (mantissa << 13);
+        float result;
+        memcpy(&result, &bits, sizeof(result));
+        return result;
+    }
+
+    void quantizeHalf(const float* positions, size_t vertexCount, uint16_t* out) {
+        const uint16_t one = 0x3C00;
+
+        for (size_t i = 0; i < vertexCount; ++i) {
+            out[i * 4] = floatToHalf(positions[i * 3]);
+            out[i * 4 + 1] = floatToHalf(positions[i * 3 + 1]);
+            out[i * 4 + 2] = floatToHalf(positions[i * 3 + 2]);
+            out[i * 4 + 3] = one;
+        }
+    }
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Mesh processing shared by meshconv and the renderer. Meshes are position
+// only (3 floats per vertex) with 32-bit triangle list indices; the
+// renderer's MeshFile picks the final index size and vertex encoding.
+namespace MeshOptimizer {
+    struct Mesh {
+        std::vector<float> positions;
+        std::vector<uint32_t> indices;
+
+        size_t getVertexCount() const {
+            return positions.size() / 3;
+        }
+    };
+
+    // Post-transform cache model: a FIFO of cacheSize vertices. ACMR is
+    // transformed vertices per triangle (0.5 is ideal for large grids, 3 is
+    // no reuse), ATVR transformed vertices per unique vertex (1 is ideal).
+    struct CacheStats {
+        double acmr = 0.0;
+        double atvr = 0.0;
+    };
+
+    // Bytes of vertex data pulled in by the index order through a 128 KiB
+    // cache of 64 byte lines, relative to the size of the vertex buffer.
+    // 1 means every line is read exactly once.
+    struct FetchStats {
+        double overfetch = 0.0;
+    };
+
+    // Welds identical vertices of an unindexed triangle list (vertexCount
+    // 3-float positions) into a vertex and index buffer.
+    Mesh fromTriangles(const float* positions, size_t vertexCount);
+
+    // Welds identical vertices of an indexed mesh and drops unused ones.
+    void weldVertices(Mesh& mesh);
+
+    // Reorders triangles for the post-transform cache (Forsyth's linear
+    // speed algorithm), then vertices in order of first use so the fetches
+    // walk the vertex buffer front to back.
+    void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount);
+    void optimizeVertexFetch(Mesh& mesh);
+
+    // weldVertices, optimizeVertexCache and optimizeVertexFetch in order.
+    void optimize(Mesh& mesh);
+
+    CacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = 16);
+    FetchStats analyzeVertexFetch(const uint32_t* indices, size_t indexCount, size_t vertexCount, size_t vertexStride);
+
+    // IEEE half floats, round to nearest even. Positions are written as
+    // x, y, z, 1 so each vertex is 8 bytes and matches R16G16B16A16_SFLOAT.
+    uint16_t floatToHalf(float value);
+    float halfToFloat(uint16_t value);
+    void quantizeHalf(const float* positions, size_t vertexCount, uint16_t* out);
+};
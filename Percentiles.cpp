@@ -0,0 +1,41 @@
+#include "Percentiles.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+Percentiles percentiles(std::vector<double> samples) {
+    Percentiles result;
+    if (samples.empty()) return result;
+
+    std::sort(samples.begin(), samples.end());
+
+    double sum = 0.0;
+    for (double sample: samples) sum += sample;
+
+    // Nearest-rank percentile.
+    auto rank = [&](double p) {
+        size_t index = (size_t)(p * (double)samples.size() + 0.5);
+        if (index > 0) index--;
+        if (index >= samples.size()) index = samples.size() - 1;
+        return samples[index];
+    };
+
+    result.mean = sum / (double)samples.size();
+    result.min = samples.front();
+    result.p50 = rank(0.50);
+    result.p95 = rank(0.95);
+    result.p99 = rank(0.99);
+    result.max = samples.back();
+    return result;
+}
+
+std::string toJson(const Percentiles& p) {
+    std::ostringstream out;
+    out << "{\"mean\": " << p.mean
+        << ", \"min\": " << p.min
+        << ", \"p50\": " << p.p50
+        << ", \"p95\": " << p.p95
+        << ", \"p99\": " << p.p99
+        << ", \"max\": " << p.max << "}";
+    return out.str();
+}
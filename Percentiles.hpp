@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Summary of a set of timings, shared by bench and replay so both report
+// the same numbers for the same samples. Percentiles are nearest-rank.
+struct Percentiles {
+    double mean = 0.0;
+    double min = 0.0;
+    double p50 = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+};
+
+// All zero for no samples.
+Percentiles percentiles(std::vector<double> samples);
+
+// {"mean": ..., "min": ..., "p50": ..., "p95": ..., "p99": ..., "max": ...}
+std::string toJson(const Percentiles& p);
@@ -0,0 +1,280 @@
+#include "PipelineCache.hpp"
+#include "VulkanError.hpp"
+#include <iostream>
+#include <fstream>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+static const uint32_t CACHE_MAGIC = 0x43504b56; // "VKPC"
+static const uint32_t CACHE_VERSION = 1;
+
+typedef std::chrono::steady_clock Clock;
+
+static double millisecondsSince(Clock::time_point begin) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+}
+
+// FNV-1a, good enough to catch truncated or corrupted files.
+uint64_t PipelineCache::hash(const void* data, size_t size) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    uint64_t value = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; ++i) {
+        value ^= bytes[i];
+        value *= 0x100000001b3ull;
+    }
+    return value;
+}
+
+bool PipelineCache::load(std::vector<char>& data) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        stats.rejectReason = "no cache file";
+        return false;
+    }
+
+    FileHeader header;
+    if (!file.read((char*)&header, sizeof(header))) {
+        stats.rejectReason = "truncated header";
+        return false;
+    }
+
+    if (header.magic != CACHE_MAGIC || header.version != CACHE_VERSION) {
+        stats.rejectReason = "unknown file format";
+        return false;
+    }
+    if (header.vendorID != properties.vendorID || header.deviceID != properties.deviceID) {
+        stats.rejectReason = "different device";
+        return false;
+    }
+    if (header.driverVersion != properties.driverVersion) {
+        stats.rejectReason = "different driver version";
+        return false;
+    }
+    if (memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+        stats.rejectReason = "different pipelineCacheUUID";
+        return false;
+    }
+
+    // dataSize comes from the file, it is checked against what is left of
+    // it before anything is allocated for it.
+    std::streamoff dataBegin = file.tellg();
+    file.seekg(0, std::ios::end);
+    std::streamoff dataEnd = file.tellg();
+    file.seekg(dataBegin);
+    if (dataBegin < 0 || dataEnd < dataBegin || header.dataSize > (uint64_t)(dataEnd - dataBegin)) {
+        stats.rejectReason = "truncated data";
+        return false;
+    }
+
+    data.resize((size_t)header.dataSize);
+    if (!file.read(data.data(), data.size())) {
+        stats.rejectReason = "truncated data";
+        return false;
+    }
+    if (hash(data.data(), data.size()) != header.checksum) {
+        stats.rejectReason = "checksum mismatch";
+        return false;
+    }
+
+    // The driver's own header has to agree as well.
+    VkPipelineCacheHeaderVersionOne driverHeader;
+    if (data.size() < sizeof(driverHeader)) {
+        stats.rejectReason = "driver header missing";
+        return false;
+    }
+    memcpy(&driverHeader, data.data(), sizeof(driverHeader));
+    if (driverHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+            driverHeader.vendorID != properties.vendorID ||
+            driverHeader.deviceID != properties.deviceID ||
+            memcmp(driverHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+        stats.rejectReason = "driver header mismatch";
+        return false;
+    }
+
+    return true;
+}
+
+bool PipelineCache::init(VkPhysicalDevice gpu, VkDevice device, const std::string& path, bool creationFeedback) {
+    this->device = device;
+    this->path = path;
+    this->creationFeedback = creationFeedback;
+    vkGetPhysicalDeviceProperties(gpu, &properties);
+
+    Clock::time_point begin = Clock::now();
+
+    std::vector<char> data;
+    stats.loaded = load(data);
+    if (!stats.loaded) data.clear();
+    stats.loadedBytes = data.size();
+
+    VkPipelineCacheCreateInfo pipelineCacheCreateInfo {};
+    pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    pipelineCacheCreateInfo.initialDataSize = data.size();
+    pipelineCacheCreateInfo.pInitialData = data.empty() ? NULL : data.data();
+
+    VkResult result = vkCreatePipelineCache(device, &pipelineCacheCreateInfo, NULL, &cache);
+    if (result != VK_SUCCESS && !data.empty()) {
+        // Fall back to an empty cache rather than failing start-up.
+        stats.loaded = false;
+        stats.rejectReason = "rejected by driver";
+        stats.loadedBytes = 0;
+        pipelineCacheCreateInfo.initialDataSize = 0;
+        pipelineCacheCreateInfo.pInitialData = NULL;
+        result = vkCreatePipelineCache(device, &pipelineCacheCreateInfo, NULL, &cache);
+    }
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create pipeline cache: " << getVulkanErrorString(result) << std::endl;
+        return false;
+    }
+
+    stats.loadTime = millisecondsSince(begin);
+    return true;
+}
+
+bool PipelineCache::save() {
+    if (cache == VK_NULL_HANDLE) return false;
+
+    size_t size = 0;
+    VkResult result = vkGetPipelineCacheData(device, cache, &size, NULL);
+    if (result != VK_SUCCESS || size == 0) return false;
+
+    std::vector<char> data(size);
+    result = vkGetPipelineCacheData(device, cache, &size, data.data());
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to read pipeline cache data: " << getVulkanErrorString(result) << std::endl;
+        return false;
+    }
+    data.resize(size);
+
+    FileHeader header {};
+    header.magic = CACHE_MAGIC;
+    header.version = CACHE_VERSION;
+    header.vendorID = properties.vendorID;
+    header.deviceID = properties.deviceID;
+    header.driverVersion = properties.driverVersion;
+    memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+    header.dataSize = data.size();
+    header.checksum = hash(data.data(), data.size());
+
+    // Write to a temporary file first so a crash never leaves a torn cache.
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        file.write((const char*)&header, sizeof(header));
+        file.write(data.data(), data.size());
+        if (!file) {
+            std::cout << "Failed to write pipeline cache " << tempPath << std::endl;
+            return false;
+        }
+    }
+
+    if (std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        std::cout << "Failed to replace pipeline cache " << path << std::endl;
+        return false;
+    }
+
+    std::cout << "Pipeline cache saved: " << data.size() << " bytes" << std::endl;
+    return true;
+}
+
+void PipelineCache::destroy() {
+    if (cache != VK_NULL_HANDLE) {
+        save();
+        vkDestroyPipelineCache(device, cache, NULL);
+        cache = VK_NULL_HANDLE;
+        std::cout << "Pipeline cache deleted" << std::endl;
+    }
+}
+
+static void recordCreation(PipelineCache::Stats& stats, const char* name, double time,
+        bool feedbackEnabled, const VkPipelineCreationFeedbackEXT& feedback) {
+    const char* outcome = "unknown";
+    if (feedbackEnabled && (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT)) {
+        if (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT) {
+            stats.hits++;
+            outcome = "cache hit";
+        } else {
+            stats.misses++;
+            outcome = "cache miss";
+        }
+    } else {
+        stats.unknown++;
+    }
+
+    stats.pipelines++;
+    stats.creationTime += time;
+    std::cout << "Pipeline " << name << " created in " << time << " ms (" << outcome << ")" << std::endl;
+}
+
+bool PipelineCache::createGraphicsPipeline(const char* name, const VkGraphicsPipelineCreateInfo& createInfo, VkPipeline& pipeline) {
+    VkGraphicsPipelineCreateInfo info = createInfo;
+
+    VkPipelineCreationFeedbackEXT feedback {};
+    std::vector<VkPipelineCreationFeedbackEXT> stageFeedback(info.stageCount);
+    VkPipelineCreationFeedbackCreateInfoEXT feedbackInfo {};
+    if (creationFeedback) {
+        feedbackInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+        feedbackInfo.pNext = info.pNext;
+        feedbackInfo.pPipelineCreationFeedback = &feedback;
+        feedbackInfo.pipelineStageCreationFeedbackCount = info.stageCount;
+        feedbackInfo.pPipelineStageCreationFeedbacks = stageFeedback.data();
+        info.pNext = &feedbackInfo;
+    }
+
+    Clock::time_point begin = Clock::now();
+    VkResult result = vkCreateGraphicsPipelines(device, cache, 1, &info, NULL, &pipeline);
+    double time = millisecondsSince(begin);
+
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create pipeline " << name << ": " << getVulkanErrorString(result) << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    recordCreation(stats, name, time, creationFeedback, feedback);
+    return true;
+}
+
+bool PipelineCache::createComputePipeline(const char* name, const VkComputePipelineCreateInfo& createInfo, VkPipeline& pipeline) {
+    VkComputePipelineCreateInfo info = createInfo;
+
+    VkPipelineCreationFeedbackEXT feedback {};
+    VkPipelineCreationFeedbackEXT stageFeedback {};
+    VkPipelineCreationFeedbackCreateInfoEXT feedbackInfo {};
+    if (creationFeedback) {
+        feedbackInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+        feedbackInfo.pNext = info.pNext;
+        feedbackInfo.pPipelineCreationFeedback = &feedback;
+        feedbackInfo.pipelineStageCreationFeedbackCount = 1;
+        feedbackInfo.pPipelineStageCreationFeedbacks = &stageFeedback;
+        info.pNext = &feedbackInfo;
+    }
+
+    Clock::time_point begin = Clock::now();
+    VkResult result = vkCreateComputePipelines(device, cache, 1, &info, NULL, &pipeline);
+    double time = millisecondsSince(begin);
+
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create pipeline " << name << ": " << getVulkanErrorString(result) << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(statsMutex);
+    recordCreation(stats, name, time, creationFeedback, feedback);
+    return true;
+}
+
+void PipelineCache::printStats() {
+    if (stats.loaded) {
+        std::cout << "Pipeline cache: loaded " << stats.loadedBytes << " bytes from " << path
+                  << " in " << stats.loadTime << " ms" << std::endl;
+    } else {
+        std::cout << "Pipeline cache: starting empty (" << stats.rejectReason << ")" << std::endl;
+    }
+
+    std::cout << "Pipelines: " << stats.pipelines << " created in " << stats.creationTime << " ms, "
+              << stats.hits << " hits, " << stats.misses << " misses, "
+              << stats.unknown << " without feedback" << std::endl;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+// VkPipelineCache persisted to disk between runs. The file carries its own
+// header (device identity, driver version, checksum) in front of the driver
+// blob; anything that does not match the current device is discarded.
+//
+// Pipelines may be created from several threads at once, VkPipelineCache
+// synchronizes itself.
+class PipelineCache {
+    public:
+        struct Stats {
+            bool loaded = false;
+            std::string rejectReason = "";
+            size_t loadedBytes = 0;
+            double loadTime = 0.0;          // ms
+            uint32_t pipelines = 0;
+            uint32_t hits = 0;
+            uint32_t misses = 0;
+            uint32_t unknown = 0;           // no creation feedback available
+            double creationTime = 0.0;      // ms, all pipelines
+        };
+
+    private:
+        struct FileHeader {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t vendorID;
+            uint32_t deviceID;
+            uint32_t driverVersion;
+            uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+            uint64_t dataSize;
+            uint64_t checksum;
+        };
+
+        VkDevice device = VK_NULL_HANDLE;
+        VkPhysicalDeviceProperties properties = {};
+        VkPipelineCache cache = VK_NULL_HANDLE;
+        std::string path = "";
+        bool creationFeedback = false;
+        Stats stats;
+        std::mutex statsMutex;
+
+        bool load(std::vector<char>& data);
+
+    public:
+        static uint64_t hash(const void* data, size_t size);
+
+        // creationFeedback: VK_EXT_pipeline_creation_feedback is enabled on
+        // the device, so cache hits can be reported per pipeline.
+        bool init(VkPhysicalDevice gpu, VkDevice device, const std::string& path, bool creationFeedback);
+        void destroy();
+        bool save();
+
+        bool createGraphicsPipeline(const char* name, const VkGraphicsPipelineCreateInfo& createInfo, VkPipeline& pipeline);
+        bool createComputePipeline(const char* name, const VkComputePipelineCreateInfo& createInfo, VkPipeline& pipeline);
+
+        VkPipelineCache get() const {
+            return cache;
+        }
+        const Stats& getStats() const {
+            return stats;
+        }
+        void printStats();
+};
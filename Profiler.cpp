@@ -0,0 +1,342 @@
+#include "Profiler.hpp"
+#include "VulkanError.hpp"
+#include <iostream>
+#include <fstream>
+
+#include <algorithm>
+
+const VkQueryPipelineStatisticFlags Profiler::STATISTICS_FLAGS =
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+
+// GPU events get their own row in the trace.
+static const uint32_t GPU_THREAD_ID = 0;
+
+Profiler::Profiler() {
+    epoch = std::chrono::steady_clock::now();
+}
+
+const char* Profiler::getStatisticName(uint32_t index) {
+    // Results are written in the bit order of STATISTICS_FLAGS.
+    switch (index) {
+        case 0: return "input_assembly_vertices";
+        case 1: return "input_assembly_primitives";
+        case 2: return "vertex_shader_invocations";
+        case 3: return "clipping_primitives";
+        case 4: return "fragment_shader_invocations";
+        case 5: return "compute_shader_invocations";
+        default: return "unknown";
+    }
+}
+
+bool Profiler::init(VkPhysicalDevice gpu, VkDevice device, uint32_t queueFamilyIndex,
+        uint32_t framesInFlight, bool pipelineStatistics) {
+    VkResult result;
+    
+    this->device = device;
+    slots.resize(framesInFlight);
+    
+    uint32_t family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(gpu, &family_count, NULL);
+    std::vector<VkQueueFamilyProperties> family_property_list(family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(gpu, &family_count, family_property_list.data());
+    
+    uint32_t validBits = family_property_list[queueFamilyIndex].timestampValidBits;
+    if (validBits == 0) {
+        std::cout << "Timestamps are not supported, GPU timings are unavailable" << std::endl;
+        return true;
+    }
+    timestampMask = validBits >= 64 ? UINT64_MAX : ((1ull << validBits) - 1);
+    
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(gpu, &properties);
+    timestampPeriod = properties.limits.timestampPeriod;
+    
+    VkQueryPoolCreateInfo queryPoolCreateInfo {};
+    queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolCreateInfo.queryCount = framesInFlight * maxQueriesPerFrame;
+    
+    result = vkCreateQueryPool(device, &queryPoolCreateInfo, NULL, &timestampPool);
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create timestamp query pool: " << getVulkanErrorString(result) << std::endl;
+        return false;
+    }
+    timestampsSupported = true;
+    
+    if (pipelineStatistics) {
+        queryPoolCreateInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+        queryPoolCreateInfo.queryCount = framesInFlight * maxStatisticsPerFrame;
+        queryPoolCreateInfo.pipelineStatistics = STATISTICS_FLAGS;
+        
+        result = vkCreateQueryPool(device, &queryPoolCreateInfo, NULL, &statisticsPool);
+        if (result != VK_SUCCESS) {
+            std::cout << "Failed to create pipeline statistics query pool: " << getVulkanErrorString(result) << std::endl;
+            return false;
+        }
+        statisticsSupported = true;
+    }
+    
+    return true;
+}
+
+void Profiler::destroy() {
+    if (timestampPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, timestampPool, NULL);
+        timestampPool = VK_NULL_HANDLE;
+        std::cout << "Timestamp query pool deleted" << std::endl;
+    }
+    
+    if (statisticsPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(device, statisticsPool, NULL);
+        statisticsPool = VK_NULL_HANDLE;
+        std::cout << "Pipeline statistics query pool deleted" << std::endl;
+    }
+}
+
+void Profiler::beginFrame(VkCommandBuffer cmdBuffer, uint32_t frameIndex) {
+    currentSlot = frameIndex;
+    FrameSlot& slot = slots[frameIndex];
+    
+    // Resolve what this slot recorded framesInFlight frames ago.
+    if (slot.pending && slot.queryCount > 0) {
+        std::vector<uint64_t> timestamps(slot.queryCount);
+        VkResult result = vkGetQueryPoolResults(device, timestampPool,
+            frameIndex * maxQueriesPerFrame, slot.queryCount,
+            timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT);
+        
+        std::vector<uint64_t> statistics(slot.statisticsCount * STATISTICS_COUNT);
+        if (result == VK_SUCCESS && slot.statisticsCount > 0) {
+            result = vkGetQueryPoolResults(device, statisticsPool,
+                frameIndex * maxStatisticsPerFrame, slot.statisticsCount,
+                statistics.size() * sizeof(uint64_t), statistics.data(),
+                STATISTICS_COUNT * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+        }
+        
+        if (result == VK_SUCCESS) {
+            uint64_t base = UINT64_MAX;
+            for (const GpuRegion& region: slot.regions) {
+                base = std::min(base, timestamps[region.beginQuery] & timestampMask);
+            }
+            
+            double frameEnd = 0.0;
+            lastGpuRegions.clear();
+            for (const GpuRegion& region: slot.regions) {
+                uint64_t begin = timestamps[region.beginQuery] & timestampMask;
+                uint64_t end = timestamps[region.endQuery] & timestampMask;
+                
+                RegionTiming timing;
+                timing.name = region.name;
+                timing.depth = region.depth;
+                timing.begin = (double)(begin - base) * timestampPeriod / 1000000.0;
+                timing.duration = (double)(end - begin) * timestampPeriod / 1000000.0;
+                
+                std::string args = "";
+                if (region.statisticsQuery >= 0) {
+                    timing.hasStatistics = true;
+                    for (uint32_t i = 0; i < STATISTICS_COUNT; ++i) {
+                        timing.statistics[i] = statistics[region.statisticsQuery * STATISTICS_COUNT + i];
+                        args += std::string(i > 0 ? ", " : "") + "\"" + getStatisticName(i) + "\": " +
+                            std::to_string(timing.statistics[i]);
+                    }
+                }
+                
+                frameEnd = std::max(frameEnd, timing.begin + timing.duration);
+                lastGpuRegions.push_back(timing);
+                
+                // GPU and CPU clocks are not calibrated against each other, GPU
+                // events are anchored at the CPU time the frame was recorded.
+                // Worker threads add CPU events at the same time.
+                std::lock_guard<std::mutex> lock(eventMutex);
+                if (tracing) {
+                    addEvent(timing.name, "gpu", GPU_THREAD_ID,
+                        slot.submitTime + timing.begin, timing.duration, args);
+                }
+            }
+            lastGpuFrameTime = frameEnd;
+        }
+    }
+    
+    slot.regions.clear();
+    slot.queryCount = 0;
+    slot.statisticsCount = 0;
+    slot.submitTime = now();
+    slot.pending = true;
+    openRegions.clear();
+    openStatisticsRegion = -1;
+    
+    if (timestampsSupported) {
+        vkCmdResetQueryPool(cmdBuffer, timestampPool, frameIndex * maxQueriesPerFrame, maxQueriesPerFrame);
+    }
+    if (statisticsSupported) {
+        vkCmdResetQueryPool(cmdBuffer, statisticsPool, frameIndex * maxStatisticsPerFrame, maxStatisticsPerFrame);
+    }
+}
+
+void Profiler::endFrame() {
+    if (!openRegions.empty()) {
+        std::cout << "Profiler: " << openRegions.size() << " GPU regions left open" << std::endl;
+        slots[currentSlot].pending = false;
+    }
+}
+
+void Profiler::beginRegion(VkCommandBuffer cmdBuffer, const char* name, bool statistics) {
+    if (!timestampsSupported) return;
+    
+    FrameSlot& slot = slots[currentSlot];
+    if (slot.queryCount + 2 > maxQueriesPerFrame) {
+        // Out of queries for this frame, keep begin/end balanced anyway.
+        openRegions.push_back(UINT32_MAX);
+        return;
+    }
+    
+    GpuRegion region;
+    region.name = name;
+    region.depth = (uint32_t)openRegions.size();
+    region.beginQuery = slot.queryCount++;
+    region.endQuery = slot.queryCount++;
+    
+    vkCmdWriteTimestamp(cmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool,
+        currentSlot * maxQueriesPerFrame + region.beginQuery);
+    
+    // Queries of one type cannot be nested, only the outermost requesting
+    // region gets pipeline statistics.
+    if (statistics && statisticsSupported && openStatisticsRegion < 0 &&
+            slot.statisticsCount < maxStatisticsPerFrame) {
+        region.statisticsQuery = (int32_t)slot.statisticsCount++;
+        openStatisticsRegion = (int32_t)slot.regions.size();
+        vkCmdBeginQuery(cmdBuffer, statisticsPool,
+            currentSlot * maxStatisticsPerFrame + region.statisticsQuery, 0);
+    }
+    
+    openRegions.push_back((uint32_t)slot.regions.size());
+    slot.regions.push_back(region);
+}
+
+void Profiler::endRegion(VkCommandBuffer cmdBuffer) {
+    if (!timestampsSupported || openRegions.empty()) return;
+    
+    uint32_t index = openRegions.back();
+    openRegions.pop_back();
+    if (index == UINT32_MAX) return;
+    
+    GpuRegion& region = slots[currentSlot].regions[index];
+    
+    if (openStatisticsRegion == (int32_t)index) {
+        vkCmdEndQuery(cmdBuffer, statisticsPool,
+            currentSlot * maxStatisticsPerFrame + region.statisticsQuery);
+        openStatisticsRegion = -1;
+    }
+    
+    vkCmdWriteTimestamp(cmdBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool,
+        currentSlot * maxQueriesPerFrame + region.endQuery);
+}
+
+double Profiler::now() const {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+uint32_t Profiler::getThreadId() {
+    std::thread::id id = std::this_thread::get_id();
+    auto it = threadIds.find(id);
+    if (it != threadIds.end()) return it->second;
+    
+    uint32_t index = (uint32_t)threadIds.size() + 1;
+    threadIds[id] = index;
+    return index;
+}
+
+void Profiler::addEvent(const std::string& name, const char* category, uint32_t thread,
+        double begin, double duration, const std::string& args) {
+    if (events.size() >= maxEvents) return;
+    
+    TraceEvent event;
+    event.name = name;
+    event.category = category;
+    event.thread = thread;
+    event.begin = begin;
+    event.duration = duration;
+    event.args = args;
+    events.push_back(event);
+}
+
+void Profiler::addCpuTime(const char* name, double begin, double end) {
+    std::lock_guard<std::mutex> lock(eventMutex);
+    
+    lastCpuTimes[name] = end - begin;
+    if (tracing) {
+        addEvent(name, "cpu", getThreadId(), begin, end - begin, "");
+    }
+}
+
+void Profiler::addStartupTime(const std::string& name, double begin, double end) {
+    std::lock_guard<std::mutex> lock(eventMutex);
+    
+    addEvent(name, "startup", getThreadId(), begin, end - begin, "");
+}
+
+double Profiler::getLastCpuTime(const std::string& name) {
+    std::lock_guard<std::mutex> lock(eventMutex);
+    
+    auto it = lastCpuTimes.find(name);
+    return it != lastCpuTimes.end() ? it->second : -1.0;
+}
+
+static std::string escapeJson(const std::string& text) {
+    std::string escaped;
+    for (char c: text) {
+        if (c == '"' || c == '\\') escaped += '\\';
+        escaped += c;
+    }
+    return escaped;
+}
+
+bool Profiler::writeChromeTrace(const std::string& path) {
+    std::lock_guard<std::mutex> lock(eventMutex);
+    
+    std::ofstream out(path);
+    if (!out) {
+        std::cout << "Failed to open trace file " << path << std::endl;
+        return false;
+    }
+    
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << std::endl;
+    out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << GPU_THREAD_ID
+        << ", \"args\": {\"name\": \"GPU\"}}";
+    for (const auto& thread: threadIds) {
+        out << "," << std::endl << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << thread.second
+            << ", \"args\": {\"name\": \"CPU " << thread.second << "\"}}";
+    }
+    
+    // Chrome trace timestamps are in microseconds.
+    for (const TraceEvent& event: events) {
+        out << "," << std::endl
+            << "{\"name\": \"" << escapeJson(event.name) << "\", \"cat\": \"" << event.category
+            << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << event.thread
+            << ", \"ts\": " << (uint64_t)(event.begin * 1000.0)
+            << ", \"dur\": " << (uint64_t)(event.duration * 1000.0);
+        if (!event.args.empty()) {
+            out << ", \"args\": {" << event.args << "}";
+        }
+        out << "}";
+    }
+    out << std::endl << "]}" << std::endl;
+    
+    std::cout << "Wrote " << events.size() << " trace events to " << path << std::endl;
+    return (bool)out;
+}
+
+Profiler::CpuScope::CpuScope(Profiler& profiler, const char* name) {
+    this->profiler = &profiler;
+    this->name = name;
+    this->begin = profiler.now();
+}
+
+Profiler::CpuScope::~CpuScope() {
+    profiler->addCpuTime(name, begin, profiler->now());
+}
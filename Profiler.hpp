@@ -0,0 +1,141 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Collects named GPU regions (timestamp pairs, optionally with pipeline
+// statistics) and CPU scopes. GPU results are read back when a frame slot
+// is reused, i.e. framesInFlight frames later, so nothing ever stalls.
+class Profiler {
+    public:
+        static const uint32_t STATISTICS_COUNT = 6;
+        // Counted by statistics regions; secondary command buffers executed
+        // inside one have to inherit them.
+        static const VkQueryPipelineStatisticFlags STATISTICS_FLAGS;
+
+        struct RegionTiming {
+            std::string name;
+            uint32_t depth = 0;
+            double begin = 0.0;         // ms since the frame's first timestamp
+            double duration = 0.0;      // ms
+            bool hasStatistics = false;
+            uint64_t statistics[STATISTICS_COUNT] = {};
+        };
+
+        // RAII helper timing a CPU scope, e.g. Profiler::CpuScope scope(profiler, "update");
+        class CpuScope {
+            private:
+                Profiler* profiler;
+                const char* name;
+                double begin;
+            public:
+                CpuScope(Profiler& profiler, const char* name);
+                ~CpuScope();
+        };
+
+    private:
+        struct GpuRegion {
+            std::string name;
+            uint32_t depth = 0;
+            uint32_t beginQuery = 0;
+            uint32_t endQuery = 0;
+            int32_t statisticsQuery = -1;
+        };
+
+        struct FrameSlot {
+            std::vector<GpuRegion> regions;
+            uint32_t queryCount = 0;
+            uint32_t statisticsCount = 0;
+            double submitTime = 0.0;
+            bool pending = false;
+        };
+
+        struct TraceEvent {
+            std::string name;
+            const char* category;
+            uint32_t thread;
+            double begin;       // ms since the profiler was created
+            double duration;    // ms
+            std::string args;
+        };
+
+        VkDevice device = VK_NULL_HANDLE;
+
+        bool timestampsSupported = false;
+        bool statisticsSupported = false;
+        uint64_t timestampMask = 0;
+        float timestampPeriod = 1.0f;
+
+        uint32_t maxQueriesPerFrame = 128;
+        uint32_t maxStatisticsPerFrame = 16;
+        VkQueryPool timestampPool = VK_NULL_HANDLE;
+        VkQueryPool statisticsPool = VK_NULL_HANDLE;
+
+        std::vector<FrameSlot> slots = {};
+        uint32_t currentSlot = 0;
+        std::vector<uint32_t> openRegions = {};
+        int32_t openStatisticsRegion = -1;
+
+        std::vector<RegionTiming> lastGpuRegions = {};
+        double lastGpuFrameTime = -1.0;
+
+        std::chrono::steady_clock::time_point epoch;
+
+        std::mutex eventMutex;
+        std::map<std::string, double> lastCpuTimes = {};
+        std::map<std::thread::id, uint32_t> threadIds = {};
+        std::vector<TraceEvent> events = {};
+        size_t maxEvents = 1 << 20;
+        bool tracing = false;
+
+        // Both with eventMutex held, CpuScopes end on worker threads too.
+        uint32_t getThreadId();
+        void addEvent(const std::string& name, const char* category, uint32_t thread,
+            double begin, double duration, const std::string& args);
+
+    public:
+        Profiler();
+
+        bool init(VkPhysicalDevice gpu, VkDevice device, uint32_t queueFamilyIndex,
+            uint32_t framesInFlight, bool pipelineStatistics);
+        void destroy();
+
+        // Reads back the previous contents of the slot (its fence must have been
+        // waited on) and resets its queries into cmdBuffer.
+        void beginFrame(VkCommandBuffer cmdBuffer, uint32_t frameIndex);
+        void endFrame();
+
+        void beginRegion(VkCommandBuffer cmdBuffer, const char* name, bool statistics = false);
+        void endRegion(VkCommandBuffer cmdBuffer);
+
+        double now() const;
+        void addCpuTime(const char* name, double begin, double end);
+        // Start-up tasks are traced whether or not tracing is enabled, they
+        // happen before anyone could have enabled it.
+        void addStartupTime(const std::string& name, double begin, double end);
+
+        // Trace events are only kept while tracing is enabled.
+        void setTracing(bool enabled) {
+            tracing = enabled;
+        }
+        bool writeChromeTrace(const std::string& path);
+
+        bool hasStatistics() const {
+            return statisticsSupported;
+        }
+        double getLastGpuFrameTime() const {
+            return lastGpuFrameTime;
+        }
+        const std::vector<RegionTiming>& getLastGpuRegions() const {
+            return lastGpuRegions;
+        }
+        double getLastCpuTime(const std::string& name);
+
+        static const char* getStatisticName(uint32_t index);
+};
@@ -0,0 +1,548 @@
+#include "RenderGraph.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+struct AccessInfo {
+    VkPipelineStageFlags stages;
+    VkAccessFlags access;
+    VkImageLayout layout;       // for images, ignored for buffers
+    bool write;
+};
+
+static const AccessInfo ACCESS_INFO[RenderGraph::ACCESS_COUNT] {
+    { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, false },
+    { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, true },
+    { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false },
+    { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+        VK_IMAGE_LAYOUT_GENERAL, true },
+    { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        VK_IMAGE_LAYOUT_GENERAL, true },
+    { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED, false },
+    { VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT,
+        VK_IMAGE_LAYOUT_UNDEFINED, false },
+    { VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false },
+    { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false },
+    { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true },
+    { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+        VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, true },
+    { VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT,
+        VK_IMAGE_LAYOUT_GENERAL, false },
+    { VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+        VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, false }
+};
+
+static const VkAccessFlags WRITE_ACCESS = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT |
+    VK_ACCESS_MEMORY_WRITE_BIT;
+
+bool RenderGraph::init(VkDevice device, Allocator& allocator) {
+    this->device = device;
+    this->allocator = &allocator;
+    return true;
+}
+
+void RenderGraph::destroy() {
+    destroyTransients();
+    resources.clear();
+    passes.clear();
+    declared.clear();
+}
+
+void RenderGraph::destroyTransients() {
+    for (TransientImage& transient: transients) {
+        if (transient.view != VK_NULL_HANDLE) {
+            vkDestroyImageView(device, transient.view, NULL);
+        }
+        if (transient.image != VK_NULL_HANDLE) {
+            vkDestroyImage(device, transient.image, NULL);
+        }
+    }
+    for (Slot& slot: slots) {
+        allocator->free(slot.allocation);
+    }
+    transients.clear();
+    slots.clear();
+}
+
+void RenderGraph::begin() {
+    resources.clear();
+    passes.clear();
+    declared.clear();
+}
+
+RenderGraph::Resource RenderGraph::importBuffer(const std::string& name) {
+    ResourceEntry entry;
+    entry.name = name;
+    entry.kind = KIND_BUFFER;
+    // Whatever used the buffer before the graph was declared is waited for
+    // once by the first access.
+    entry.state.writeStages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    entry.state.writeAccess = VK_ACCESS_MEMORY_WRITE_BIT;
+    resources.push_back(entry);
+    return (Resource)resources.size() - 1;
+}
+
+RenderGraph::Resource RenderGraph::importImage(const std::string& name, VkImageAspectFlags aspects) {
+    ResourceEntry entry;
+    entry.name = name;
+    entry.kind = KIND_IMAGE;
+    entry.aspects = aspects;
+    resources.push_back(entry);
+    return (Resource)resources.size() - 1;
+}
+
+RenderGraph::Resource RenderGraph::createImage(const std::string& name, const ImageDesc& desc) {
+    TransientImage transient;
+    transient.name = name;
+    transient.desc = desc;
+    declared.push_back(transient);
+
+    ResourceEntry entry;
+    entry.name = name;
+    entry.kind = KIND_TRANSIENT;
+    entry.aspects = desc.aspects;
+    entry.transient = (uint32_t)declared.size() - 1;
+    resources.push_back(entry);
+    return (Resource)resources.size() - 1;
+}
+
+RenderGraph::Pass RenderGraph::addPass(const std::string& name, std::function<void(VkCommandBuffer)> record,
+        Queue queue) {
+    PassEntry pass;
+    pass.name = name;
+    pass.record = record;
+    pass.queue = queue;
+    passes.push_back(pass);
+    return (Pass)passes.size() - 1;
+}
+
+void RenderGraph::read(Pass pass, Resource resource, Access access) {
+    passes[pass].accesses.push_back(PassAccess { resource, access });
+}
+
+void RenderGraph::write(Pass pass, Resource resource, Access access) {
+    passes[pass].accesses.push_back(PassAccess { resource, access });
+}
+
+void RenderGraph::setOutput(Resource resource, Access finalAccess) {
+    resources[resource].output = true;
+    resources[resource].finalAccess = finalAccess;
+}
+
+// Walks the passes backwards from the outputs. Writes are not assumed to
+// cover the whole resource, so a later writer never hides an earlier one.
+void RenderGraph::cullPasses() {
+    std::vector<uint8_t> needed(resources.size(), 0);
+    for (size_t i = 0; i < resources.size(); ++i) {
+        needed[i] = resources[i].output;
+    }
+
+    stats.passes = (uint32_t)passes.size();
+    stats.culledPasses = 0;
+    for (size_t p = passes.size(); p-- > 0;) {
+        PassEntry& pass = passes[p];
+        pass.live = false;
+        for (const PassAccess& access: pass.accesses) {
+            if (ACCESS_INFO[access.access].write && needed[access.resource]) {
+                pass.live = true;
+            }
+        }
+        if (!pass.live) {
+            stats.culledPasses++;
+            continue;
+        }
+        for (const PassAccess& access: pass.accesses) {
+            if (!ACCESS_INFO[access.access].write || (ACCESS_INFO[access.access].access & ~WRITE_ACCESS)) {
+                needed[access.resource] = 1;
+            }
+        }
+    }
+}
+
+bool RenderGraph::compile() {
+    cullPasses();
+
+    // Lifetimes in live passes; transients nothing live touches get none
+    // and take no memory.
+    for (TransientImage& transient: declared) {
+        transient.firstPass = UINT32_MAX;
+        transient.lastPass = 0;
+    }
+    for (uint32_t p = 0; p < passes.size(); ++p) {
+        if (!passes[p].live) continue;
+        for (const PassAccess& access: passes[p].accesses) {
+            const ResourceEntry& entry = resources[access.resource];
+            if (entry.kind != KIND_TRANSIENT) continue;
+            TransientImage& transient = declared[entry.transient];
+            transient.firstPass = std::min(transient.firstPass, p);
+            transient.lastPass = std::max(transient.lastPass, p);
+        }
+    }
+
+    // The images from the last compile stay if nothing about them changed.
+    bool same = declared.size() == transients.size();
+    for (size_t i = 0; same && i < declared.size(); ++i) {
+        const ImageDesc& a = declared[i].desc;
+        const ImageDesc& b = transients[i].desc;
+        same = declared[i].name == transients[i].name && a.format == b.format &&
+            a.extent.width == b.extent.width && a.extent.height == b.extent.height &&
+            a.usage == b.usage && a.aspects == b.aspects &&
+            declared[i].firstPass == transients[i].firstPass && declared[i].lastPass == transients[i].lastPass;
+    }
+    if (same) return true;
+
+    if (!transients.empty()) {
+        vkDeviceWaitIdle(device);
+        destroyTransients();
+    }
+    transients = declared;
+    generation++;
+    return allocateTransients();
+}
+
+bool RenderGraph::allocateTransients() {
+    VkResult result;
+
+    stats.transientImages = 0;
+    stats.transientBytes = 0;
+    stats.allocatedBytes = 0;
+    stats.lazySlots = 0;
+
+    for (TransientImage& transient: transients) {
+        if (transient.firstPass == UINT32_MAX) continue;
+
+        VkImageCreateInfo imageCreateInfo {};
+        imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageCreateInfo.format = transient.desc.format;
+        imageCreateInfo.extent.width = transient.desc.extent.width;
+        imageCreateInfo.extent.height = transient.desc.extent.height;
+        imageCreateInfo.extent.depth = 1;
+        imageCreateInfo.mipLevels = 1;
+        imageCreateInfo.arrayLayers = 1;
+        imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageCreateInfo.usage = transient.desc.usage;
+        imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        result = vkCreateImage(device, &imageCreateInfo, NULL, &transient.image);
+        if (result != VK_SUCCESS) {
+            std::cout << "Failed to create transient image " << transient.name << std::endl;
+            return false;
+        }
+        vkGetImageMemoryRequirements(device, transient.image, &transient.requirements);
+        stats.transientImages++;
+        stats.transientBytes += transient.requirements.size;
+    }
+
+    // Largest first, each into the first slot whose images are all dead
+    // while it lives and whose memory types it can use.
+    std::vector<uint32_t> order;
+    for (uint32_t i = 0; i < transients.size(); ++i) {
+        if (transients[i].image != VK_NULL_HANDLE) order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return transients[a].requirements.size > transients[b].requirements.size;
+    });
+
+    std::vector<std::vector<uint32_t>> slotImages;
+    for (uint32_t index: order) {
+        TransientImage& transient = transients[index];
+        bool transientUsage = (transient.desc.usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) != 0;
+
+        uint32_t slot = 0;
+        for (; slot < slots.size(); ++slot) {
+            if (!(slots[slot].requirements.memoryTypeBits & transient.requirements.memoryTypeBits)) continue;
+            // Lazily allocated memory only takes transient attachments.
+            if (slots[slot].lazy != transientUsage) continue;
+
+            bool overlaps = false;
+            for (uint32_t other: slotImages[slot]) {
+                if (transient.firstPass <= transients[other].lastPass && transients[other].firstPass <= transient.lastPass) {
+                    overlaps = true;
+                    break;
+                }
+            }
+            if (!overlaps) break;
+        }
+
+        if (slot == slots.size()) {
+            Slot newSlot;
+            newSlot.requirements = transient.requirements;
+            newSlot.lazy = transientUsage;
+            slots.push_back(newSlot);
+            slotImages.push_back(std::vector<uint32_t>());
+        } else {
+            VkMemoryRequirements& requirements = slots[slot].requirements;
+            requirements.size = std::max(requirements.size, transient.requirements.size);
+            requirements.alignment = std::max(requirements.alignment, transient.requirements.alignment);
+            requirements.memoryTypeBits &= transient.requirements.memoryTypeBits;
+        }
+        transient.slot = slot;
+        slotImages[slot].push_back(index);
+    }
+
+    for (Slot& slot: slots) {
+        Allocator::Usage usage = slot.lazy ? Allocator::GPU_LAZY : Allocator::GPU_ONLY;
+        if (!allocator->allocate(slot.requirements, usage, false, slot.allocation)) {
+            std::cout << "Failed to allocate transient memory" << std::endl;
+            return false;
+        }
+        // GPU_LAZY falls back to ordinary device memory.
+        slot.lazy = allocator->isLazilyAllocated(slot.allocation);
+        stats.allocatedBytes += slot.requirements.size;
+        if (slot.lazy) stats.lazySlots++;
+    }
+    stats.memorySlots = (uint32_t)slots.size();
+
+    for (TransientImage& transient: transients) {
+        if (transient.image == VK_NULL_HANDLE) continue;
+
+        const Allocation& allocation = slots[transient.slot].allocation;
+        result = vkBindImageMemory(device, transient.image, allocation.memory, allocation.offset);
+        if (result != VK_SUCCESS) {
+            std::cout << "Failed to bind transient image " << transient.name << std::endl;
+            return false;
+        }
+
+        VkImageViewCreateInfo imageViewCreateInfo {};
+        imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        imageViewCreateInfo.image = transient.image;
+        imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        imageViewCreateInfo.format = transient.desc.format;
+        imageViewCreateInfo.subresourceRange.aspectMask = transient.desc.aspects;
+        imageViewCreateInfo.subresourceRange.baseMipLevel = 0;
+        imageViewCreateInfo.subresourceRange.levelCount = 1;
+        imageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
+        imageViewCreateInfo.subresourceRange.layerCount = 1;
+
+        result = vkCreateImageView(device, &imageViewCreateInfo, NULL, &transient.view);
+        if (result != VK_SUCCESS) {
+            std::cout << "Failed to create transient image view " << transient.name << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void RenderGraph::setBuffer(Resource resource, VkBuffer buffer) {
+    resources[resource].buffer = buffer;
+}
+
+void RenderGraph::setImage(Resource resource, VkImage image, VkPipelineStageFlags stages) {
+    ResourceEntry& entry = resources[resource];
+    entry.image = image;
+    entry.state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    entry.state.writeStages = stages;
+    entry.state.writeAccess = 0;
+    entry.state.readers.clear();
+}
+
+void RenderGraph::setPassEnabled(Pass pass, bool enabled) {
+    passes[pass].enabled = enabled;
+}
+
+VkImageView RenderGraph::getImageView(Resource resource) const {
+    const ResourceEntry& entry = resources[resource];
+    if (entry.kind != KIND_TRANSIENT) return VK_NULL_HANDLE;
+    return transients[entry.transient].view;
+}
+
+RenderGraph::State& RenderGraph::getState(Resource resource) {
+    ResourceEntry& entry = resources[resource];
+    if (entry.kind == KIND_TRANSIENT) {
+        return slots[transients[entry.transient].slot].state;
+    }
+    return entry.state;
+}
+
+void RenderGraph::addAccess(Batch& batch, Resource resource, Access access, Queue queue) {
+    const AccessInfo& info = ACCESS_INFO[access];
+    ResourceEntry& entry = resources[resource];
+    State& state = getState(resource);
+
+    // The semaphore between the queues made every earlier access available
+    // and visible, and waited for it to finish.
+    if (state.queue != queue) {
+        state.writeStages = 0;
+        state.writeAccess = 0;
+        state.readers.clear();
+        state.queue = queue;
+    }
+
+    // Host reads are ordered by the frame's fence, nothing on the device
+    // has to wait for them.
+    VkPipelineStageFlags readStages = 0;
+    for (const std::pair<VkPipelineStageFlags, VkAccessFlags>& reader: state.readers) {
+        readStages |= reader.first;
+    }
+    readStages &= ~VK_PIPELINE_STAGE_HOST_BIT;
+
+    // A transient starts undefined in every frame, after whatever last used
+    // its memory: itself a frame ago or an image aliasing it.
+    bool discard = entry.kind == KIND_TRANSIENT && !entry.usedThisFrame;
+    entry.usedThisFrame = true;
+
+    if (entry.kind != KIND_BUFFER && (discard || state.layout != info.layout)) {
+        VkImageMemoryBarrier imageBarrier {};
+        imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        imageBarrier.srcAccessMask = state.writeAccess;
+        imageBarrier.dstAccessMask = info.access;
+        imageBarrier.oldLayout = discard ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout;
+        imageBarrier.newLayout = info.layout;
+        imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.image = entry.kind == KIND_TRANSIENT ? transients[entry.transient].image : entry.image;
+        imageBarrier.subresourceRange.aspectMask = entry.aspects;
+        imageBarrier.subresourceRange.baseMipLevel = 0;
+        imageBarrier.subresourceRange.levelCount = 1;
+        imageBarrier.subresourceRange.baseArrayLayer = 0;
+        imageBarrier.subresourceRange.layerCount = 1;
+        batch.images.push_back(imageBarrier);
+        batch.srcStages |= state.writeStages | readStages;
+        batch.dstStages |= info.stages;
+
+        // The transition is a write later accesses have to wait for.
+        state.layout = info.layout;
+        state.writeStages = info.stages;
+        state.writeAccess = info.access & WRITE_ACCESS;
+        state.readers.clear();
+        if (!info.write) {
+            state.readers.push_back(std::make_pair(info.stages, info.access));
+        }
+        return;
+    }
+
+    if (info.write) {
+        if (readStages != 0) {
+            // Write after read only needs the readers to be done, they
+            // already waited for the previous write.
+            batch.srcStages |= readStages;
+            batch.dstStages |= info.stages;
+        } else if (state.writeStages != 0) {
+            batch.srcStages |= state.writeStages;
+            batch.srcAccess |= state.writeAccess;
+            batch.dstStages |= info.stages;
+            batch.dstAccess |= info.access;
+        }
+        state.writeStages = info.stages;
+        state.writeAccess = info.access & WRITE_ACCESS;
+        state.readers.clear();
+        return;
+    }
+
+    if (state.writeStages != 0) {
+        for (const std::pair<VkPipelineStageFlags, VkAccessFlags>& reader: state.readers) {
+            if ((reader.first & info.stages) == info.stages && (reader.second & info.access) == info.access) return;
+        }
+        batch.srcStages |= state.writeStages;
+        batch.srcAccess |= state.writeAccess;
+        batch.dstStages |= info.stages;
+        batch.dstAccess |= info.access;
+    }
+    state.readers.push_back(std::make_pair(info.stages, info.access));
+}
+
+void RenderGraph::flush(VkCommandBuffer cmdBuffer, Batch& batch) {
+    if (batch.srcStages == 0 && batch.images.empty()) return;
+
+    VkMemoryBarrier memoryBarrier {};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = batch.srcAccess;
+    memoryBarrier.dstAccessMask = batch.dstAccess;
+    uint32_t memoryBarrierCount = batch.srcAccess != 0 ? 1 : 0;
+
+    // Stage masks may not be empty; a transition out of nothing waits on
+    // the top of the pipe, and one into nothing blocks no later stage.
+    VkPipelineStageFlags srcStages = batch.srcStages != 0 ? batch.srcStages :
+        (VkPipelineStageFlags)VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    VkPipelineStageFlags dstStages = batch.dstStages != 0 ? batch.dstStages :
+        (VkPipelineStageFlags)VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+
+    vkCmdPipelineBarrier(cmdBuffer, srcStages, dstStages, 0, memoryBarrierCount, &memoryBarrier, 0, NULL, (uint32_t)batch.images.size(), batch.images.data());
+
+    stats.barrierCalls++;
+    stats.memoryBarriers += memoryBarrierCount;
+    stats.imageBarriers += (uint32_t)batch.images.size();
+
+    batch.srcStages = 0;
+    batch.dstStages = 0;
+    batch.srcAccess = 0;
+    batch.dstAccess = 0;
+    batch.images.clear();
+}
+
+void RenderGraph::execute(VkCommandBuffer cmdBuffer, Profiler* profiler) {
+    beginFrame();
+    execute(cmdBuffer, 0, (Pass)passes.size(), profiler);
+}
+
+void RenderGraph::beginFrame() {
+    stats.barrierCalls = 0;
+    stats.memoryBarriers = 0;
+    stats.imageBarriers = 0;
+    for (ResourceEntry& entry: resources) {
+        entry.usedThisFrame = false;
+    }
+}
+
+void RenderGraph::execute(VkCommandBuffer cmdBuffer, Pass begin, Pass end, Profiler* profiler) {
+    // Every range runs on one queue, the one of its first running pass.
+    Queue queue = QUEUE_GRAPHICS;
+    for (Pass p = end; p > begin; --p) {
+        if (passes[p - 1].live && passes[p - 1].enabled) {
+            queue = passes[p - 1].queue;
+        }
+    }
+
+    for (Pass p = begin; p < end; ++p) {
+        PassEntry& pass = passes[p];
+        if (!pass.live || !pass.enabled) continue;
+
+        if (profiler != NULL) profiler->beginRegion(cmdBuffer, pass.name.c_str());
+        for (const PassAccess& access: pass.accesses) {
+            addAccess(batch, access.resource, access.access, queue);
+        }
+        flush(cmdBuffer, batch);
+        pass.record(cmdBuffer);
+        if (profiler != NULL) profiler->endRegion(cmdBuffer);
+    }
+
+    // An output is finished in the range of the last running pass that
+    // uses it, or in the last range if none does.
+    std::vector<Pass> lastUse(resources.size(), (Pass)passes.size() - 1);
+    for (Pass p = 0; p < passes.size(); ++p) {
+        if (!passes[p].live || !passes[p].enabled) continue;
+        for (const PassAccess& access: passes[p].accesses) {
+            lastUse[access.resource] = p;
+        }
+    }
+
+    for (Resource i = 0; i < resources.size(); ++i) {
+        if (resources[i].output && resources[i].finalAccess != ACCESS_COUNT &&
+                lastUse[i] >= begin && lastUse[i] < end) {
+            addAccess(batch, i, resources[i].finalAccess, queue);
+        }
+    }
+    flush(cmdBuffer, batch);
+}
+
+void RenderGraph::printStats() const {
+    std::cout << "Render graph: " << stats.passes - stats.culledPasses << " of " << stats.passes << " passes live, "
+              << stats.transientImages << " transient images of " << stats.transientBytes << " bytes in "
+              << stats.memorySlots << " memory slots of " << stats.allocatedBytes << " bytes ("
+              << stats.transientBytes - stats.allocatedBytes << " saved by aliasing, "
+              << stats.lazySlots << " lazily allocated)" << std::endl;
+}
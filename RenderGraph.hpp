@@ -0,0 +1,232 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Allocator.hpp"
+#include "Profiler.hpp"
+
+// Frame graph over one command buffer. Passes declare how they access
+// buffers and images; the graph drops passes nothing depends on and inserts
+// one merged barrier in front of every pass with exactly the stages,
+// accesses and layout transitions the declared hazards need.
+//
+// The graph is declared between begin() and compile() whenever the frame's
+// structure changes, and executed every frame. Resource state carries over
+// from frame to frame, so barriers against the previous frame's accesses on
+// the same queue come out right as well.
+//
+// Transient images live for one frame only. Images whose lifetimes do not
+// overlap share memory, which is lazily allocated where the device has it.
+//
+// Passes may run on a second queue. The frame is then executed in ranges of
+// passes, one command buffer per range, and the caller orders the ranges
+// with semaphores whose waits cover all commands. A resource accessed on
+// another queue than last time gets no barrier; it is taken to be
+// synchronized by those semaphores. Resources shared by queue families
+// have to be created concurrent.
+class RenderGraph {
+    public:
+        typedef uint32_t Resource;
+        typedef uint32_t Pass;
+        static const Resource INVALID_RESOURCE = UINT32_MAX;
+
+        enum Access {
+            ACCESS_TRANSFER_READ,
+            ACCESS_TRANSFER_WRITE,
+            ACCESS_COMPUTE_READ,
+            ACCESS_COMPUTE_WRITE,
+            ACCESS_COMPUTE_READ_WRITE,
+            ACCESS_INDIRECT_READ,
+            ACCESS_VERTEX_INPUT_READ,
+            ACCESS_VERTEX_SHADER_READ,
+            ACCESS_FRAGMENT_SHADER_READ,
+            ACCESS_COLOR_ATTACHMENT_WRITE,
+            ACCESS_DEPTH_ATTACHMENT_WRITE,
+            ACCESS_HOST_READ,
+            ACCESS_PRESENT,
+            ACCESS_COUNT
+        };
+
+        enum Queue {
+            QUEUE_GRAPHICS,
+            QUEUE_COMPUTE
+        };
+
+        struct ImageDesc {
+            VkFormat format = VK_FORMAT_UNDEFINED;
+            VkExtent2D extent = {};
+            VkImageUsageFlags usage = 0;
+            VkImageAspectFlags aspects = 0;
+        };
+
+        struct Stats {
+            uint32_t passes = 0;
+            uint32_t culledPasses = 0;
+            uint32_t transientImages = 0;
+            VkDeviceSize transientBytes = 0;    // sum of the transient images
+            VkDeviceSize allocatedBytes = 0;    // memory actually bound to them
+            uint32_t lazySlots = 0;
+            uint32_t memorySlots = 0;
+
+            // Of the last execute().
+            uint32_t barrierCalls = 0;
+            uint32_t memoryBarriers = 0;
+            uint32_t imageBarriers = 0;
+        };
+
+    private:
+        // Synchronization state of a resource, or of a memory slot shared by
+        // transient images. readers are (stages, accesses) that already
+        // waited for the last write.
+        struct State {
+            VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+            VkPipelineStageFlags writeStages = 0;
+            VkAccessFlags writeAccess = 0;
+            std::vector<std::pair<VkPipelineStageFlags, VkAccessFlags>> readers = {};
+            Queue queue = QUEUE_GRAPHICS;
+        };
+
+        enum Kind {
+            KIND_BUFFER,
+            KIND_IMAGE,
+            KIND_TRANSIENT
+        };
+
+        struct ResourceEntry {
+            std::string name;
+            Kind kind = KIND_BUFFER;
+            VkImageAspectFlags aspects = 0;
+            VkBuffer buffer = VK_NULL_HANDLE;
+            VkImage image = VK_NULL_HANDLE;
+            uint32_t transient = 0;
+            bool output = false;
+            Access finalAccess = ACCESS_COUNT;
+            bool usedThisFrame = false;
+            State state;
+        };
+
+        struct PassAccess {
+            Resource resource;
+            Access access;
+        };
+
+        struct PassEntry {
+            std::string name;
+            std::function<void(VkCommandBuffer)> record;
+            std::vector<PassAccess> accesses = {};
+            Queue queue = QUEUE_GRAPHICS;
+            bool live = false;
+            bool enabled = true;
+        };
+
+        struct TransientImage {
+            std::string name;
+            ImageDesc desc;
+            VkImage image = VK_NULL_HANDLE;
+            VkImageView view = VK_NULL_HANDLE;
+            VkMemoryRequirements requirements = {};
+            uint32_t slot = 0;
+            uint32_t firstPass = UINT32_MAX;
+            uint32_t lastPass = 0;
+        };
+
+        struct Slot {
+            Allocation allocation = {};
+            VkMemoryRequirements requirements = {};
+            bool lazy = false;
+            State state;
+        };
+
+        // Barriers gathered for one pass, recorded as one call.
+        struct Batch {
+            VkPipelineStageFlags srcStages = 0;
+            VkPipelineStageFlags dstStages = 0;
+            VkAccessFlags srcAccess = 0;
+            VkAccessFlags dstAccess = 0;
+            std::vector<VkImageMemoryBarrier> images = {};
+        };
+
+        VkDevice device = VK_NULL_HANDLE;
+        Allocator* allocator = NULL;
+
+        std::vector<ResourceEntry> resources = {};
+        std::vector<PassEntry> passes = {};
+        std::vector<TransientImage> declared = {};
+        std::vector<TransientImage> transients = {};
+        std::vector<Slot> slots = {};
+        uint32_t generation = 0;
+        Batch batch;
+        Stats stats;
+
+        void cullPasses();
+        bool allocateTransients();
+        void destroyTransients();
+        State& getState(Resource resource);
+        void addAccess(Batch& batch, Resource resource, Access access, Queue queue);
+        void flush(VkCommandBuffer cmdBuffer, Batch& batch);
+
+    public:
+        bool init(VkDevice device, Allocator& allocator);
+        void destroy();
+
+        // Starts a new declaration. Transient images are kept if the next
+        // compile() declares and aliases them the same way.
+        void begin();
+
+        Resource importBuffer(const std::string& name);
+        Resource importImage(const std::string& name, VkImageAspectFlags aspects);
+        Resource createImage(const std::string& name, const ImageDesc& desc);
+
+        Pass addPass(const std::string& name, std::function<void(VkCommandBuffer)> record,
+            Queue queue = QUEUE_GRAPHICS);
+        void read(Pass pass, Resource resource, Access access);
+        void write(Pass pass, Resource resource, Access access);
+
+        // Passes contributing to an output are kept; at the end of every
+        // frame the output is made available for finalAccess.
+        void setOutput(Resource resource, Access finalAccess);
+
+        // Culls passes and places the transient images. When the images
+        // have to be created again this waits for the device to go idle.
+        bool compile();
+
+        // Per frame, before execute().
+        void setBuffer(Resource resource, VkBuffer buffer);
+        // The image's contents are discarded; stages are the ones its
+        // previous use is synchronized with, e.g. the acquire semaphore's.
+        void setImage(Resource resource, VkImage image, VkPipelineStageFlags stages);
+        // Disabled passes record nothing and are left out of the barriers.
+        void setPassEnabled(Pass pass, bool enabled);
+
+        // Records every live, enabled pass in declaration order, each in a
+        // profiler region of its name when a profiler is given.
+        void execute(VkCommandBuffer cmdBuffer, Profiler* profiler = NULL);
+
+        // The same split into ranges [begin, end) of passes on one queue,
+        // executed in order after beginFrame(). An output is made available
+        // for its final access in the range of the last pass using it.
+        void beginFrame();
+        void execute(VkCommandBuffer cmdBuffer, Pass begin, Pass end, Profiler* profiler = NULL);
+        uint32_t getPassCount() const {
+            return (uint32_t)passes.size();
+        }
+
+        VkImageView getImageView(Resource resource) const;
+        // Changes whenever compile() recreated the transient images.
+        uint32_t getGeneration() const {
+            return generation;
+        }
+        bool isPassLive(Pass pass) const {
+            return passes[pass].live;
+        }
+
+        const Stats& getStats() const {
+            return stats;
+        }
+        void printStats() const;
+};
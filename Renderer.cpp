@@ -1,11 +1,18 @@
 #include "Renderer.hpp"
+#include "MeshOptimizer.hpp"
+#include "VulkanError.hpp"
 #include <iostream>
 
 #include <vector>
 #include <vulkan/vulkan.h>
 #include <GLFW/glfw3.h>
 
+#include <algorithm>
 #include <climits>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
 #include <string>
 
 static const float g_vertex_buffer_data[] = {
@@ -52,555 +59,2766 @@ static const float g_vertex_buffer_data[] = {
      1.0f, 1.0f, 1.0f,
 };
 
-std::string Renderer::getVulkanErrorString(VkResult result) {
-    switch(result) {
-        case VK_ERROR_OUT_OF_HOST_MEMORY: 
-            return "VK_ERROR_OUT_OF_HOST_MEMORY"; 
-            break;
-        case VK_ERROR_OUT_OF_DEVICE_MEMORY: 
-            return "VK_ERROR_OUT_OF_DEVICE_MEMORY"; 
-            break;
-        case VK_ERROR_INITIALIZATION_FAILED: 
-            return "VK_ERROR_INITIALIZATION_FAILED"; 
-            break;
-        case VK_ERROR_DEVICE_LOST: 
-            return "VK_ERROR_DEVICE_LOST"; 
-            break;
-        case VK_ERROR_MEMORY_MAP_FAILED: 
-            return "VK_ERROR_MEMORY_MAP_FAILED"; 
-            break;
-        case VK_ERROR_LAYER_NOT_PRESENT: 
-            return "VK_ERROR_LAYER_NOT_PRESENT"; 
-            break;
-        case VK_ERROR_EXTENSION_NOT_PRESENT: 
-            return "VK_ERROR_EXTENSION_NOT_PRESENT"; 
-            break;
-        case VK_ERROR_FEATURE_NOT_PRESENT: 
-            return "VK_ERROR_FEATURE_NOT_PRESENT"; 
-            break;
-        case VK_ERROR_INCOMPATIBLE_DRIVER: 
-            return "VK_ERROR_INCOMPATIBLE_DRIVER"; 
-            break;
-        case VK_ERROR_TOO_MANY_OBJECTS: 
-            return "VK_ERROR_TOO_MANY_OBJECTS"; 
-            break;
-        case VK_ERROR_FORMAT_NOT_SUPPORTED: 
-            return "VK_ERROR_FORMAT_NOT_SUPPORTED"; 
-            break;
-        default: 
-            return "No error, code: " +  std::to_string(result);
+float test = 0.0f;
+
+// Draw
+void Renderer::pollEvents() {
+    if (commandStream.isRecording()) {
+        commandStream.record(CommandStream::OP_POLL_EVENTS);
+    }
+    
+    if (!software) {
+        Profiler::CpuScope waitScope(profiler, "frame_wait");
+        vkWaitForFences(device, 1, &frames[currentFrame].fence, VK_TRUE, UINT64_MAX);
     }
+    {
+        Profiler::CpuScope paceScope(profiler, "pace");
+        pacer.wait();
+    }
+    if (window != NULL) {
+        // Nothing is drawn to a minimized window, wait for it to come back
+        // rather than spin.
+        if (swapchainStale) {
+            glfwWaitEvents();
+        } else {
+            glfwPollEvents();
+        }
+    }
+    pacer.markInput();
 }
 
-float test = 0.0f;
+bool Renderer::setPresentPolicy(const PresentPolicy& policy) {
+    bool swapchainChanged = policy.mode != presentPolicy.mode || policy.imageCount != presentPolicy.imageCount;
+    presentPolicy = policy;
+    pacer.setTargetFps(policy.targetFps);
+    
+    if (headless || software || !swapchainChanged) return true;
+    
+    waitReady();
+    return recreateSwapchain();
+}
+
+const char* Renderer::getPresentModeName(VkPresentModeKHR mode) {
+    switch (mode) {
+        case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+        case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+        case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+        case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo_relaxed";
+        default: break;
+    }
+    return "unknown";
+}
+
+bool Renderer::parsePresentMode(const char* name, VkPresentModeKHR& mode) {
+    const VkPresentModeKHR modes[] {
+        VK_PRESENT_MODE_IMMEDIATE_KHR,
+        VK_PRESENT_MODE_MAILBOX_KHR,
+        VK_PRESENT_MODE_FIFO_KHR,
+        VK_PRESENT_MODE_FIFO_RELAXED_KHR
+    };
+    for (VkPresentModeKHR candidate: modes) {
+        if (strcmp(name, getPresentModeName(candidate)) == 0) {
+            mode = candidate;
+            return true;
+        }
+    }
+    return false;
+}
 
-// Draw
 void Renderer::draw() {
     VkResult result;
+    
+    Profiler::CpuScope drawScope(profiler, "draw");
+    if (commandStream.isRecording()) {
+        commandStream.record(CommandStream::OP_DRAW);
+    }
+    
+    if (software) {
+        drawSoftware();
+        return;
+    }
+    
+    if (swapchainStale) {
+        waitReady();
+        if (!recreateSwapchain() || swapchainStale) return;
+    }
+    
+    bool async = isAsyncFrame();
+    if ((cullingMode != renderGraphMode || async != renderGraphAsync) && !buildRenderGraph()) return;
+    
+    FrameData& frame = frames[currentFrame];
+    
+    // Only wait for the GPU to finish the frame that last used this slot,
+    // the other frames in flight keep executing meanwhile.
+    {
+        Profiler::CpuScope waitScope(profiler, "fence_wait");
+        vkWaitForFences(device, 1, &frame.fence, VK_TRUE, UINT64_MAX);
+    }
+    
+    destroyRetiredBuffers(frame);
+    streamer.update(currentFrame);
+    capture.collect(currentFrame);
+    if (!writeFrameDescriptors(frame)) return;
+    
+    if (cullingMode == CULLING_GPU) {
+        gpuVisibleInstances = ((const uint32_t*)visibleCountBufferMemory.mapped)[currentFrame];
+    }
 
     VkCommandBufferBeginInfo beginInfo {};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     
-    result = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX,
-                                    (VkSemaphore)0,
-                                    fence,
-                                    &currentImage);
-    
-    if (result != VK_SUCCESS) {
-        std::cout << "Failed to create AcquireNextImage: " << getVulkanErrorString(result) << std::endl;
+    // A suboptimal swapchain still presents, it is replaced after this
+    // frame. An out of date one cannot; the frame is dropped.
+    bool suboptimal = false;
+    if (headless) {
+        // Each frame slot owns one offscreen target, the fence wait above
+        // already guarantees it is no longer in use.
+        currentImage = currentFrame;
+    } else {
+        Profiler::CpuScope acquireScope(profiler, "acquire");
+        result = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX,
+                                        frame.imageAcquired,
+                                        VK_NULL_HANDLE,
+                                        &currentImage);
+        
+        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+            waitReady();
+            recreateSwapchain();
+            return;
+        }
+        suboptimal = result == VK_SUBOPTIMAL_KHR;
+        if (result != VK_SUCCESS && !suboptimal) {
+            std::cout << "Failed to create AcquireNextImage: " << getVulkanErrorString(result) << std::endl;
+            return;
+        }
     }
+    
+    vkResetFences(device, 1, &frame.fence);
+    
+    VkCommandBuffer commandBuffer = frame.commandBuffer;
     vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    
+    profiler.beginFrame(commandBuffer, currentFrame);
+    profiler.beginRegion(commandBuffer, "frame", true);
     test = test + 0.01f;
     if(test > 1.0f){
         test = 0.0f;
     }
 
-    VkClearColorValue clear_color = {{ test, test, test, 0.0f }};
-
-	VkImageSubresourceRange image_subresource_range {};
-    image_subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    image_subresource_range.baseMipLevel = 0;
-    image_subresource_range.levelCount = 1;
-    image_subresource_range.baseArrayLayer = 0;
-    image_subresource_range.layerCount = 1;
+    waitSemaphores.clear();
+    streamer.recordAcquires(commandBuffer, currentFrame, waitSemaphores);
+    updateStreamedMesh(frame);
+    scenePipeline = shaders.getPipeline(scenePipelines, getSceneVariant());
     
-    vkCmdClearColorImage(commandBuffer, swapchainImages[currentImage], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clear_color, 1, &image_subresource_range );
+    uploadInstances();
+    if (cullingMode != CULLING_GPU) {
+        uploadVisibleInstances();
+    }
     
-    VkViewport viewport {};
-    viewport.height = (float)surfaceCapabilities.currentExtent.height;
-    viewport.width = (float)surfaceCapabilities.currentExtent.width;
-    viewport.minDepth = (float)0.0f;
-    viewport.maxDepth = (float)1.0f;
-    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
-
-    VkRect2D scissor {};
-    scissor.extent.width = surfaceCapabilities.currentExtent.height;
-    scissor.extent.height = surfaceCapabilities.currentExtent.width;
-    scissor.offset.x = 0;
-    scissor.offset.y = 0;
-    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+    // Buffers are recreated by setInstanceCount(), the target changes
+    // every frame. A swapchain image may only be written once the acquire
+    // semaphore, waited on at colour output, has been signaled.
+    renderGraph.setBuffer(instanceResource, instanceBuffer);
+    renderGraph.setBuffer(visibleListResource, visibleArena.getBuffer());
+    renderGraph.setBuffer(gpuVisibleResource, frame.gpuVisibleBuffer);
+    renderGraph.setBuffer(drawCommandResource, frame.drawCommandBuffer);
+    renderGraph.setBuffer(visibleCountResource, visibleCountBuffer);
+    renderGraph.setImage(colorResource, swapchainImages[currentImage],
+        headless ? 0 : VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+    bool uploading = !uploadRegions.empty();
+    renderGraph.setPassEnabled(uploadPass, uploading);
+    VkBuffer captureBuffer = capture.begin(currentFrame);
+    renderGraph.setBuffer(captureResource, captureBuffer);
+    renderGraph.setPassEnabled(capturePass, captureBuffer != VK_NULL_HANDLE);
     
-    //vkCmdDraw(commandBuffer, 3, 1, 0, 0);
-
+    // Timestamps of different queues cannot be compared, with async compute
+    // the profiler only covers the scene.
+    if (async) {
+        renderGraph.beginFrame();
+        if (uploading) {
+            vkBeginCommandBuffer(frame.uploadCommandBuffer, &beginInfo);
+            renderGraph.execute(frame.uploadCommandBuffer, uploadPass, cullResetPass);
+            vkEndCommandBuffer(frame.uploadCommandBuffer);
+        }
+        vkBeginCommandBuffer(frame.computeCommandBuffer, &beginInfo);
+        renderGraph.execute(frame.computeCommandBuffer, cullResetPass, scenePass);
+        vkEndCommandBuffer(frame.computeCommandBuffer);
+        renderGraph.execute(commandBuffer, scenePass, renderGraph.getPassCount(), &profiler);
+    } else {
+        renderGraph.execute(commandBuffer, &profiler);
+    }
+    
+    profiler.endRegion(commandBuffer);
+    profiler.endFrame();
     
     vkEndCommandBuffer(commandBuffer);
     
-    VkPipelineStageFlags wait_dst_stage_mask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    // Streamed uploads only have to be complete before vertex input.
+    waitStages.assign(waitSemaphores.size(), VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+    if (!headless) {
+        waitSemaphores.push_back(frame.imageAcquired);
+        waitStages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+    }
+    
+    // Binary semaphores have to be signaled by an earlier submission than
+    // the one waiting for them. Both waits cover all commands, which is
+    // what lets renderGraph skip barriers between the queues.
+    if (async) {
+        VkPipelineStageFlags allCommands = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        
+        VkSubmitInfo uploadSubmitInfo {};
+        uploadSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        uploadSubmitInfo.commandBufferCount = 1;
+        uploadSubmitInfo.pCommandBuffers = &frame.uploadCommandBuffer;
+        uploadSubmitInfo.signalSemaphoreCount = 1;
+        uploadSubmitInfo.pSignalSemaphores = &frame.uploadFinished;
+        if (uploading) {
+            result = vkQueueSubmit(queue, 1, &uploadSubmitInfo, VK_NULL_HANDLE);
+            if (result != VK_SUCCESS) {
+                std::cout << "Failed to submit uploads: " << getVulkanErrorString(result) << std::endl;
+            }
+        }
+        
+        VkSubmitInfo computeSubmitInfo {};
+        computeSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        if (uploading) {
+            computeSubmitInfo.waitSemaphoreCount = 1;
+            computeSubmitInfo.pWaitSemaphores = &frame.uploadFinished;
+            computeSubmitInfo.pWaitDstStageMask = &allCommands;
+        }
+        computeSubmitInfo.commandBufferCount = 1;
+        computeSubmitInfo.pCommandBuffers = &frame.computeCommandBuffer;
+        computeSubmitInfo.signalSemaphoreCount = 1;
+        computeSubmitInfo.pSignalSemaphores = &frame.computeFinished;
+        result = vkQueueSubmit(computeQueue, 1, &computeSubmitInfo, VK_NULL_HANDLE);
+        if (result != VK_SUCCESS) {
+            std::cout << "Failed to submit culling: " << getVulkanErrorString(result) << std::endl;
+        }
+        
+        waitSemaphores.push_back(frame.computeFinished);
+        waitStages.push_back(allCommands);
+    }
+    
     VkSubmitInfo submitInfo {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.waitSemaphoreCount = (uint32_t)waitSemaphores.size();
+    submitInfo.pWaitSemaphores = waitSemaphores.data();
+    submitInfo.pWaitDstStageMask = waitStages.data();
+    if (!headless) {
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &frame.renderFinished;
+    }
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &commandBuffer;
-    submitInfo.pWaitDstStageMask = &wait_dst_stage_mask;
     
-    vkQueueSubmit(queue, 1, &submitInfo, fence);
+    result = vkQueueSubmit(queue, 1, &submitInfo, frame.fence);
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to submit frame: " << getVulkanErrorString(result) << std::endl;
+    }
+    pacer.markSubmit();
+    markFirstFrame();
     
-    vkWaitForFences(device, 1, &fence, VK_TRUE, UINT_MAX);
+    if (headless) {
+        pacer.markPresent();
+        currentFrame = (currentFrame + 1) % framesInFlight;
+        return;
+    }
         
     VkPresentInfoKHR presentInfo = {};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    presentInfo.waitSemaphoreCount = 1;
+    presentInfo.pWaitSemaphores = &frame.renderFinished;
     presentInfo.swapchainCount = 1;
     presentInfo.pSwapchains = &swapchain;
     presentInfo.pImageIndices = &currentImage;
     
-    vkQueuePresentKHR(queue, &presentInfo);
+    {
+        Profiler::CpuScope presentScope(profiler, "present");
+        result = vkQueuePresentKHR(queue, &presentInfo);
+    }
+    pacer.markPresent();
+    
+    currentFrame = (currentFrame + 1) % framesInFlight;
+    
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || suboptimal) {
+        waitReady();
+        recreateSwapchain();
+    } else if (result != VK_SUCCESS) {
+        std::cout << "Failed to present: " << getVulkanErrorString(result) << std::endl;
+    }
  }
 
-void Renderer::setImageLayout(VkCommandBuffer cmdBuffer, VkImage image, VkImageAspectFlags aspects, VkImageLayout oldLayout, VkImageLayout newLayout){
-    VkImageMemoryBarrier imageBarrier = {};
-    imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    imageBarrier.pNext = NULL;
-    imageBarrier.oldLayout = oldLayout;
-    imageBarrier.newLayout = newLayout;
-    imageBarrier.image = image;
-    imageBarrier.subresourceRange.aspectMask = aspects;
-    imageBarrier.subresourceRange.baseMipLevel = 0;
-    imageBarrier.subresourceRange.levelCount = 1;
-    imageBarrier.subresourceRange.layerCount = 1;
-    
-    switch (oldLayout) {
-      case VK_IMAGE_LAYOUT_PREINITIALIZED:
-        imageBarrier.srcAccessMask =
-            VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
-        break;
-      case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
-        imageBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-        break;
-      case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
-        imageBarrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-        break;
-      case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
-        imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-        break;
-      case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
-        imageBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
-        break;
-    }
-
-    switch (newLayout) {
-      case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
-        imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        break;
-      case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
-        imageBarrier.srcAccessMask |= VK_ACCESS_TRANSFER_READ_BIT;
-        imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-        break;
-      case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
-        imageBarrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-        imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-        break;
-      case VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL:
-        imageBarrier.dstAccessMask |=
-            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-        break;
-      case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
-        imageBarrier.srcAccessMask =
-            VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
-        imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-        break;
-    }
-    
-    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 
-        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1,&imageBarrier);
+// The frame is rendered right away on threadPool, there is nothing in
+// flight. The rasterizer reads the instances where they are, changes only
+// have to be taken off the dirty list, after cull() has seen them.
+void Renderer::drawSoftware() {
+    test = test + 0.01f;
+    if(test > 1.0f){
+        test = 0.0f;
+    }
+    
+    for (uint32_t index: dirtyInstances) {
+        instanceDirty[index] = 0;
+    }
+    dirtyInstances.clear();
+    lastUploadedInstances = 0;
+    
+    {
+        Profiler::CpuScope recordScope(profiler, "record");
+        float clearColor[4] { test, test, test, 0.0f };
+        rasterizer.draw(clearColor, viewProjection, instances.data(), visibleInstances.data(),
+            (uint32_t)visibleInstances.size(), shadingMode == SHADING_INSTANCE);
+    }
+    
+    pacer.markSubmit();
+    pacer.markPresent();
+    markFirstFrame();
 }
 
-// Init
-Renderer::Renderer(GLFWwindow* window){
-    if (!glfwVulkanSupported()) exit(1);    
+// Timestamps cannot be written between secondary buffers, the graph's region
+// of this pass encloses the whole render pass.
+void Renderer::recordScenePass(VkCommandBuffer cmdBuffer) {
+    VkClearValue clearValues[2] {};
+    clearValues[0].color = {{ test, test, test, 0.0f }};
+    clearValues[1].depthStencil.depth = 1.0f;
+    clearValues[1].depthStencil.stencil = 0;
     
-    applicationInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-    applicationInfo.apiVersion = VK_API_VERSION_1_0;
-    applicationInfo.applicationVersion = VK_MAKE_VERSION(0, 1, 0);
-    applicationInfo.pApplicationName = "test";
+    VkRenderPassBeginInfo renderPassBeginInfo {};
+    renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassBeginInfo.renderPass = renderPass;
+    renderPassBeginInfo.framebuffer = swapchainFramebuffers[currentImage];
+    renderPassBeginInfo.renderArea.offset.x = 0;
+    renderPassBeginInfo.renderArea.offset.y = 0;
+    renderPassBeginInfo.renderArea.extent = extent;
+    renderPassBeginInfo.clearValueCount = 2;
+    renderPassBeginInfo.pClearValues = clearValues;
     
-    this->window = window;
+    vkCmdBeginRenderPass(cmdBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    recordScene(frames[currentFrame]);
+    vkCmdEndRenderPass(cmdBuffer);
+}
 
-    if (!initInstance()) exit(1);
-    if (!initDevice()) exit(1);
-    if (!initSurface(window)) exit(1);
+void Renderer::recordScene(FrameData& frame) {
+    Profiler::CpuScope recordScope(profiler, "record");
+    
+    uint32_t threadCount = threadPool.getThreadCount();
+    for (uint32_t i = 0; i < threadCount; ++i) {
+        vkResetCommandPool(device, frame.threadCommandPools[i], 0);
+        frame.secondaryRecorded[i] = 0;
+    }
+    
+    // The variant failed to build, the render pass only clears.
+    if (scenePipeline == VK_NULL_HANDLE) return;
+    
+    VkCommandBufferInheritanceInfo inheritanceInfo {};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = renderPass;
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.framebuffer = swapchainFramebuffers[currentImage];
+    if (profiler.hasStatistics()) {
+        inheritanceInfo.pipelineStatistics = Profiler::STATISTICS_FLAGS;
+    }
+    
+    VkCommandBufferBeginInfo beginInfo {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+        VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+    
+    // Each thread only ever touches its own pool and buffer. A buffer is
+    // begun on the first batch its thread picks up, so threads that got no
+    // work contribute nothing to vkCmdExecuteCommands.
+    threadPool.parallelFor(getDrawCount(), drawBatchSize, [&](uint32_t threadIndex, uint32_t begin, uint32_t end) {
+        Profiler::CpuScope batchScope(profiler, "record_batch");
+        
+        VkCommandBuffer cmdBuffer = frame.secondaryCommandBuffers[threadIndex];
+        if (!frame.secondaryRecorded[threadIndex]) {
+            vkBeginCommandBuffer(cmdBuffer, &beginInfo);
+            
+            // Dynamic state is not inherited from the primary buffer.
+            VkViewport viewport {};
+            viewport.height = (float)extent.height;
+            viewport.width = (float)extent.width;
+            viewport.minDepth = (float)0.0f;
+            viewport.maxDepth = (float)1.0f;
+            vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
+            
+            VkRect2D scissor {};
+            scissor.extent = extent;
+            scissor.offset.x = 0;
+            scissor.offset.y = 0;
+            vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
+            
+            VkBuffer vertexBuffers[2] { vertexBuffer, visibleArena.getBuffer() };
+            VkDeviceSize offsets[2] { 0, visibleOffset };
+            if (cullingMode == CULLING_GPU) {
+                vertexBuffers[1] = frame.gpuVisibleBuffer;
+                offsets[1] = 0;
+            }
+            vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, scenePipeline);
+            vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &frame.descriptorSet,
+                1, &frame.uniformOffset);
+            vkCmdBindVertexBuffers(cmdBuffer, 0, 2, vertexBuffers, offsets);
+            vkCmdBindIndexBuffer(cmdBuffer, indexBuffer, 0, indexType);
+            
+            frame.secondaryRecorded[threadIndex] = 1;
+        }
+        
+        recordDraws(cmdBuffer, begin, end);
+    });
+    
+    std::vector<VkCommandBuffer> recorded;
+    for (uint32_t i = 0; i < threadCount; ++i) {
+        if (frame.secondaryRecorded[i]) {
+            vkEndCommandBuffer(frame.secondaryCommandBuffers[i]);
+            recorded.push_back(frame.secondaryCommandBuffers[i]);
+        }
+    }
+    
+    if (!recorded.empty()) {
+        vkCmdExecuteCommands(frame.commandBuffer, (uint32_t)recorded.size(), recorded.data());
+    }
+}
 
-    if (!initCommands()) exit(1);
+// Draws [begin, end) each cover instancesPerDraw consecutive entries of the
+// visible instance list.
+void Renderer::recordDraws(VkCommandBuffer cmdBuffer, uint32_t begin, uint32_t end) {
+    if (cullingMode == CULLING_GPU) {
+        vkCmdDrawIndexedIndirect(cmdBuffer, frames[currentFrame].drawCommandBuffer, 0, 1, sizeof(VkDrawIndexedIndirectCommand));
+        return;
+    }
+    
+    uint32_t instanceCount = getVisibleInstanceCount();
+    
+    for (uint32_t i = begin; i < end; ++i) {
+        uint32_t firstInstance = (uint32_t)((uint64_t)i * instancesPerDraw);
+        uint32_t count = std::min(instancesPerDraw, instanceCount - firstInstance);
+        vkCmdDrawIndexed(cmdBuffer, indexCount, count, 0, 0, firstInstance);
+    }
+}
 
-    if (!initSwapchain()) exit(1);
-    if (!initRenderPass()) exit(1);
+void Renderer::markInstanceDirty(uint32_t index) {
+    if (!instanceDirty[index]) {
+        instanceDirty[index] = 1;
+        dirtyInstances.push_back(index);
+    }
 }
 
-bool Renderer::initInstance() {
-    VkInstanceCreateInfo instanceCreateInfo {};
-    instanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-    instanceCreateInfo.pApplicationInfo = &applicationInfo;
+// Writes the model matrices straight into the interleaved instance array.
+void Renderer::composeInstances(uint32_t first, uint32_t count) {
+    Math::composeTransforms(instanceTransforms, first, count, instances[first].model,
+        sizeof(InstanceData) / sizeof(float));
     
-    instanceCreateInfo.pNext = NULL;
+    updateInstanceBounds(first, count);
+    for (uint32_t i = first; i < first + count; ++i) {
+        markInstanceDirty(i);
+    }
+}
+
+// World space box around the mesh bounds: the centre is transformed, the
+// half extent along each axis is the absolute rotation/scale row applied
+// to the mesh half extent.
+void Renderer::updateInstanceBounds(uint32_t first, uint32_t count) {
+    Math::Vec3 center = (meshMin + meshMax) * 0.5f;
+    Math::Vec3 extent = (meshMax - meshMin) * 0.5f;
     
-    instanceCreateInfo.enabledLayerCount = 0;
-    instanceCreateInfo.ppEnabledLayerNames = NULL;
-    instanceCreateInfo.enabledExtensionCount = 0;
-    instanceCreateInfo.ppEnabledExtensionNames = NULL;
+    for (uint32_t i = first; i < first + count; ++i) {
+        const float* m = instances[i].model;
+        Math::Vec3 worldCenter(
+            m[0] * center.x + m[4] * center.y + m[8] * center.z + m[12],
+            m[1] * center.x + m[5] * center.y + m[9] * center.z + m[13],
+            m[2] * center.x + m[6] * center.y + m[10] * center.z + m[14]);
+        Math::Vec3 worldExtent(
+            std::fabs(m[0]) * extent.x + std::fabs(m[4]) * extent.y + std::fabs(m[8]) * extent.z,
+            std::fabs(m[1]) * extent.x + std::fabs(m[5]) * extent.y + std::fabs(m[9]) * extent.z,
+            std::fabs(m[2]) * extent.x + std::fabs(m[6]) * extent.y + std::fabs(m[10]) * extent.z);
+        instanceBounds.set(i, worldCenter - worldExtent, worldCenter + worldExtent);
+    }
+}
 
-    uint32_t count;
-    instanceCreateInfo.ppEnabledExtensionNames = glfwGetRequiredInstanceExtensions(&count);
-    instanceCreateInfo.enabledExtensionCount = count;
+// Sets the model matrix directly; it is replaced again if the instance is
+// animated or given a new transform.
+void Renderer::setInstance(uint32_t index, const InstanceData& data) {
+    if (commandStream.isRecording()) {
+        commandStream.recordInstance(index, data);
+    }
+    
+    instances[index] = data;
+    updateInstanceBounds(index, 1);
+    markInstanceDirty(index);
+}
 
-    VkResult result = vkCreateInstance(&instanceCreateInfo, NULL, &instance);
-    if (result != VK_SUCCESS) {
-        std::cout << "Failed to create instance: " << getVulkanErrorString(result) << std::endl;
-        return false;
+void Renderer::setInstanceTransform(uint32_t index, const Math::Vec3& position, const Math::Quat& rotation, float scale) {
+    if (commandStream.isRecording()) {
+        commandStream.recordInstanceTransform(index, position, rotation, scale);
     }
     
-    return true;
+    instanceTransforms.set(index, position, rotation, scale);
+    composeInstances(index, 1);
 }
 
-bool Renderer::initDevice() {
-    VkResult result;
+void Renderer::animateInstances() {
+    uint32_t instanceCount = getInstanceCount();
+    uint32_t count = std::min(animatedInstances, instanceCount);
+    if (count == 0) return;
     
-    // Get GPU
-    // {{
-    uint32_t gpu_count = 0;
-    result = vkEnumeratePhysicalDevices(instance, &gpu_count, NULL);
+    uint32_t first = (uint32_t)(((uint64_t)animationFrame * count) % instanceCount);
+    Math::Quat rotation = Math::fromAxisAngle(Math::Vec3(0.3f, 1.0f, 0.5f), (float)animationFrame * 0.05f);
     
-    if (result != VK_SUCCESS) return false;
-    if (gpu_count == 0) return false;
-
-    std::vector<VkPhysicalDevice> gpu_list(gpu_count);
-    result = vkEnumeratePhysicalDevices(instance, &gpu_count, gpu_list.data());
-    if (result != VK_SUCCESS) {
-        std::cout << "Failed to create device: " << getVulkanErrorString(result) << std::endl;
-        return false;
-     }
+    // The window wraps around the end of the instance array.
+    uint32_t firstCount = std::min(count, instanceCount - first);
+    uint32_t ranges[2][2] { { first, firstCount }, { 0, count - firstCount } };
+    
+    for (uint32_t r = 0; r < 2; ++r) {
+        uint32_t begin = ranges[r][0];
+        uint32_t end = begin + ranges[r][1];
         
-    this->gpu = gpu_list[0];
-    // }}
+        for (uint32_t i = begin; i < end; ++i) {
+            instanceTransforms.rotationX[i] = rotation.x;
+            instanceTransforms.rotationY[i] = rotation.y;
+            instanceTransforms.rotationZ[i] = rotation.z;
+            instanceTransforms.rotationW[i] = rotation.w;
+        }
+        
+        if (end > begin) {
+            composeInstances(begin, end - begin);
+        }
+    }
     
-    // Get index of queue family that supports graphics
-    // {{
-    uint32_t family_count = 0;
-    vkGetPhysicalDeviceQueueFamilyProperties(this->gpu, &family_count, NULL);
-    std::vector<VkQueueFamilyProperties> family_property_list(family_count);
-    vkGetPhysicalDeviceQueueFamilyProperties(this->gpu, &family_count, family_property_list.data());
+    animationFrame++;
+}
+
+void Renderer::update() {
+    Profiler::CpuScope scope(profiler, "update");
+    if (commandStream.isRecording()) {
+        commandStream.record(CommandStream::OP_UPDATE);
+    }
     
-    uint32_t family_index;
-    for (family_index = 0; family_index < family_count; family_index++) {
-        if (family_property_list[family_index].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-            break;
+    animateInstances();
+}
+
+// Every bounds change goes through markInstanceDirty(), and dirtyInstances
+// is only drained by the upload in draw(), so it still lists everything
+// that moved since the last cull.
+void Renderer::cull() {
+    Profiler::CpuScope scope(profiler, "cull");
+    if (commandStream.isRecording()) {
+        commandStream.record(CommandStream::OP_CULL);
+    }
+    
+    uint32_t instanceCount = getInstanceCount();
+    if (cullingMode == CULLING_GPU) return;
+    if (cullingMode == CULLING_NONE) {
+        visibleInstances.resize(instanceCount);
+        for (uint32_t i = 0; i < instanceCount; ++i) {
+            visibleInstances[i] = i;
         }
+        return;
+    }
+    
+    if (!instanceBvhBuilt) {
+        instanceBvh.build(instanceBounds);
+        instanceBvhBuilt = true;
+    } else {
+        instanceBvh.refit(instanceBounds, dirtyInstances);
     }
+    
+    Culling::Frustum frustum = Culling::Frustum::fromMatrix(viewProjection);
+    instanceBvh.cull(frustum, &threadPool, visibleInstances);
+}
 
-    if (family_index >= family_count) {
-        std::cout << "Cannot get family index." << std::endl;
-        return false;
-     }
+// Push constants of shaders/cull.comp.
+struct CullPushConstants {
+    float planes[6][4];
+    float meshCenter[3];
+    uint32_t instanceCount;
+    float meshExtent[3];
+    float padding;
+};
+
+// The cull passes only record their commands, renderGraph places the
+// barriers between them and against the previous frame's draw.
+void Renderer::recordCullReset(VkCommandBuffer cmdBuffer) {
+    FrameData& frame = frames[currentFrame];
+    vkCmdFillBuffer(cmdBuffer, frame.drawCommandBuffer, offsetof(VkDrawIndexedIndirectCommand, instanceCount), sizeof(uint32_t), 0);
+    if (frame.drawCommandIndexCount != indexCount) {
+        vkCmdUpdateBuffer(cmdBuffer, frame.drawCommandBuffer, offsetof(VkDrawIndexedIndirectCommand, indexCount), sizeof(uint32_t), &indexCount);
+        frame.drawCommandIndexCount = indexCount;
+    }
+}
+
+void Renderer::recordGpuCull(VkCommandBuffer cmdBuffer) {
+    uint32_t instanceCount = getInstanceCount();
     
-    this->queueFamilyIndex = family_index;
-    // }}
+    ShaderCache::Variant variant;
+    variant.constants.push_back(cullGroupSize);
+    VkPipeline cullPipeline = shaders.getPipeline(cullPipelines, variant);
+    if (cullPipeline == VK_NULL_HANDLE) return;
     
-    float queue_priorities[] { 1.0f };
-    VkDeviceQueueCreateInfo deviceQueueCreateInfo {}; 
-    deviceQueueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    deviceQueueCreateInfo.queueFamilyIndex = this->queueFamilyIndex;
-    deviceQueueCreateInfo.queueCount = 1;
-    deviceQueueCreateInfo.pQueuePriorities = queue_priorities;
+    Culling::Frustum frustum = Culling::Frustum::fromMatrix(viewProjection);
+    Math::Vec3 center = (meshMin + meshMax) * 0.5f;
+    Math::Vec3 extent = (meshMax - meshMin) * 0.5f;
     
-    VkDeviceCreateInfo deviceCreateInfo {};
-    deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    deviceCreateInfo.queueCreateInfoCount = 1;
-    deviceCreateInfo.pQueueCreateInfos = &deviceQueueCreateInfo;
+    CullPushConstants pushConstants {};
+    memcpy(pushConstants.planes, frustum.planes, sizeof(pushConstants.planes));
+    pushConstants.meshCenter[0] = center.x;
+    pushConstants.meshCenter[1] = center.y;
+    pushConstants.meshCenter[2] = center.z;
+    pushConstants.instanceCount = instanceCount;
+    pushConstants.meshExtent[0] = extent.x;
+    pushConstants.meshExtent[1] = extent.y;
+    pushConstants.meshExtent[2] = extent.z;
     
-    result = vkCreateDevice(this->gpu, &deviceCreateInfo, NULL, &device);
-    if (result != VK_SUCCESS) {
-        std::cout << "Failed to create logical device: " << getVulkanErrorString(result) << std::endl;
-        return false;
-     }
-     
-    vkGetDeviceQueue(device, queueFamilyIndex, 0, &queue);
+    vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+    vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1,
+        &frames[currentFrame].cullDescriptorSet, 0, NULL);
+    vkCmdPushConstants(cmdBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+    vkCmdDispatch(cmdBuffer, (instanceCount + cullGroupSize - 1) / cullGroupSize, 1, 1);
+}
+
+void Renderer::recordVisibleCount(VkCommandBuffer cmdBuffer) {
+    VkBufferCopy countCopy {};
+    countCopy.srcOffset = offsetof(VkDrawIndexedIndirectCommand, instanceCount);
+    countCopy.dstOffset = currentFrame * sizeof(uint32_t);
+    countCopy.size = sizeof(uint32_t);
+    vkCmdCopyBuffer(cmdBuffer, frames[currentFrame].drawCommandBuffer, visibleCountBuffer, 1, &countCopy);
+}
+
+const char* Renderer::getShadingModeName(ShadingMode mode) {
+    switch (mode) {
+        case SHADING_COLOR: return "color";
+        case SHADING_INSTANCE: return "instance";
+    }
+    return "unknown";
+}
+
+bool Renderer::parseShadingMode(const char* name, ShadingMode& mode) {
+    for (int i = SHADING_COLOR; i <= SHADING_INSTANCE; ++i) {
+        if (strcmp(name, getShadingModeName((ShadingMode)i)) == 0) {
+            mode = (ShadingMode)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* Renderer::getCullingModeName(CullingMode mode) {
+    switch (mode) {
+        case CULLING_NONE: return "none";
+        case CULLING_CPU: return "cpu";
+        case CULLING_GPU: return "gpu";
+    }
+    return "unknown";
+}
+
+const char* Renderer::getBackendName(RenderBackend backend) {
+    switch (backend) {
+        case BACKEND_AUTO: return "auto";
+        case BACKEND_VULKAN: return "vulkan";
+        case BACKEND_SOFTWARE: return "software";
+    }
+    return "unknown";
+}
+
+bool Renderer::parseBackend(const char* name, RenderBackend& backend) {
+    for (int candidate = BACKEND_AUTO; candidate <= BACKEND_SOFTWARE; ++candidate) {
+        if (strcmp(name, getBackendName((RenderBackend)candidate)) == 0) {
+            backend = (RenderBackend)candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Renderer::parseCullingMode(const char* name, CullingMode& mode) {
+    for (int i = CULLING_NONE; i <= CULLING_GPU; ++i) {
+        if (strcmp(name, getCullingModeName((CullingMode)i)) == 0) {
+            mode = (CullingMode)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Renderer::uploadVisibleInstances() {
+    visibleArena.beginFrame(currentFrame);
+    visibleOffset = 0;
+    if (visibleInstances.empty()) return;
     
-    return true;
+    void* mapped;
+    VkDeviceSize size = visibleInstances.size() * sizeof(uint32_t);
+    if (!visibleArena.allocate(size, sizeof(uint32_t), visibleOffset, mapped)) {
+        // Cannot happen, the arena holds every instance.
+        std::cout << "Visible instance list does not fit" << std::endl;
+        visibleInstances.clear();
+        return;
+    }
+    memcpy(mapped, visibleInstances.data(), size);
 }
 
-bool Renderer::initSurface(GLFWwindow* window) {
-    VkResult result = glfwCreateWindowSurface(instance, window, NULL, &surface);
+// Copies the dirty instances into the instance buffer. Neighbouring indices
+// are merged into one copy region; whatever does not fit into this frame's
+// part of uploadArena stays dirty for the next frame.
+void Renderer::uploadInstances() {
+    lastUploadedInstances = 0;
+    uploadRegions.clear();
+    uploadArena.beginFrame(currentFrame);
+    if (dirtyInstances.empty()) return;
     
-    if (result != VK_SUCCESS) {
-        std::cout << "Failed to init surface: " << getVulkanErrorString(result) << std::endl;
-        return false;
-    }    
+    Profiler::CpuScope uploadScope(profiler, "upload");
+    std::sort(dirtyInstances.begin(), dirtyInstances.end());
     
-    VkBool32 wsiSupported = false;
-    vkGetPhysicalDeviceSurfaceSupportKHR(gpu, queueFamilyIndex, surface, &wsiSupported);
-    if (!wsiSupported) {
-        std::cout << "Failed to init surface: " << "WSI is not supported" << std::endl;
-        return false;
+    std::vector<VkBufferCopy>& regions = uploadRegions;
+    size_t processed = 0;
+    while (processed < dirtyInstances.size()) {
+        size_t rangeEnd = processed + 1;
+        while (rangeEnd < dirtyInstances.size() &&
+                dirtyInstances[rangeEnd] == dirtyInstances[rangeEnd - 1] + 1) {
+            rangeEnd++;
+        }
+        
+        uint32_t first = dirtyInstances[processed];
+        uint32_t count = (uint32_t)(rangeEnd - processed);
+        VkDeviceSize size = (VkDeviceSize)count * sizeof(InstanceData);
+        
+        // Ranges larger than the space left are split.
+        VkDeviceSize offset;
+        void* mapped;
+        bool allocated = uploadArena.allocate(size, 16, offset, mapped);
+        while (!allocated && count > 1) {
+            count /= 2;
+            size = (VkDeviceSize)count * sizeof(InstanceData);
+            allocated = uploadArena.allocate(size, 16, offset, mapped);
+        }
+        if (!allocated) break;
+        
+        memcpy(mapped, &instances[first], size);
+        for (uint32_t i = first; i < first + count; ++i) {
+            instanceDirty[i] = 0;
+        }
+        
+        VkBufferCopy region {};
+        region.srcOffset = offset;
+        region.dstOffset = (VkDeviceSize)first * sizeof(InstanceData);
+        region.size = size;
+        regions.push_back(region);
+        
+        lastUploadedInstances += count;
+        processed += count;
     }
+    dirtyInstances.erase(dirtyInstances.begin(), dirtyInstances.begin() + processed);
+}
+
+// Only recorded when uploadInstances() produced regions; the graph skips
+// the pass and its barriers otherwise.
+void Renderer::recordInstanceUploads(VkCommandBuffer cmdBuffer) {
+    vkCmdCopyBuffer(cmdBuffer, uploadArena.getBuffer(), instanceBuffer, (uint32_t)uploadRegions.size(), uploadRegions.data());
+}
+
+// Init
+Renderer::Renderer(GLFWwindow* window, uint32_t framesInFlight, RenderBackend backend){
+    this->window = window;
+    
+    if (framesInFlight < 1) framesInFlight = 1;
+    if (framesInFlight > MAX_FRAMES_IN_FLIGHT) framesInFlight = MAX_FRAMES_IN_FLIGHT;
+    this->framesInFlight = framesInFlight;
+    this->recordThreadCount = ThreadPool::getDefaultThreadCount();
+
+    if (!init(backend)) exit(1);
+}
+
+Renderer::Renderer(uint32_t width, uint32_t height, uint32_t framesInFlight, RenderBackend backend){
+    this->headless = true;
+    this->extent.width = width;
+    this->extent.height = height;
+    
+    if (framesInFlight < 1) framesInFlight = 1;
+    if (framesInFlight > MAX_FRAMES_IN_FLIGHT) framesInFlight = MAX_FRAMES_IN_FLIGHT;
+    this->framesInFlight = framesInFlight;
+    this->recordThreadCount = ThreadPool::getDefaultThreadCount();
+
+    if (!init(backend)) exit(1);
+}
+
+bool Renderer::init(RenderBackend backend) {
+    applicationInfo = {};
+    applicationInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    applicationInfo.apiVersion = VK_API_VERSION_1_0;
+    applicationInfo.applicationVersion = VK_MAKE_VERSION(0, 1, 0);
+    applicationInfo.pApplicationName = "test";
+    
+    // No camera yet: x and y are used as clip space directly, z is mapped
+    // from [-1, 1] to Vulkan's [0, 1] depth range.
+    viewProjection = Math::translation(Math::Vec3(0.0f, 0.0f, 0.5f)) * Math::scaling(Math::Vec3(1.0f, 1.0f, 0.5f));
+    
+    // The record threads run start-up too.
+    if (!threadPool.init(recordThreadCount)) return false;
+    
+    // The mesh is read while the device is created. Which backend that
+    // ends up with decides about the rest of the tasks.
+    InitGraph::Task meshRead = startup.add("mesh_read", [this]() {
+        return readMesh();
+    });
+    startup.add("device", [this, backend, meshRead]() {
+        if (!initBackend(backend)) return false;
+        
+        if (software) {
+            addSoftwareTasks(meshRead);
+        } else {
+            addVulkanTasks(meshRead);
+        }
+        return true;
+    });
+    
+    bool succeeded = startup.run(threadPool, &profiler);
+    startup.printStats();
+    if (!succeeded) return false;
+    
+    if (!software) {
+        pipelineCache.printStats();
+        shaders.printStats();
+        renderGraph.printStats();
+    }
+    
+    return true;
+}
+
+// Everything after the device, as tasks that only wait for what they use.
+// Pipeline work only needs the layouts and the render pass, so the pipeline
+// cache, the shader modules and every pipeline variant are created while
+// the images, buffers and uploads are being set up.
+//
+// Tasks that submit to queue, the mesh and instance uploads, are chained
+// so only one of them does at a time. shaders and pipelineCache synchronize
+// themselves, allocator as well.
+void Renderer::addVulkanTasks(InitGraph::Task meshRead) {
+    InitGraph::Task allocatorTask = startup.add("allocator", [this]() {
+        return initAllocator();
+    });
+    InitGraph::Task pipelineCacheTask = startup.add("pipeline_cache", [this]() {
+        return pipelineCache.init(gpu, device, pipelineCachePath, pipelineCreationFeedbackSupported);
+    });
+    InitGraph::Task shaderModules = startup.add("shader_modules", [this]() {
+        if (!shaders.init(device, pipelineVariantsPath)) return false;
+        
+        const char* paths[] { "shaders/cube.vert.spv", "shaders/cube.frag.spv", "shaders/cull.comp.spv" };
+        for (const char* path: paths) {
+            if (shaders.getModule(path) == VK_NULL_HANDLE) return false;
+        }
+        return true;
+    });
+    
+    // glfwGetFramebufferSize() is main thread only.
+    InitGraph::Task surface = startup.add("surface", [this]() {
+        if (!headless) return initSurface(window);
+        
+        surfaceFormat.format = VK_FORMAT_R8G8B8A8_UNORM;
+        surfaceFormat.colorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
+        return true;
+    }, {}, headless ? InitGraph::ANY_THREAD : InitGraph::MAIN_THREAD);
+    
+    InitGraph::Task commands = startup.add("commands", [this]() {
+        return initCommands();
+    });
+    startup.add("queries", [this]() {
+        return initQueries();
+    });
+    startup.add("streamer", [this]() {
+        return initStreamer();
+    }, { allocatorTask });
+    startup.add("textures", [this]() {
+        return initTextures();
+    }, { allocatorTask });
+    startup.add("record_threads", [this]() {
+        return initRecordThreads();
+    }, { commands });
+    
+    InitGraph::Task swapchainTask = startup.add(headless ? "offscreen_images" : "swapchain", [this]() {
+        return headless ? initOffscreenImages() : initSwapchain();
+    }, { surface, allocatorTask });
+    InitGraph::Task renderPassTask = startup.add("render_pass", [this]() {
+        return initRenderPass();
+    }, { surface });
+    InitGraph::Task renderGraphTask = startup.add("render_graph", [this]() {
+        return initRenderGraph();
+    }, { renderPassTask, swapchainTask });
+    startup.add("framebuffers", [this]() {
+        return initFramebuffers();
+    }, { renderGraphTask });
+    InitGraph::Task descriptors = startup.add("descriptors", [this]() {
+        return initDescriptors();
+    }, { allocatorTask, commands });
+    
+    // The cull family is added after the scene family, families are not
+    // added concurrently.
+    InitGraph::Task pipeline = startup.add("pipeline", [this]() {
+        return initPipeline();
+    }, { descriptors, renderPassTask, pipelineCacheTask, shaderModules });
+    InitGraph::Task cullPipeline = startup.add("cull_pipeline", [this]() {
+        return initCullPipeline();
+    }, { descriptors, pipeline });
+    
+    // The first frame's scene pipeline is created even without a prewarm
+    // list, there is nothing to hide its creation behind later. It only
+    // needs the mesh's vertex format, not its upload.
+    startup.add("scene_pipeline", [this]() {
+        return shaders.warm(scenePipelines, getSceneVariant());
+    }, { pipeline, meshRead });
+    startup.add("prewarm_list", [this]() {
+        for (const ShaderCache::ListedVariant& listed: shaders.readPrewarmList()) {
+            ShaderCache::Family family = listed.family;
+            ShaderCache::Variant variant = listed.variant;
+            startup.add("pipeline " + listed.name, [this, family, variant]() {
+                shaders.warm(family, variant);
+                return true;
+            });
+        }
+        return true;
+    }, { pipeline, cullPipeline });
+    
+    InitGraph::Task mesh = startup.add("mesh_upload", [this]() {
+        return initMeshBuffers();
+    }, { meshRead, allocatorTask, commands });
+    startup.add("instances", [this]() {
+        return initInstances(1024);
+    }, { mesh, descriptors });
+}
+
+// A window only provides the size of the frames.
+void Renderer::addSoftwareTasks(InitGraph::Task meshRead) {
+    InitGraph::Task rasterizerTask = startup.add("rasterizer", [this]() {
+        if (!headless) {
+            int width, height;
+            glfwGetFramebufferSize(window, &width, &height);
+            extent.width = (uint32_t)width;
+            extent.height = (uint32_t)height;
+            std::cout << "The software backend does not present, frames are rendered but not shown" << std::endl;
+        }
+        return rasterizer.init(extent.width, extent.height, threadPool);
+    }, {}, headless ? InitGraph::ANY_THREAD : InitGraph::MAIN_THREAD);
+    
+    startup.add("mesh_upload", [this]() {
+        return initMeshBuffers();
+    }, { meshRead, rasterizerTask });
+    startup.add("instances", [this]() {
+        return initInstances(1024);
+    }, { meshRead });
+}
+
+void Renderer::markFirstFrame() {
+    if (timeToFirstFrame >= 0.0) return;
+    
+    timeToFirstFrame = profiler.now();
+    std::cout << "Time to first frame: " << timeToFirstFrame << " ms, " << startup.getTotalTime()
+              << " ms of it in startup" << std::endl;
+}
+
+// Creates the instance and device unless the software backend was asked
+// for. Without a usable device BACKEND_AUTO falls back to it, after
+// destroying whatever was created.
+bool Renderer::initBackend(RenderBackend backend) {
+    if (backend != BACKEND_SOFTWARE) {
+        bool supported = headless || glfwVulkanSupported();
+        if (supported && initInstance() && initDevice()) return true;
+        
+        destroyDevice();
+        device = VK_NULL_HANDLE;
+        destroyInstance();
+        instance = VK_NULL_HANDLE;
+        
+        if (backend == BACKEND_VULKAN) {
+            std::cout << "No usable Vulkan device" << std::endl;
+            return false;
+        }
+        std::cout << "No usable Vulkan device, falling back to the software rasterizer" << std::endl;
+    }
+    
+    software = true;
+    return true;
+}
+
+bool Renderer::initInstance() {
+    VkInstanceCreateInfo instanceCreateInfo {};
+    instanceCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    instanceCreateInfo.pApplicationInfo = &applicationInfo;
+    
+    instanceCreateInfo.pNext = NULL;
+    
+    instanceCreateInfo.enabledLayerCount = 0;
+    instanceCreateInfo.ppEnabledLayerNames = NULL;
+    instanceCreateInfo.enabledExtensionCount = 0;
+    instanceCreateInfo.ppEnabledExtensionNames = NULL;
+
+    // Headless mode needs no WSI extensions, and GLFW may not even be
+    // initialized on a machine without a display.
+    if (!headless) {
+        uint32_t count;
+        instanceCreateInfo.ppEnabledExtensionNames = glfwGetRequiredInstanceExtensions(&count);
+        instanceCreateInfo.enabledExtensionCount = count;
+    }
+
+    VkResult result = vkCreateInstance(&instanceCreateInfo, NULL, &instance);
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create instance: " << getVulkanErrorString(result) << std::endl;
+        return false;
+    }
+    
+    return true;
+}
+
+bool Renderer::initDevice() {
+    VkResult result;
+    
+    // Get GPU
+    // {{
+    uint32_t gpu_count = 0;
+    result = vkEnumeratePhysicalDevices(instance, &gpu_count, NULL);
+    
+    if (result != VK_SUCCESS) return false;
+    if (gpu_count == 0) return false;
+
+    std::vector<VkPhysicalDevice> gpu_list(gpu_count);
+    result = vkEnumeratePhysicalDevices(instance, &gpu_count, gpu_list.data());
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create device: " << getVulkanErrorString(result) << std::endl;
+        return false;
+     }
+        
+    this->gpu = gpu_list[0];
+    // }}
+    
+    // Get index of queue family that supports graphics
+    // {{
+    uint32_t family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(this->gpu, &family_count, NULL);
+    std::vector<VkQueueFamilyProperties> family_property_list(family_count);
+    vkGetPhysicalDeviceQueueFamilyProperties(this->gpu, &family_count, family_property_list.data());
+    
+    uint32_t family_index;
+    for (family_index = 0; family_index < family_count; family_index++) {
+        if (family_property_list[family_index].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+            break;
+        }
+    }
+
+    if (family_index >= family_count) {
+        std::cout << "Cannot get family index." << std::endl;
+        return false;
+     }
+    
+    this->queueFamilyIndex = family_index;
+    // }}
+    
+    // Streaming uploads prefer a transfer-only family (the DMA engines),
+    // then any other family, then a second queue of the graphics family.
+    // Without either they share the graphics queue.
+    // {{
+    uint32_t transfer_index = family_count;
+    for (uint32_t i = 0; i < family_count; ++i) {
+        VkQueueFlags flags = family_property_list[i].queueFlags;
+        if (i == queueFamilyIndex || !(flags & (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+            continue;
+        }
+        if (!(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+            transfer_index = i;
+            break;
+        }
+        if (transfer_index == family_count) {
+            transfer_index = i;
+        }
+    }
+    // }}
+    
+    // Async compute prefers a compute-only family, then a second queue of
+    // the graphics family. Without either culling stays on the graphics
+    // queue.
+    // {{
+    uint32_t compute_index = family_count;
+    for (uint32_t i = 0; i < family_count; ++i) {
+        VkQueueFlags flags = family_property_list[i].queueFlags;
+        if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+            compute_index = i;
+            break;
+        }
+    }
+    // }}
+    
+    // Every user takes the next free queue of its family. Once a family has
+    // run out, transfers and compute share its first queue; both are only
+    // submitted from the render thread.
+    // {{
+    std::vector<uint32_t> queues_used(family_count, 0);
+    queues_used[queueFamilyIndex] = 1;
+    
+    uint32_t transfer_queue = 0;
+    if (transfer_index < family_count) {
+        this->transferQueueFamilyIndex = transfer_index;
+        transfer_queue = queues_used[transfer_index]++;
+    } else {
+        this->transferQueueFamilyIndex = queueFamilyIndex;
+        if (family_property_list[queueFamilyIndex].queueCount > 1) {
+            transfer_queue = queues_used[queueFamilyIndex]++;
+        }
+    }
+    
+    uint32_t compute_queue = 0;
+    if (compute_index < family_count) {
+        this->computeQueueFamilyIndex = compute_index;
+        if (queues_used[compute_index] < family_property_list[compute_index].queueCount) {
+            compute_queue = queues_used[compute_index]++;
+        }
+    } else {
+        this->computeQueueFamilyIndex = queueFamilyIndex;
+        if (queues_used[queueFamilyIndex] < family_property_list[queueFamilyIndex].queueCount) {
+            compute_queue = queues_used[queueFamilyIndex]++;
+        }
+    }
+    
+    std::vector<float> queue_priorities(3, 1.0f);
+    std::vector<VkDeviceQueueCreateInfo> deviceQueueCreateInfos;
+    for (uint32_t i = 0; i < family_count; ++i) {
+        if (queues_used[i] == 0) continue;
+        
+        VkDeviceQueueCreateInfo deviceQueueCreateInfo {};
+        deviceQueueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        deviceQueueCreateInfo.queueFamilyIndex = i;
+        deviceQueueCreateInfo.queueCount = queues_used[i];
+        deviceQueueCreateInfo.pQueuePriorities = queue_priorities.data();
+        deviceQueueCreateInfos.push_back(deviceQueueCreateInfo);
+    }
+    // }}
+    
+    // Pipeline statistics are optional, the profiler works without them.
+    // The scene is drawn from secondary command buffers inside the frame's
+    // statistics query, so they also take inherited queries.
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(gpu, &supportedFeatures);
+    
+    VkPhysicalDeviceFeatures enabledFeatures {};
+    pipelineStatisticsSupported = supportedFeatures.pipelineStatisticsQuery == VK_TRUE &&
+        supportedFeatures.inheritedQueries == VK_TRUE;
+    enabledFeatures.pipelineStatisticsQuery = pipelineStatisticsSupported ? VK_TRUE : VK_FALSE;
+    enabledFeatures.inheritedQueries = pipelineStatisticsSupported ? VK_TRUE : VK_FALSE;
+    
+    // BCn textures are only loaded where the device decodes them, which
+    // the texture cache checks through the format properties.
+    enabledFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+    
+    // Creation feedback is optional too, it only lets the pipeline cache
+    // report hits and misses.
+    uint32_t extension_count = 0;
+    vkEnumerateDeviceExtensionProperties(gpu, NULL, &extension_count, NULL);
+    std::vector<VkExtensionProperties> extension_list(extension_count);
+    vkEnumerateDeviceExtensionProperties(gpu, NULL, &extension_count, extension_list.data());
+    
+    pipelineCreationFeedbackSupported = false;
+    for (const VkExtensionProperties& extension: extension_list) {
+        if (strcmp(extension.extensionName, VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME) == 0) {
+            pipelineCreationFeedbackSupported = true;
+        }
+    }
+    
+    std::vector<const char*> device_extensions;
+    if (!headless) {
+        device_extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    }
+    if (pipelineCreationFeedbackSupported) {
+        device_extensions.push_back(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+    }
+    
+    VkDeviceCreateInfo deviceCreateInfo {};
+    deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceCreateInfo.queueCreateInfoCount = (uint32_t)deviceQueueCreateInfos.size();
+    deviceCreateInfo.pQueueCreateInfos = deviceQueueCreateInfos.data();
+    deviceCreateInfo.pEnabledFeatures = &enabledFeatures;
+    deviceCreateInfo.enabledExtensionCount = (uint32_t)device_extensions.size();
+    deviceCreateInfo.ppEnabledExtensionNames = device_extensions.data();
+    
+    result = vkCreateDevice(this->gpu, &deviceCreateInfo, NULL, &device);
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create logical device: " << getVulkanErrorString(result) << std::endl;
+        return false;
+     }
+     
+    vkGetDeviceQueue(device, queueFamilyIndex, 0, &queue);
+    
+    vkGetDeviceQueue(device, transferQueueFamilyIndex, transfer_queue, &transferQueue);
+    if (transferQueueFamilyIndex != queueFamilyIndex) {
+        std::cout << "Streaming on queue family " << transferQueueFamilyIndex << std::endl;
+    } else if (transferQueue != queue) {
+        std::cout << "Streaming on a second graphics queue" << std::endl;
+    } else {
+        std::cout << "Streaming on the graphics queue" << std::endl;
+    }
+    
+    vkGetDeviceQueue(device, computeQueueFamilyIndex, compute_queue, &computeQueue);
+    if (computeQueueFamilyIndex != queueFamilyIndex) {
+        std::cout << "Async compute on queue family " << computeQueueFamilyIndex << std::endl;
+    } else if (computeQueue != queue) {
+        std::cout << "Async compute on a second graphics queue" << std::endl;
+    } else {
+        std::cout << "Compute shares the graphics queue" << std::endl;
+    }
+    asyncCompute = computeQueue != queue;
+    
+    sharedQueueFamilies.clear();
+    sharedQueueFamilies.push_back(queueFamilyIndex);
+    if (computeQueueFamilyIndex != queueFamilyIndex) {
+        sharedQueueFamilies.push_back(computeQueueFamilyIndex);
+    }
+    
+    return true;
+}
+
+bool Renderer::initAllocator() {
+    return allocator.init(gpu, device);
+}
+
+bool Renderer::initSurface(GLFWwindow* window) {
+    VkResult result = glfwCreateWindowSurface(instance, window, NULL, &surface);
+    
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to init surface: " << getVulkanErrorString(result) << std::endl;
+        return false;
+    }    
+    
+    VkBool32 wsiSupported = false;
+    vkGetPhysicalDeviceSurfaceSupportKHR(gpu, queueFamilyIndex, surface, &wsiSupported);
+    if (!wsiSupported) {
+        std::cout << "Failed to init surface: " << "WSI is not supported" << std::endl;
+        return false;
+    }
+    
+    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(gpu, surface, &surfaceCapabilities);
+    
+    extent = surfaceCapabilities.currentExtent;
+    if (extent.width == UINT32_MAX) {
+        int width, height;
+        glfwGetFramebufferSize(window, &width, &height);
+        extent.width = (uint32_t)width;
+        extent.height = (uint32_t)height;
+    }
+    
+    uint32_t formatCount = 0;
+    vkGetPhysicalDeviceSurfaceFormatsKHR(gpu, surface, &formatCount, NULL);
+    if (formatCount == 0) {
+        std::cout << "Failed to init surface: " << "Surface formats missing." << std::endl;
+        return false;
+    }
+    
+    std::vector<VkSurfaceFormatKHR> formats (formatCount);
+    vkGetPhysicalDeviceSurfaceFormatsKHR(gpu, surface, &formatCount, formats.data());
+    if (formats[0].format == VK_FORMAT_UNDEFINED) {
+        surfaceFormat.format = VK_FORMAT_B8G8R8A8_UNORM;
+        surfaceFormat.colorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
+    } else {
+        surfaceFormat = formats[0];
+    }
+    
+    return true;
+}
+
+bool Renderer::initCommands() {
+    VkResult result;
+
+    // Create command pool
+    VkCommandPoolCreateInfo poolCreateInfo {};
+    poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolCreateInfo.queueFamilyIndex = this->queueFamilyIndex ;
+    poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    
+    result = vkCreateCommandPool(device, &poolCreateInfo, NULL, &commandPool);
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create command pool: " << getVulkanErrorString(result) << std::endl;
+        return false;
+     }
+     
+    frames.resize(framesInFlight);
+    
+    // Create command buffers
+    std::vector<VkCommandBuffer> commandBuffers(framesInFlight);
+    VkCommandBufferAllocateInfo commandBufferAllocateInfo {};
+    commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    commandBufferAllocateInfo.commandPool = commandPool;
+    commandBufferAllocateInfo.commandBufferCount = framesInFlight;
+    commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    
+    result = vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, commandBuffers.data());
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create command buffer: " << getVulkanErrorString(result) << std::endl;
+        return false;
+    }
+    
+    // Create per-frame sync objects. Fences start signaled so the first
+    // wait on every slot returns immediately.
+    VkFenceCreateInfo fenceCreateInfo {};
+    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    
+    VkSemaphoreCreateInfo semaphoreCreateInfo {};
+    semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    
+    for (uint32_t i = 0; i < framesInFlight; ++i) {
+        frames[i].commandBuffer = commandBuffers[i];
+        
+        result = vkCreateFence(device, &fenceCreateInfo, NULL, &frames[i].fence); 
+        if (result != VK_SUCCESS) {
+            std::cout << "Failed to create fence[" << i << "]: " << getVulkanErrorString(result) << std::endl;
+            return false;
+        }
+        
+        result = vkCreateSemaphore(device, &semaphoreCreateInfo, NULL, &frames[i].imageAcquired);
+        if (result != VK_SUCCESS) {
+            std::cout << "Failed to create semaphore[" << i << "]: " << getVulkanErrorString(result) << std::endl;
+            return false;
+        }
+        
+        result = vkCreateSemaphore(device, &semaphoreCreateInfo, NULL, &frames[i].renderFinished);
+        if (result != VK_SUCCESS) {
+            std::cout << "Failed to create semaphore[" << i << "]: " << getVulkanErrorString(result) << std::endl;
+            return false;
+        }
+    }
+    
+    if (!isAsyncComputeSupported()) return true;
+    
+    // Async compute: a pool on the compute family, and upload buffers on the
+    // graphics one.
+    poolCreateInfo.queueFamilyIndex = computeQueueFamilyIndex;
+    result = vkCreateCommandPool(device, &poolCreateInfo, NULL, &computeCommandPool);
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create compute command pool: " << getVulkanErrorString(result) << std::endl;
+        return false;
+    }
+    
+    std::vector<VkCommandBuffer> uploadCommandBuffers(framesInFlight);
+    result = vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, uploadCommandBuffers.data());
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create upload command buffer: " << getVulkanErrorString(result) << std::endl;
+        return false;
+    }
+    
+    commandBufferAllocateInfo.commandPool = computeCommandPool;
+    result = vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, commandBuffers.data());
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create compute command buffer: " << getVulkanErrorString(result) << std::endl;
+        return false;
+    }
+    
+    for (uint32_t i = 0; i < framesInFlight; ++i) {
+        frames[i].uploadCommandBuffer = uploadCommandBuffers[i];
+        frames[i].computeCommandBuffer = commandBuffers[i];
+        
+        result = vkCreateSemaphore(device, &semaphoreCreateInfo, NULL, &frames[i].uploadFinished);
+        if (result != VK_SUCCESS) {
+            std::cout << "Failed to create semaphore[" << i << "]: " << getVulkanErrorString(result) << std::endl;
+            return false;
+        }
+        
+        result = vkCreateSemaphore(device, &semaphoreCreateInfo, NULL, &frames[i].computeFinished);
+        if (result != VK_SUCCESS) {
+            std::cout << "Failed to create semaphore[" << i << "]: " << getVulkanErrorString(result) << std::endl;
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+bool Renderer::initQueries() {
+    return profiler.init(gpu, device, queueFamilyIndex, framesInFlight, pipelineStatisticsSupported);
+}
+
+bool Renderer::initSwapchain() {
+    VkResult result;
+
+    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(gpu, surface, &surfaceCapabilities);
+    
+    // The surface fixes the extent unless it leaves it to the swapchain,
+    // then the window's framebuffer size is clamped to what it allows.
+    if (surfaceCapabilities.currentExtent.width != UINT32_MAX) {
+        extent = surfaceCapabilities.currentExtent;
+    } else {
+        extent.width = std::max(surfaceCapabilities.minImageExtent.width,
+            std::min(surfaceCapabilities.maxImageExtent.width, extent.width));
+        extent.height = std::max(surfaceCapabilities.minImageExtent.height,
+            std::min(surfaceCapabilities.maxImageExtent.height, extent.height));
+    }
+    
+    // A maxImageCount of 0 means there is no upper limit.
+    swapchainImageCount = presentPolicy.imageCount;
+    if (swapchainImageCount == 0)
+        swapchainImageCount = surfaceCapabilities.minImageCount + 1;
+    
+    if (swapchainImageCount < surfaceCapabilities.minImageCount) 
+        swapchainImageCount = surfaceCapabilities.minImageCount;
+        
+    if (surfaceCapabilities.maxImageCount > 0 && swapchainImageCount > surfaceCapabilities.maxImageCount) 
+        swapchainImageCount = surfaceCapabilities.maxImageCount;
+    
+    uint32_t presentModesCount;
+    result = vkGetPhysicalDeviceSurfacePresentModesKHR(gpu, surface, &presentModesCount, NULL);
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create swapchain: " << getVulkanErrorString(result) << std::endl;
+        return false;
+    }
+    
+    std::vector<VkPresentModeKHR> presentModes(presentModesCount);
+    result = vkGetPhysicalDeviceSurfacePresentModesKHR(gpu, surface, &presentModesCount, presentModes.data());
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create swapchain: " << getVulkanErrorString(result) << std::endl;
+        return false;
+    }
+    
+    presentMode = VK_PRESENT_MODE_FIFO_KHR;
+    for(VkPresentModeKHR mode: presentModes) {
+        if (mode == presentPolicy.mode) {
+            presentMode = mode;
+            break;
+        }
+    }
+    if (presentMode != presentPolicy.mode) {
+        std::cout << "Present mode " << getPresentModeName(presentPolicy.mode) << " is not supported, using fifo" << std::endl;
+    }
+    
+    VkSwapchainCreateInfoKHR swapchainCreateInfo {};
+    swapchainCreateInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+    swapchainCreateInfo.surface = surface;
+    swapchainCreateInfo.minImageCount = swapchainImageCount;
+    swapchainCreateInfo.imageFormat = surfaceFormat.format;
+    swapchainCreateInfo.imageColorSpace = surfaceFormat.colorSpace;
+    swapchainCreateInfo.imageExtent= extent;
+    swapchainCreateInfo.imageArrayLayers = 1;
+    swapchainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    captureSupported = (surfaceCapabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) != 0;
+    if (captureSupported) {
+        swapchainCreateInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    }
+    swapchainCreateInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    swapchainCreateInfo.queueFamilyIndexCount = 0;
+    swapchainCreateInfo.pQueueFamilyIndices = NULL;
+    swapchainCreateInfo.preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+    swapchainCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    swapchainCreateInfo.presentMode = presentMode;
+    swapchainCreateInfo.clipped = VK_TRUE;
+    swapchainCreateInfo.oldSwapchain = swapchain;
+    
+    VkSwapchainKHR oldSwapchain = swapchain;
+    result = vkCreateSwapchainKHR(device, &swapchainCreateInfo, NULL, &swapchain);
+    if (oldSwapchain != VK_NULL_HANDLE) {
+        vkDestroySwapchainKHR(device, oldSwapchain, NULL);
+    }
+    if (result != VK_SUCCESS) {
+        swapchain = VK_NULL_HANDLE;
+        std::cout << "Failed to create swapchain: " << getVulkanErrorString(result) << std::endl;
+        return false;
+    }
+    
+    vkGetSwapchainImagesKHR(device, swapchain, &swapchainImageCount, NULL);
+    std::cout << "Swapchain: " << swapchainImageCount << " images, " << getPresentModeName(presentMode) << std::endl;
+    
+    if (!initSwapchainImages()) return false;
+    
+    return true;
+}
+
+// The device has to be idle. Framebuffers are the only other objects that
+// refer to swapchain images; the depth image is sized to the swapchain and
+// follows a new extent through the render graph.
+bool Renderer::recreateSwapchain() {
+    int width = 0, height = 0;
+    glfwGetFramebufferSize(window, &width, &height);
+    swapchainStale = width == 0 || height == 0;
+    if (swapchainStale) return true;
+    extent.width = (uint32_t)width;
+    extent.height = (uint32_t)height;
+    
+    destroySwapchainImages();
+    swapchainImageViews.clear();
+    swapchainFramebuffers.clear();
+    
+    if (!initSwapchain()) return false;
+    
+    VkExtent2D captureExtent = capture.getExtent();
+    if (capture.isActive() && (captureExtent.width != extent.width || captureExtent.height != extent.height ||
+            !captureSupported)) {
+        std::cout << "Swapchain changed, capture stopped" << std::endl;
+        capture.destroy();
+    }
+    
+    if (!buildRenderGraph()) return false;
+    return initFramebuffers();
+}
+
+bool Renderer::initSwapchainImages() {
+    VkResult result;
+
+    swapchainImages.resize(swapchainImageCount);
+    swapchainImageViews.resize(swapchainImageCount);
+    swapchainFramebuffers.resize(swapchainImageCount);
+
+    result = vkGetSwapchainImagesKHR(device, swapchain, &swapchainImageCount, swapchainImages.data());
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create swapchain image view: " << getVulkanErrorString(result) << std::endl;
+        return false;
+    }
+    
+    for (uint32_t i = 0; i < swapchainImageCount; ++i) {
+        VkImageViewCreateInfo imageViewCreateInfo {};
+        imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        imageViewCreateInfo.image = swapchainImages[i];
+        imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        imageViewCreateInfo.format = surfaceFormat.format;
+        imageViewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+        imageViewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+        imageViewCreateInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+        imageViewCreateInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+        imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        imageViewCreateInfo.subresourceRange.baseMipLevel = 0;
+        imageViewCreateInfo.subresourceRange.levelCount = 1;
+        imageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
+        imageViewCreateInfo.subresourceRange.layerCount = 1;
+        
+        result = vkCreateImageView(device, &imageViewCreateInfo, NULL, &swapchainImageViews[i]);
+        if (result != VK_SUCCESS) {
+            std::cout << "Failed to create swapchain image view[" <<  i << "]: " << getVulkanErrorString(result) << std::endl;
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+bool Renderer::initOffscreenImages() {
+    VkResult result;
+    
+    swapchainImageCount = framesInFlight;
+    captureSupported = true;
+    swapchainImages.resize(swapchainImageCount);
+    swapchainImageViews.resize(swapchainImageCount);
+    swapchainFramebuffers.resize(swapchainImageCount);
+    offscreenImageMemory.resize(swapchainImageCount);
+    
+    for (uint32_t i = 0; i < swapchainImageCount; ++i) {
+        VkImageCreateInfo imageCreateInfo {};
+        imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageCreateInfo.format = surfaceFormat.format;
+        imageCreateInfo.extent.width = extent.width;
+        imageCreateInfo.extent.height = extent.height;
+        imageCreateInfo.extent.depth = 1;
+        imageCreateInfo.mipLevels = 1;
+        imageCreateInfo.arrayLayers = 1;
+        imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageCreateInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+            VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        
+        if (!allocator.createImage(imageCreateInfo, Allocator::GPU_ONLY, swapchainImages[i], offscreenImageMemory[i])) {
+            std::cout << "Failed to create offscreen image[" <<  i << "]" << std::endl;
+            return false;
+        }
+        
+        VkImageViewCreateInfo imageViewCreateInfo {};
+        imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        imageViewCreateInfo.image = swapchainImages[i];
+        imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        imageViewCreateInfo.format = surfaceFormat.format;
+        imageViewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+        imageViewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+        imageViewCreateInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+        imageViewCreateInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+        imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        imageViewCreateInfo.subresourceRange.baseMipLevel = 0;
+        imageViewCreateInfo.subresourceRange.levelCount = 1;
+        imageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
+        imageViewCreateInfo.subresourceRange.layerCount = 1;
+        
+        result = vkCreateImageView(device, &imageViewCreateInfo, NULL, &swapchainImageViews[i]);
+        if (result != VK_SUCCESS) {
+            std::cout << "Failed to create offscreen image view[" <<  i << "]: " << getVulkanErrorString(result) << std::endl;
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+bool Renderer::initRenderPass() {
+    VkResult result;
+
+    // Pick the first depth format usable as an optimally tiled attachment.
+    const VkFormat depth_candidates[] {
+        VK_FORMAT_D32_SFLOAT,
+        VK_FORMAT_D24_UNORM_S8_UINT,
+        VK_FORMAT_D16_UNORM
+    };
+    depthFormat = VK_FORMAT_UNDEFINED;
+    for (VkFormat candidate: depth_candidates) {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(gpu, candidate, &properties);
+        if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) {
+            depthFormat = candidate;
+            break;
+        }
+    }
+    if (depthFormat == VK_FORMAT_UNDEFINED) {
+        std::cout << "No supported depth format" << std::endl;
+        return false;
+    }
+    depthAspects = VK_IMAGE_ASPECT_DEPTH_BIT;
+    if (depthFormat == VK_FORMAT_D24_UNORM_S8_UINT) {
+        depthAspects |= VK_IMAGE_ASPECT_STENCIL_BIT;
+    }
+
+    VkAttachmentDescription attachments[2] {};
+    attachments[0].format = surfaceFormat.format;;
+    attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    // renderGraph moves both attachments in and out of these layouts, along
+    // with every other barrier of the frame.
+    attachments[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    attachments[0].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    attachments[1].format = depthFormat;
+    attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+    attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachments[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference color_reference {};
+    color_reference.attachment = 0;
+    color_reference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    
+    VkAttachmentReference depth_reference {};
+    depth_reference.attachment = 1;
+    depth_reference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    
+    VkSubpassDescription subpass {};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.flags = 0;
+    subpass.inputAttachmentCount = 0;
+    subpass.pInputAttachments = NULL;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &color_reference;
+    subpass.pResolveAttachments = NULL;
+    subpass.pDepthStencilAttachment = &depth_reference;
+    subpass.preserveAttachmentCount = 0;
+    subpass.pPreserveAttachments = NULL;
+
+    VkRenderPassCreateInfo rp_info {};
+    rp_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    rp_info.pNext = NULL;
+    rp_info.attachmentCount = 2;
+    rp_info.pAttachments = attachments;
+    rp_info.subpassCount = 1;
+    rp_info.pSubpasses = &subpass;
+    rp_info.dependencyCount = 0;
+    rp_info.pDependencies = NULL;
+    
+    result = vkCreateRenderPass(device, &rp_info, NULL, &renderPass);
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create renderpass" << getVulkanErrorString(result) << std::endl;
+        return false;
+    }
+    
+    return true;
+}
+
+bool Renderer::initRenderGraph() {
+    if (!renderGraph.init(device, allocator)) return false;
+    
+    return buildRenderGraph();
+}
+
+// Declares the frame: which buffers and images every pass touches and how.
+// Passes that do not contribute to the colour target are culled, so the
+// GPU culling passes only run in CULLING_GPU. Depth is the only transient
+// image; it is cleared on load and never stored, so it can live in lazily
+// allocated memory on tilers.
+bool Renderer::buildRenderGraph() {
+    bool gpuCulling = cullingMode == CULLING_GPU;
+    RenderGraph::Queue cullQueue = isAsyncFrame() ? RenderGraph::QUEUE_COMPUTE : RenderGraph::QUEUE_GRAPHICS;
+    
+    renderGraph.begin();
+    
+    instanceResource = renderGraph.importBuffer("instances");
+    visibleListResource = renderGraph.importBuffer("visible_list");
+    gpuVisibleResource = renderGraph.importBuffer("gpu_visible");
+    drawCommandResource = renderGraph.importBuffer("draw_command");
+    visibleCountResource = renderGraph.importBuffer("visible_count");
+    colorResource = renderGraph.importImage("color", VK_IMAGE_ASPECT_COLOR_BIT);
+    captureResource = renderGraph.importBuffer("capture");
+    
+    RenderGraph::ImageDesc depthDesc;
+    depthDesc.format = depthFormat;
+    depthDesc.extent = extent;
+    depthDesc.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+    depthDesc.aspects = depthAspects;
+    depthResource = renderGraph.createImage("depth", depthDesc);
+    
+    uploadPass = renderGraph.addPass("upload", [this](VkCommandBuffer cmdBuffer) {
+        recordInstanceUploads(cmdBuffer);
+    });
+    renderGraph.write(uploadPass, instanceResource, RenderGraph::ACCESS_TRANSFER_WRITE);
+    
+    cullResetPass = renderGraph.addPass("cull_reset", [this](VkCommandBuffer cmdBuffer) {
+        recordCullReset(cmdBuffer);
+    }, cullQueue);
+    renderGraph.write(cullResetPass, drawCommandResource, RenderGraph::ACCESS_TRANSFER_WRITE);
+    
+    RenderGraph::Pass cullPass = renderGraph.addPass("gpu_cull", [this](VkCommandBuffer cmdBuffer) {
+        recordGpuCull(cmdBuffer);
+    }, cullQueue);
+    renderGraph.read(cullPass, instanceResource, RenderGraph::ACCESS_COMPUTE_READ);
+    renderGraph.write(cullPass, drawCommandResource, RenderGraph::ACCESS_COMPUTE_READ_WRITE);
+    renderGraph.write(cullPass, gpuVisibleResource, RenderGraph::ACCESS_COMPUTE_WRITE);
+    
+    RenderGraph::Pass countPass = renderGraph.addPass("visible_count", [this](VkCommandBuffer cmdBuffer) {
+        recordVisibleCount(cmdBuffer);
+    }, cullQueue);
+    renderGraph.read(countPass, drawCommandResource, RenderGraph::ACCESS_TRANSFER_READ);
+    renderGraph.write(countPass, visibleCountResource, RenderGraph::ACCESS_TRANSFER_WRITE);
+    
+    scenePass = renderGraph.addPass("scene", [this](VkCommandBuffer cmdBuffer) {
+        recordScenePass(cmdBuffer);
+    });
+    renderGraph.read(scenePass, instanceResource, RenderGraph::ACCESS_VERTEX_SHADER_READ);
+    if (gpuCulling) {
+        renderGraph.read(scenePass, gpuVisibleResource, RenderGraph::ACCESS_VERTEX_INPUT_READ);
+        renderGraph.read(scenePass, drawCommandResource, RenderGraph::ACCESS_INDIRECT_READ);
+    } else {
+        renderGraph.read(scenePass, visibleListResource, RenderGraph::ACCESS_VERTEX_INPUT_READ);
+    }
+    renderGraph.write(scenePass, colorResource, RenderGraph::ACCESS_COLOR_ATTACHMENT_WRITE);
+    renderGraph.write(scenePass, depthResource, RenderGraph::ACCESS_DEPTH_ATTACHMENT_WRITE);
+    
+    // Only enabled in the frames that are captured. The host reads the
+    // buffer once the frame's fence has been waited on.
+    capturePass = renderGraph.addPass("capture", [this](VkCommandBuffer cmdBuffer) {
+        capture.recordCopy(cmdBuffer, swapchainImages[currentImage]);
+    });
+    renderGraph.read(capturePass, colorResource, RenderGraph::ACCESS_TRANSFER_READ);
+    renderGraph.write(capturePass, captureResource, RenderGraph::ACCESS_TRANSFER_WRITE);
+    
+    // Offscreen targets are left ready to be copied out.
+    renderGraph.setOutput(colorResource, headless ? RenderGraph::ACCESS_TRANSFER_READ : RenderGraph::ACCESS_PRESENT);
+    if (gpuCulling) {
+        renderGraph.setOutput(visibleCountResource, RenderGraph::ACCESS_HOST_READ);
+    }
+    renderGraph.setOutput(captureResource, RenderGraph::ACCESS_HOST_READ);
+    
+    uint32_t generation = renderGraph.getGeneration();
+    bool framebuffersBuilt = !swapchainFramebuffers.empty() && swapchainFramebuffers[0] != VK_NULL_HANDLE;
+    if (!renderGraph.compile()) return false;
+    renderGraphMode = cullingMode;
+    renderGraphAsync = isAsyncFrame();
+    
+    // A new depth image means new framebuffers; compile() already waited
+    // for the device.
+    if (framebuffersBuilt && renderGraph.getGeneration() != generation) {
+        for (VkFramebuffer& framebuffer: swapchainFramebuffers) {
+            vkDestroyFramebuffer(device, framebuffer, NULL);
+            framebuffer = VK_NULL_HANDLE;
+        }
+        if (!initFramebuffers()) return false;
+    }
+    
+    return true;
+}
+
+bool Renderer::initFramebuffers() {
+    VkResult result;
+    
+    for (uint32_t i = 0; i < swapchainImageCount; ++i) {
+        VkImageView attachments[2] { swapchainImageViews[i], renderGraph.getImageView(depthResource) };
+        
+        VkFramebufferCreateInfo framebufferbCreateInfo = {};
+        framebufferbCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebufferbCreateInfo.renderPass = renderPass;
+        framebufferbCreateInfo.attachmentCount = 2;
+        framebufferbCreateInfo.pAttachments = attachments;
+        framebufferbCreateInfo.width = extent.width;
+        framebufferbCreateInfo.height = extent.height;
+        framebufferbCreateInfo.layers = 1;
+        
+        result = vkCreateFramebuffer(device, &framebufferbCreateInfo, NULL, &swapchainFramebuffers[i]);
+        if (result != VK_SUCCESS) {
+            std::cout << "Failed to create framebuffer[" <<  i << "]: " << getVulkanErrorString(result) << std::endl;
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+bool Renderer::uploadBuffer(VkBuffer buffer, const void* data, VkDeviceSize size) {
+    VkResult result;
+    
+    VkBuffer stagingBuffer;
+    Allocation stagingMemory;
+    if (!allocator.createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, Allocator::CPU_TO_GPU, stagingBuffer, stagingMemory)) {
+        std::cout << "Failed to create staging buffer" << std::endl;
+        return false;
+    }
+    memcpy(stagingMemory.mapped, data, size);
+    
+    VkCommandBufferAllocateInfo commandBufferAllocateInfo {};
+    commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    commandBufferAllocateInfo.commandPool = commandPool;
+    commandBufferAllocateInfo.commandBufferCount = 1;
+    commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    
+    VkCommandBuffer cmdBuffer;
+    result = vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, &cmdBuffer);
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create upload command buffer: " << getVulkanErrorString(result) << std::endl;
+        allocator.destroyBuffer(stagingBuffer, stagingMemory);
+        return false;
+    }
+    
+    VkCommandBufferBeginInfo beginInfo {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(cmdBuffer, &beginInfo);
+    
+    VkBufferCopy region {};
+    region.size = size;
+    vkCmdCopyBuffer(cmdBuffer, stagingBuffer, buffer, 1, &region);
+    
+    vkEndCommandBuffer(cmdBuffer);
+    
+    VkSubmitInfo submitInfo {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cmdBuffer;
+    
+    // The queue idle wait also makes the copy visible to every later submit.
+    result = vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+    if (result == VK_SUCCESS) {
+        result = vkQueueWaitIdle(queue);
+    }
+    
+    vkFreeCommandBuffers(device, commandPool, 1, &cmdBuffer);
+    allocator.destroyBuffer(stagingBuffer, stagingMemory);
+    
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to upload buffer: " << getVulkanErrorString(result) << std::endl;
+        return false;
+    }
+    
+    return true;
+}
+
+bool Renderer::initMesh() {
+    return readMesh() && initMeshBuffers();
+}
+
+bool Renderer::readMesh() {
+    // The mapped streams go straight into the staging copies; nothing is
+    // parsed or copied on the CPU side first.
+    if (meshFile.open(meshPath)) {
+        const MeshFile::Header& header = meshFile.getHeader();
+        
+        if (header.vertexCount == 0 || header.indexCount == 0) {
+            std::cout << "Mesh file " << meshPath << " has no triangles, using the built-in cube" << std::endl;
+            meshFile.close();
+        } else {
+            vertexCount = header.vertexCount;
+            indexCount = header.indexCount;
+            vertexFormat = header.vertexFormat;
+            indexType = header.indexSize == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+            meshMin = Math::Vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+            meshMax = Math::Vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+            
+            meshVertexData = meshFile.getVertexData();
+            meshVertexBytes = header.vertexBytes;
+            meshIndexData = meshFile.getIndexData();
+            meshIndexBytes = header.indexBytes;
+            return true;
+        }
+    } else {
+        std::cout << "Mesh file " << meshPath << " not found, using the built-in cube" << std::endl;
+    }
+    
+    // g_vertex_buffer_data repeats corners for every triangle; the
+    // optimizer welds them and orders the result the way meshconv would.
+    uint32_t expandedCount = sizeof(g_vertex_buffer_data) / (3 * sizeof(float));
+    MeshOptimizer::Mesh mesh = MeshOptimizer::fromTriangles(g_vertex_buffer_data, expandedCount);
+    MeshOptimizer::optimize(mesh);
+    
+    cubeIndices.assign(mesh.indices.begin(), mesh.indices.end());
+    cubeVertices = mesh.positions;
+    const std::vector<float>& vertices = cubeVertices;
+    vertexCount = (uint32_t)mesh.getVertexCount();
+    indexCount = (uint32_t)cubeIndices.size();
+    vertexFormat = MeshFile::FORMAT_FLOAT3;
+    indexType = VK_INDEX_TYPE_UINT16;
+    
+    std::cout << "Built-in cube: " << expandedCount << " vertices welded to " << vertexCount << ", "
+        << sizeof(g_vertex_buffer_data) << " bytes to " << vertices.size() * sizeof(float) + cubeIndices.size() * sizeof(uint16_t)
+        << " bytes with indices" << std::endl;
+    
+    meshMin = Math::Vec3(vertices[0], vertices[1], vertices[2]);
+    meshMax = meshMin;
+    for (size_t i = 0; i < vertices.size(); i += 3) {
+        meshMin = Math::Vec3(std::min(meshMin.x, vertices[i]), std::min(meshMin.y, vertices[i + 1]), std::min(meshMin.z, vertices[i + 2]));
+        meshMax = Math::Vec3(std::max(meshMax.x, vertices[i]), std::max(meshMax.y, vertices[i + 1]), std::max(meshMax.z, vertices[i + 2]));
+    }
+    
+    meshVertexData = cubeVertices.data();
+    meshVertexBytes = cubeVertices.size() * sizeof(float);
+    meshIndexData = cubeIndices.data();
+    meshIndexBytes = cubeIndices.size() * sizeof(uint16_t);
+    return true;
+}
+
+// The CPU side of the mesh is let go of either way.
+bool Renderer::initMeshBuffers() {
+    bool uploaded = true;
+    if (software) {
+        uploaded = rasterizer.setMesh(meshVertexData, vertexFormat, vertexCount, meshIndexData,
+            indexType == VK_INDEX_TYPE_UINT16 ? 2 : 4, indexCount);
+    } else if (!allocator.createBuffer(meshVertexBytes, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            Allocator::GPU_ONLY, vertexBuffer, vertexBufferMemory)) {
+        std::cout << "Failed to create vertex buffer" << std::endl;
+        uploaded = false;
+    } else if (!allocator.createBuffer(meshIndexBytes, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            Allocator::GPU_ONLY, indexBuffer, indexBufferMemory)) {
+        std::cout << "Failed to create index buffer" << std::endl;
+        uploaded = false;
+    } else {
+        uploaded = uploadBuffer(vertexBuffer, meshVertexData, meshVertexBytes) &&
+            uploadBuffer(indexBuffer, meshIndexData, meshIndexBytes);
+    }
+    
+    meshFile.close();
+    cubeVertices.clear();
+    cubeIndices.clear();
+    meshVertexData = NULL;
+    meshIndexData = NULL;
+    return uploaded;
+}
+
+// Lays the cubes out on a square grid in clip space.
+bool Renderer::initInstances(uint32_t instanceCount) {
+    if (instanceCount < 1) instanceCount = 1;
+    
+    instances.resize(instanceCount);
+    instanceTransforms.resize(instanceCount);
+    instanceBounds.resize(instanceCount);
+    instanceDirty.assign(instanceCount, 0);
+    dirtyInstances.clear();
+    
+    uint32_t columns = (uint32_t)std::ceil(std::sqrt((double)instanceCount));
+    float cell = 2.0f / (float)columns;
+    float scale = cell * 0.35f;
+    
+    for (uint32_t i = 0; i < instanceCount; ++i) {
+        uint32_t column = i % columns;
+        uint32_t row = i / columns;
+        
+        Math::Vec3 position(-1.0f + cell * ((float)column + 0.5f), -1.0f + cell * ((float)row + 0.5f), 0.0f);
+        instanceTransforms.set(i, position, Math::Quat(), scale);
+        
+        InstanceData& data = instances[i];
+        data.color[0] = (float)((i * 97) % 256) / 255.0f;
+        data.color[1] = (float)((i * 57) % 256) / 255.0f;
+        data.color[2] = (float)((i * 29) % 256) / 255.0f;
+        data.color[3] = 1.0f;
+    }
+    
+    // Everything is uploaded below, nothing has to be streamed.
+    composeInstances(0, instanceCount);
+    instanceDirty.assign(instanceCount, 0);
+    dirtyInstances.clear();
+    
+    // Until the first cull() everything is drawn.
+    instanceBvhBuilt = false;
+    visibleInstances.resize(instanceCount);
+    for (uint32_t i = 0; i < instanceCount; ++i) {
+        visibleInstances[i] = i;
+    }
+    
+    if (software) return true;
+    
+    VkDeviceSize size = (VkDeviceSize)instanceCount * sizeof(InstanceData);
+    if (!allocator.createBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            Allocator::GPU_ONLY, instanceBuffer, instanceBufferMemory, sharedQueueFamilies)) {
+        std::cout << "Failed to create instance buffer" << std::endl;
+        return false;
+    }
+    if (!uploadBuffer(instanceBuffer, instances.data(), size)) return false;
+    
+    // Room for streaming a quarter of the instances every frame, but at
+    // least 1 MiB so small scenes are never starved.
+    VkDeviceSize uploadSize = std::max<VkDeviceSize>(size / 4, 1 << 20);
+    if (!uploadArena.init(allocator, uploadSize, framesInFlight, VK_BUFFER_USAGE_TRANSFER_SRC_BIT)) {
+        std::cout << "Failed to create instance upload arena" << std::endl;
+        return false;
+    }
+    
+    if (!visibleArena.init(allocator, (VkDeviceSize)instanceCount * sizeof(uint32_t), framesInFlight,
+            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT)) {
+        std::cout << "Failed to create visible instance arena" << std::endl;
+        return false;
+    }
+    
+    // Buffers of the GPU culling path, shared with the compute queue. The
+    // draw command never changes apart from its instance count, which the
+    // cull pass fills in.
+    VkDrawIndexedIndirectCommand drawCommand {};
+    drawCommand.indexCount = indexCount;
+    drawCommand.instanceCount = 0;
+    drawCommand.firstIndex = 0;
+    drawCommand.vertexOffset = 0;
+    drawCommand.firstInstance = 0;
+    
+    for (FrameData& frame: frames) {
+        if (!allocator.createBuffer((VkDeviceSize)instanceCount * sizeof(uint32_t),
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                Allocator::GPU_ONLY, frame.gpuVisibleBuffer, frame.gpuVisibleBufferMemory, sharedQueueFamilies)) {
+            std::cout << "Failed to create GPU visible instance buffer" << std::endl;
+            return false;
+        }
+        if (!allocator.createBuffer(sizeof(VkDrawIndexedIndirectCommand),
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                Allocator::GPU_ONLY, frame.drawCommandBuffer, frame.drawCommandBufferMemory, sharedQueueFamilies)) {
+            std::cout << "Failed to create draw command buffer" << std::endl;
+            return false;
+        }
+        if (!uploadBuffer(frame.drawCommandBuffer, &drawCommand, sizeof(drawCommand))) return false;
+        frame.drawCommandIndexCount = indexCount;
+    }
+    if (!allocator.createBuffer(framesInFlight * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            Allocator::GPU_TO_CPU, visibleCountBuffer, visibleCountBufferMemory, sharedQueueFamilies)) {
+        std::cout << "Failed to create visible count buffer" << std::endl;
+        return false;
+    }
+    memset(visibleCountBufferMemory.mapped, 0, framesInFlight * sizeof(uint32_t));
+    gpuVisibleInstances = 0;
+    
+    writeDescriptors();
+    
+    return true;
+}
+
+bool Renderer::initDescriptors() {
+    VkResult result;
+    
+    // The instance buffer and the frame's uniforms.
+    VkDescriptorSetLayoutBinding bindings[2] {};
+    bindings[0].binding = 0;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[0].descriptorCount = 1;
+    bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    bindings[1].binding = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    bindings[1].descriptorCount = 1;
+    bindings[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    
+    VkDescriptorSetLayoutCreateInfo layoutCreateInfo {};
+    layoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutCreateInfo.bindingCount = 2;
+    layoutCreateInfo.pBindings = bindings;
+    
+    result = vkCreateDescriptorSetLayout(device, &layoutCreateInfo, NULL, &descriptorSetLayout);
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create descriptor set layout: " << getVulkanErrorString(result) << std::endl;
+        return false;
+    }
+    
+    // Instances, visible instances and the draw command.
+    VkDescriptorSetLayoutBinding cullBindings[3] {};
+    for (uint32_t i = 0; i < 3; ++i) {
+        cullBindings[i].binding = i;
+        cullBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        cullBindings[i].descriptorCount = 1;
+        cullBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    layoutCreateInfo.bindingCount = 3;
+    layoutCreateInfo.pBindings = cullBindings;
+    
+    result = vkCreateDescriptorSetLayout(device, &layoutCreateInfo, NULL, &cullDescriptorSetLayout);
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create cull descriptor set layout: " << getVulkanErrorString(result) << std::endl;
+        return false;
+    }
+    
+    VkDescriptorPoolSize poolSize {};
+    poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSize.descriptorCount = 3 * framesInFlight;
+    
+    VkDescriptorPoolCreateInfo poolCreateInfo {};
+    poolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolCreateInfo.maxSets = framesInFlight;
+    poolCreateInfo.poolSizeCount = 1;
+    poolCreateInfo.pPoolSizes = &poolSize;
+    
+    result = vkCreateDescriptorPool(device, &poolCreateInfo, NULL, &descriptorPool);
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create descriptor pool: " << getVulkanErrorString(result) << std::endl;
+        return false;
+    }
+    
+    VkDescriptorSetAllocateInfo allocateInfo {};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocateInfo.descriptorPool = descriptorPool;
+    allocateInfo.descriptorSetCount = 1;
+    allocateInfo.pSetLayouts = &cullDescriptorSetLayout;
+    
+    for (FrameData& frame: frames) {
+        result = vkAllocateDescriptorSets(device, &allocateInfo, &frame.cullDescriptorSet);
+        if (result != VK_SUCCESS) {
+            std::cout << "Failed to allocate descriptor sets: " << getVulkanErrorString(result) << std::endl;
+            return false;
+        }
+    }
+    
+    // Transient sets only use descriptorSetLayout so far; pools grow when
+    // a frame needs more than 16 of them.
+    std::vector<VkDescriptorPoolSize> setSizes(2);
+    setSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    setSizes[0].descriptorCount = 1;
+    setSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    setSizes[1].descriptorCount = 1;
+    for (uint32_t i = 0; i < framesInFlight; ++i) {
+        if (!frames[i].descriptors.init(device, setSizes, 16)) return false;
+    }
+    
+    if (!uniforms.init(gpu, allocator, 64 * 1024, framesInFlight)) {
+        std::cout << "Failed to create uniform ring" << std::endl;
+        return false;
+    }
+    
+    return true;
+}
+
+// Allocates the frame's set 0 and writes its FrameUniforms. Called once the
+// frame's fence has been waited on, which is what makes resetting its pools
+// and its region of the uniform ring safe.
+bool Renderer::writeFrameDescriptors(FrameData& frame) {
+    frame.descriptors.reset();
+    uniforms.beginFrame(currentFrame);
+    
+    FrameUniforms frameUniforms;
+    memcpy(frameUniforms.viewProjection, viewProjection.m, sizeof(frameUniforms.viewProjection));
+    if (!uniforms.push(frameUniforms, frame.uniformOffset)) {
+        std::cout << "Uniform ring is full" << std::endl;
+        return false;
+    }
+    if (!frame.descriptors.allocate(descriptorSetLayout, frame.descriptorSet)) return false;
+    
+    VkDescriptorBufferInfo bufferInfos[2] {};
+    bufferInfos[0].buffer = instanceBuffer;
+    bufferInfos[0].offset = 0;
+    bufferInfos[0].range = VK_WHOLE_SIZE;
+    bufferInfos[1].buffer = uniforms.getBuffer();
+    bufferInfos[1].offset = 0;
+    bufferInfos[1].range = sizeof(FrameUniforms);
+    
+    VkWriteDescriptorSet descriptorWrites[2] {};
+    for (uint32_t i = 0; i < 2; ++i) {
+        descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[i].dstSet = frame.descriptorSet;
+        descriptorWrites[i].dstBinding = i;
+        descriptorWrites[i].descriptorCount = 1;
+        descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+    }
+    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    
+    vkUpdateDescriptorSets(device, 2, descriptorWrites, 0, NULL);
+    
+    lastDescriptorSets = frame.descriptors.getFrameSetCount();
+    lastUniformBytes = uniforms.getFrameBytes();
+    return true;
+}
+
+// Points the cull descriptor sets at the buffers created by initInstances().
+void Renderer::writeDescriptors() {
+    for (FrameData& frame: frames) {
+        VkDescriptorBufferInfo bufferInfos[3] {};
+        bufferInfos[0].buffer = instanceBuffer;
+        bufferInfos[1].buffer = frame.gpuVisibleBuffer;
+        bufferInfos[2].buffer = frame.drawCommandBuffer;
+        for (uint32_t i = 0; i < 3; ++i) {
+            bufferInfos[i].offset = 0;
+            bufferInfos[i].range = VK_WHOLE_SIZE;
+        }
+        
+        VkWriteDescriptorSet descriptorWrites[3] {};
+        for (uint32_t i = 0; i < 3; ++i) {
+            descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[i].dstSet = frame.cullDescriptorSet;
+            descriptorWrites[i].dstBinding = i;
+            descriptorWrites[i].descriptorCount = 1;
+            descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+        }
+        
+        vkUpdateDescriptorSets(device, 3, descriptorWrites, 0, NULL);
+    }
+}
+
+bool Renderer::setInstanceCount(uint32_t instanceCount) {
+    if (commandStream.isRecording()) {
+        commandStream.record(CommandStream::OP_SET_INSTANCE_COUNT, instanceCount);
+    }
+    
+    waitReady();
+    destroyInstances();
+    return initInstances(instanceCount);
+}
+
+bool Renderer::loadMesh(const std::string& path) {
+    if (commandStream.isRecording()) {
+        commandStream.recordPath(CommandStream::OP_LOAD_MESH, path);
+    }
+    
+    waitReady();
+    destroyMesh();
+    pendingMesh = Streamer::INVALID_HANDLE;
+    
+    meshPath = path;
+    if (!initMesh()) return false;
+    
+    // Instance bounds depend on the mesh bounds. The indirect commands
+    // carry the index count, the next cull of every frame updates them.
+    updateInstanceBounds(0, (uint32_t)instances.size());
+    instanceBvhBuilt = false;
+    
+    return true;
+}
+
+void Renderer::loadMeshAsync(const std::string& path) {
+    // There is nothing to overlap the load with.
+    if (software) {
+        loadMesh(path);
+        return;
+    }
+    
+    pendingMesh = streamer.requestMesh(path);
+    pendingMeshPath = path;
+}
+
+bool Renderer::initStreamer() {
+    return streamer.init(device, allocator, transferQueue, transferQueueFamilyIndex, queueFamilyIndex);
+}
+
+void Renderer::destroyStreamer() {
+    streamer.destroy();
+    for (FrameData& frame: frames) {
+        destroyRetiredBuffers(frame);
+    }
+}
+
+void Renderer::destroyRetiredBuffers(FrameData& frame) {
+    for (RetiredBuffer& retired: frame.retiredBuffers) {
+        allocator.destroyBuffer(retired.buffer, retired.allocation);
+    }
+    frame.retiredBuffers.clear();
+}
+
+// Runs after the streamer recorded its acquires, so the new buffers can be
+// used by everything recorded from here on.
+void Renderer::updateStreamedMesh(FrameData& frame) {
+    if (pendingMesh == Streamer::INVALID_HANDLE) return;
+    
+    if (streamer.getState(pendingMesh) == Streamer::FAILED) {
+        std::cout << "Streaming mesh " << pendingMeshPath << " failed, keeping " << meshPath << std::endl;
+        pendingMesh = Streamer::INVALID_HANDLE;
+        return;
+    }
+    
+    Streamer::Mesh mesh;
+    if (!streamer.takeMesh(pendingMesh, mesh)) return;
+    pendingMesh = Streamer::INVALID_HANDLE;
+    
+    frame.retiredBuffers.push_back(RetiredBuffer { vertexBuffer, vertexBufferMemory });
+    frame.retiredBuffers.push_back(RetiredBuffer { indexBuffer, indexBufferMemory });
+    
+    vertexBuffer = mesh.vertexBuffer;
+    vertexBufferMemory = mesh.vertexMemory;
+    indexBuffer = mesh.indexBuffer;
+    indexBufferMemory = mesh.indexMemory;
+    vertexCount = mesh.vertexCount;
+    indexCount = mesh.indexCount;
+    vertexFormat = mesh.vertexFormat;
+    indexType = mesh.indexType;
+    meshMin = Math::Vec3(mesh.boundsMin[0], mesh.boundsMin[1], mesh.boundsMin[2]);
+    meshMax = Math::Vec3(mesh.boundsMax[0], mesh.boundsMax[1], mesh.boundsMax[2]);
+    meshPath = pendingMeshPath;
+    
+    updateInstanceBounds(0, (uint32_t)instances.size());
+    instanceBvhBuilt = false;
+    
+    if (commandStream.isRecording()) {
+        commandStream.recordPath(CommandStream::OP_STREAMED_MESH, meshPath);
+    }
+}
+
+bool Renderer::initTextures() {
+    return textures.init(gpu, device, allocator, queue, queueFamilyIndex);
+}
+
+void Renderer::destroyTextures() {
+    textures.destroy();
+}
+
+bool Renderer::startCapture(const FrameCapture::Settings& settings) {
+    if (software) {
+        std::cout << "The software backend cannot capture frames" << std::endl;
+        return false;
+    }
+    if (!captureSupported) {
+        std::cout << "The swapchain images cannot be captured" << std::endl;
+        return false;
+    }
+    
+    waitReady();
+    return capture.init(allocator, settings, extent, surfaceFormat.format, framesInFlight);
+}
+
+void Renderer::stopCapture() {
+    waitReady();
+    capture.destroy();
+}
+
+void Renderer::destroyCapture() {
+    capture.destroy();
+}
+
+bool Renderer::startRecording(const std::string& path) {
+    if (!commandStream.open(path, extent.width, extent.height, framesInFlight)) return false;
+    
+    // What a new renderer has to be told to end up in the current state.
+    commandStream.recordPath(CommandStream::OP_LOAD_MESH, meshPath);
+    commandStream.record(CommandStream::OP_SET_INSTANCE_COUNT, getInstanceCount());
+    commandStream.recordInstances(instanceTransforms, instances);
+    commandStream.record(CommandStream::OP_SET_ANIMATED_INSTANCES, animatedInstances);
+    commandStream.record(CommandStream::OP_SET_ANIMATION_FRAME, animationFrame);
+    commandStream.record(CommandStream::OP_SET_INSTANCES_PER_DRAW, instancesPerDraw);
+    commandStream.record(CommandStream::OP_SET_CULLING_MODE, cullingMode);
+    commandStream.record(CommandStream::OP_SET_SHADING_MODE, shadingMode);
+    commandStream.record(CommandStream::OP_SET_ASYNC_COMPUTE, asyncCompute ? 1 : 0);
+    commandStream.recordViewProjection(viewProjection);
+    
+    return true;
+}
+
+void Renderer::stopRecording() {
+    commandStream.close();
+}
+
+// Restores the snapshot written by startRecording(): transforms and
+// instance data as they were, including model matrices set directly.
+bool Renderer::replayInstances(const CommandStream::Command& command) {
+    uint32_t count = command.value;
+    if (count == 0 || command.size != count * (8 * sizeof(float) + sizeof(InstanceData))) return false;
+    if (count != getInstanceCount() && !setInstanceCount(count)) return false;
     
-    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(gpu, surface, &surfaceCapabilities);
-    
-    uint32_t formatCount = 0;
-    vkGetPhysicalDeviceSurfaceFormatsKHR(gpu, surface, &formatCount, NULL);
-    if (formatCount == 0) {
-        std::cout << "Failed to init surface: " << "Surface formats missing." << std::endl;
-        return false;
+    std::vector<float>* arrays[8] {
+        &instanceTransforms.positionX, &instanceTransforms.positionY, &instanceTransforms.positionZ,
+        &instanceTransforms.rotationX, &instanceTransforms.rotationY, &instanceTransforms.rotationZ,
+        &instanceTransforms.rotationW, &instanceTransforms.scale
+    };
+    const uint8_t* data = command.payload;
+    for (std::vector<float>* array: arrays) {
+        memcpy(array->data(), data, count * sizeof(float));
+        data += count * sizeof(float);
     }
+    memcpy(instances.data(), data, count * sizeof(InstanceData));
     
-    std::vector<VkSurfaceFormatKHR> formats (formatCount);
-    vkGetPhysicalDeviceSurfaceFormatsKHR(gpu, surface, &formatCount, formats.data());
-    if (formats[0].format == VK_FORMAT_UNDEFINED) {
-        surfaceFormat.format = VK_FORMAT_B8G8R8A8_UNORM;
-        surfaceFormat.colorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
-    } else {
-        surfaceFormat = formats[0];
+    updateInstanceBounds(0, count);
+    for (uint32_t i = 0; i < count; ++i) {
+        markInstanceDirty(i);
     }
+    instanceBvhBuilt = false;
     
     return true;
 }
 
-bool Renderer::initCommands() {
-    VkResult result;
+bool Renderer::replayFrame(CommandStream& stream) {
+    CommandStream::Command command;
     
-    // Create fence
-    VkFenceCreateInfo fenceCreateInfo {};
-    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    while (stream.read(command)) {
+        bool valid = true;
+        
+        switch (command.op) {
+            case CommandStream::OP_POLL_EVENTS:
+                pollEvents();
+                break;
+            case CommandStream::OP_UPDATE:
+                update();
+                break;
+            case CommandStream::OP_CULL:
+                cull();
+                break;
+            case CommandStream::OP_DRAW: {
+                // A mesh swap is recorded by the draw that made it.
+                CommandStream::Command next;
+                if (stream.peek(next) && next.op == CommandStream::OP_STREAMED_MESH) {
+                    stream.read(next);
+                    loadMesh(std::string((const char*)next.payload, next.size));
+                }
+                draw();
+                return true;
+            }
+            case CommandStream::OP_SET_INSTANCE_COUNT:
+                valid = setInstanceCount(command.value);
+                break;
+            case CommandStream::OP_SET_INSTANCES_PER_DRAW:
+                setInstancesPerDraw(command.value);
+                break;
+            case CommandStream::OP_SET_ANIMATED_INSTANCES:
+                setAnimatedInstanceCount(command.value);
+                break;
+            case CommandStream::OP_SET_ANIMATION_FRAME:
+                animationFrame = command.value;
+                break;
+            case CommandStream::OP_SET_CULLING_MODE:
+                valid = command.value <= CULLING_GPU;
+                if (valid) setCullingMode((CullingMode)command.value);
+                break;
+            case CommandStream::OP_SET_SHADING_MODE:
+                valid = command.value <= SHADING_INSTANCE;
+                if (valid) setShadingMode((ShadingMode)command.value);
+                break;
+            case CommandStream::OP_SET_ASYNC_COMPUTE:
+                setAsyncCompute(command.value != 0);
+                break;
+            case CommandStream::OP_SET_INSTANCE: {
+                valid = command.value < getInstanceCount() && command.size == sizeof(InstanceData);
+                if (!valid) break;
+                
+                InstanceData data;
+                memcpy(&data, command.payload, sizeof(data));
+                setInstance(command.value, data);
+                break;
+            }
+            case CommandStream::OP_SET_INSTANCE_TRANSFORM: {
+                float transform[8];
+                valid = command.value < getInstanceCount() && command.size == sizeof(transform);
+                if (!valid) break;
+                
+                memcpy(transform, command.payload, sizeof(transform));
+                setInstanceTransform(command.value, Math::Vec3(transform[0], transform[1], transform[2]),
+                    Math::Quat(transform[3], transform[4], transform[5], transform[6]), transform[7]);
+                break;
+            }
+            case CommandStream::OP_SET_INSTANCES:
+                valid = replayInstances(command);
+                break;
+            case CommandStream::OP_SET_VIEW_PROJECTION: {
+                Math::Mat4 matrix;
+                valid = command.size == sizeof(matrix.m);
+                if (!valid) break;
+                
+                memcpy(matrix.m, command.payload, sizeof(matrix.m));
+                setViewProjection(matrix);
+                break;
+            }
+            case CommandStream::OP_LOAD_MESH:
+            case CommandStream::OP_STREAMED_MESH:
+                loadMesh(std::string((const char*)command.payload, command.size));
+                break;
+        }
+        
+        if (!valid) {
+            std::cout << "Invalid " << CommandStream::getOpName(command.op) << " command in "
+                      << stream.getPath() << std::endl;
+            return false;
+        }
+    }
     
-    result = vkCreateFence(device, &fenceCreateInfo, NULL, &fence); 
-    if (result != VK_SUCCESS) return false;
+    return false;
+}
 
-    // Create command pool
+// One command pool per frame and thread of threadPool.
+bool Renderer::initRecordThreads() {
+    VkResult result;
+    
     VkCommandPoolCreateInfo poolCreateInfo {};
     poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    poolCreateInfo.queueFamilyIndex = this->queueFamilyIndex ;
-    poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolCreateInfo.queueFamilyIndex = queueFamilyIndex;
+    poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
     
-    result = vkCreateCommandPool(device, &poolCreateInfo, NULL, &commandPool);
-    if (result != VK_SUCCESS) {
-        std::cout << "Failed to create command pool: " << getVulkanErrorString(result) << std::endl;
-        return false;
-     }
-     
-    // Create command buffer
     VkCommandBufferAllocateInfo commandBufferAllocateInfo {};
     commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    commandBufferAllocateInfo.commandPool = commandPool;
     commandBufferAllocateInfo.commandBufferCount = 1;
-    commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
     
-    result = vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, &commandBuffer);
-    if (result != VK_SUCCESS) {
-        std::cout << "Failed to create command buffer: " << getVulkanErrorString(result) << std::endl;
-        return false;
+    for (uint32_t i = 0; i < framesInFlight; ++i) {
+        frames[i].threadCommandPools.resize(recordThreadCount, VK_NULL_HANDLE);
+        frames[i].secondaryCommandBuffers.resize(recordThreadCount, VK_NULL_HANDLE);
+        frames[i].secondaryRecorded.resize(recordThreadCount, 0);
+        
+        for (uint32_t j = 0; j < recordThreadCount; ++j) {
+            result = vkCreateCommandPool(device, &poolCreateInfo, NULL, &frames[i].threadCommandPools[j]);
+            if (result != VK_SUCCESS) {
+                std::cout << "Failed to create thread command pool[" << i << "][" << j << "]: " << getVulkanErrorString(result) << std::endl;
+                return false;
+            }
+            
+            commandBufferAllocateInfo.commandPool = frames[i].threadCommandPools[j];
+            result = vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, &frames[i].secondaryCommandBuffers[j]);
+            if (result != VK_SUCCESS) {
+                std::cout << "Failed to create secondary command buffer[" << i << "][" << j << "]: " << getVulkanErrorString(result) << std::endl;
+                return false;
+            }
+        }
     }
-     
+    
     return true;
 }
 
-bool Renderer::initSwapchain() {
-    VkResult result;
-
-    if (swapchainImageCount > surfaceCapabilities.maxImageCount) 
-        swapchainImageCount = surfaceCapabilities.maxImageCount;
-        
-    if (swapchainImageCount < surfaceCapabilities.minImageCount + 1) 
-        swapchainImageCount = surfaceCapabilities.minImageCount + 1;
-    
-    VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
-    
-    uint32_t presentModesCount;
-    result = vkGetPhysicalDeviceSurfacePresentModesKHR(gpu, surface, &presentModesCount, NULL);
-    if (result != VK_SUCCESS) {
-        std::cout << "Failed to create swapchain: " << getVulkanErrorString(result) << std::endl;
-        return false;
-    }
+bool Renderer::setRecordThreadCount(uint32_t threadCount) {
+    if (threadCount < 1) threadCount = 1;
+    if (threadCount == recordThreadCount) return true;
     
-    std::vector<VkPresentModeKHR> presentModes(presentModesCount);
-    result = vkGetPhysicalDeviceSurfacePresentModesKHR(gpu, surface, &presentModesCount, presentModes.data());
-    if (result != VK_SUCCESS) {
-        std::cout << "Failed to create swapchain: " << getVulkanErrorString(result) << std::endl;
-        return false;
-    }
+    waitReady();
+    destroyRecordThreads();
+    threadPool.destroy();
     
-    for(VkPresentModeKHR mode: presentModes) {
-        if (mode == VK_PRESENT_MODE_MAILBOX_KHR) {
-            presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
-            break;
-        }
-    }
+    recordThreadCount = threadCount;
+    if (!threadPool.init(recordThreadCount)) return false;
+    return software || initRecordThreads();
+}
+
+// pipelineCache and shaders have been initialized by their own tasks.
+bool Renderer::initPipeline() {
+    VkResult result;
     
-    VkSwapchainCreateInfoKHR swapchainCreateInfo {};
-    swapchainCreateInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-    swapchainCreateInfo.surface = surface;
-    swapchainCreateInfo.minImageCount = swapchainImageCount;
-    swapchainCreateInfo.imageFormat = surfaceFormat.format;
-    swapchainCreateInfo.imageColorSpace = surfaceFormat.colorSpace;
-    swapchainCreateInfo.imageExtent= surfaceCapabilities.currentExtent;
-    swapchainCreateInfo.imageArrayLayers = 1;
-    swapchainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-    swapchainCreateInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    swapchainCreateInfo.queueFamilyIndexCount = 0;
-    swapchainCreateInfo.pQueueFamilyIndices = NULL;
-    swapchainCreateInfo.preTransform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
-    swapchainCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-    swapchainCreateInfo.presentMode = presentMode;
-    swapchainCreateInfo.clipped = VK_TRUE;
-    swapchainCreateInfo.oldSwapchain = VK_NULL_HANDLE;
+    // Per-object data comes from the instance buffer, the view-projection
+    // matrix from the frame's uniforms.
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo {};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &descriptorSetLayout;
     
-    result = vkCreateSwapchainKHR(device, &swapchainCreateInfo, NULL, &swapchain);
+    result = vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, NULL, &pipelineLayout);
     if (result != VK_SUCCESS) {
-        std::cout << "Failed to create swapchain: " << getVulkanErrorString(result) << std::endl;
+        std::cout << "Failed to create pipeline layout: " << getVulkanErrorString(result) << std::endl;
         return false;
     }
     
-    vkGetSwapchainImagesKHR(device, swapchain, &swapchainImageCount, NULL);
-    
-    if (!initSwapchainImages()) return false;
+    scenePipelines = shaders.addFamily("scene", [this](const std::string& name, const ShaderCache::Variant& variant,
+            const VkSpecializationInfo& specialization, VkPipeline& pipeline) {
+        return createScenePipeline(name, variant.state, specialization, pipeline);
+    });
     
     return true;
 }
 
-bool Renderer::initSwapchainImages() {
-    VkResult result;
-
-    swapchainImages.resize(swapchainImageCount);
-    swapchainImageViews.resize(swapchainImageCount);
-    swapchainFramebuffers.resize(swapchainImageCount);
+ShaderCache::Variant Renderer::getSceneVariant() const {
+    ShaderCache::Variant variant;
+    variant.state = vertexFormat;
+    variant.constants.push_back(shadingMode);
+    return variant;
+}
 
-    result = vkGetSwapchainImagesKHR(device, swapchain, &swapchainImageCount, swapchainImages.data());
-    if (result != VK_SUCCESS) {
-        std::cout << "Failed to create swapchain image view: " << getVulkanErrorString(result) << std::endl;
-        return false;
-    }
+bool Renderer::createScenePipeline(const std::string& name, uint32_t format,
+        const VkSpecializationInfo& specialization, VkPipeline& pipeline) {
+    VkShaderModule vertexShader = shaders.getModule("shaders/cube.vert.spv");
+    VkShaderModule fragmentShader = shaders.getModule("shaders/cube.frag.spv");
+    if (vertexShader == VK_NULL_HANDLE || fragmentShader == VK_NULL_HANDLE) return false;
     
-    for (uint32_t i = 0; i < swapchainImageCount; ++i) {
-        VkImageViewCreateInfo imageViewCreateInfo {};
-        imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-        imageViewCreateInfo.image = swapchainImages[i];
-        imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-        imageViewCreateInfo.format = surfaceFormat.format;
-        imageViewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-        imageViewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-        imageViewCreateInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-        imageViewCreateInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-        imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        imageViewCreateInfo.subresourceRange.baseMipLevel = 0;
-        imageViewCreateInfo.subresourceRange.levelCount = 1;
-        imageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
-        imageViewCreateInfo.subresourceRange.layerCount = 1;
-        
-        result = vkCreateImageView(device, &imageViewCreateInfo, NULL, &swapchainImageViews[i]);
-        if (result != VK_SUCCESS) {
-            std::cout << "Failed to create swapchain image view[" <<  i << "]: " << getVulkanErrorString(result) << std::endl;
-            return false;
-        }
-        
-        VkFramebufferCreateInfo framebufferbCreateInfo = {};
-        framebufferbCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        framebufferbCreateInfo.attachmentCount = 1;
-        framebufferbCreateInfo.pAttachments = &swapchainImageViews[i];
-        framebufferbCreateInfo.width = surfaceCapabilities.currentExtent.width;
-        framebufferbCreateInfo.height = surfaceCapabilities.currentExtent.width;
-        framebufferbCreateInfo.layers = 1;
-        
-        result = vkCreateFramebuffer(device, &framebufferbCreateInfo, NULL, &swapchainFramebuffers[i]);
-        if (result != VK_SUCCESS) {
-            std::cout << "Failed to create swapchain framebuffer view[" <<  i << "]: " << getVulkanErrorString(result) << std::endl;
-            return false;
-        }
-    }
+    VkPipelineShaderStageCreateInfo stages[2] {};
+    stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    stages[0].module = vertexShader;
+    stages[0].pName = "main";
+    stages[0].pSpecializationInfo = &specialization;
+    stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    stages[1].module = fragmentShader;
+    stages[1].pName = "main";
+    stages[1].pSpecializationInfo = &specialization;
     
-    return true;
+    // Half positions are read through a 4 component format; the shader
+    // only consumes xyz either way.
+    static const VkFormat positionFormats[MeshFile::FORMAT_COUNT] { VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R16G16B16A16_SFLOAT };
+    
+    VkVertexInputBindingDescription vertexBindings[2] {};
+    vertexBindings[0].binding = 0;
+    vertexBindings[0].stride = MeshFile::getVertexStride(format);
+    vertexBindings[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    vertexBindings[1].binding = 1;
+    vertexBindings[1].stride = sizeof(uint32_t);
+    vertexBindings[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+    
+    // Position and the index of the visible instance being drawn.
+    VkVertexInputAttributeDescription vertexAttributes[2] {};
+    vertexAttributes[0].location = 0;
+    vertexAttributes[0].binding = 0;
+    vertexAttributes[0].format = positionFormats[format];
+    vertexAttributes[0].offset = 0;
+    vertexAttributes[1].location = 1;
+    vertexAttributes[1].binding = 1;
+    vertexAttributes[1].format = VK_FORMAT_R32_UINT;
+    vertexAttributes[1].offset = 0;
+    
+    VkPipelineVertexInputStateCreateInfo vertexInputState {};
+    vertexInputState.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertexInputState.vertexBindingDescriptionCount = 2;
+    vertexInputState.pVertexBindingDescriptions = vertexBindings;
+    vertexInputState.vertexAttributeDescriptionCount = 2;
+    vertexInputState.pVertexAttributeDescriptions = vertexAttributes;
+    
+    VkPipelineInputAssemblyStateCreateInfo inputAssemblyState {};
+    inputAssemblyState.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssemblyState.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    
+    // Viewport and scissor are set per frame in draw().
+    VkPipelineViewportStateCreateInfo viewportState {};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+    
+    VkPipelineRasterizationStateCreateInfo rasterizationState {};
+    rasterizationState.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizationState.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizationState.cullMode = VK_CULL_MODE_NONE;
+    rasterizationState.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    rasterizationState.lineWidth = 1.0f;
+    
+    VkPipelineMultisampleStateCreateInfo multisampleState {};
+    multisampleState.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampleState.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    
+    VkPipelineDepthStencilStateCreateInfo depthStencilState {};
+    depthStencilState.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencilState.depthTestEnable = VK_TRUE;
+    depthStencilState.depthWriteEnable = VK_TRUE;
+    depthStencilState.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+    
+    VkPipelineColorBlendAttachmentState colorBlendAttachment {};
+    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+        VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    
+    VkPipelineColorBlendStateCreateInfo colorBlendState {};
+    colorBlendState.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlendState.attachmentCount = 1;
+    colorBlendState.pAttachments = &colorBlendAttachment;
+    
+    VkDynamicState dynamicStates[] { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+    VkPipelineDynamicStateCreateInfo dynamicState {};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = 2;
+    dynamicState.pDynamicStates = dynamicStates;
+    
+    VkGraphicsPipelineCreateInfo pipelineCreateInfo {};
+    pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineCreateInfo.stageCount = 2;
+    pipelineCreateInfo.pStages = stages;
+    pipelineCreateInfo.pVertexInputState = &vertexInputState;
+    pipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
+    pipelineCreateInfo.pViewportState = &viewportState;
+    pipelineCreateInfo.pRasterizationState = &rasterizationState;
+    pipelineCreateInfo.pMultisampleState = &multisampleState;
+    pipelineCreateInfo.pDepthStencilState = &depthStencilState;
+    pipelineCreateInfo.pColorBlendState = &colorBlendState;
+    pipelineCreateInfo.pDynamicState = &dynamicState;
+    pipelineCreateInfo.layout = pipelineLayout;
+    pipelineCreateInfo.renderPass = renderPass;
+    pipelineCreateInfo.subpass = 0;
+    
+    return pipelineCache.createGraphicsPipeline(name.c_str(), pipelineCreateInfo, pipeline);
 }
 
-bool Renderer::initRenderPass() {
+bool Renderer::initCullPipeline() {
     VkResult result;
-
-    VkAttachmentDescription attachments[2] {};
-    attachments[0].format = surfaceFormat.format;;
-    attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
-    attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    attachments[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-    attachments[0].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-    attachments[1].format = surfaceFormat.format;;
-    attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
-    attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    attachments[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-    attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-    VkAttachmentReference color_reference {};
-    color_reference.attachment = 0;
-    color_reference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
     
-    VkAttachmentReference depth_reference {};
-    depth_reference.attachment = 1;
-    depth_reference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    VkPushConstantRange pushConstantRange {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(CullPushConstants);
     
-    VkSubpassDescription subpass {};
-    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    subpass.flags = 0;
-    subpass.inputAttachmentCount = 0;
-    subpass.pInputAttachments = NULL;
-    subpass.colorAttachmentCount = 1;
-    subpass.pColorAttachments = &color_reference;
-    subpass.pResolveAttachments = NULL;
-    subpass.pDepthStencilAttachment = &depth_reference;
-    subpass.preserveAttachmentCount = 0;
-    subpass.pPreserveAttachments = NULL;
-
-    VkRenderPassCreateInfo rp_info {};
-    rp_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    rp_info.pNext = NULL;
-    rp_info.attachmentCount = 2;
-    rp_info.pAttachments = attachments;
-    rp_info.subpassCount = 1;
-    rp_info.pSubpasses = &subpass;
-    rp_info.dependencyCount = 0;
-    rp_info.pDependencies = NULL;
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo {};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &cullDescriptorSetLayout;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
     
-    result = vkCreateRenderPass(device, &rp_info, NULL, &renderPass);
+    result = vkCreatePipelineLayout(device, &pipelineLayoutCreateInfo, NULL, &cullPipelineLayout);
     if (result != VK_SUCCESS) {
-        std::cout << "Failed to create renderpass" << getVulkanErrorString(result) << std::endl;
+        std::cout << "Failed to create cull pipeline layout: " << getVulkanErrorString(result) << std::endl;
         return false;
     }
     
+    // Only GPU culling needs the pipeline, it is created on first use
+    // unless a previous run listed it.
+    cullPipelines = shaders.addFamily("cull", [this](const std::string& name, const ShaderCache::Variant&,
+            const VkSpecializationInfo& specialization, VkPipeline& pipeline) {
+        VkShaderModule computeShader = shaders.getModule("shaders/cull.comp.spv");
+        if (computeShader == VK_NULL_HANDLE) return false;
+        
+        VkComputePipelineCreateInfo pipelineCreateInfo {};
+        pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineCreateInfo.stage.module = computeShader;
+        pipelineCreateInfo.stage.pName = "main";
+        pipelineCreateInfo.stage.pSpecializationInfo = &specialization;
+        pipelineCreateInfo.layout = cullPipelineLayout;
+        
+        return pipelineCache.createComputePipeline(name.c_str(), pipelineCreateInfo, pipeline);
+    });
+    
     return true;
 }
 
 // Destroy
 Renderer::~Renderer(){
+    if (software) {
+        destroySoftware();
+        return;
+    }
+    
     vkDeviceWaitIdle(device);
     
+    destroyRecordThreads();
+    threadPool.destroy();
     destroyCommands();
+    destroyQueries();
+    destroyInstances();
+    destroyMesh();
+    destroyStreamer();
+    destroyTextures();
+    destroyCapture();
+    destroyCullPipeline();
+    destroyPipeline();
+    destroyDescriptors();
     destroyRenderPass();
     destroySwapchainImages();
+    destroyRenderGraph();
+    destroyOffscreenImages();
     destroySwapchain();
     destroySurface();
+    destroyAllocator();
     destroyDevice();
     destroyInstance();  
     
 }
 
+void Renderer::destroySoftware() {
+    destroyInstances();
+    rasterizer.destroy();
+    threadPool.destroy();
+}
+
 void Renderer::destroyInstance() {
     if (instance != VK_NULL_HANDLE) {
         vkDestroyInstance(instance, NULL);
@@ -620,11 +2838,34 @@ void Renderer::destroyCommands() {
         vkDestroyCommandPool(device, commandPool, NULL);
         std::cout << "Command pool deleted" << std::endl;
     }
+    if (computeCommandPool != VK_NULL_HANDLE) {
+        vkDestroyCommandPool(device, computeCommandPool, NULL);
+        std::cout << "Compute command pool deleted" << std::endl;
+    }
     
-    if (fence != VK_NULL_HANDLE) {
-        vkDestroyFence(device, fence, NULL);        
-        std::cout << "Fence deleted" << std::endl;
+    for (uint32_t i = 0; i < frames.size(); ++i) {
+        if (frames[i].fence != VK_NULL_HANDLE) {
+            vkDestroyFence(device, frames[i].fence, NULL);        
+            std::cout << "Fence" << i << " deleted" << std::endl;
+        }
+        if (frames[i].imageAcquired != VK_NULL_HANDLE) {
+            vkDestroySemaphore(device, frames[i].imageAcquired, NULL);
+        }
+        if (frames[i].renderFinished != VK_NULL_HANDLE) {
+            vkDestroySemaphore(device, frames[i].renderFinished, NULL);
+        }
+        if (frames[i].uploadFinished != VK_NULL_HANDLE) {
+            vkDestroySemaphore(device, frames[i].uploadFinished, NULL);
+        }
+        if (frames[i].computeFinished != VK_NULL_HANDLE) {
+            vkDestroySemaphore(device, frames[i].computeFinished, NULL);
+        }
     }
+    std::cout << "All frame sync objects deleted" << std::endl;
+}
+
+void Renderer::destroyQueries() {
+    profiler.destroy();
 }
 
 void Renderer::destroySurface() {
@@ -642,7 +2883,7 @@ void Renderer::destroySwapchain() {
 }
 
 void Renderer::destroySwapchainImages() {
-    for (uint32_t i = 0; i < swapchainImageCount; ++i) {
+    for (uint32_t i = 0; i < swapchainImageViews.size(); ++i) {
         if (swapchainImageViews[i] != VK_NULL_HANDLE) {
             vkDestroyImageView(device, swapchainImageViews[i], NULL);
             std::cout << "ImageView" << i <<" deleted" << std::endl;
@@ -650,7 +2891,7 @@ void Renderer::destroySwapchainImages() {
     }
     std::cout << "All ImageViews deleted" << std::endl;
     
-    for (uint32_t i = 0; i < swapchainImageCount; ++i) {
+    for (uint32_t i = 0; i < swapchainFramebuffers.size(); ++i) {
         if (swapchainFramebuffers[i] != VK_NULL_HANDLE) {
             vkDestroyFramebuffer(device, swapchainFramebuffers[i], NULL);
             std::cout << "Framebuffers" << i <<" deleted" << std::endl;
@@ -659,6 +2900,120 @@ void Renderer::destroySwapchainImages() {
     std::cout << "All Framebuffers deleted" << std::endl;
 }
 
+void Renderer::destroyOffscreenImages() {
+    if (!headless) return;
+    
+    for (uint32_t i = 0; i < offscreenImageMemory.size(); ++i) {
+        allocator.destroyImage(swapchainImages[i], offscreenImageMemory[i]);
+    }
+    std::cout << "All offscreen images deleted" << std::endl;
+}
+
+void Renderer::destroyAllocator() {
+    allocator.printStats();
+    allocator.destroy();
+}
+
 void Renderer::destroyRenderPass(){ 
+    if (renderPass != VK_NULL_HANDLE) {
+        vkDestroyRenderPass(device, renderPass, NULL);
+        std::cout << "Render pass deleted" << std::endl;
+    }
+}
+
+void Renderer::destroyRenderGraph() {
+    renderGraph.destroy();
+}
+
+void Renderer::destroyMesh() {
+    if (vertexBuffer != VK_NULL_HANDLE) {
+        allocator.destroyBuffer(vertexBuffer, vertexBufferMemory);
+        std::cout << "Vertex buffer deleted" << std::endl;
+    }
+    if (indexBuffer != VK_NULL_HANDLE) {
+        allocator.destroyBuffer(indexBuffer, indexBufferMemory);
+        std::cout << "Index buffer deleted" << std::endl;
+    }
+}
+
+void Renderer::destroyInstances() {
+    uploadArena.destroy();
+    visibleArena.destroy();
+    
+    for (FrameData& frame: frames) {
+        if (frame.gpuVisibleBuffer != VK_NULL_HANDLE) {
+            allocator.destroyBuffer(frame.gpuVisibleBuffer, frame.gpuVisibleBufferMemory);
+        }
+        if (frame.drawCommandBuffer != VK_NULL_HANDLE) {
+            allocator.destroyBuffer(frame.drawCommandBuffer, frame.drawCommandBufferMemory);
+        }
+    }
+    if (visibleCountBuffer != VK_NULL_HANDLE) {
+        allocator.destroyBuffer(visibleCountBuffer, visibleCountBufferMemory);
+    }
+    
+    if (instanceBuffer != VK_NULL_HANDLE) {
+        allocator.destroyBuffer(instanceBuffer, instanceBufferMemory);
+        std::cout << "Instance buffer deleted" << std::endl;
+    }
+    
+    instances.clear();
+    instanceTransforms.resize(0);
+    instanceBounds.resize(0);
+    instanceBvh.clear();
+    instanceBvhBuilt = false;
+    visibleInstances.clear();
+    instanceDirty.clear();
+    dirtyInstances.clear();
+}
+
+void Renderer::destroyDescriptors() {
+    for (FrameData& frame: frames) {
+        frame.descriptors.destroy();
+    }
+    uniforms.destroy();
+    
+    if (descriptorPool != VK_NULL_HANDLE) {
+        vkDestroyDescriptorPool(device, descriptorPool, NULL);
+        std::cout << "Descriptor pool deleted" << std::endl;
+    }
+    if (descriptorSetLayout != VK_NULL_HANDLE) {
+        vkDestroyDescriptorSetLayout(device, descriptorSetLayout, NULL);
+        std::cout << "Descriptor set layout deleted" << std::endl;
+    }
+    if (cullDescriptorSetLayout != VK_NULL_HANDLE) {
+        vkDestroyDescriptorSetLayout(device, cullDescriptorSetLayout, NULL);
+        std::cout << "Cull descriptor set layout deleted" << std::endl;
+    }
+}
+
+void Renderer::destroyCullPipeline() {
+    if (cullPipelineLayout != VK_NULL_HANDLE) {
+        vkDestroyPipelineLayout(device, cullPipelineLayout, NULL);
+        std::cout << "Cull pipeline layout deleted" << std::endl;
+    }
+}
+
+void Renderer::destroyRecordThreads() {
+    for (uint32_t i = 0; i < frames.size(); ++i) {
+        for (uint32_t j = 0; j < frames[i].threadCommandPools.size(); ++j) {
+            if (frames[i].threadCommandPools[j] != VK_NULL_HANDLE) {
+                vkDestroyCommandPool(device, frames[i].threadCommandPools[j], NULL);
+            }
+        }
+        frames[i].threadCommandPools.clear();
+        frames[i].secondaryCommandBuffers.clear();
+        frames[i].secondaryRecorded.clear();
+    }
+    std::cout << "All thread command pools deleted" << std::endl;
+}
+
+void Renderer::destroyPipeline() {
+    shaders.destroy();
+    if (pipelineLayout != VK_NULL_HANDLE) {
+        vkDestroyPipelineLayout(device, pipelineLayout, NULL);
+        std::cout << "Pipeline layout deleted" << std::endl;
+    }
     
+    pipelineCache.destroy();
 }
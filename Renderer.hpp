@@ -4,13 +4,102 @@
 #include <string>
 #include <vector>
 
+#include "Allocator.hpp"
+#include "CommandStream.hpp"
+#include "Culling.hpp"
+#include "DescriptorAllocator.hpp"
+#include "FrameCapture.hpp"
+#include "FramePacer.hpp"
+#include "InitGraph.hpp"
+#include "Math.hpp"
+#include "MeshFile.hpp"
+#include "PipelineCache.hpp"
+#include "Profiler.hpp"
+#include "RenderGraph.hpp"
+#include "ShaderCache.hpp"
+#include "SoftwareRasterizer.hpp"
+#include "Streamer.hpp"
+#include "TextureCache.hpp"
+#include "ThreadPool.hpp"
+
+// Per-instance data, streamed to the GPU instance buffer and read by the
+// vertex shader as a storage buffer. model is column-major, matching GLSL.
+struct InstanceData {
+    float model[16];
+    float color[4];
+};
+
+// Per-frame shader constants, written into the uniform ring every frame and
+// bound with a dynamic offset. Laid out as GLSL std140.
+struct FrameUniforms {
+    float viewProjection[16];
+};
+
+// Where visibility is determined: not at all, on the CPU through the
+// instance BVH, or by a compute pass that writes an indirect draw.
+enum CullingMode {
+    CULLING_NONE,
+    CULLING_CPU,
+    CULLING_GPU
+};
+
+// How frames reach the screen. The mode falls back to FIFO, which every
+// surface supports, when the surface lacks it. Headless renderers only
+// use targetFps.
+struct PresentPolicy {
+    VkPresentModeKHR mode = VK_PRESENT_MODE_MAILBOX_KHR;
+    // Swapchain images to ask for, 0: one more than the surface's minimum.
+    uint32_t imageCount = 0;
+    // Frame rate limit, 0: unlimited.
+    double targetFps = 0.0;
+};
+
+// How the scene is coloured: by each instance's colour, or by a colour
+// hashed from the index of the instance, to tell instances apart.
+enum ShadingMode {
+    SHADING_COLOR,
+    SHADING_INSTANCE
+};
+
+// What renders the frames. Auto uses Vulkan and falls back to the software
+// rasterizer where there is no usable Vulkan device; Vulkan fails instead.
+enum RenderBackend {
+    BACKEND_AUTO,
+    BACKEND_VULKAN,
+    BACKEND_SOFTWARE
+};
+
 class Renderer {
     private:
-        GLFWwindow* window;
+        GLFWwindow* window = NULL;
+        
+        // Headless renderers have no window, surface or swapchain; frames are
+        // rendered into device-local images owned by the renderer instead.
+        bool headless = false;
+        VkExtent2D extent = {};
         
         VkApplicationInfo applicationInfo;
         
-        std::string getVulkanErrorString(VkResult result);
+        // Start-up runs as a graph of init tasks on threadPool, see
+        // addVulkanTasks(). The report of the last run is kept, together
+        // with how long after the profiler's epoch, i.e. the renderer's
+        // creation, the first frame was submitted.
+        InitGraph startup;
+        double timeToFirstFrame = -1.0;
+        bool init(RenderBackend backend);
+        void addVulkanTasks(InitGraph::Task meshRead);
+        void addSoftwareTasks(InitGraph::Task meshRead);
+        void markFirstFrame();
+        
+        // With the software backend there is no instance or device, only
+        // the CPU side of the renderer: instances, culling, the thread pool
+        // and the mesh, which rasterizer keeps a copy of. Windowed frames
+        // are rendered but not presented.
+        bool software = false;
+        SoftwareRasterizer rasterizer;
+        bool initBackend(RenderBackend backend);
+        void destroySoftware();
+        void drawSoftware();
         
         VkInstance instance = VK_NULL_HANDLE;
         bool initInstance();
@@ -18,28 +107,122 @@ class Renderer {
         
         uint32_t queueFamilyIndex = -1;
         VkQueue queue = VK_NULL_HANDLE;
+        // May be the graphics family or even the graphics queue itself.
+        uint32_t transferQueueFamilyIndex = -1;
+        VkQueue transferQueue = VK_NULL_HANDLE;
+        // A compute-only family if there is one, otherwise a second queue
+        // of the graphics family, otherwise the graphics queue itself.
+        uint32_t computeQueueFamilyIndex = -1;
+        VkQueue computeQueue = VK_NULL_HANDLE;
+        // Families of the queues that share the cull buffers.
+        std::vector<uint32_t> sharedQueueFamilies = {};
         VkPhysicalDevice gpu = VK_NULL_HANDLE;
         VkDevice device = VK_NULL_HANDLE;
+        bool pipelineStatisticsSupported = false;
+        bool pipelineCreationFeedbackSupported = false;
         bool initDevice();
         void destroyDevice();
         
+        Allocator allocator;
+        bool initAllocator();
+        void destroyAllocator();
+        
         VkSurfaceCapabilitiesKHR surfaceCapabilities = {};
         VkSurfaceFormatKHR surfaceFormat = {};
         VkSurfaceKHR surface = VK_NULL_HANDLE;
         bool initSurface(GLFWwindow* window);
         void destroySurface();
         
+        struct RetiredBuffer {
+            VkBuffer buffer;
+            Allocation allocation;
+        };
+        
+        // Per-frame resources, recycled as a ring of framesInFlight entries so
+        // recording of frame N+1 overlaps GPU execution of frame N.
+        struct FrameData {
+            VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+            VkSemaphore imageAcquired = VK_NULL_HANDLE;
+            VkSemaphore renderFinished = VK_NULL_HANDLE;
+            VkFence fence = VK_NULL_HANDLE;
+            
+            // One transient pool and secondary buffer per recording thread,
+            // reset together once the fence above has been waited on.
+            std::vector<VkCommandPool> threadCommandPools = {};
+            std::vector<VkCommandBuffer> secondaryCommandBuffers = {};
+            std::vector<uint8_t> secondaryRecorded = {};
+            
+            // Replaced while earlier frames were still drawing from them;
+            // destroyed once this slot's fence has been waited on again.
+            std::vector<RetiredBuffer> retiredBuffers = {};
+            
+            // Reset after the fence wait. descriptorSet is this frame's set
+            // 0, uniformOffset the dynamic offset of its FrameUniforms.
+            DescriptorAllocator descriptors;
+            VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+            uint32_t uniformOffset = 0;
+            
+            // Outputs of the GPU cull passes. They are per frame so culling
+            // for this frame may overlap the previous frame's draw.
+            // drawCommandIndexCount is the index count the command holds.
+            VkBuffer gpuVisibleBuffer = VK_NULL_HANDLE;
+            Allocation gpuVisibleBufferMemory = {};
+            VkBuffer drawCommandBuffer = VK_NULL_HANDLE;
+            Allocation drawCommandBufferMemory = {};
+            VkDescriptorSet cullDescriptorSet = VK_NULL_HANDLE;
+            uint32_t drawCommandIndexCount = 0;
+            
+            // With async compute the frame is submitted as instance uploads
+            // (only when there are any), the cull passes on computeQueue and
+            // the scene in commandBuffer, chained by the two semaphores.
+            VkCommandBuffer uploadCommandBuffer = VK_NULL_HANDLE;
+            VkCommandBuffer computeCommandBuffer = VK_NULL_HANDLE;
+            VkSemaphore uploadFinished = VK_NULL_HANDLE;
+            VkSemaphore computeFinished = VK_NULL_HANDLE;
+        };
+        
+        uint32_t framesInFlight = 2;
+        uint32_t currentFrame = 0;
+        std::vector<FrameData> frames = {};
+        
         VkCommandPool commandPool = VK_NULL_HANDLE;
-        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
-        VkFence fence = VK_NULL_HANDLE;
+        VkCommandPool computeCommandPool = VK_NULL_HANDLE;
         bool initCommands();
         void destroyCommands();
         
-        uint32_t swapchainImageCount = 2;
+        // Draws are recorded into secondary command buffers by threadPool,
+        // in batches of drawBatchSize, and executed from the primary buffer.
+        // Every draw covers up to instancesPerDraw visible instances; by
+        // default they are all drawn with a single instanced draw.
+        ThreadPool threadPool;
+        uint32_t recordThreadCount = 1;
+        uint32_t drawBatchSize = 64;
+        uint32_t instancesPerDraw = UINT32_MAX;
+        bool initRecordThreads();
+        void destroyRecordThreads();
+        void recordScene(FrameData& frame);
+        void recordDraws(VkCommandBuffer cmdBuffer, uint32_t begin, uint32_t end);
+        
+        Profiler profiler;
+        bool initQueries();
+        void destroyQueries();
+        
+        PresentPolicy presentPolicy;
+        VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+        FramePacer pacer;
+        uint32_t swapchainImageCount = 0;
         VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+        // Replaces the previous swapchain, if any, through oldSwapchain.
+        // recreateSwapchain() also takes the window's new size and rebuilds
+        // what depends on it. While the window is minimized there is no
+        // size to build for; swapchainStale makes draw() try again.
+        bool swapchainStale = false;
         bool initSwapchain();
+        bool recreateSwapchain();
         void destroySwapchain();
 
+        // In headless mode swapchainImages holds the offscreen render targets,
+        // one per frame in flight, backed by offscreenImageMemory.
         uint32_t currentImage = 0;
         std::vector<VkImage> swapchainImages = {};
         std::vector<VkImageView> swapchainImageViews = {};
@@ -47,27 +230,495 @@ class Renderer {
         bool initSwapchainImages();
         void destroySwapchainImages();
         
+        std::vector<Allocation> offscreenImageMemory = {};
+        bool initOffscreenImages();
+        void destroyOffscreenImages();
+        
+        VkFormat depthFormat = VK_FORMAT_UNDEFINED;
         VkRenderPass renderPass = VK_NULL_HANDLE;
         bool initRenderPass();
         void destroyRenderPass();
         
-        void setImageLayout(VkCommandBuffer cmdBuffer, VkImage image,
-            VkImageAspectFlags aspects,
-            VkImageLayout oldLayout,
-            VkImageLayout newLayout);
+        // The attachments' layouts are left to renderGraph, the render pass
+        // neither transitions nor synchronizes them.
+        VkImageAspectFlags depthAspects = 0;
+        
+        bool initFramebuffers();
+        
+        // Copies data into a device-local buffer through a staging buffer
+        // and waits for the transfer. Only meant for setup.
+        bool uploadBuffer(VkBuffer buffer, const void* data, VkDeviceSize size);
+        
+        // Loaded from meshPath at startup when it exists, otherwise the
+        // built-in cube is used.
+        std::string meshPath = "meshes/cube.mesh";
+        uint32_t vertexCount = 0;
+        uint32_t indexCount = 0;
+        uint32_t vertexFormat = MeshFile::FORMAT_FLOAT3;
+        VkIndexType indexType = VK_INDEX_TYPE_UINT16;
+        Math::Vec3 meshMin;
+        Math::Vec3 meshMax;
+        VkBuffer vertexBuffer = VK_NULL_HANDLE;
+        Allocation vertexBufferMemory = {};
+        VkBuffer indexBuffer = VK_NULL_HANDLE;
+        Allocation indexBufferMemory = {};
+        // A mesh requested with loadMeshAsync() replaces the current one in
+        // the first frame after it became resident.
+        Streamer streamer;
+        Streamer::Handle pendingMesh = Streamer::INVALID_HANDLE;
+        std::string pendingMeshPath = "";
+        std::vector<VkSemaphore> waitSemaphores = {};
+        std::vector<VkPipelineStageFlags> waitStages = {};
+        bool initStreamer();
+        void destroyStreamer();
+        void updateStreamedMesh(FrameData& frame);
+        void destroyRetiredBuffers(FrameData& frame);
+        
+        // Nothing samples textures yet; they are loaded, budgeted and kept
+        // ready to be bound.
+        TextureCache textures;
+        bool initTextures();
+        void destroyTextures();
+        
+        // When capturing, the capture pass copies the colour target into
+        // one of capture's buffers after the scene. Swapchain images can
+        // only be captured where the surface allows them as transfer
+        // sources.
+        FrameCapture capture;
+        bool captureSupported = false;
+        void destroyCapture();
+        
+        // Calls are appended while a recording runs.
+        CommandStream commandStream;
+        bool replayInstances(const CommandStream::Command& command);
+        
+        // readMesh() maps meshPath or builds the built-in cube and sets the
+        // mesh's counts, format and bounds; initMeshBuffers() copies it to
+        // the GPU, or to rasterizer, and lets go of it. Only the latter
+        // needs the device.
+        MeshFile meshFile;
+        std::vector<float> cubeVertices = {};
+        std::vector<uint16_t> cubeIndices = {};
+        const void* meshVertexData = NULL;
+        VkDeviceSize meshVertexBytes = 0;
+        const void* meshIndexData = NULL;
+        VkDeviceSize meshIndexBytes = 0;
+        bool initMesh();
+        bool readMesh();
+        bool initMeshBuffers();
+        void destroyMesh();
+        
+        // CPU copy of the instance buffer. Changed instances are queued in
+        // dirtyInstances and copied in contiguous ranges through uploadArena
+        // at the start of the next frame. Model matrices are composed from
+        // instanceTransforms with the batch math functions.
+        Math::TransformArrays instanceTransforms;
+        std::vector<InstanceData> instances = {};
+        std::vector<uint8_t> instanceDirty = {};
+        std::vector<uint32_t> dirtyInstances = {};
+        uint32_t lastUploadedInstances = 0;
+        VkBuffer instanceBuffer = VK_NULL_HANDLE;
+        Allocation instanceBufferMemory = {};
+        LinearArena uploadArena;
+        std::vector<VkBufferCopy> uploadRegions = {};
+        bool initInstances(uint32_t instanceCount);
+        void destroyInstances();
+        void uploadInstances();
+        void recordInstanceUploads(VkCommandBuffer cmdBuffer);
+        void markInstanceDirty(uint32_t index);
+        void composeInstances(uint32_t first, uint32_t count);
+        void updateInstanceBounds(uint32_t first, uint32_t count);
+        
+        // cull() tests the world bounds of every instance against the
+        // frustum of viewProjection through instanceBvh and leaves the
+        // indices of the visible ones in visibleInstances. draw() copies
+        // that list into visibleArena, where it is read as a per-instance
+        // vertex attribute that indexes the instance buffer.
+        Math::Mat4 viewProjection;
+        CullingMode cullingMode = CULLING_CPU;
+        Culling::BoundsArrays instanceBounds;
+        Culling::Bvh instanceBvh;
+        bool instanceBvhBuilt = false;
+        std::vector<uint32_t> visibleInstances = {};
+        LinearArena visibleArena;
+        VkDeviceSize visibleOffset = 0;
+        void uploadVisibleInstances();
+        
+        // With CULLING_GPU the cull pipeline fills the frame's
+        // gpuVisibleBuffer and the instance count of the single command in
+        // its drawCommandBuffer instead, and the scene is drawn with one
+        // indirect draw. The count is copied to visibleCountBuffer, one
+        // entry per frame in flight, so it can be reported once the frame's
+        // fence has been waited on.
+        VkPipelineLayout cullPipelineLayout = VK_NULL_HANDLE;
+        // Specialization constant 0 of the cull shader, its workgroup size.
+        uint32_t cullGroupSize = 64;
+        ShaderCache::Family cullPipelines = 0;
+        VkBuffer visibleCountBuffer = VK_NULL_HANDLE;
+        Allocation visibleCountBufferMemory = {};
+        uint32_t gpuVisibleInstances = 0;
+        bool initCullPipeline();
+        void destroyCullPipeline();
+        void recordCullReset(VkCommandBuffer cmdBuffer);
+        void recordGpuCull(VkCommandBuffer cmdBuffer);
+        void recordVisibleCount(VkCommandBuffer cmdBuffer);
+        
+        // The scene's set 0 (instance buffer and frame uniforms) is
+        // allocated every frame from the frame's DescriptorAllocator, so it
+        // always points at the current buffers and is never updated while
+        // in flight. The cull pass's buffers are bound through the long
+        // lived cull descriptor sets of the frames.
+        VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+        VkDescriptorSetLayout cullDescriptorSetLayout = VK_NULL_HANDLE;
+        VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+        UniformRing uniforms;
+        uint32_t lastDescriptorSets = 0;
+        VkDeviceSize lastUniformBytes = 0;
+        bool initDescriptors();
+        void destroyDescriptors();
+        void writeDescriptors();
+        bool writeFrameDescriptors(FrameData& frame);
+        
+        // update() spins a window of animatedInstances instances that moves
+        // through the scene, so only they have to be streamed.
+        uint32_t animatedInstances = 0;
+        uint32_t animationFrame = 0;
+        void animateInstances();
+        
+        // Pipelines are created through pipelineCache, which is loaded from
+        // and saved back to pipelineCachePath so warm starts skip compilation.
+        std::string pipelineCachePath = "pipeline_cache.bin";
+        PipelineCache pipelineCache;
+        VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+        // Modules and pipeline variants. The variants a run used are listed
+        // in pipelineVariantsPath and created during init() of the next.
+        std::string pipelineVariantsPath = "pipeline_variants.txt";
+        ShaderCache shaders;
+        // Scene variants differ in the position attribute, their state is a
+        // MeshFile::VertexFormat, and in the shading mode, constant 0.
+        ShaderCache::Family scenePipelines = 0;
+        ShadingMode shadingMode = SHADING_COLOR;
+        // Resolved once per frame on the main thread, before recording.
+        VkPipeline scenePipeline = VK_NULL_HANDLE;
+        ShaderCache::Variant getSceneVariant() const;
+        bool createScenePipeline(const std::string& name, uint32_t format,
+            const VkSpecializationInfo& specialization, VkPipeline& pipeline);
+        bool initPipeline();
+        void destroyPipeline();
+        
+        // A frame is the instance upload, the GPU cull passes, the scene and
+        // the copy of the colour target while capturing.
+        // All passes are always declared; what the scene reads depends on
+        // the culling mode and the graph culls the passes it does not need.
+        // Depth is a transient of the graph, shared by all frames in flight.
+        // With async compute and GPU culling the cull passes are declared on
+        // the compute queue and the frame is executed in three ranges:
+        // [uploadPass, cullResetPass), [cullResetPass, scenePass) and the rest.
+        RenderGraph renderGraph;
+        CullingMode renderGraphMode = CULLING_NONE;
+        bool asyncCompute = false;
+        bool renderGraphAsync = false;
+        RenderGraph::Resource instanceResource = RenderGraph::INVALID_RESOURCE;
+        RenderGraph::Resource visibleListResource = RenderGraph::INVALID_RESOURCE;
+        RenderGraph::Resource gpuVisibleResource = RenderGraph::INVALID_RESOURCE;
+        RenderGraph::Resource drawCommandResource = RenderGraph::INVALID_RESOURCE;
+        RenderGraph::Resource visibleCountResource = RenderGraph::INVALID_RESOURCE;
+        RenderGraph::Resource colorResource = RenderGraph::INVALID_RESOURCE;
+        RenderGraph::Resource depthResource = RenderGraph::INVALID_RESOURCE;
+        RenderGraph::Resource captureResource = RenderGraph::INVALID_RESOURCE;
+        RenderGraph::Pass uploadPass = 0;
+        RenderGraph::Pass cullResetPass = 0;
+        RenderGraph::Pass scenePass = 0;
+        RenderGraph::Pass capturePass = 0;
+        bool isAsyncFrame() const {
+            return asyncCompute && cullingMode == CULLING_GPU;
+        }
+        bool initRenderGraph();
+        bool buildRenderGraph();
+        void destroyRenderGraph();
+        void recordScenePass(VkCommandBuffer cmdBuffer);
     public:
-        Renderer(GLFWwindow* window);
+        static const uint32_t MAX_FRAMES_IN_FLIGHT = 3;
+        
+        Renderer(GLFWwindow* window, uint32_t framesInFlight = 2, RenderBackend backend = BACKEND_AUTO);
+        Renderer(uint32_t width, uint32_t height, uint32_t framesInFlight = 2, RenderBackend backend = BACKEND_AUTO);
         ~Renderer();
         
+        bool isHeadless() const {
+            return headless;
+        }
+        
+        // The backend in use, never BACKEND_AUTO.
+        RenderBackend getBackend() const {
+            return software ? BACKEND_SOFTWARE : BACKEND_VULKAN;
+        }
+        // Holds the last frame of the software backend.
+        const SoftwareRasterizer& getSoftwareRasterizer() const {
+            return rasterizer;
+        }
+        
+        static const char* getBackendName(RenderBackend backend);
+        // Accepts auto, vulkan and software.
+        static bool parseBackend(const char* name, RenderBackend& backend);
+        
         void waitReady() {
             if (device != VK_NULL_HANDLE) {
                 vkDeviceWaitIdle(device);
             }
         }
         
+        // Call before update() every frame: waits for the next frame slot
+        // and for the frame limiter, then polls window events. Input is
+        // sampled as late as possible, so it ages the least before present;
+        // nothing else polls, or input-to-present latency would read low.
+        void pollEvents();
+        
         void draw();
         
-        void update() {
-            glfwPollEvents();
+        // GPU execution time in milliseconds of the most recently completed
+        // frame, or a negative value if it is not known yet.
+        double getLastGpuFrameTime() const {
+            return profiler.getLastGpuFrameTime();
+        }
+        
+        Profiler& getProfiler() {
+            return profiler;
+        }
+        
+        const InitGraph& getStartup() const {
+            return startup;
+        }
+        // ms from the renderer's creation until draw() submitted the first
+        // frame, negative before that.
+        double getTimeToFirstFrame() const {
+            return timeToFirstFrame;
+        }
+        
+        Allocator& getAllocator() {
+            return allocator;
+        }
+        
+        const ShaderCache& getShaderCache() const {
+            return shaders;
+        }
+        TextureCache& getTextureCache() {
+            return textures;
+        }
+        PipelineCache& getPipelineCache() {
+            return pipelineCache;
+        }
+        
+        // Waits for the device and recreates the per-thread command pools.
+        bool setRecordThreadCount(uint32_t threadCount);
+        uint32_t getRecordThreadCount() const {
+            return recordThreadCount;
+        }
+        
+        // Recreates the instance buffer with a default grid layout.
+        bool setInstanceCount(uint32_t instanceCount);
+        uint32_t getInstanceCount() const {
+            return (uint32_t)instances.size();
+        }
+        
+        // Waits for the device and replaces the mesh with a MeshFile; falls
+        // back to the built-in cube if the file cannot be used.
+        bool loadMesh(const std::string& path);
+        
+        // Loads and uploads the mesh in the background; it replaces the
+        // current one in a later draw() without waiting for the device.
+        void loadMeshAsync(const std::string& path);
+        bool isMeshStreaming() const {
+            return pendingMesh != Streamer::INVALID_HANDLE;
+        }
+        Streamer& getStreamer() {
+            return streamer;
+        }
+        const std::string& getMeshPath() const {
+            return meshPath;
+        }
+        uint32_t getMeshVertexCount() const {
+            return vertexCount;
+        }
+        uint32_t getMeshIndexCount() const {
+            return indexCount;
+        }
+        uint32_t getMeshVertexFormat() const {
+            return vertexFormat;
+        }
+        
+        const InstanceData& getInstance(uint32_t index) const {
+            return instances[index];
+        }
+        void setInstance(uint32_t index, const InstanceData& data);
+        void setInstanceTransform(uint32_t index, const Math::Vec3& position, const Math::Quat& rotation, float scale);
+        
+        void setInstancesPerDraw(uint32_t instancesPerDraw) {
+            this->instancesPerDraw = instancesPerDraw < 1 ? 1 : instancesPerDraw;
+            if (commandStream.isRecording()) {
+                commandStream.record(CommandStream::OP_SET_INSTANCES_PER_DRAW, this->instancesPerDraw);
+            }
+        }
+        uint32_t getDrawCount() const {
+            if (cullingMode == CULLING_GPU) return 1;
+            return (uint32_t)(((uint64_t)getVisibleInstanceCount() + instancesPerDraw - 1) / instancesPerDraw);
+        }
+        
+        void setAnimatedInstanceCount(uint32_t count) {
+            animatedInstances = count;
+            if (commandStream.isRecording()) {
+                commandStream.record(CommandStream::OP_SET_ANIMATED_INSTANCES, count);
+            }
+        }
+        
+        const RenderGraph& getRenderGraph() const {
+            return renderGraph;
+        }
+        // Number of instances copied to the GPU by the last draw().
+        uint32_t getLastUploadedInstanceCount() const {
+            return lastUploadedInstances;
+        }
+        // Descriptor sets allocated and uniform bytes written by the last
+        // draw(), and the pools the frame allocators have grown to.
+        uint32_t getLastDescriptorSetCount() const {
+            return lastDescriptorSets;
+        }
+        VkDeviceSize getLastUniformBytes() const {
+            return lastUniformBytes;
+        }
+        uint32_t getDescriptorPoolCount() const {
+            uint32_t count = 0;
+            for (const FrameData& frame: frames) {
+                count += frame.descriptors.getPoolCount();
+            }
+            return count;
+        }
+        
+        // CPU time in milliseconds spent recording the last frame's draws,
+        // or rasterizing them with the software backend.
+        double getLastRecordTime() {
+            return profiler.getLastCpuTime("record");
+        }
+        
+        void update();
+        
+        // Culling stage, run between update() and draw(). Without culling
+        // every instance is drawn; GPU culling happens inside draw().
+        void cull();
+        
+        // The software backend culls on the CPU instead of the GPU.
+        void setCullingMode(CullingMode mode) {
+            cullingMode = software && mode == CULLING_GPU ? CULLING_CPU : mode;
+            if (commandStream.isRecording()) {
+                commandStream.record(CommandStream::OP_SET_CULLING_MODE, cullingMode);
+            }
+        }
+        CullingMode getCullingMode() const {
+            return cullingMode;
+        }
+        
+        // Runs GPU culling on the compute queue, overlapping the previous
+        // frame's draw. On by default where the device has a second queue;
+        // off records everything on the graphics queue, for comparison.
+        // Returns false if there is no queue to run it on.
+        bool setAsyncCompute(bool enabled) {
+            asyncCompute = enabled && isAsyncComputeSupported();
+            if (commandStream.isRecording()) {
+                commandStream.record(CommandStream::OP_SET_ASYNC_COMPUTE, enabled ? 1 : 0);
+            }
+            return asyncCompute == enabled;
+        }
+        bool getAsyncCompute() const {
+            return asyncCompute;
+        }
+        bool isAsyncComputeSupported() const {
+            return computeQueue != queue;
+        }
+        
+        // Captures every settings.interval-th frame from the next draw()
+        // on, replacing a running capture. stopCapture() waits for the
+        // device and for the frames still being written.
+        bool startCapture(const FrameCapture::Settings& settings);
+        void stopCapture();
+        bool isCapturing() const {
+            return capture.isActive();
+        }
+        FrameCapture& getFrameCapture() {
+            return capture;
+        }
+        
+        // Appends every following call to a command stream at path, after a
+        // snapshot of the current instances, mesh, camera and settings. The
+        // record thread count and present policy are left out, they belong
+        // to the machine a stream is replayed on.
+        bool startRecording(const std::string& path);
+        void stopRecording();
+        bool isRecording() const {
+            return commandStream.isRecording();
+        }
+        // Applies the commands of a loaded stream up to and including the
+        // next draw(). Returns false at its end or if it is malformed. A
+        // mesh that was streamed is loaded synchronously instead, before the
+        // draw that swapped it in, so the frames match the recording.
+        bool replayFrame(CommandStream& stream);
+        
+        // Recreates the swapchain when the mode or image count changed.
+        bool setPresentPolicy(const PresentPolicy& policy);
+        const PresentPolicy& getPresentPolicy() const {
+            return presentPolicy;
+        }
+        // The mode in use, which may be the FIFO fallback.
+        VkPresentModeKHR getPresentMode() const {
+            return presentMode;
+        }
+        uint32_t getSwapchainImageCount() const {
+            return swapchainImageCount;
+        }
+        FramePacer& getFramePacer() {
+            return pacer;
+        }
+        
+        static const char* getPresentModeName(VkPresentModeKHR mode);
+        // Accepts immediate, mailbox, fifo and fifo_relaxed.
+        static bool parsePresentMode(const char* name, VkPresentModeKHR& mode);
+        
+        // Takes effect with the next draw(); a shading mode used for the
+        // first time creates its pipeline then.
+        void setShadingMode(ShadingMode mode) {
+            shadingMode = mode;
+            if (commandStream.isRecording()) {
+                commandStream.record(CommandStream::OP_SET_SHADING_MODE, mode);
+            }
+        }
+        ShadingMode getShadingMode() const {
+            return shadingMode;
+        }
+        
+        static const char* getShadingModeName(ShadingMode mode);
+        static bool parseShadingMode(const char* name, ShadingMode& mode);
+        
+        static const char* getCullingModeName(CullingMode mode);
+        // Accepts the names returned above.
+        static bool parseCullingMode(const char* name, CullingMode& mode);
+        
+        void setViewProjection(const Math::Mat4& viewProjection) {
+            this->viewProjection = viewProjection;
+            if (commandStream.isRecording()) {
+                commandStream.recordViewProjection(viewProjection);
+            }
+        }
+        const Math::Mat4& getViewProjection() const {
+            return viewProjection;
+        }
+        
+        // With GPU culling this is read back from the GPU and lags
+        // framesInFlight frames behind.
+        uint32_t getVisibleInstanceCount() const {
+            if (cullingMode == CULLING_GPU) return gpuVisibleInstances;
+            return (uint32_t)visibleInstances.size();
+        }
+        
+        // CPU time in milliseconds of the last cull().
+        double getLastCullTime() {
+            return profiler.getLastCpuTime("cull");
         }
 };
@@ -0,0 +1,328 @@
+#include "Scene.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// push_back() takes these by reference.
+const Scene::Entity Scene::INVALID_ENTITY;
+const uint32_t Scene::NO_HANDLE;
+const uint32_t Scene::NO_PARENT;
+const uint32_t Scene::NO_SLOT;
+
+// The permuted copy goes to scratch, which then takes the old array, so one
+// allocation serves all arrays of a type.
+template<typename T>
+static void permute(std::vector<T>& values, const std::vector<uint32_t>& order, std::vector<T>& scratch) {
+    scratch.resize(order.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        scratch[i] = values[order[i]];
+    }
+    values.swap(scratch);
+}
+
+void Scene::reserve(size_t count) {
+    entities.reserve(count);
+    parents.reserve(count);
+    subtreeEnds.reserve(count);
+    flags.reserve(count);
+    world.reserve(count);
+    meshes.reserve(count);
+    materials.reserve(count);
+    slots.reserve(count);
+    for (std::vector<float>* values: { &local.positionX, &local.positionY, &local.positionZ,
+            &local.rotationX, &local.rotationY, &local.rotationZ, &local.rotationW, &local.scale,
+            &localBounds.minX, &localBounds.minY, &localBounds.minZ,
+            &localBounds.maxX, &localBounds.maxY, &localBounds.maxZ,
+            &worldBounds.minX, &worldBounds.minY, &worldBounds.minZ,
+            &worldBounds.maxX, &worldBounds.maxY, &worldBounds.maxZ }) {
+        values->reserve(count);
+    }
+}
+
+void Scene::clear() {
+    entities.clear();
+    parents.clear();
+    subtreeEnds.clear();
+    flags.clear();
+    local.resize(0);
+    world.clear();
+    localBounds.resize(0);
+    worldBounds.resize(0);
+    meshes.clear();
+    materials.clear();
+    slots.clear();
+    freeEntities.clear();
+    dirtySlots.clear();
+    changed.clear();
+    orderDirty = false;
+    stats = Stats();
+}
+
+Scene::Entity Scene::create(Entity parent) {
+    Entity entity;
+    if (!freeEntities.empty()) {
+        entity = freeEntities.back();
+        freeEntities.pop_back();
+    } else {
+        entity = (Entity)slots.size();
+        slots.push_back(NO_SLOT);
+    }
+
+    uint32_t slot = (uint32_t)entities.size();
+    slots[entity] = slot;
+    entities.push_back(entity);
+    parents.push_back(parent != INVALID_ENTITY ? slots[parent] : NO_PARENT);
+    subtreeEnds.push_back(slot + 1);
+    flags.push_back(0);
+    local.resize(slot + 1);
+    world.push_back(Math::Mat4());
+    localBounds.resize(slot + 1);
+    worldBounds.resize(slot + 1);
+    meshes.push_back(NO_HANDLE);
+    materials.push_back(NO_HANDLE);
+    markDirty(slot);
+
+    // A root appended at the end leaves the order depth-first.
+    if (parent != INVALID_ENTITY) {
+        orderDirty = true;
+    } else {
+        stats.roots++;
+    }
+    stats.entities++;
+    return entity;
+}
+
+void Scene::destroy(Entity entity) {
+    flags[slots[entity]] |= FLAG_DESTROYED;
+    orderDirty = true;
+}
+
+bool Scene::setParent(Entity entity, Entity parent) {
+    uint32_t slot = slots[entity];
+    uint32_t parentSlot = parent != INVALID_ENTITY ? slots[parent] : NO_PARENT;
+
+    // The parent links are valid even while the order is not.
+    for (uint32_t ancestor = parentSlot; ancestor != NO_PARENT; ancestor = parents[ancestor]) {
+        if (ancestor == slot || (flags[ancestor] & FLAG_DESTROYED)) return false;
+    }
+
+    parents[slot] = parentSlot;
+    orderDirty = true;
+    markDirty(slot);
+    return true;
+}
+
+Scene::Entity Scene::getParent(Entity entity) const {
+    uint32_t parentSlot = parents[slots[entity]];
+    return parentSlot != NO_PARENT ? entities[parentSlot] : INVALID_ENTITY;
+}
+
+void Scene::setLocalTransform(Entity entity, const Math::Vec3& position, const Math::Quat& rotation, float scale) {
+    uint32_t slot = slots[entity];
+    local.set(slot, position, rotation, scale);
+    markDirty(slot);
+}
+
+void Scene::setLocalBounds(Entity entity, const Math::Vec3& min, const Math::Vec3& max) {
+    uint32_t slot = slots[entity];
+    localBounds.set(slot, min, max);
+    markDirty(slot);
+}
+
+void Scene::markDirty(uint32_t slot) {
+    if (flags[slot] & FLAG_DIRTY) return;
+    flags[slot] |= FLAG_DIRTY;
+    dirtySlots.push_back(slot);
+}
+
+void Scene::invalidate() {
+    for (uint32_t slot = 0; slot < parents.size(); ++slot) {
+        if (parents[slot] == NO_PARENT) {
+            markDirty(slot);
+        }
+    }
+}
+
+// Rebuilds the depth-first order: children follow their parent in the order
+// of their current slots, so an unchanged hierarchy keeps its layout.
+// Destroyed entities and everything below them are dropped and their ids
+// freed.
+void Scene::sort() {
+    uint32_t count = (uint32_t)entities.size();
+
+    // Children of every slot, grouped by parent; roots are the children of
+    // slot count.
+    std::vector<uint32_t> childStart(count + 3, 0);
+    for (uint32_t slot = 0; slot < count; ++slot) {
+        uint32_t parent = parents[slot] != NO_PARENT ? parents[slot] : count;
+        childStart[parent + 2]++;
+    }
+    for (uint32_t i = 2; i < childStart.size(); ++i) {
+        childStart[i] += childStart[i - 1];
+    }
+    std::vector<uint32_t> children(count);
+    for (uint32_t slot = 0; slot < count; ++slot) {
+        uint32_t parent = parents[slot] != NO_PARENT ? parents[slot] : count;
+        children[childStart[parent + 1]++] = slot;
+    }
+
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> depths;
+    std::vector<uint32_t> newSlots(count, NO_SLOT);
+    std::vector<uint32_t> stack;
+    order.reserve(count);
+    depths.reserve(count);
+    uint32_t roots = 0;
+    uint32_t maxDepth = 0;
+
+    for (uint32_t i = childStart[count + 1]; i-- > childStart[count];) {
+        stack.push_back(children[i]);
+    }
+    while (!stack.empty()) {
+        uint32_t slot = stack.back();
+        stack.pop_back();
+        if (flags[slot] & FLAG_DESTROYED) continue;
+
+        uint32_t parent = parents[slot];
+        uint32_t depth = parent != NO_PARENT ? depths[newSlots[parent]] + 1 : 0;
+        if (parent == NO_PARENT) roots++;
+        maxDepth = std::max(maxDepth, depth);
+
+        newSlots[slot] = (uint32_t)order.size();
+        order.push_back(slot);
+        depths.push_back(depth);
+        for (uint32_t i = childStart[slot + 1]; i-- > childStart[slot];) {
+            stack.push_back(children[i]);
+        }
+    }
+
+    for (uint32_t slot = 0; slot < count; ++slot) {
+        if (newSlots[slot] == NO_SLOT) {
+            slots[entities[slot]] = NO_SLOT;
+            freeEntities.push_back(entities[slot]);
+        }
+    }
+
+    std::vector<uint32_t> indices;
+    std::vector<uint8_t> bytes;
+    std::vector<float> floats;
+    std::vector<Math::Mat4> matrices;
+    permute(entities, order, indices);
+    permute(parents, order, indices);
+    permute(meshes, order, indices);
+    permute(materials, order, indices);
+    permute(flags, order, bytes);
+    permute(world, order, matrices);
+    for (std::vector<float>* values: { &local.positionX, &local.positionY, &local.positionZ,
+            &local.rotationX, &local.rotationY, &local.rotationZ, &local.rotationW, &local.scale,
+            &localBounds.minX, &localBounds.minY, &localBounds.minZ,
+            &localBounds.maxX, &localBounds.maxY, &localBounds.maxZ,
+            &worldBounds.minX, &worldBounds.minY, &worldBounds.minZ,
+            &worldBounds.maxX, &worldBounds.maxY, &worldBounds.maxZ }) {
+        permute(*values, order, floats);
+    }
+
+    count = (uint32_t)order.size();
+    subtreeEnds.resize(count);
+    dirtySlots.clear();
+    for (uint32_t slot = 0; slot < count; ++slot) {
+        slots[entities[slot]] = slot;
+        if (parents[slot] != NO_PARENT) {
+            parents[slot] = newSlots[parents[slot]];
+        }
+        subtreeEnds[slot] = slot + 1;
+        if (flags[slot] & FLAG_DIRTY) {
+            dirtySlots.push_back(slot);
+        }
+    }
+    // Children come after their parents, so walking backwards finishes
+    // every subtree before its parent reads it.
+    for (uint32_t slot = count; slot-- > 0;) {
+        if (parents[slot] != NO_PARENT) {
+            subtreeEnds[parents[slot]] = std::max(subtreeEnds[parents[slot]], subtreeEnds[slot]);
+        }
+    }
+
+    orderDirty = false;
+    stats.entities = count;
+    stats.roots = roots;
+    stats.depth = maxDepth;
+    stats.reorders++;
+}
+
+size_t Scene::update() {
+    if (orderDirty) sort();
+
+    changed.clear();
+    stats.dirtyEntities = (uint32_t)dirtySlots.size();
+    stats.updatedSubtrees = 0;
+    stats.updatedEntities = 0;
+
+    // A dirty slot inside a subtree that was just updated is covered by it.
+    std::sort(dirtySlots.begin(), dirtySlots.end());
+    uint32_t covered = 0;
+    for (uint32_t slot: dirtySlots) {
+        flags[slot] &= ~FLAG_DIRTY;
+        if (slot < covered) continue;
+
+        uint32_t end = subtreeEnds[slot];
+        updateRange(slot, end);
+        stats.updatedSubtrees++;
+        stats.updatedEntities += end - slot;
+
+        if (!changed.empty() && changed.back().first + changed.back().count == slot) {
+            changed.back().count += end - slot;
+        } else {
+            changed.push_back(Range { slot, end - slot });
+        }
+        covered = end;
+    }
+    dirtySlots.clear();
+
+    return stats.updatedEntities;
+}
+
+// Composes the local matrices of the range, then multiplies each by its
+// parent's world matrix. The parent of first is outside the range and up to
+// date; every other parent precedes its children in it. Siblings that are
+// next to each other are multiplied in one batch.
+void Scene::updateRange(uint32_t first, uint32_t end) {
+    Math::composeTransforms(local, first, end - first, world[first].m, 16);
+
+    for (uint32_t slot = first; slot < end;) {
+        uint32_t parent = parents[slot];
+        uint32_t runEnd = slot + 1;
+        while (runEnd < end && parents[runEnd] == parent) runEnd++;
+
+        if (parent != NO_PARENT) {
+            Math::multiplyMatrices(world[parent], world[slot].m, 16, world[slot].m, 16, runEnd - slot);
+        }
+        slot = runEnd;
+    }
+
+    // The world box of a local box: its transformed centre, and the extent
+    // projected on the axes through the absolute matrix.
+    for (uint32_t slot = first; slot < end; ++slot) {
+        const float* m = world[slot].m;
+        float cx = (localBounds.minX[slot] + localBounds.maxX[slot]) * 0.5f;
+        float cy = (localBounds.minY[slot] + localBounds.maxY[slot]) * 0.5f;
+        float cz = (localBounds.minZ[slot] + localBounds.maxZ[slot]) * 0.5f;
+        float ex = (localBounds.maxX[slot] - localBounds.minX[slot]) * 0.5f;
+        float ey = (localBounds.maxY[slot] - localBounds.minY[slot]) * 0.5f;
+        float ez = (localBounds.maxZ[slot] - localBounds.minZ[slot]) * 0.5f;
+
+        float wx = m[0] * cx + m[4] * cy + m[8] * cz + m[12];
+        float wy = m[1] * cx + m[5] * cy + m[9] * cz + m[13];
+        float wz = m[2] * cx + m[6] * cy + m[10] * cz + m[14];
+        float rx = std::fabs(m[0]) * ex + std::fabs(m[4]) * ey + std::fabs(m[8]) * ez;
+        float ry = std::fabs(m[1]) * ex + std::fabs(m[5]) * ey + std::fabs(m[9]) * ez;
+        float rz = std::fabs(m[2]) * ex + std::fabs(m[6]) * ey + std::fabs(m[10]) * ez;
+
+        worldBounds.minX[slot] = wx - rx;
+        worldBounds.minY[slot] = wy - ry;
+        worldBounds.minZ[slot] = wz - rz;
+        worldBounds.maxX[slot] = wx + rx;
+        worldBounds.maxY[slot] = wy + ry;
+        worldBounds.maxZ[slot] = wz + rz;
+    }
+}
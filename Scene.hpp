@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Culling.hpp"
+#include "Math.hpp"
+
+// Entity storage for scenes too large to keep as objects. Components are
+// structure-of-arrays indexed by slot: local transforms, world matrices,
+// local and world bounds, and mesh and material handles. Slots are kept in
+// depth-first order, so parents come before their children and every
+// subtree covers a contiguous range of slots.
+//
+// Setting a local transform or bounds only marks the entity. update()
+// recomputes world matrices and bounds for the marked subtrees, one linear
+// pass over each range, and leaves every other slot alone. Structural
+// changes are batched: the order is rebuilt once, in the next update().
+class Scene {
+    public:
+        typedef uint32_t Entity;
+        static const Entity INVALID_ENTITY = UINT32_MAX;
+        static const uint32_t NO_HANDLE = UINT32_MAX;
+
+        // Slots whose world matrices and bounds changed in the last update().
+        struct Range {
+            uint32_t first;
+            uint32_t count;
+        };
+
+        struct Stats {
+            uint32_t entities = 0;
+            uint32_t roots = 0;
+            uint32_t depth = 0;             // deepest level, roots are 0
+            uint64_t reorders = 0;
+
+            // Of the last update().
+            uint32_t dirtyEntities = 0;
+            uint32_t updatedSubtrees = 0;
+            uint32_t updatedEntities = 0;
+        };
+
+    private:
+        static const uint32_t NO_PARENT = UINT32_MAX;
+        static const uint32_t NO_SLOT = UINT32_MAX;
+
+        enum Flags {
+            FLAG_DIRTY = 1,
+            FLAG_DESTROYED = 2
+        };
+
+        // Per slot. parents holds slots as well.
+        std::vector<Entity> entities = {};
+        std::vector<uint32_t> parents = {};
+        std::vector<uint32_t> subtreeEnds = {};
+        std::vector<uint8_t> flags = {};
+        Math::TransformArrays local;
+        std::vector<Math::Mat4> world = {};
+        Culling::BoundsArrays localBounds;
+        Culling::BoundsArrays worldBounds;
+        std::vector<uint32_t> meshes = {};
+        std::vector<uint32_t> materials = {};
+
+        // Per entity, NO_SLOT for free ids.
+        std::vector<uint32_t> slots = {};
+        std::vector<Entity> freeEntities = {};
+
+        std::vector<uint32_t> dirtySlots = {};
+        std::vector<Range> changed = {};
+        bool orderDirty = false;
+        Stats stats;
+
+        void markDirty(uint32_t slot);
+        void sort();
+        void updateRange(uint32_t first, uint32_t end);
+
+    public:
+        void reserve(size_t count);
+        void clear();
+
+        // New entities are at the origin without bounds or handles.
+        Entity create(Entity parent = INVALID_ENTITY);
+        // Takes the entity's descendants with it in the next update().
+        void destroy(Entity entity);
+        // Keeps the local transform. Fails if parent is the entity itself or
+        // one of its descendants.
+        bool setParent(Entity entity, Entity parent);
+        Entity getParent(Entity entity) const;
+        bool isAlive(Entity entity) const {
+            return entity < slots.size() && slots[entity] != NO_SLOT;
+        }
+
+        void setLocalTransform(Entity entity, const Math::Vec3& position, const Math::Quat& rotation, float scale);
+        void setLocalBounds(Entity entity, const Math::Vec3& min, const Math::Vec3& max);
+        void setMesh(Entity entity, uint32_t mesh) {
+            meshes[slots[entity]] = mesh;
+        }
+        void setMaterial(Entity entity, uint32_t material) {
+            materials[slots[entity]] = material;
+        }
+        uint32_t getMesh(Entity entity) const {
+            return meshes[slots[entity]];
+        }
+        uint32_t getMaterial(Entity entity) const {
+            return materials[slots[entity]];
+        }
+
+        // Marks every root, so the next update() recomputes everything.
+        void invalidate();
+        // Applies structural changes and propagates transforms. Returns the
+        // number of entities whose world matrices were recomputed.
+        size_t update();
+
+        // Valid after update().
+        const Math::Mat4& getWorldMatrix(Entity entity) const {
+            return world[slots[entity]];
+        }
+        const std::vector<Range>& getChangedRanges() const {
+            return changed;
+        }
+
+        // Slot-indexed component arrays, in hierarchy order.
+        size_t getSlotCount() const {
+            return entities.size();
+        }
+        uint32_t getSlot(Entity entity) const {
+            return slots[entity];
+        }
+        const std::vector<Entity>& getEntities() const {
+            return entities;
+        }
+        const std::vector<Math::Mat4>& getWorldMatrices() const {
+            return world;
+        }
+        const Culling::BoundsArrays& getWorldBounds() const {
+            return worldBounds;
+        }
+        const std::vector<uint32_t>& getMeshes() const {
+            return meshes;
+        }
+        const std::vector<uint32_t>& getMaterials() const {
+            return materials;
+        }
+
+        const Stats& getStats() const {
+            return stats;
+        }
+};
@@ -0,0 +1,256 @@
+#include "ShaderCache.hpp"
+#include "PipelineCache.hpp"
+#include "VulkanError.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+#include <chrono>
+#include <cstdio>
+
+static const uint32_t SPIRV_MAGIC = 0x07230203;
+
+typedef std::chrono::steady_clock Clock;
+
+static double millisecondsSince(Clock::time_point begin) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+}
+
+bool ShaderCache::init(VkDevice device, const std::string& prewarmPath) {
+    this->device = device;
+    this->prewarmPath = prewarmPath;
+    return true;
+}
+
+void ShaderCache::destroy() {
+    if (device == VK_NULL_HANDLE) return;
+
+    savePrewarmList();
+
+    for (FamilyEntry& family: families) {
+        for (auto& entry: family.pipelines) {
+            if (entry.second != VK_NULL_HANDLE) {
+                vkDestroyPipeline(device, entry.second, NULL);
+            }
+        }
+    }
+    families.clear();
+
+    for (auto& entry: modules) {
+        vkDestroyShaderModule(device, entry.second, NULL);
+    }
+    modules.clear();
+    paths.clear();
+
+    device = VK_NULL_HANDLE;
+    std::cout << "Shader modules and pipeline variants deleted" << std::endl;
+}
+
+// The file is read without holding mutex, two threads loading the same
+// path at once end up with the same module.
+VkShaderModule ShaderCache::getModule(const std::string& path) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto known = paths.find(path);
+        if (known != paths.end()) return modules[known->second];
+    }
+
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        std::cout << "Failed to open shader " << path << std::endl;
+        return VK_NULL_HANDLE;
+    }
+
+    // SPIR-V is consumed as 32-bit words.
+    size_t size = (size_t)file.tellg();
+    std::vector<uint32_t> code((size + 3) / 4);
+    file.seekg(0);
+    file.read((char*)code.data(), size);
+    if (!file || size % 4 != 0 || code.empty() || code[0] != SPIRV_MAGIC) {
+        std::cout << "Shader " << path << " is not SPIR-V" << std::endl;
+        return VK_NULL_HANDLE;
+    }
+
+    uint64_t hash = PipelineCache::hash(code.data(), size);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    bool knownPath = paths.count(path) != 0;
+    paths[path] = hash;
+
+    auto loaded = modules.find(hash);
+    if (loaded != modules.end()) {
+        if (!knownPath) stats.sharedModules++;
+        return loaded->second;
+    }
+
+    VkShaderModuleCreateInfo shaderModuleCreateInfo {};
+    shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shaderModuleCreateInfo.codeSize = size;
+    shaderModuleCreateInfo.pCode = code.data();
+
+    VkShaderModule shaderModule = VK_NULL_HANDLE;
+    VkResult result = vkCreateShaderModule(device, &shaderModuleCreateInfo, NULL, &shaderModule);
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create shader module " << path << ": " << getVulkanErrorString(result) << std::endl;
+        paths.erase(path);
+        return VK_NULL_HANDLE;
+    }
+
+    modules[hash] = shaderModule;
+    stats.modules++;
+    stats.moduleBytes += size;
+    return shaderModule;
+}
+
+ShaderCache::Family ShaderCache::addFamily(const std::string& name, Builder builder) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    FamilyEntry family;
+    family.name = name;
+    family.builder = builder;
+    families.push_back(family);
+    return (Family)(families.size() - 1);
+}
+
+std::string ShaderCache::getVariantName(const std::string& family, const Variant& variant) {
+    std::ostringstream name;
+    name << family << "[" << variant.state;
+    for (uint32_t constant: variant.constants) {
+        name << "," << constant;
+    }
+    name << "]";
+    return name.str();
+}
+
+// Returns the variant, building it first if it does not exist; count and
+// time are the stats charged for building it. The builder runs without
+// holding mutex, other threads asking for the same variant wait for it.
+VkPipeline ShaderCache::resolve(Family family, const Variant& variant, uint32_t& count, double& time) {
+    std::pair<Family, Variant> key(family, variant);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    built.wait(lock, [&] { return building.count(key) == 0; });
+
+    FamilyEntry& entry = families[family];
+    auto found = entry.pipelines.find(variant);
+    if (found != entry.pipelines.end()) return found->second;
+
+    building.insert(key);
+    std::string name = getVariantName(entry.name, variant);
+    Builder builder = entry.builder;
+    lock.unlock();
+
+    Clock::time_point begin = Clock::now();
+
+    std::vector<VkSpecializationMapEntry> entries(variant.constants.size());
+    for (uint32_t i = 0; i < variant.constants.size(); ++i) {
+        entries[i].constantID = i;
+        entries[i].offset = i * sizeof(uint32_t);
+        entries[i].size = sizeof(uint32_t);
+    }
+
+    VkSpecializationInfo specialization {};
+    specialization.mapEntryCount = (uint32_t)entries.size();
+    specialization.pMapEntries = entries.data();
+    specialization.dataSize = variant.constants.size() * sizeof(uint32_t);
+    specialization.pData = variant.constants.data();
+
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    bool created = builder(name, variant, specialization, pipeline);
+    if (!created) {
+        std::cout << "Failed to create pipeline variant " << name << std::endl;
+        pipeline = VK_NULL_HANDLE;
+    }
+    double elapsed = millisecondsSince(begin);
+
+    lock.lock();
+    if (created) stats.variants++;
+    count++;
+    time += elapsed;
+    families[family].pipelines[variant] = pipeline;
+    building.erase(key);
+    built.notify_all();
+    return pipeline;
+}
+
+VkPipeline ShaderCache::getPipeline(Family family, const Variant& variant) {
+    return resolve(family, variant, stats.lazy, stats.lazyTime);
+}
+
+bool ShaderCache::warm(Family family, const Variant& variant) {
+    return resolve(family, variant, stats.prewarmed, stats.prewarmTime) != VK_NULL_HANDLE;
+}
+
+// One variant per line: family name, state, then the constants.
+std::vector<ShaderCache::ListedVariant> ShaderCache::readPrewarmList() {
+    std::vector<ListedVariant> listed;
+
+    std::ifstream file(prewarmPath);
+    if (!file) return listed;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string name;
+        Variant variant;
+        if (!(fields >> name >> variant.state)) continue;
+        uint32_t constant;
+        while (fields >> constant) {
+            variant.constants.push_back(constant);
+        }
+
+        for (Family family = 0; family < families.size(); ++family) {
+            if (families[family].name == name && families[family].pipelines.count(variant) == 0) {
+                listed.push_back({ family, variant, getVariantName(name, variant) });
+            }
+        }
+    }
+
+    return listed;
+}
+
+void ShaderCache::prewarm() {
+    for (const ListedVariant& listed: readPrewarmList()) {
+        warm(listed.family, listed.variant);
+    }
+}
+
+bool ShaderCache::savePrewarmList() const {
+    if (prewarmPath.empty()) return false;
+
+    // Write to a temporary file first so a crash never leaves a torn list.
+    std::string tempPath = prewarmPath + ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::trunc);
+        for (const FamilyEntry& family: families) {
+            for (const auto& entry: family.pipelines) {
+                if (entry.second == VK_NULL_HANDLE) continue;
+
+                file << family.name << " " << entry.first.state;
+                for (uint32_t constant: entry.first.constants) {
+                    file << " " << constant;
+                }
+                file << "\n";
+            }
+        }
+        if (!file) {
+            std::cout << "Failed to write pipeline variant list " << tempPath << std::endl;
+            return false;
+        }
+    }
+
+    if (std::rename(tempPath.c_str(), prewarmPath.c_str()) != 0) {
+        std::cout << "Failed to replace pipeline variant list " << prewarmPath << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void ShaderCache::printStats() const {
+    std::cout << "Shaders: " << stats.modules << " modules of " << stats.moduleBytes << " bytes, "
+              << stats.sharedModules << " shared; " << stats.variants << " pipeline variants, "
+              << stats.prewarmed << " prewarmed in " << stats.prewarmTime << " ms, "
+              << stats.lazy << " created on first use in " << stats.lazyTime << " ms" << std::endl;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+// SPIR-V modules and the pipeline variants built from them.
+//
+// Every file is read once; modules are keyed by a hash of their contents, so
+// the same binary under two paths is one module, and they live as long as
+// the cache so variants can still be built mid-run.
+//
+// Pipelines are grouped in families, one per shader set. A variant of a
+// family differs in its specialization constants and in one word of state
+// the family's builder interprets itself, like a vertex format. Variants
+// are created on first use; the ones a run used are saved to a prewarm list
+// and created up front by the next run, before the first frame needs them.
+//
+// Modules and variants may be requested from several threads at once, a
+// variant being built by one of them is waited for by the others. Families
+// have to be added before that.
+class ShaderCache {
+    public:
+        typedef uint32_t Family;
+
+        struct Variant {
+            uint32_t state = 0;
+            // Value of specialization constant i, all of them 32-bit.
+            std::vector<uint32_t> constants = {};
+
+            bool operator<(const Variant& other) const {
+                if (state != other.state) return state < other.state;
+                return constants < other.constants;
+            }
+        };
+
+        // Creates the pipeline of one variant; specialization has to be
+        // passed to every stage. name identifies the variant in logs.
+        typedef std::function<bool(const std::string& name, const Variant& variant,
+            const VkSpecializationInfo& specialization, VkPipeline& pipeline)> Builder;
+
+        struct Stats {
+            uint32_t modules = 0;
+            size_t moduleBytes = 0;
+            uint32_t sharedModules = 0;     // paths that resolved to a loaded module
+            uint32_t variants = 0;
+            uint32_t prewarmed = 0;
+            uint32_t lazy = 0;              // created on first use
+            double prewarmTime = 0.0;       // ms, summed over threads
+            double lazyTime = 0.0;          // ms, spent inside frames
+        };
+
+        struct ListedVariant {
+            Family family;
+            Variant variant;
+            std::string name;
+        };
+
+    private:
+        struct FamilyEntry {
+            std::string name;
+            Builder builder;
+            // Failed variants are kept as VK_NULL_HANDLE, they are not
+            // retried every frame.
+            std::map<Variant, VkPipeline> pipelines = {};
+        };
+
+        VkDevice device = VK_NULL_HANDLE;
+        std::map<std::string, uint64_t> paths = {};
+        std::map<uint64_t, VkShaderModule> modules = {};
+        std::vector<FamilyEntry> families = {};
+        std::string prewarmPath = "";
+        Stats stats;
+
+        std::mutex mutex;
+        std::condition_variable built;
+        std::set<std::pair<Family, Variant>> building = {};
+
+        VkPipeline resolve(Family family, const Variant& variant, uint32_t& count, double& time);
+
+    public:
+        bool init(VkDevice device, const std::string& prewarmPath);
+        // Saves the prewarm list before destroying modules and pipelines.
+        void destroy();
+
+        // VK_NULL_HANDLE if the file cannot be read or is not SPIR-V.
+        VkShaderModule getModule(const std::string& path);
+
+        Family addFamily(const std::string& name, Builder builder);
+
+        // The variants of the prewarm list whose families have been added
+        // and that do not exist yet, for creating them on other threads. A
+        // missing or stale list is not an error.
+        std::vector<ListedVariant> readPrewarmList();
+
+        // Creates every variant of readPrewarmList().
+        void prewarm();
+
+        // Creates a variant ahead of its first use, e.g. the one the first
+        // frame is going to need.
+        bool warm(Family family, const Variant& variant);
+
+        // Creates the variant if this is its first use, which stalls the
+        // caller; resolve pipelines before handing work to record threads.
+        VkPipeline getPipeline(Family family, const Variant& variant);
+
+        // family[state,constant,...], as in logs.
+        static std::string getVariantName(const std::string& family, const Variant& variant);
+
+        bool savePrewarmList() const;
+
+        const Stats& getStats() const {
+            return stats;
+        }
+        void printStats() const;
+};
@@ -0,0 +1,677 @@
+#include "SoftwareRasterizer.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#include "MeshFile.hpp"
+#include "MeshOptimizer.hpp"
+#include "Renderer.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RASTER_X86 1
+#include <immintrin.h>
+#define RASTER_AVX2 __attribute__((target("avx2")))
+#endif
+
+typedef SoftwareRasterizer::Triangle Triangle;
+
+static const int32_t SUBPIXEL_BITS = 4;
+static const int32_t SUBPIXEL = 1 << SUBPIXEL_BITS;
+// Clip space w below this is treated as behind the eye.
+static const float MIN_W = 1e-6f;
+
+// Per clip space vertex: outside a frustum plane, or beyond the guard band.
+enum Outcode {
+    OUT_LEFT = 1,
+    OUT_RIGHT = 2,
+    OUT_LOW = 4,
+    OUT_HIGH = 8,
+    OUT_NEAR = 16,
+    OUT_FAR = 32,
+    OUT_BEHIND = 64,
+    GUARD_LEFT = 128,
+    GUARD_RIGHT = 256,
+    GUARD_LOW = 512,
+    GUARD_HIGH = 1024
+};
+// A triangle with all vertices outside one of these planes is invisible.
+static const uint16_t CULL_CODES = OUT_LEFT | OUT_RIGHT | OUT_LOW | OUT_HIGH | OUT_NEAR | OUT_FAR | OUT_BEHIND;
+// Anything crossing these is clipped; the frustum sides are left to the
+// scissor test inside the guard band.
+static const uint16_t CLIP_CODES = OUT_NEAR | OUT_FAR | OUT_BEHIND | GUARD_LEFT | GUARD_RIGHT | GUARD_LOW | GUARD_HIGH;
+static const uint16_t CLIP_PLANES[] = { OUT_BEHIND, OUT_NEAR, OUT_FAR, GUARD_LEFT, GUARD_RIGHT, GUARD_LOW, GUARD_HIGH };
+static const int MAX_CLIPPED_VERTICES = 3 + sizeof(CLIP_PLANES) / sizeof(CLIP_PLANES[0]);
+
+static int32_t floorDiv(int32_t value, int32_t divisor) {
+    return value >= 0 ? value / divisor : -((-value + divisor - 1) / divisor);
+}
+
+static uint32_t packColor(const float* color, float shade) {
+    uint32_t packed = 0xff000000u;
+    for (int c = 0; c < 3; ++c) {
+        float value = std::min(std::max(color[c] * shade, 0.0f), 1.0f);
+        packed |= (uint32_t)lrintf(value * 255.0f) << (8 * c);
+    }
+    return packed;
+}
+
+// Edge values at the first pixel of a rectangle and their steps per pixel.
+// Edges the whole rectangle is inside of are replaced by a constant 0, the
+// others cross it, which bounds their values within it to 32 bits.
+struct Edges {
+    int32_t e[3];
+    int32_t stepX[3];
+    int32_t stepY[3];
+};
+
+static bool prepareEdges(const Triangle& t, int32_t x0, int32_t y0, int32_t x1, int32_t y1, Edges& edges) {
+    for (int i = 0; i < 3; ++i) {
+        int64_t stepX = (int64_t)t.a[i] * SUBPIXEL;
+        int64_t stepY = (int64_t)t.b[i] * SUBPIXEL;
+        int64_t e = (int64_t)t.a[i] * (x0 * SUBPIXEL + SUBPIXEL / 2) +
+            (int64_t)t.b[i] * (y0 * SUBPIXEL + SUBPIXEL / 2) + t.c[i];
+
+        int64_t spanX = stepX * (x1 - x0 - 1);
+        int64_t spanY = stepY * (y1 - y0 - 1);
+        int64_t minE = e + std::min<int64_t>(spanX, 0) + std::min<int64_t>(spanY, 0);
+        int64_t maxE = e + std::max<int64_t>(spanX, 0) + std::max<int64_t>(spanY, 0);
+        if (maxE < 0) return false;
+
+        bool inside = minE >= 0;
+        edges.e[i] = inside ? 0 : (int32_t)e;
+        edges.stepX[i] = inside ? 0 : (int32_t)stepX;
+        edges.stepY[i] = inside ? 0 : (int32_t)stepY;
+    }
+    return true;
+}
+
+// Kernels, one per Math::SimdLevel. Each fills the pixels of [x0, x1) x
+// [y0, y1) covered by the triangle that pass the depth test, evaluating the
+// attribute planes in the same order, with the same result.
+
+static void rasterizeScalar(const Triangle& t, int32_t x0, int32_t y0, int32_t x1, int32_t y1,
+        uint32_t* color, float* depth, uint32_t stride) {
+    Edges edges;
+    if (!prepareEdges(t, x0, y0, x1, y1, edges)) return;
+
+    int32_t row[3] { edges.e[0], edges.e[1], edges.e[2] };
+    for (int32_t y = y0; y < y1; ++y) {
+        int32_t e0 = row[0], e1 = row[1], e2 = row[2];
+        uint32_t* colorRow = color + (size_t)y * stride;
+        float* depthRow = depth + (size_t)y * stride;
+        float fy = (float)y;
+        float zRow = t.z[0] + t.z[2] * fy;
+        float invWRow = t.invW[0] + t.invW[2] * fy;
+        float shadeRow = t.shadeOverW[0] + t.shadeOverW[2] * fy;
+
+        for (int32_t x = x0; x < x1; ++x) {
+            if ((e0 | e1 | e2) >= 0) {
+                float fx = (float)x;
+                float z = zRow + t.z[1] * fx;
+                if (z <= depthRow[x]) {
+                    float invW = invWRow + t.invW[1] * fx;
+                    float shade = (shadeRow + t.shadeOverW[1] * fx) / invW;
+                    depthRow[x] = z;
+                    colorRow[x] = packColor(t.color, shade);
+                }
+            }
+            e0 += edges.stepX[0];
+            e1 += edges.stepX[1];
+            e2 += edges.stepX[2];
+        }
+
+        row[0] += edges.stepY[0];
+        row[1] += edges.stepY[1];
+        row[2] += edges.stepY[2];
+    }
+}
+
+#ifdef RASTER_X86
+// 4 pixels per iteration. Rows are padded to whole tiles, so groups that
+// start at a multiple of 4 never leave the buffer.
+static void rasterizeSse(const Triangle& t, int32_t x0, int32_t y0, int32_t x1, int32_t y1,
+        uint32_t* color, float* depth, uint32_t stride) {
+    int32_t xStart = x0 & ~3;
+    Edges edges;
+    if (!prepareEdges(t, xStart, y0, x1, y1, edges)) return;
+
+    __m128i row[3], step[3];
+    for (int i = 0; i < 3; ++i) {
+        int32_t e = edges.e[i], s = edges.stepX[i];
+        row[i] = _mm_setr_epi32(e, e + s, e + 2 * s, e + 3 * s);
+        step[i] = _mm_set1_epi32(4 * s);
+    }
+
+    const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128 laneOffsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    const __m128i first = _mm_set1_epi32(x0 - 1);
+    const __m128i end = _mm_set1_epi32(x1);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(255.0f);
+    const __m128i alpha = _mm_set1_epi32((int)0xff000000u);
+    const __m128 red = _mm_set1_ps(t.color[0]);
+    const __m128 green = _mm_set1_ps(t.color[1]);
+    const __m128 blue = _mm_set1_ps(t.color[2]);
+    const __m128 zX = _mm_set1_ps(t.z[1]);
+    const __m128 invWX = _mm_set1_ps(t.invW[1]);
+    const __m128 shadeX = _mm_set1_ps(t.shadeOverW[1]);
+
+    for (int32_t y = y0; y < y1; ++y) {
+        __m128i e0 = row[0], e1 = row[1], e2 = row[2];
+        uint32_t* colorRow = color + (size_t)y * stride;
+        float* depthRow = depth + (size_t)y * stride;
+        float fy = (float)y;
+        __m128 zRow = _mm_set1_ps(t.z[0] + t.z[2] * fy);
+        __m128 invWRow = _mm_set1_ps(t.invW[0] + t.invW[2] * fy);
+        __m128 shadeRow = _mm_set1_ps(t.shadeOverW[0] + t.shadeOverW[2] * fy);
+
+        for (int32_t x = xStart; x < x1; x += 4) {
+            // Inside all edges has every sign bit clear.
+            __m128i xs = _mm_add_epi32(_mm_set1_epi32(x), lanes);
+            __m128i mask = _mm_and_si128(_mm_cmpgt_epi32(xs, first), _mm_cmplt_epi32(xs, end));
+            __m128i outside = _mm_srai_epi32(_mm_or_si128(_mm_or_si128(e0, e1), e2), 31);
+            mask = _mm_andnot_si128(outside, mask);
+
+            if (_mm_movemask_epi8(mask) != 0) {
+                __m128 fx = _mm_add_ps(_mm_set1_ps((float)x), laneOffsets);
+                __m128 z = _mm_add_ps(zRow, _mm_mul_ps(zX, fx));
+                __m128 d = _mm_loadu_ps(depthRow + x);
+                __m128 pass = _mm_and_ps(_mm_castsi128_ps(mask), _mm_cmple_ps(z, d));
+
+                if (_mm_movemask_ps(pass) != 0) {
+                    _mm_storeu_ps(depthRow + x, _mm_or_ps(_mm_and_ps(pass, z), _mm_andnot_ps(pass, d)));
+
+                    __m128 invW = _mm_add_ps(invWRow, _mm_mul_ps(invWX, fx));
+                    __m128 shade = _mm_div_ps(_mm_add_ps(shadeRow, _mm_mul_ps(shadeX, fx)), invW);
+                    __m128i r = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_mul_ps(red, shade), zero), one), scale));
+                    __m128i g = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_mul_ps(green, shade), zero), one), scale));
+                    __m128i b = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_mul_ps(blue, shade), zero), one), scale));
+                    __m128i packed = _mm_or_si128(_mm_or_si128(r, _mm_slli_epi32(g, 8)),
+                        _mm_or_si128(_mm_slli_epi32(b, 16), alpha));
+
+                    __m128i passMask = _mm_castps_si128(pass);
+                    __m128i old = _mm_loadu_si128((const __m128i*)(colorRow + x));
+                    _mm_storeu_si128((__m128i*)(colorRow + x),
+                        _mm_or_si128(_mm_and_si128(passMask, packed), _mm_andnot_si128(passMask, old)));
+                }
+            }
+
+            e0 = _mm_add_epi32(e0, step[0]);
+            e1 = _mm_add_epi32(e1, step[1]);
+            e2 = _mm_add_epi32(e2, step[2]);
+        }
+
+        row[0] = _mm_add_epi32(row[0], _mm_set1_epi32(edges.stepY[0]));
+        row[1] = _mm_add_epi32(row[1], _mm_set1_epi32(edges.stepY[1]));
+        row[2] = _mm_add_epi32(row[2], _mm_set1_epi32(edges.stepY[2]));
+    }
+}
+
+// 8 pixels per iteration, otherwise the same as rasterizeSse(). There is
+// no FMA, so that all kernels produce the same image.
+RASTER_AVX2 static void rasterizeAvx2(const Triangle& t, int32_t x0, int32_t y0, int32_t x1, int32_t y1,
+        uint32_t* color, float* depth, uint32_t stride) {
+    int32_t xStart = x0 & ~7;
+    Edges edges;
+    if (!prepareEdges(t, xStart, y0, x1, y1, edges)) return;
+
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i row[3], step[3];
+    for (int i = 0; i < 3; ++i) {
+        row[i] = _mm256_add_epi32(_mm256_set1_epi32(edges.e[i]), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(edges.stepX[i])));
+        step[i] = _mm256_set1_epi32(8 * edges.stepX[i]);
+    }
+
+    const __m256 laneOffsets = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+    const __m256i first = _mm256_set1_epi32(x0 - 1);
+    const __m256i end = _mm256_set1_epi32(x1);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 scale = _mm256_set1_ps(255.0f);
+    const __m256i alpha = _mm256_set1_epi32((int)0xff000000u);
+    const __m256 red = _mm256_set1_ps(t.color[0]);
+    const __m256 green = _mm256_set1_ps(t.color[1]);
+    const __m256 blue = _mm256_set1_ps(t.color[2]);
+    const __m256 zX = _mm256_set1_ps(t.z[1]);
+    const __m256 invWX = _mm256_set1_ps(t.invW[1]);
+    const __m256 shadeX = _mm256_set1_ps(t.shadeOverW[1]);
+
+    for (int32_t y = y0; y < y1; ++y) {
+        __m256i e0 = row[0], e1 = row[1], e2 = row[2];
+        uint32_t* colorRow = color + (size_t)y * stride;
+        float* depthRow = depth + (size_t)y * stride;
+        float fy = (float)y;
+        __m256 zRow = _mm256_set1_ps(t.z[0] + t.z[2] * fy);
+        __m256 invWRow = _mm256_set1_ps(t.invW[0] + t.invW[2] * fy);
+        __m256 shadeRow = _mm256_set1_ps(t.shadeOverW[0] + t.shadeOverW[2] * fy);
+
+        for (int32_t x = xStart; x < x1; x += 8) {
+            __m256i xs = _mm256_add_epi32(_mm256_set1_epi32(x), lanes);
+            __m256i mask = _mm256_and_si256(_mm256_cmpgt_epi32(xs, first), _mm256_cmpgt_epi32(end, xs));
+            __m256i outside = _mm256_srai_epi32(_mm256_or_si256(_mm256_or_si256(e0, e1), e2), 31);
+            mask = _mm256_andnot_si256(outside, mask);
+
+            if (!_mm256_testz_si256(mask, mask)) {
+                __m256 fx = _mm256_add_ps(_mm256_set1_ps((float)x), laneOffsets);
+                __m256 z = _mm256_add_ps(zRow, _mm256_mul_ps(zX, fx));
+                __m256 d = _mm256_loadu_ps(depthRow + x);
+                __m256 pass = _mm256_and_ps(_mm256_castsi256_ps(mask), _mm256_cmp_ps(z, d, _CMP_LE_OQ));
+
+                if (_mm256_movemask_ps(pass) != 0) {
+                    _mm256_storeu_ps(depthRow + x, _mm256_blendv_ps(d, z, pass));
+
+                    __m256 invW = _mm256_add_ps(invWRow, _mm256_mul_ps(invWX, fx));
+                    __m256 shade = _mm256_div_ps(_mm256_add_ps(shadeRow, _mm256_mul_ps(shadeX, fx)), invW);
+                    __m256i r = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(red, shade), zero), one), scale));
+                    __m256i g = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(green, shade), zero), one), scale));
+                    __m256i b = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(blue, shade), zero), one), scale));
+                    __m256i packed = _mm256_or_si256(_mm256_or_si256(r, _mm256_slli_epi32(g, 8)),
+                        _mm256_or_si256(_mm256_slli_epi32(b, 16), alpha));
+
+                    __m256i old = _mm256_loadu_si256((const __m256i*)(colorRow + x));
+                    _mm256_storeu_si256((__m256i*)(colorRow + x), _mm256_castps_si256(
+                        _mm256_blendv_ps(_mm256_castsi256_ps(old), _mm256_castsi256_ps(packed), pass)));
+                }
+            }
+
+            e0 = _mm256_add_epi32(e0, step[0]);
+            e1 = _mm256_add_epi32(e1, step[1]);
+            e2 = _mm256_add_epi32(e2, step[2]);
+        }
+
+        row[0] = _mm256_add_epi32(row[0], _mm256_set1_epi32(edges.stepY[0]));
+        row[1] = _mm256_add_epi32(row[1], _mm256_set1_epi32(edges.stepY[1]));
+        row[2] = _mm256_add_epi32(row[2], _mm256_set1_epi32(edges.stepY[2]));
+    }
+}
+#endif
+
+typedef void (*RasterizeKernel)(const Triangle&, int32_t, int32_t, int32_t, int32_t, uint32_t*, float*, uint32_t);
+
+static const RasterizeKernel rasterizeKernels[] = {
+    rasterizeScalar,
+#ifdef RASTER_X86
+    rasterizeSse,
+    rasterizeAvx2,
+#endif
+};
+
+bool SoftwareRasterizer::init(uint32_t width, uint32_t height, ThreadPool& threadPool) {
+    if (width == 0 || height == 0 || width > MAX_EXTENT || height > MAX_EXTENT) {
+        std::cout << "The software rasterizer cannot render " << width << "x" << height << " frames" << std::endl;
+        return false;
+    }
+
+    this->threadPool = &threadPool;
+    this->width = width;
+    this->height = height;
+    tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    stride = tilesX * TILE_SIZE;
+    color.assign((size_t)stride * tilesY * TILE_SIZE, 0);
+    depth.assign((size_t)stride * tilesY * TILE_SIZE, 1.0f);
+
+    guardX = (float)GUARD_BAND / (0.5f * (float)width);
+    guardY = (float)GUARD_BAND / (0.5f * (float)height);
+
+    std::cout << "Software rasterizer: " << width << "x" << height << " in " << tilesX * tilesY << " tiles of "
+              << TILE_SIZE << "x" << TILE_SIZE << ", " << Math::getSimdLevelName(Math::getSimdLevel())
+              << " kernels" << std::endl;
+    return true;
+}
+
+void SoftwareRasterizer::destroy() {
+    if (threadPool == NULL) return;
+
+    color.clear();
+    color.shrink_to_fit();
+    depth.clear();
+    depth.shrink_to_fit();
+    jobs.clear();
+    threadPool = NULL;
+
+    std::cout << "Software rasterizer deleted" << std::endl;
+}
+
+bool SoftwareRasterizer::setMesh(const void* vertexData, uint32_t vertexFormat, uint32_t vertexCount,
+        const void* indexData, uint32_t indexSize, uint32_t indexCount) {
+    positions.resize((size_t)vertexCount * 3);
+    shades.resize(vertexCount);
+
+    for (uint32_t i = 0; i < vertexCount; ++i) {
+        float* position = &positions[(size_t)i * 3];
+        if (vertexFormat == MeshFile::FORMAT_HALF4) {
+            const uint16_t* half = (const uint16_t*)vertexData + (size_t)i * 4;
+            for (int c = 0; c < 3; ++c) {
+                position[c] = MeshOptimizer::halfToFloat(half[c]);
+            }
+        } else {
+            memcpy(position, (const float*)vertexData + (size_t)i * 3, 3 * sizeof(float));
+        }
+        shades[i] = 0.75f + 0.25f * position[2];
+    }
+
+    indices.resize(indexCount - indexCount % 3);
+    for (uint32_t i = 0; i < indices.size(); ++i) {
+        indices[i] = indexSize == 2 ? ((const uint16_t*)indexData)[i] : ((const uint32_t*)indexData)[i];
+        if (indices[i] >= vertexCount) {
+            std::cout << "Mesh index " << indices[i] << " is out of range, the software rasterizer has "
+                      << vertexCount << " vertices" << std::endl;
+            indices.clear();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void SoftwareRasterizer::draw(const float clearColor[4], const Math::Mat4& viewProjection, const InstanceData* instances,
+        const uint32_t* visible, uint32_t count, bool indexColors) {
+    typedef std::chrono::steady_clock Clock;
+
+    stats = Stats();
+    uint32_t tileCount = tilesX * tilesY;
+    uint32_t trianglesPerInstance = std::max((uint32_t)indices.size() / 3, 1u);
+    uint32_t passSize = std::max(MAX_TRIANGLES_PER_PASS / trianglesPerInstance, 1u);
+
+    // Only the first pass clears, an empty frame still has one.
+    uint32_t first = 0;
+    do {
+        uint32_t passCount = std::min(passSize, count - first);
+        uint32_t jobCount = std::max(std::min(passCount, threadPool->getThreadCount() * 4), 1u);
+        if (jobs.size() < jobCount) {
+            jobs.resize(jobCount);
+        }
+
+        Clock::time_point begin = Clock::now();
+        threadPool->parallelFor(jobCount, 1, [&](uint32_t, uint32_t jobBegin, uint32_t jobEnd) {
+            for (uint32_t j = jobBegin; j < jobEnd; ++j) {
+                uint32_t rangeBegin = (uint32_t)((uint64_t)passCount * j / jobCount);
+                uint32_t rangeEnd = (uint32_t)((uint64_t)passCount * (j + 1) / jobCount);
+                setupJob(jobs[j], viewProjection, instances, visible + first + rangeBegin, rangeEnd - rangeBegin, indexColors);
+            }
+        });
+        Clock::time_point setupEnd = Clock::now();
+
+        const float* clear = first == 0 ? clearColor : NULL;
+        threadPool->parallelFor(tileCount, 1, [&](uint32_t, uint32_t tileBegin, uint32_t tileEnd) {
+            for (uint32_t tile = tileBegin; tile < tileEnd; ++tile) {
+                rasterizeTile(tile, jobCount, clear);
+            }
+        });
+
+        stats.setupTime += std::chrono::duration<double, std::milli>(setupEnd - begin).count();
+        stats.rasterTime += std::chrono::duration<double, std::milli>(Clock::now() - setupEnd).count();
+        for (uint32_t j = 0; j < jobCount; ++j) {
+            stats.triangles += jobs[j].submitted;
+            stats.culled += jobs[j].culled;
+            stats.clipped += jobs[j].clipped;
+            stats.binned += jobs[j].binned;
+        }
+        stats.passes++;
+
+        first += passCount;
+    } while (first < count);
+}
+
+void SoftwareRasterizer::setupJob(Job& job, const Math::Mat4& viewProjection, const InstanceData* instances,
+        const uint32_t* visible, uint32_t count, bool indexColors) {
+    uint32_t vertexCount = (uint32_t)shades.size();
+    job.vertices.resize(vertexCount);
+    job.outcodes.resize(vertexCount);
+    job.triangles.clear();
+    job.tiles.resize(tilesX * tilesY);
+    for (std::vector<uint32_t>& tile: job.tiles) {
+        tile.clear();
+    }
+    job.submitted = 0;
+    job.culled = 0;
+    job.clipped = 0;
+    job.binned = 0;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const InstanceData& instance = instances[visible[i]];
+        Math::Mat4 model;
+        memcpy(model.m, instance.model, sizeof(model.m));
+        Math::Mat4 mvp = viewProjection * model;
+        const float* m = mvp.m;
+
+        // cube.vert's colours: the instance's, or hashed from its index.
+        float color[3] { instance.color[0], instance.color[1], instance.color[2] };
+        if (indexColors) {
+            uint32_t hash = visible[i] * 2654435761u;
+            color[0] = (float)((hash >> 8) & 255u) / 255.0f;
+            color[1] = (float)((hash >> 16) & 255u) / 255.0f;
+            color[2] = (float)((hash >> 24) & 255u) / 255.0f;
+        }
+
+        for (uint32_t v = 0; v < vertexCount; ++v) {
+            const float* p = &positions[(size_t)v * 3];
+            Vertex& out = job.vertices[v];
+            out.x = m[0] * p[0] + m[4] * p[1] + m[8] * p[2] + m[12];
+            out.y = m[1] * p[0] + m[5] * p[1] + m[9] * p[2] + m[13];
+            out.z = m[2] * p[0] + m[6] * p[1] + m[10] * p[2] + m[14];
+            out.w = m[3] * p[0] + m[7] * p[1] + m[11] * p[2] + m[15];
+            out.shade = shades[v];
+
+            uint16_t code = 0;
+            if (out.x < -out.w) code |= OUT_LEFT;
+            if (out.x > out.w) code |= OUT_RIGHT;
+            if (out.y < -out.w) code |= OUT_LOW;
+            if (out.y > out.w) code |= OUT_HIGH;
+            if (out.z < 0.0f) code |= OUT_NEAR;
+            if (out.z > out.w) code |= OUT_FAR;
+            if (out.w < MIN_W) code |= OUT_BEHIND;
+            if (out.x < -guardX * out.w) code |= GUARD_LEFT;
+            if (out.x > guardX * out.w) code |= GUARD_RIGHT;
+            if (out.y < -guardY * out.w) code |= GUARD_LOW;
+            if (out.y > guardY * out.w) code |= GUARD_HIGH;
+            job.outcodes[v] = code;
+        }
+
+        for (size_t t = 0; t < indices.size(); t += 3) {
+            uint32_t i0 = indices[t], i1 = indices[t + 1], i2 = indices[t + 2];
+            uint16_t c0 = job.outcodes[i0], c1 = job.outcodes[i1], c2 = job.outcodes[i2];
+            job.submitted++;
+
+            if (c0 & c1 & c2 & CULL_CODES) {
+                job.culled++;
+            } else if ((c0 | c1 | c2) & CLIP_CODES) {
+                Vertex triangle[3] { job.vertices[i0], job.vertices[i1], job.vertices[i2] };
+                clipTriangle(job, triangle, (c0 | c1 | c2) & CLIP_CODES, color);
+                job.clipped++;
+            } else if (!setupTriangle(job, job.vertices[i0], job.vertices[i1], job.vertices[i2], color)) {
+                job.culled++;
+            }
+        }
+    }
+}
+
+// Sutherland-Hodgman against the planes the triangle crosses, in clip space,
+// then a fan of the polygon that is left.
+void SoftwareRasterizer::clipTriangle(Job& job, const Vertex* vertices, uint16_t clipCodes, const float* color) {
+    Vertex polygons[2][MAX_CLIPPED_VERTICES];
+    int count = 3;
+    int current = 0;
+    memcpy(polygons[0], vertices, 3 * sizeof(Vertex));
+
+    for (uint16_t plane: CLIP_PLANES) {
+        if (!(clipCodes & plane)) continue;
+
+        auto distance = [&](const Vertex& v) {
+            switch (plane) {
+                case OUT_BEHIND: return v.w - MIN_W;
+                case OUT_NEAR: return v.z;
+                case OUT_FAR: return v.w - v.z;
+                case GUARD_LEFT: return v.x + guardX * v.w;
+                case GUARD_RIGHT: return guardX * v.w - v.x;
+                case GUARD_LOW: return v.y + guardY * v.w;
+                default: return guardY * v.w - v.y;
+            }
+        };
+
+        const Vertex* in = polygons[current];
+        Vertex* out = polygons[current ^ 1];
+        int outCount = 0;
+        for (int i = 0; i < count; ++i) {
+            const Vertex& a = in[i];
+            const Vertex& b = in[(i + 1) % count];
+            float da = distance(a);
+            float db = distance(b);
+
+            if (da >= 0.0f) {
+                out[outCount++] = a;
+            }
+            if ((da >= 0.0f) != (db >= 0.0f)) {
+                float t = da / (da - db);
+                Vertex& v = out[outCount++];
+                v.x = a.x + (b.x - a.x) * t;
+                v.y = a.y + (b.y - a.y) * t;
+                v.z = a.z + (b.z - a.z) * t;
+                v.w = a.w + (b.w - a.w) * t;
+                v.shade = a.shade + (b.shade - a.shade) * t;
+            }
+        }
+
+        count = outCount;
+        current ^= 1;
+        if (count < 3) return;
+    }
+
+    const Vertex* polygon = polygons[current];
+    for (int i = 1; i + 1 < count; ++i) {
+        setupTriangle(job, polygon[0], polygon[i], polygon[i + 1], color);
+    }
+}
+
+// Vertices are inside the guard band and in front of the eye.
+bool SoftwareRasterizer::setupTriangle(Job& job, const Vertex& v0, const Vertex& v1, const Vertex& v2, const float* color) {
+    const Vertex* vertices[3] { &v0, &v1, &v2 };
+    int32_t x[3], y[3];
+    float px[3], py[3], z[3], invW[3], shadeOverW[3];
+
+    for (int i = 0; i < 3; ++i) {
+        const Vertex& v = *vertices[i];
+        invW[i] = 1.0f / v.w;
+        x[i] = (int32_t)lrintf((v.x * invW[i] * 0.5f + 0.5f) * (float)width * SUBPIXEL);
+        y[i] = (int32_t)lrintf((v.y * invW[i] * 0.5f + 0.5f) * (float)height * SUBPIXEL);
+        px[i] = (float)x[i] / SUBPIXEL;
+        py[i] = (float)y[i] / SUBPIXEL;
+        z[i] = v.z * invW[i];
+        shadeOverW[i] = v.shade * invW[i];
+    }
+
+    int64_t area = (int64_t)(x[1] - x[0]) * (y[2] - y[0]) - (int64_t)(x[2] - x[0]) * (y[1] - y[0]);
+    if (area == 0) return false;
+
+    // Nothing is culled by facing; the other winding is turned around so
+    // the inside is always where the edge functions are positive.
+    if (area < 0) {
+        std::swap(x[1], x[2]);
+        std::swap(y[1], y[2]);
+        std::swap(px[1], px[2]);
+        std::swap(py[1], py[2]);
+        std::swap(z[1], z[2]);
+        std::swap(invW[1], invW[2]);
+        std::swap(shadeOverW[1], shadeOverW[2]);
+        area = -area;
+    }
+
+    // Pixels whose centres can be inside, clamped to the viewport.
+    Triangle t;
+    int32_t minX = std::min(x[0], std::min(x[1], x[2]));
+    int32_t maxX = std::max(x[0], std::max(x[1], x[2]));
+    int32_t minY = std::min(y[0], std::min(y[1], y[2]));
+    int32_t maxY = std::max(y[0], std::max(y[1], y[2]));
+    t.minX = std::max(-floorDiv(-(minX - SUBPIXEL / 2), SUBPIXEL), 0);
+    t.maxX = std::min(floorDiv(maxX - SUBPIXEL / 2, SUBPIXEL) + 1, (int32_t)width);
+    t.minY = std::max(-floorDiv(-(minY - SUBPIXEL / 2), SUBPIXEL), 0);
+    t.maxY = std::min(floorDiv(maxY - SUBPIXEL / 2, SUBPIXEL) + 1, (int32_t)height);
+    if (t.minX >= t.maxX || t.minY >= t.maxY) return false;
+
+    // Edge i is opposite vertex i. Samples exactly on an edge belong to the
+    // triangle if it is a top or a left edge.
+    for (int i = 0; i < 3; ++i) {
+        int a = (i + 1) % 3;
+        int b = (i + 2) % 3;
+        t.a[i] = y[a] - y[b];
+        t.b[i] = x[b] - x[a];
+        t.c[i] = (int64_t)x[a] * y[b] - (int64_t)y[a] * x[b];
+
+        int32_t dx = x[b] - x[a];
+        int32_t dy = y[b] - y[a];
+        bool topLeft = dy < 0 || (dy == 0 && dx > 0);
+        if (!topLeft) t.c[i] -= 1;
+    }
+
+    // Attribute planes through the snapped positions, at pixel centres.
+    float x10 = px[1] - px[0], y10 = py[1] - py[0];
+    float x20 = px[2] - px[0], y20 = py[2] - py[0];
+    float invArea = (float)(SUBPIXEL * SUBPIXEL) / (float)area;
+    auto plane = [&](const float* values, float* out) {
+        float d1 = values[1] - values[0];
+        float d2 = values[2] - values[0];
+        float dx = (d1 * y20 - d2 * y10) * invArea;
+        float dy = (d2 * x10 - d1 * x20) * invArea;
+        out[0] = values[0] + dx * (0.5f - px[0]) + dy * (0.5f - py[0]);
+        out[1] = dx;
+        out[2] = dy;
+    };
+    plane(z, t.z);
+    plane(invW, t.invW);
+    plane(shadeOverW, t.shadeOverW);
+    memcpy(t.color, color, sizeof(t.color));
+
+    uint32_t index = (uint32_t)job.triangles.size();
+    job.triangles.push_back(t);
+
+    uint32_t tileMinX = (uint32_t)t.minX / TILE_SIZE, tileMaxX = (uint32_t)(t.maxX - 1) / TILE_SIZE;
+    uint32_t tileMinY = (uint32_t)t.minY / TILE_SIZE, tileMaxY = (uint32_t)(t.maxY - 1) / TILE_SIZE;
+    for (uint32_t ty = tileMinY; ty <= tileMaxY; ++ty) {
+        for (uint32_t tx = tileMinX; tx <= tileMaxX; ++tx) {
+            job.tiles[ty * tilesX + tx].push_back(index);
+        }
+    }
+    job.binned += (uint64_t)(tileMaxX - tileMinX + 1) * (tileMaxY - tileMinY + 1);
+
+    return true;
+}
+
+// The bins of the jobs are walked in job order, which is submission order.
+void SoftwareRasterizer::rasterizeTile(uint32_t tile, uint32_t jobCount, const float* clearColor) {
+    int32_t tileX = (int32_t)(tile % tilesX * TILE_SIZE);
+    int32_t tileY = (int32_t)(tile / tilesX * TILE_SIZE);
+
+    if (clearColor != NULL) {
+        uint32_t clear = 0;
+        for (int c = 0; c < 4; ++c) {
+            float value = std::min(std::max(clearColor[c], 0.0f), 1.0f);
+            clear |= (uint32_t)(value * 255.0f + 0.5f) << (8 * c);
+        }
+        for (int32_t y = tileY; y < tileY + (int32_t)TILE_SIZE; ++y) {
+            size_t offset = (size_t)y * stride + tileX;
+            std::fill(color.begin() + offset, color.begin() + offset + TILE_SIZE, clear);
+            std::fill(depth.begin() + offset, depth.begin() + offset + TILE_SIZE, 1.0f);
+        }
+    }
+
+    RasterizeKernel rasterize = rasterizeKernels[Math::getSimdLevel()];
+    int32_t tileEndX = std::min(tileX + (int32_t)TILE_SIZE, (int32_t)width);
+    int32_t tileEndY = std::min(tileY + (int32_t)TILE_SIZE, (int32_t)height);
+
+    for (uint32_t j = 0; j < jobCount; ++j) {
+        const Job& job = jobs[j];
+        for (uint32_t index: job.tiles[tile]) {
+            const Triangle& t = job.triangles[index];
+            int32_t x0 = std::max(t.minX, tileX);
+            int32_t y0 = std::max(t.minY, tileY);
+            int32_t x1 = std::min(t.maxX, tileEndX);
+            int32_t y1 = std::min(t.maxY, tileEndY);
+            rasterize(t, x0, y0, x1, y1, color.data(), depth.data(), stride);
+        }
+    }
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Math.hpp"
+#include "ThreadPool.hpp"
+
+struct InstanceData;
+
+// Renders instanced triangle meshes on the CPU, the way the scene pipeline
+// does on the GPU: clip space from the view-projection and instance model
+// matrices, the vertex shade of shaders/cube.vert, no face culling and a
+// LESS_OR_EQUAL depth test.
+//
+// A frame runs in two parallel stages on a ThreadPool. Setup transforms,
+// clips and sets up the triangles of consecutive ranges of instances and
+// bins them into TILE_SIZE square screen tiles by their bounds. Raster then
+// processes whole tiles, each walking the bins of the ranges in order, so
+// the result does not depend on the thread count. Coverage is tested with
+// integer edge functions on 4 sub-pixel bits, SIMD across a row of pixels,
+// with the usual top-left fill rule.
+//
+// Colour is 8-bit RGBA in memory order, depth a float per pixel. Rows are
+// padded to a whole number of tiles.
+class SoftwareRasterizer {
+    public:
+        static const uint32_t TILE_SIZE = 64;
+        // Triangles are clipped to this many pixels around the centre of the
+        // viewport, which keeps the edge functions within a tile in 32 bits.
+        static const uint32_t GUARD_BAND = 8192;
+        static const uint32_t MAX_EXTENT = 8192;
+        // Setup of more instances than this many triangles is split into
+        // passes, bounding the memory held by the bins.
+        static const uint32_t MAX_TRIANGLES_PER_PASS = 1 << 18;
+
+        // Of the last draw().
+        struct Stats {
+            uint64_t triangles = 0;         // submitted
+            uint64_t culled = 0;            // outside the frustum, degenerate or between pixel centres
+            uint64_t clipped = 0;           // crossing the near, far or guard band planes
+            uint64_t binned = 0;            // triangle and tile pairs
+            uint32_t passes = 0;
+            double setupTime = 0.0;         // ms
+            double rasterTime = 0.0;        // ms
+        };
+
+        // Set up for rasterization. Edge functions are in sub-pixels,
+        // A * x + B * y + C >= 0 inside; attribute planes are in pixels,
+        // base + dx * x + dy * y at pixel centres.
+        struct Triangle {
+            int32_t minX, minY, maxX, maxY; // pixels, max exclusive
+            int32_t a[3];
+            int32_t b[3];
+            int64_t c[3];
+            float z[3];
+            float invW[3];
+            float shadeOverW[3];
+            float color[3];
+        };
+
+    private:
+        struct Vertex {
+            float x, y, z, w;
+            float shade;
+        };
+
+        // The triangles of one range of instances and their tile bins.
+        struct Job {
+            std::vector<Triangle> triangles;
+            std::vector<std::vector<uint32_t>> tiles;
+            std::vector<Vertex> vertices;
+            std::vector<uint16_t> outcodes;
+            uint64_t submitted = 0;
+            uint64_t culled = 0;
+            uint64_t clipped = 0;
+            uint64_t binned = 0;
+        };
+
+        ThreadPool* threadPool = NULL;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t tilesX = 0;
+        uint32_t tilesY = 0;
+        uint32_t stride = 0;
+        // The guard band in normalized device coordinates.
+        float guardX = 0.0f;
+        float guardY = 0.0f;
+        std::vector<uint32_t> color = {};
+        std::vector<float> depth = {};
+
+        // Object space positions and the shade of cube.vert per vertex.
+        std::vector<float> positions = {};
+        std::vector<float> shades = {};
+        std::vector<uint32_t> indices = {};
+
+        std::vector<Job> jobs = {};
+        Stats stats;
+
+        void setupJob(Job& job, const Math::Mat4& viewProjection, const InstanceData* instances,
+            const uint32_t* visible, uint32_t count, bool indexColors);
+        void clipTriangle(Job& job, const Vertex* vertices, uint16_t clipCodes, const float* color);
+        bool setupTriangle(Job& job, const Vertex& v0, const Vertex& v1, const Vertex& v2, const float* color);
+        void rasterizeTile(uint32_t tile, uint32_t jobCount, const float* clearColor);
+
+    public:
+        ~SoftwareRasterizer() {
+            destroy();
+        }
+
+        // threadPool has to outlive the rasterizer; its thread count may
+        // change between frames.
+        bool init(uint32_t width, uint32_t height, ThreadPool& threadPool);
+        void destroy();
+
+        // Positions in a MeshFile::VertexFormat, indices of indexSize bytes.
+        bool setMesh(const void* vertexData, uint32_t vertexFormat, uint32_t vertexCount,
+            const void* indexData, uint32_t indexSize, uint32_t indexCount);
+
+        // Clears the frame and draws the mesh once for every entry of
+        // visible, with the model matrix of that instance and its colour,
+        // or with a colour hashed from its index (SHADING_INSTANCE).
+        void draw(const float clearColor[4], const Math::Mat4& viewProjection, const InstanceData* instances,
+            const uint32_t* visible, uint32_t count, bool indexColors);
+
+        uint32_t getWidth() const {
+            return width;
+        }
+        uint32_t getHeight() const {
+            return height;
+        }
+        // In pixels.
+        uint32_t getStride() const {
+            return stride;
+        }
+        const uint32_t* getColor() const {
+            return color.data();
+        }
+        const float* getDepth() const {
+            return depth.data();
+        }
+
+        const Stats& getStats() const {
+            return stats;
+        }
+};
@@ -0,0 +1,501 @@
+#include "Streamer.hpp"
+#include "MeshFile.hpp"
+
+#include <iostream>
+#include <cstring>
+#include <system_error>
+
+// Offsets into the ring and between the two streams of a mesh. Covers
+// optimalBufferCopyOffsetAlignment on every device the renderer runs on.
+static const VkDeviceSize STAGING_ALIGNMENT = 256;
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+bool Streamer::init(VkDevice device, Allocator& allocator, VkQueue transferQueue, uint32_t transferFamily,
+        uint32_t graphicsFamily, uint32_t loaderCount, VkDeviceSize ringSize) {
+    this->device = device;
+    this->allocator = &allocator;
+    this->transferQueue = transferQueue;
+    this->transferFamily = transferFamily;
+    this->graphicsFamily = graphicsFamily;
+    this->ringSize = alignUp(ringSize, STAGING_ALIGNMENT);
+
+    VkCommandPoolCreateInfo poolCreateInfo {};
+    poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolCreateInfo.queueFamilyIndex = transferFamily;
+    poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+    VkResult result = vkCreateCommandPool(device, &poolCreateInfo, NULL, &commandPool);
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create streaming command pool" << std::endl;
+        return false;
+    }
+
+    if (!allocator.createBuffer(this->ringSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, Allocator::CPU_TO_GPU,
+            stagingBuffer, stagingMemory)) {
+        std::cout << "Failed to create streaming staging ring" << std::endl;
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = false;
+        stats = Stats();
+        stats.ringSize = this->ringSize;
+    }
+
+    if (loaderCount < 1) loaderCount = 1;
+    try {
+        for (uint32_t i = 0; i < loaderCount; ++i) {
+            loaders.push_back(std::thread(&Streamer::loaderMain, this));
+        }
+    } catch (const std::system_error& error) {
+        std::cout << "Failed to start loader thread: " << error.what() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+void Streamer::destroy() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    requestQueued.notify_all();
+    spaceFreed.notify_all();
+    for (std::thread& loader: loaders) {
+        loader.join();
+    }
+    loaders.clear();
+
+    if (device == VK_NULL_HANDLE) return;
+
+    if (transferQueue != VK_NULL_HANDLE) {
+        vkQueueWaitIdle(transferQueue);
+    }
+
+    for (Batch& batch: batches) {
+        if (batch.fence != VK_NULL_HANDLE) vkDestroyFence(device, batch.fence, NULL);
+        if (batch.semaphore != VK_NULL_HANDLE) vkDestroySemaphore(device, batch.semaphore, NULL);
+    }
+    batches.clear();
+    submitted.clear();
+    acquiring.clear();
+    retiring.clear();
+    freeBatches.clear();
+
+    if (commandPool != VK_NULL_HANDLE) {
+        vkDestroyCommandPool(device, commandPool, NULL);
+        commandPool = VK_NULL_HANDLE;
+    }
+
+    // Meshes nobody took are still owned here.
+    for (Asset& asset: assets) {
+        if (asset.state != TAKEN) {
+            destroyMesh(asset.mesh);
+        }
+    }
+    assets.clear();
+    requests.clear();
+    regions.clear();
+    staged.clear();
+
+    if (stagingBuffer != VK_NULL_HANDLE) {
+        allocator->destroyBuffer(stagingBuffer, stagingMemory);
+    }
+    device = VK_NULL_HANDLE;
+}
+
+void Streamer::destroyMesh(Mesh& mesh) {
+    if (mesh.vertexBuffer != VK_NULL_HANDLE) {
+        allocator->destroyBuffer(mesh.vertexBuffer, mesh.vertexMemory);
+    }
+    if (mesh.indexBuffer != VK_NULL_HANDLE) {
+        allocator->destroyBuffer(mesh.indexBuffer, mesh.indexMemory);
+    }
+}
+
+Streamer::Handle Streamer::requestMesh(const std::string& path) {
+    Handle handle;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        handle = (Handle)assets.size();
+        assets.push_back(Asset());
+        assets.back().path = path;
+        requests.push_back(handle);
+        stats.requested++;
+    }
+    requestQueued.notify_one();
+    return handle;
+}
+
+Streamer::State Streamer::getState(Handle handle) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return handle < assets.size() ? assets[handle].state : FAILED;
+}
+
+bool Streamer::takeMesh(Handle handle, Mesh& mesh) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (handle >= assets.size() || assets[handle].state != RESIDENT) return false;
+
+    mesh = assets[handle].mesh;
+    assets[handle].mesh = Mesh();
+    assets[handle].state = TAKEN;
+    return true;
+}
+
+bool Streamer::isIdle() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return requests.empty() && staged.empty() && regions.empty() && acquiring.empty();
+}
+
+Streamer::Stats Streamer::getStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+void Streamer::loaderMain() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true) {
+        requestQueued.wait(lock, [this]() { return stopping || !requests.empty(); });
+        if (stopping) return;
+
+        Handle handle = requests.front();
+        requests.pop_front();
+        assets[handle].state = LOADING;
+        std::string path = assets[handle].path;
+
+        if (!load(handle, path, lock)) {
+            destroyMesh(assets[handle].mesh);
+            assets[handle].mesh = Mesh();
+            assets[handle].state = FAILED;
+            stats.failed++;
+        }
+    }
+}
+
+// Entered and left with the lock held; file access, buffer creation and the
+// copy into the ring run without it.
+bool Streamer::load(Handle handle, const std::string& path, std::unique_lock<std::mutex>& lock) {
+    lock.unlock();
+
+    MeshFile file;
+    Mesh mesh;
+    bool ok = file.open(path);
+    if (!ok) {
+        std::cout << "Streaming " << path << " failed: cannot open mesh file" << std::endl;
+    } else if (file.getHeader().vertexCount == 0 || file.getHeader().indexCount == 0) {
+        std::cout << "Streaming " << path << " failed: no triangles" << std::endl;
+        ok = false;
+    }
+
+    const MeshFile::Header* header = ok ? &file.getHeader() : NULL;
+    if (ok) {
+        mesh.vertexCount = header->vertexCount;
+        mesh.indexCount = header->indexCount;
+        mesh.indexType = header->indexSize == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+        mesh.vertexFormat = header->vertexFormat;
+        memcpy(mesh.boundsMin, header->boundsMin, sizeof(mesh.boundsMin));
+        memcpy(mesh.boundsMax, header->boundsMax, sizeof(mesh.boundsMax));
+
+        ok = allocator->createBuffer(header->vertexBytes, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                Allocator::GPU_ONLY, mesh.vertexBuffer, mesh.vertexMemory) &&
+            allocator->createBuffer(header->indexBytes, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                Allocator::GPU_ONLY, mesh.indexBuffer, mesh.indexMemory);
+        if (!ok) {
+            std::cout << "Streaming " << path << " failed: cannot create buffers" << std::endl;
+        }
+    }
+
+    lock.lock();
+    assets[handle].mesh = mesh;
+    if (!ok) return false;
+
+    VkDeviceSize size = alignUp(header->vertexBytes, STAGING_ALIGNMENT) + header->indexBytes;
+    if (size > ringSize) {
+        std::cout << "Streaming " << path << " failed: " << size << " bytes do not fit the "
+                  << ringSize << " byte staging ring" << std::endl;
+        return false;
+    }
+
+    // Waits for batches in flight to hand their ring space back.
+    VkDeviceSize offset = 0;
+    spaceFreed.wait(lock, [&]() { return stopping || tryReserve(size, offset); });
+    if (stopping) return false;
+
+    lock.unlock();
+    char* staging = (char*)stagingMemory.mapped + offset;
+    memcpy(staging, file.getVertexData(), header->vertexBytes);
+    memcpy(staging + alignUp(header->vertexBytes, STAGING_ALIGNMENT), file.getIndexData(), header->indexBytes);
+    VkDeviceSize vertexBytes = header->vertexBytes;
+    VkDeviceSize indexBytes = header->indexBytes;
+    file.close();
+    lock.lock();
+
+    Asset& asset = assets[handle];
+    asset.stagingOffset = offset;
+    asset.vertexBytes = vertexBytes;
+    asset.indexBytes = indexBytes;
+    asset.state = STAGED;
+    staged.push_back(handle);
+    return true;
+}
+
+bool Streamer::tryReserve(VkDeviceSize size, VkDeviceSize& offset) {
+    size = alignUp(size, STAGING_ALIGNMENT);
+
+    if (regions.empty()) {
+        offset = 0;
+    } else {
+        VkDeviceSize head = regions.back().end;
+        VkDeviceSize tail = regions.front().begin;
+
+        // Head and tail never meet while anything is reserved, so a full ring
+        // is not mistaken for an empty one.
+        if (head > tail) {
+            if (head + size <= ringSize) {
+                offset = head;
+            } else if (size < tail) {
+                offset = 0;
+            } else {
+                return false;
+            }
+        } else if (head + size < tail) {
+            offset = head;
+        } else {
+            return false;
+        }
+    }
+
+    regions.push_back(Region { offset, offset + size, false });
+
+    VkDeviceSize used = 0;
+    for (const Region& region: regions) {
+        used += region.end - region.begin;
+    }
+    if (used > stats.ringHighWater) {
+        stats.ringHighWater = used;
+    }
+    return true;
+}
+
+void Streamer::release(VkDeviceSize offset) {
+    for (Region& region: regions) {
+        if (region.begin == offset && !region.done) {
+            region.done = true;
+            break;
+        }
+    }
+    while (!regions.empty() && regions.front().done) {
+        regions.pop_front();
+    }
+}
+
+Streamer::Batch* Streamer::getBatch() {
+    if (!freeBatches.empty()) {
+        Batch* batch = freeBatches.back();
+        freeBatches.pop_back();
+        vkResetCommandBuffer(batch->commandBuffer, 0);
+        vkResetFences(device, 1, &batch->fence);
+        batch->assets.clear();
+        return batch;
+    }
+
+    batches.push_back(Batch());
+    Batch* batch = &batches.back();
+
+    VkCommandBufferAllocateInfo commandBufferAllocateInfo {};
+    commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    commandBufferAllocateInfo.commandPool = commandPool;
+    commandBufferAllocateInfo.commandBufferCount = 1;
+    commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+    VkFenceCreateInfo fenceCreateInfo {};
+    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    VkSemaphoreCreateInfo semaphoreCreateInfo {};
+    semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    if (vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, &batch->commandBuffer) != VK_SUCCESS ||
+            vkCreateFence(device, &fenceCreateInfo, NULL, &batch->fence) != VK_SUCCESS ||
+            vkCreateSemaphore(device, &semaphoreCreateInfo, NULL, &batch->semaphore) != VK_SUCCESS) {
+        std::cout << "Failed to create streaming batch" << std::endl;
+        return NULL;
+    }
+    return batch;
+}
+
+void Streamer::update(uint32_t frameIndex) {
+    // The frame that waited on these semaphores has finished, so they can be
+    // signalled again.
+    for (size_t i = 0; i < retiring.size();) {
+        if (retiring[i]->retireFrame == frameIndex) {
+            freeBatches.push_back(retiring[i]);
+            retiring[i] = retiring.back();
+            retiring.pop_back();
+        } else {
+            ++i;
+        }
+    }
+
+    // Batches finish in submission order on one queue.
+    while (!submitted.empty() && vkGetFenceStatus(device, submitted.front()->fence) == VK_SUCCESS) {
+        Batch* batch = submitted.front();
+        submitted.pop_front();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (Handle handle: batch->assets) {
+                release(assets[handle].stagingOffset);
+            }
+        }
+        acquiring.push_back(batch);
+    }
+    spaceFreed.notify_all();
+
+    submitStaged();
+}
+
+void Streamer::submitStaged() {
+    std::vector<Handle> handles;
+    std::vector<Asset> uploads;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (staged.empty()) return;
+
+        handles.swap(staged);
+        for (Handle handle: handles) {
+            uploads.push_back(assets[handle]);
+        }
+    }
+
+    Batch* batch = getBatch();
+    if (batch == NULL) {
+        std::lock_guard<std::mutex> lock(mutex);
+        staged.insert(staged.begin(), handles.begin(), handles.end());
+        return;
+    }
+
+    VkCommandBufferBeginInfo beginInfo {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(batch->commandBuffer, &beginInfo);
+
+    std::vector<VkBufferMemoryBarrier> releases;
+    uint64_t bytes = 0;
+    for (const Asset& asset: uploads) {
+        VkBufferCopy region {};
+        region.srcOffset = asset.stagingOffset;
+        region.size = asset.vertexBytes;
+        vkCmdCopyBuffer(batch->commandBuffer, stagingBuffer, asset.mesh.vertexBuffer, 1, &region);
+
+        region.srcOffset = asset.stagingOffset + alignUp(asset.vertexBytes, STAGING_ALIGNMENT);
+        region.size = asset.indexBytes;
+        vkCmdCopyBuffer(batch->commandBuffer, stagingBuffer, asset.mesh.indexBuffer, 1, &region);
+
+        bytes += asset.vertexBytes + asset.indexBytes;
+
+        if (usesOwnershipTransfer()) {
+            VkBufferMemoryBarrier release {};
+            release.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            release.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            release.dstAccessMask = 0;
+            release.srcQueueFamilyIndex = transferFamily;
+            release.dstQueueFamilyIndex = graphicsFamily;
+            release.offset = 0;
+            release.size = VK_WHOLE_SIZE;
+
+            release.buffer = asset.mesh.vertexBuffer;
+            releases.push_back(release);
+            release.buffer = asset.mesh.indexBuffer;
+            releases.push_back(release);
+        }
+    }
+
+    if (!releases.empty()) {
+        vkCmdPipelineBarrier(batch->commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            0, 0, NULL, (uint32_t)releases.size(), releases.data(), 0, NULL);
+    }
+
+    vkEndCommandBuffer(batch->commandBuffer);
+
+    VkSubmitInfo submitInfo {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &batch->commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &batch->semaphore;
+
+    VkResult result = vkQueueSubmit(transferQueue, 1, &submitInfo, batch->fence);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to submit streaming batch" << std::endl;
+        for (Handle handle: handles) {
+            release(assets[handle].stagingOffset);
+            destroyMesh(assets[handle].mesh);
+            assets[handle].mesh = Mesh();
+            assets[handle].state = FAILED;
+            stats.failed++;
+        }
+        freeBatches.push_back(batch);
+        spaceFreed.notify_all();
+        return;
+    }
+
+    for (Handle handle: handles) {
+        assets[handle].state = UPLOADING;
+    }
+    batch->assets = handles;
+    submitted.push_back(batch);
+    stats.uploadedBytes += bytes;
+    stats.batches++;
+}
+
+void Streamer::recordAcquires(VkCommandBuffer cmdBuffer, uint32_t frameIndex, std::vector<VkSemaphore>& waitSemaphores) {
+    if (acquiring.empty()) return;
+
+    std::vector<VkBufferMemoryBarrier> acquires;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Batch* batch: acquiring) {
+            for (Handle handle: batch->assets) {
+                Asset& asset = assets[handle];
+                asset.state = RESIDENT;
+                stats.completed++;
+
+                if (usesOwnershipTransfer()) {
+                    VkBufferMemoryBarrier acquire {};
+                    acquire.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+                    acquire.srcAccessMask = 0;
+                    acquire.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+                    acquire.srcQueueFamilyIndex = transferFamily;
+                    acquire.dstQueueFamilyIndex = graphicsFamily;
+                    acquire.offset = 0;
+                    acquire.size = VK_WHOLE_SIZE;
+
+                    acquire.buffer = asset.mesh.vertexBuffer;
+                    acquires.push_back(acquire);
+                    acquire.buffer = asset.mesh.indexBuffer;
+                    acquires.push_back(acquire);
+                }
+            }
+
+            waitSemaphores.push_back(batch->semaphore);
+            batch->retireFrame = frameIndex;
+            retiring.push_back(batch);
+        }
+    }
+    acquiring.clear();
+
+    // Within one family the semaphore wait alone makes the copies visible.
+    // Across families the acquire has to run after the wait, which is done
+    // at the vertex input stage.
+    if (!acquires.empty()) {
+        vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+            0, 0, NULL, (uint32_t)acquires.size(), acquires.data(), 0, NULL);
+    }
+}
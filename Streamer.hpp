@@ -0,0 +1,154 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Allocator.hpp"
+
+// Background mesh uploads. Loader threads map MeshFiles and copy their
+// streams into a persistently mapped staging ring; once per frame the render
+// thread submits the staged copies to the transfer queue in one batch.
+//
+// A batch signals a fence, polled without blocking, and a semaphore that the
+// graphics submission of the frame which first uses its assets waits on.
+// When the transfer queue is from another family the buffers are released by
+// the batch and acquired again by recordAcquires() on the graphics queue.
+class Streamer {
+    public:
+        typedef uint32_t Handle;
+        static const Handle INVALID_HANDLE = UINT32_MAX;
+
+        enum State {
+            QUEUED,         // waiting for a loader thread
+            LOADING,        // being read into the staging ring
+            STAGED,         // in the ring, waiting for the next batch
+            UPLOADING,      // copy submitted to the transfer queue
+            RESIDENT,       // usable by commands recorded after the acquire
+            TAKEN,          // buffers handed over by takeMesh()
+            FAILED
+        };
+
+        struct Mesh {
+            VkBuffer vertexBuffer = VK_NULL_HANDLE;
+            Allocation vertexMemory = {};
+            VkBuffer indexBuffer = VK_NULL_HANDLE;
+            Allocation indexMemory = {};
+            uint32_t vertexCount = 0;
+            uint32_t indexCount = 0;
+            VkIndexType indexType = VK_INDEX_TYPE_UINT16;
+            uint32_t vertexFormat = 0;     // MeshFile::VertexFormat
+            float boundsMin[3] = {};
+            float boundsMax[3] = {};
+        };
+
+        struct Stats {
+            uint64_t requested = 0;
+            uint64_t completed = 0;
+            uint64_t failed = 0;
+            uint64_t uploadedBytes = 0;
+            uint64_t batches = 0;
+            VkDeviceSize ringSize = 0;
+            VkDeviceSize ringHighWater = 0;
+        };
+
+    private:
+        struct Asset {
+            std::string path;
+            State state = QUEUED;
+            Mesh mesh;
+            VkDeviceSize stagingOffset = 0;     // vertex stream, index stream follows aligned
+            VkDeviceSize vertexBytes = 0;
+            VkDeviceSize indexBytes = 0;
+        };
+
+        // A reserved range of the staging ring. Ranges are handed out in
+        // order but may finish out of order; the tail only moves past a
+        // range once everything before it is done as well.
+        struct Region {
+            VkDeviceSize begin;
+            VkDeviceSize end;
+            bool done;
+        };
+
+        struct Batch {
+            VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+            VkFence fence = VK_NULL_HANDLE;
+            VkSemaphore semaphore = VK_NULL_HANDLE;
+            std::vector<Handle> assets = {};
+            uint32_t retireFrame = 0;
+        };
+
+        VkDevice device = VK_NULL_HANDLE;
+        Allocator* allocator = NULL;
+        VkQueue transferQueue = VK_NULL_HANDLE;
+        uint32_t transferFamily = 0;
+        uint32_t graphicsFamily = 0;
+        VkCommandPool commandPool = VK_NULL_HANDLE;
+
+        VkBuffer stagingBuffer = VK_NULL_HANDLE;
+        Allocation stagingMemory = {};
+        VkDeviceSize ringSize = 0;
+
+        // Guards everything below that loader threads touch.
+        std::mutex mutex;
+        std::condition_variable requestQueued;
+        std::condition_variable spaceFreed;
+        std::vector<std::thread> loaders = {};
+        bool stopping = false;
+        std::deque<Handle> requests = {};
+        std::deque<Asset> assets = {};
+        std::deque<Region> regions = {};
+        std::vector<Handle> staged = {};
+        Stats stats;
+
+        // Only used by the render thread.
+        std::deque<Batch> batches = {};
+        std::deque<Batch*> submitted = {};
+        std::vector<Batch*> acquiring = {};
+        std::vector<Batch*> retiring = {};
+        std::vector<Batch*> freeBatches = {};
+
+        void loaderMain();
+        bool load(Handle handle, const std::string& path, std::unique_lock<std::mutex>& lock);
+        bool tryReserve(VkDeviceSize size, VkDeviceSize& offset);
+        void release(VkDeviceSize offset);
+        void destroyMesh(Mesh& mesh);
+
+        Batch* getBatch();
+        void submitStaged();
+
+    public:
+        bool init(VkDevice device, Allocator& allocator, VkQueue transferQueue, uint32_t transferFamily,
+            uint32_t graphicsFamily, uint32_t loaderCount = 2, VkDeviceSize ringSize = 64 * 1024 * 1024);
+        void destroy();
+
+        Handle requestMesh(const std::string& path);
+        State getState(Handle handle);
+
+        // Hands the buffers of a resident mesh to the caller, who destroys
+        // them from then on.
+        bool takeMesh(Handle handle, Mesh& mesh);
+
+        // Called after the fence of frameIndex has been waited on: recycles
+        // batches that frame waited for, collects finished batches and
+        // submits everything the loaders have staged since the last call.
+        void update(uint32_t frameIndex);
+
+        // Records the graphics side acquires for finished batches into the
+        // frame's command buffer and adds the semaphores the frame has to
+        // wait on. Assets become RESIDENT here.
+        void recordAcquires(VkCommandBuffer cmdBuffer, uint32_t frameIndex, std::vector<VkSemaphore>& waitSemaphores);
+
+        bool usesOwnershipTransfer() const {
+            return transferFamily != graphicsFamily;
+        }
+        bool isIdle();
+        Stats getStats();
+};
@@ -0,0 +1,358 @@
+#include "TextureCache.hpp"
+#include "VulkanError.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+bool TextureCache::init(VkPhysicalDevice gpu, VkDevice device, Allocator& allocator, VkQueue queue, uint32_t queueFamilyIndex) {
+    this->gpu = gpu;
+    this->device = device;
+    this->allocator = &allocator;
+    this->queue = queue;
+
+    VkCommandPoolCreateInfo poolCreateInfo {};
+    poolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolCreateInfo.queueFamilyIndex = queueFamilyIndex;
+    poolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+    VkResult result = vkCreateCommandPool(device, &poolCreateInfo, NULL, &commandPool);
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create texture command pool: " << getVulkanErrorString(result) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void TextureCache::destroy() {
+    if (device == VK_NULL_HANDLE) return;
+
+    for (Texture& texture: textures) {
+        destroyTexture(texture);
+    }
+    textures.clear();
+    paths.clear();
+
+    if (commandPool != VK_NULL_HANDLE) {
+        vkDestroyCommandPool(device, commandPool, NULL);
+        commandPool = VK_NULL_HANDLE;
+    }
+
+    device = VK_NULL_HANDLE;
+    std::cout << "Textures deleted" << std::endl;
+}
+
+bool TextureCache::isFormatSupported(VkFormat format, VkFormatFeatureFlags features) const {
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(gpu, format, &properties);
+    return (properties.optimalTilingFeatures & features) == features;
+}
+
+TextureCache::Handle TextureCache::load(const std::string& path) {
+    auto known = paths.find(path);
+    if (known != paths.end()) return known->second;
+
+    // The software backend has no device to put textures on.
+    if (device == VK_NULL_HANDLE) {
+        std::cout << "Texture " << path << " rejected: there is no device" << std::endl;
+        stats.refused++;
+        return INVALID_HANDLE;
+    }
+
+    TextureFile file;
+    if (!file.open(path)) return INVALID_HANDLE;
+    const TextureFile::Desc& desc = file.getDesc();
+
+    if (!isFormatSupported(desc.format, VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)) {
+        std::cout << "Texture " << path << " rejected: " << TextureFile::getFormatName(desc.format)
+                  << " is not supported by the device" << std::endl;
+        stats.refused++;
+        return INVALID_HANDLE;
+    }
+
+    Texture texture;
+    texture.path = path;
+    texture.format = desc.format;
+    texture.width = desc.width;
+    texture.height = desc.height;
+    texture.levels = (uint32_t)desc.levels.size();
+
+    // Compressed formats cannot be blitted to, they keep the levels they
+    // were stored with.
+    uint32_t fileLevels = (uint32_t)desc.levels.size();
+    if (desc.generateMips) {
+        VkFormatFeatureFlags blit = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+            VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        if (!TextureFile::isBlockCompressed(desc.format) && isFormatSupported(desc.format, blit)) {
+            while ((std::max(desc.width, desc.height) >> texture.levels) > 0) texture.levels++;
+            texture.generatedMips = texture.levels > 1;
+        } else {
+            std::cout << "Texture " << path << ": " << TextureFile::getFormatName(desc.format)
+                      << " cannot be blitted, using it without mips" << std::endl;
+        }
+    }
+
+    VkImageCreateInfo imageCreateInfo {};
+    imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageCreateInfo.format = texture.format;
+    imageCreateInfo.extent = { texture.width, texture.height, 1 };
+    imageCreateInfo.mipLevels = texture.levels;
+    imageCreateInfo.arrayLayers = 1;
+    imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    if (texture.generatedMips) {
+        imageCreateInfo.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    }
+    imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VkResult result = vkCreateImage(device, &imageCreateInfo, NULL, &texture.image);
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create texture image " << path << ": " << getVulkanErrorString(result) << std::endl;
+        return INVALID_HANDLE;
+    }
+
+    // The budget is checked against what the device asks for, before any
+    // memory is taken.
+    VkMemoryRequirements memoryRequirements;
+    vkGetImageMemoryRequirements(device, texture.image, &memoryRequirements);
+    if (stats.budget > 0 && stats.bytes + memoryRequirements.size > stats.budget) {
+        std::cout << "Texture " << path << " rejected: " << memoryRequirements.size << " bytes would exceed the budget ("
+                  << stats.bytes << " of " << stats.budget << " bytes in use)" << std::endl;
+        vkDestroyImage(device, texture.image, NULL);
+        stats.refused++;
+        return INVALID_HANDLE;
+    }
+
+    if (!allocator->allocate(memoryRequirements, Allocator::GPU_ONLY, false, texture.memory)) {
+        std::cout << "Failed to allocate texture " << path << std::endl;
+        vkDestroyImage(device, texture.image, NULL);
+        return INVALID_HANDLE;
+    }
+    vkBindImageMemory(device, texture.image, texture.memory.memory, texture.memory.offset);
+    texture.bytes = memoryRequirements.size;
+
+    VkImageViewCreateInfo viewCreateInfo {};
+    viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewCreateInfo.image = texture.image;
+    viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewCreateInfo.format = texture.format;
+    viewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewCreateInfo.subresourceRange.levelCount = texture.levels;
+    viewCreateInfo.subresourceRange.layerCount = 1;
+
+    result = vkCreateImageView(device, &viewCreateInfo, NULL, &texture.view);
+    if (result != VK_SUCCESS || !upload(texture, file, fileLevels)) {
+        std::cout << "Failed to create texture " << path << std::endl;
+        destroyTexture(texture);
+        return INVALID_HANDLE;
+    }
+
+    stats.textures++;
+    stats.bytes += texture.bytes;
+    if (texture.generatedMips) {
+        stats.generatedLevels += texture.levels - 1;
+    }
+
+    Handle handle = (Handle)textures.size();
+    for (Handle i = 0; i < textures.size(); ++i) {
+        if (textures[i].image == VK_NULL_HANDLE) {
+            handle = i;
+            break;
+        }
+    }
+    if (handle == textures.size()) {
+        textures.push_back(texture);
+    } else {
+        textures[handle] = texture;
+    }
+    paths[path] = handle;
+    return handle;
+}
+
+// Copies the stored levels, blits the rest from them and leaves every level
+// ready to be sampled.
+bool TextureCache::upload(Texture& texture, const TextureFile& file, uint32_t fileLevels) {
+    const TextureFile::Desc& desc = file.getDesc();
+
+    VkDeviceSize size = 0;
+    for (uint32_t i = 0; i < fileLevels; ++i) {
+        size += desc.levels[i].size;
+    }
+
+    VkBuffer stagingBuffer;
+    Allocation stagingMemory;
+    if (!allocator->createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, Allocator::CPU_TO_GPU, stagingBuffer, stagingMemory)) {
+        std::cout << "Failed to create texture staging buffer" << std::endl;
+        return false;
+    }
+
+    // Level sizes are multiples of the texel block size, so packing them
+    // back to back keeps every copy aligned.
+    std::vector<VkBufferImageCopy> regions(fileLevels);
+    VkDeviceSize offset = 0;
+    for (uint32_t i = 0; i < fileLevels; ++i) {
+        memcpy((char*)stagingMemory.mapped + offset, file.getLevelData(i), desc.levels[i].size);
+
+        regions[i] = {};
+        regions[i].bufferOffset = offset;
+        regions[i].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        regions[i].imageSubresource.mipLevel = i;
+        regions[i].imageSubresource.layerCount = 1;
+        regions[i].imageExtent = { std::max(texture.width >> i, 1u), std::max(texture.height >> i, 1u), 1 };
+        offset += desc.levels[i].size;
+    }
+
+    VkCommandBufferAllocateInfo commandBufferAllocateInfo {};
+    commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    commandBufferAllocateInfo.commandPool = commandPool;
+    commandBufferAllocateInfo.commandBufferCount = 1;
+    commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+    VkCommandBuffer cmdBuffer;
+    VkResult result = vkAllocateCommandBuffers(device, &commandBufferAllocateInfo, &cmdBuffer);
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to create texture upload command buffer: " << getVulkanErrorString(result) << std::endl;
+        allocator->destroyBuffer(stagingBuffer, stagingMemory);
+        return false;
+    }
+
+    VkCommandBufferBeginInfo beginInfo {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(cmdBuffer, &beginInfo);
+
+    VkImageMemoryBarrier barrier {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = texture.image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.levelCount = texture.levels;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+        0, NULL, 0, NULL, 1, &barrier);
+
+    vkCmdCopyBufferToImage(cmdBuffer, stagingBuffer, texture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        fileLevels, regions.data());
+
+    // Each level is blitted from the one above it, which is turned into a
+    // transfer source first. Levels end up in two layouts: the sources in
+    // TRANSFER_SRC, the rest still in TRANSFER_DST.
+    uint32_t sourceLevels = 0;
+    if (texture.generatedMips) {
+        barrier.subresourceRange.levelCount = 1;
+        for (uint32_t i = 1; i < texture.levels; ++i) {
+            barrier.subresourceRange.baseMipLevel = i - 1;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                0, NULL, 0, NULL, 1, &barrier);
+
+            VkImageBlit blit {};
+            blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            blit.srcSubresource.mipLevel = i - 1;
+            blit.srcSubresource.layerCount = 1;
+            blit.srcOffsets[1] = { (int32_t)std::max(texture.width >> (i - 1), 1u),
+                (int32_t)std::max(texture.height >> (i - 1), 1u), 1 };
+            blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            blit.dstSubresource.mipLevel = i;
+            blit.dstSubresource.layerCount = 1;
+            blit.dstOffsets[1] = { (int32_t)std::max(texture.width >> i, 1u), (int32_t)std::max(texture.height >> i, 1u), 1 };
+            vkCmdBlitImage(cmdBuffer, texture.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                texture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+        }
+        sourceLevels = texture.levels - 1;
+    }
+
+    VkImageMemoryBarrier finalBarriers[2] { barrier, barrier };
+    uint32_t finalBarrierCount = 0;
+    if (sourceLevels > 0) {
+        VkImageMemoryBarrier& sources = finalBarriers[finalBarrierCount++];
+        sources.subresourceRange.baseMipLevel = 0;
+        sources.subresourceRange.levelCount = sourceLevels;
+        sources.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        sources.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    }
+    VkImageMemoryBarrier& written = finalBarriers[finalBarrierCount++];
+    written.subresourceRange.baseMipLevel = sourceLevels;
+    written.subresourceRange.levelCount = texture.levels - sourceLevels;
+    written.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    written.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    for (uint32_t i = 0; i < finalBarrierCount; ++i) {
+        finalBarriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        finalBarriers[i].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    }
+    vkCmdPipelineBarrier(cmdBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+        0, NULL, 0, NULL, finalBarrierCount, finalBarriers);
+
+    vkEndCommandBuffer(cmdBuffer);
+
+    VkSubmitInfo submitInfo {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &cmdBuffer;
+
+    result = vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+    if (result == VK_SUCCESS) {
+        result = vkQueueWaitIdle(queue);
+    }
+
+    vkFreeCommandBuffers(device, commandPool, 1, &cmdBuffer);
+    allocator->destroyBuffer(stagingBuffer, stagingMemory);
+
+    if (result != VK_SUCCESS) {
+        std::cout << "Failed to upload texture: " << getVulkanErrorString(result) << std::endl;
+        return false;
+    }
+
+    stats.uploadedBytes += size;
+    return true;
+}
+
+void TextureCache::release(Handle handle) {
+    if (handle >= textures.size() || textures[handle].image == VK_NULL_HANDLE) return;
+
+    Texture& texture = textures[handle];
+    stats.textures--;
+    stats.bytes -= texture.bytes;
+    paths.erase(texture.path);
+    destroyTexture(texture);
+    texture = Texture();
+}
+
+void TextureCache::destroyTexture(Texture& texture) {
+    if (texture.view != VK_NULL_HANDLE) {
+        vkDestroyImageView(device, texture.view, NULL);
+        texture.view = VK_NULL_HANDLE;
+    }
+    if (texture.image != VK_NULL_HANDLE) {
+        allocator->destroyImage(texture.image, texture.memory);
+    }
+}
+
+void TextureCache::printStats() const {
+    for (const Texture& texture: textures) {
+        if (texture.image == VK_NULL_HANDLE) continue;
+
+        std::cout << "  " << texture.path << ": " << texture.width << "x" << texture.height << " "
+                  << TextureFile::getFormatName(texture.format) << ", " << texture.levels << " levels"
+                  << (texture.generatedMips ? " (generated)" : "") << ", " << texture.bytes << " bytes" << std::endl;
+    }
+
+    std::cout << "Textures: " << stats.textures << " resident in " << stats.bytes << " bytes";
+    if (stats.budget > 0) {
+        std::cout << " of a " << stats.budget << " byte budget";
+    }
+    std::cout << ", " << stats.generatedLevels << " levels generated, " << stats.uploadedBytes << " bytes uploaded, "
+              << stats.refused << " refused" << std::endl;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Allocator.hpp"
+#include "TextureFile.hpp"
+
+// Sampled 2D textures loaded from KTX2 and DDS files. Block-compressed
+// levels are uploaded as stored. A file without a mip chain gets one
+// generated on the GPU with linear blits where the format allows blitting,
+// otherwise it is used with its single level. Formats are checked against
+// the device before anything is allocated.
+//
+// Every texture's device memory is accounted for; a load that would exceed
+// the budget is refused. Uploads wait for the queue, so loading is meant
+// for setup and level changes, not for the middle of a frame.
+class TextureCache {
+    public:
+        typedef uint32_t Handle;
+        static const Handle INVALID_HANDLE = UINT32_MAX;
+
+        struct Texture {
+            std::string path = "";
+            VkFormat format = VK_FORMAT_UNDEFINED;
+            uint32_t width = 0;
+            uint32_t height = 0;
+            uint32_t levels = 0;
+            bool generatedMips = false;
+            VkImage image = VK_NULL_HANDLE;
+            VkImageView view = VK_NULL_HANDLE;
+            Allocation memory = {};
+            VkDeviceSize bytes = 0;         // device memory, alignment included
+        };
+
+        struct Stats {
+            uint32_t textures = 0;
+            VkDeviceSize bytes = 0;
+            VkDeviceSize budget = 0;        // 0: unlimited
+            VkDeviceSize uploadedBytes = 0;
+            uint32_t generatedLevels = 0;
+            uint32_t refused = 0;           // over budget or unsupported
+        };
+
+    private:
+        VkPhysicalDevice gpu = VK_NULL_HANDLE;
+        VkDevice device = VK_NULL_HANDLE;
+        Allocator* allocator = NULL;
+        VkQueue queue = VK_NULL_HANDLE;
+        VkCommandPool commandPool = VK_NULL_HANDLE;
+
+        // Released textures leave a hole so handles stay valid.
+        std::vector<Texture> textures = {};
+        std::map<std::string, Handle> paths = {};
+        Stats stats;
+
+        bool upload(Texture& texture, const TextureFile& file, uint32_t fileLevels);
+        void destroyTexture(Texture& texture);
+
+    public:
+        // queue has to support graphics for the mip blits.
+        bool init(VkPhysicalDevice gpu, VkDevice device, Allocator& allocator, VkQueue queue, uint32_t queueFamilyIndex);
+        void destroy();
+
+        // Loading a path again returns the same texture.
+        Handle load(const std::string& path);
+        void release(Handle handle);
+
+        bool isFormatSupported(VkFormat format, VkFormatFeatureFlags features) const;
+
+        const Texture& getTexture(Handle handle) const {
+            return textures[handle];
+        }
+        VkImageView getView(Handle handle) const {
+            return textures[handle].view;
+        }
+
+        void setBudget(VkDeviceSize bytes) {
+            stats.budget = bytes;
+        }
+        const Stats& getStats() const {
+            return stats;
+        }
+        // One line per resident texture and the totals.
+        void printStats() const;
+};
@@ -0,0 +1,317 @@
+#include "TextureFile.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const uint8_t KTX2_IDENTIFIER[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+static const size_t KTX2_HEADER_SIZE = 80;
+static const size_t KTX2_LEVEL_INDEX_ENTRY = 24;
+
+static const uint32_t DDS_MAGIC = 0x20534444;     // "DDS "
+static const size_t DDS_HEADER_SIZE = 128;        // magic included
+static const size_t DDS_DX10_HEADER_SIZE = 20;
+static const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+static const uint32_t DDPF_FOURCC = 0x4;
+static const uint32_t DDPF_RGB = 0x40;
+static const uint32_t DDSCAPS2_CUBEMAP = 0x200;
+static const uint32_t DDSCAPS2_VOLUME = 0x200000;
+static const uint32_t DDS_DIMENSION_TEXTURE2D = 3;
+static const uint32_t DDS_RESOURCE_MISC_TEXTURECUBE = 0x4;
+
+static uint32_t fourCC(const char* code) {
+    return (uint32_t)code[0] | (uint32_t)code[1] << 8 | (uint32_t)code[2] << 16 | (uint32_t)code[3] << 24;
+}
+
+// The containers are little-endian and not necessarily aligned.
+static uint32_t read32(const void* data, size_t offset) {
+    uint32_t value;
+    memcpy(&value, (const char*)data + offset, sizeof(value));
+    return value;
+}
+
+static uint64_t read64(const void* data, size_t offset) {
+    uint64_t value;
+    memcpy(&value, (const char*)data + offset, sizeof(value));
+    return value;
+}
+
+static VkFormat fromDxgiFormat(uint32_t dxgiFormat) {
+    switch (dxgiFormat) {
+        case 28: return VK_FORMAT_R8G8B8A8_UNORM;
+        case 29: return VK_FORMAT_R8G8B8A8_SRGB;
+        case 71: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+        case 72: return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+        case 74: return VK_FORMAT_BC2_UNORM_BLOCK;
+        case 75: return VK_FORMAT_BC2_SRGB_BLOCK;
+        case 77: return VK_FORMAT_BC3_UNORM_BLOCK;
+        case 78: return VK_FORMAT_BC3_SRGB_BLOCK;
+        case 80: return VK_FORMAT_BC4_UNORM_BLOCK;
+        case 81: return VK_FORMAT_BC4_SNORM_BLOCK;
+        case 83: return VK_FORMAT_BC5_UNORM_BLOCK;
+        case 84: return VK_FORMAT_BC5_SNORM_BLOCK;
+        case 87: return VK_FORMAT_B8G8R8A8_UNORM;
+        case 91: return VK_FORMAT_B8G8R8A8_SRGB;
+        case 95: return VK_FORMAT_BC6H_UFLOAT_BLOCK;
+        case 96: return VK_FORMAT_BC6H_SFLOAT_BLOCK;
+        case 98: return VK_FORMAT_BC7_UNORM_BLOCK;
+        case 99: return VK_FORMAT_BC7_SRGB_BLOCK;
+        default: return VK_FORMAT_UNDEFINED;
+    }
+}
+
+static VkFormat fromFourCC(uint32_t code) {
+    if (code == fourCC("DXT1")) return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+    if (code == fourCC("DXT3")) return VK_FORMAT_BC2_UNORM_BLOCK;
+    if (code == fourCC("DXT5")) return VK_FORMAT_BC3_UNORM_BLOCK;
+    if (code == fourCC("ATI1") || code == fourCC("BC4U")) return VK_FORMAT_BC4_UNORM_BLOCK;
+    if (code == fourCC("BC4S")) return VK_FORMAT_BC4_SNORM_BLOCK;
+    if (code == fourCC("ATI2") || code == fourCC("BC5U")) return VK_FORMAT_BC5_UNORM_BLOCK;
+    if (code == fourCC("BC5S")) return VK_FORMAT_BC5_SNORM_BLOCK;
+    return VK_FORMAT_UNDEFINED;
+}
+
+bool TextureFile::isBlockCompressed(VkFormat format) {
+    return format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && format <= VK_FORMAT_BC7_SRGB_BLOCK;
+}
+
+uint64_t TextureFile::getLevelSize(VkFormat format, uint32_t width, uint32_t height) {
+    switch (format) {
+        case VK_FORMAT_R8G8B8A8_UNORM:
+        case VK_FORMAT_R8G8B8A8_SRGB:
+        case VK_FORMAT_B8G8R8A8_UNORM:
+        case VK_FORMAT_B8G8R8A8_SRGB:
+            return (uint64_t)width * height * 4;
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+        case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+        case VK_FORMAT_BC4_UNORM_BLOCK:
+        case VK_FORMAT_BC4_SNORM_BLOCK:
+            return (uint64_t)((width + 3) / 4) * ((height + 3) / 4) * 8;
+        default:
+            if (isBlockCompressed(format)) {
+                return (uint64_t)((width + 3) / 4) * ((height + 3) / 4) * 16;
+            }
+            return 0;
+    }
+}
+
+const char* TextureFile::getFormatName(VkFormat format) {
+    switch (format) {
+        case VK_FORMAT_R8G8B8A8_UNORM: return "rgba8";
+        case VK_FORMAT_R8G8B8A8_SRGB: return "rgba8_srgb";
+        case VK_FORMAT_B8G8R8A8_UNORM: return "bgra8";
+        case VK_FORMAT_B8G8R8A8_SRGB: return "bgra8_srgb";
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK: return "bc1_rgb";
+        case VK_FORMAT_BC1_RGB_SRGB_BLOCK: return "bc1_rgb_srgb";
+        case VK_FORMAT_BC1_RGBA_UNORM_BLOCK: return "bc1";
+        case VK_FORMAT_BC1_RGBA_SRGB_BLOCK: return "bc1_srgb";
+        case VK_FORMAT_BC2_UNORM_BLOCK: return "bc2";
+        case VK_FORMAT_BC2_SRGB_BLOCK: return "bc2_srgb";
+        case VK_FORMAT_BC3_UNORM_BLOCK: return "bc3";
+        case VK_FORMAT_BC3_SRGB_BLOCK: return "bc3_srgb";
+        case VK_FORMAT_BC4_UNORM_BLOCK: return "bc4";
+        case VK_FORMAT_BC4_SNORM_BLOCK: return "bc4_snorm";
+        case VK_FORMAT_BC5_UNORM_BLOCK: return "bc5";
+        case VK_FORMAT_BC5_SNORM_BLOCK: return "bc5_snorm";
+        case VK_FORMAT_BC6H_UFLOAT_BLOCK: return "bc6h";
+        case VK_FORMAT_BC6H_SFLOAT_BLOCK: return "bc6h_sf16";
+        case VK_FORMAT_BC7_UNORM_BLOCK: return "bc7";
+        case VK_FORMAT_BC7_SRGB_BLOCK: return "bc7_srgb";
+        default: return "unknown";
+    }
+}
+
+bool TextureFile::open(const std::string& path) {
+    close();
+
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cout << "Failed to open texture " << path << std::endl;
+        return false;
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size < 4) {
+        std::cout << "Texture file " << path << " is too small" << std::endl;
+        close();
+        return false;
+    }
+    size = (size_t)status.st_size;
+
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        std::cout << "Failed to map texture file " << path << std::endl;
+        data = NULL;
+        close();
+        return false;
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    const char* error = NULL;
+    bool parsed = false;
+    if (size >= sizeof(KTX2_IDENTIFIER) && memcmp(data, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) == 0) {
+        parsed = parseKtx2(error);
+    } else if (read32(data, 0) == DDS_MAGIC) {
+        parsed = parseDds(error);
+    } else {
+        error = "neither KTX2 nor DDS";
+    }
+    if (parsed) {
+        parsed = validateLevels(error);
+    }
+
+    if (!parsed) {
+        std::cout << "Texture file " << path << " rejected: " << error << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void TextureFile::close() {
+    if (data != NULL) {
+        munmap(data, size);
+        data = NULL;
+    }
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    size = 0;
+    desc = Desc();
+}
+
+bool TextureFile::parseKtx2(const char*& error) {
+    if (size < KTX2_HEADER_SIZE) {
+        error = "truncated header";
+        return false;
+    }
+
+    desc.format = (VkFormat)read32(data, 12);
+    desc.width = read32(data, 20);
+    desc.height = read32(data, 24);
+    uint32_t depth = read32(data, 28);
+    uint32_t layerCount = read32(data, 32);
+    uint32_t faceCount = read32(data, 36);
+    uint32_t levelCount = read32(data, 40);
+    uint32_t supercompression = read32(data, 44);
+
+    if (supercompression != 0) {
+        error = "supercompressed";
+        return false;
+    }
+    if (depth > 1 || layerCount > 1 || faceCount != 1 || desc.height == 0) {
+        error = "not a single 2D image";
+        return false;
+    }
+
+    // Level 0 means the loader is asked to generate the chain.
+    desc.generateMips = levelCount == 0;
+    levelCount = std::max(levelCount, 1u);
+    if (size < KTX2_HEADER_SIZE + (uint64_t)levelCount * KTX2_LEVEL_INDEX_ENTRY) {
+        error = "truncated level index";
+        return false;
+    }
+
+    desc.levels.resize(levelCount);
+    for (uint32_t i = 0; i < levelCount; ++i) {
+        size_t entry = KTX2_HEADER_SIZE + i * KTX2_LEVEL_INDEX_ENTRY;
+        desc.levels[i].offset = read64(data, entry);
+        desc.levels[i].size = read64(data, entry + 8);
+    }
+    return true;
+}
+
+bool TextureFile::parseDds(const char*& error) {
+    if (size < DDS_HEADER_SIZE || read32(data, 4) != 124) {
+        error = "truncated header";
+        return false;
+    }
+
+    uint32_t flags = read32(data, 8);
+    desc.height = read32(data, 12);
+    desc.width = read32(data, 16);
+    uint32_t mipCount = read32(data, 28);
+    uint32_t pixelFlags = read32(data, 80);
+    uint32_t code = read32(data, 84);
+    uint32_t caps2 = read32(data, 112);
+
+    if (caps2 & (DDSCAPS2_CUBEMAP | DDSCAPS2_VOLUME)) {
+        error = "not a single 2D image";
+        return false;
+    }
+
+    uint64_t offset = DDS_HEADER_SIZE;
+    if ((pixelFlags & DDPF_FOURCC) && code == fourCC("DX10")) {
+        if (size < DDS_HEADER_SIZE + DDS_DX10_HEADER_SIZE) {
+            error = "truncated DX10 header";
+            return false;
+        }
+        if (read32(data, 132) != DDS_DIMENSION_TEXTURE2D || (read32(data, 136) & DDS_RESOURCE_MISC_TEXTURECUBE) ||
+                read32(data, 140) > 1) {
+            error = "not a single 2D image";
+            return false;
+        }
+        desc.format = fromDxgiFormat(read32(data, 128));
+        offset += DDS_DX10_HEADER_SIZE;
+    } else if (pixelFlags & DDPF_FOURCC) {
+        desc.format = fromFourCC(code);
+    } else if ((pixelFlags & DDPF_RGB) && read32(data, 88) == 32) {
+        uint32_t redMask = read32(data, 92);
+        uint32_t blueMask = read32(data, 100);
+        if (redMask == 0x000000FF && blueMask == 0x00FF0000) {
+            desc.format = VK_FORMAT_R8G8B8A8_UNORM;
+        } else if (redMask == 0x00FF0000 && blueMask == 0x000000FF) {
+            desc.format = VK_FORMAT_B8G8R8A8_UNORM;
+        }
+    }
+
+    // DDS levels are stored largest first, back to back.
+    uint32_t levelCount = (flags & DDSD_MIPMAPCOUNT) && mipCount > 0 ? mipCount : 1;
+    desc.generateMips = levelCount == 1;
+    desc.levels.resize(std::min(levelCount, 32u));
+    for (uint32_t i = 0; i < desc.levels.size(); ++i) {
+        desc.levels[i].offset = offset;
+        desc.levels[i].size = getLevelSize(desc.format, std::max(desc.width >> i, 1u), std::max(desc.height >> i, 1u));
+        offset += desc.levels[i].size;
+    }
+    return true;
+}
+
+bool TextureFile::validateLevels(const char*& error) const {
+    if (getLevelSize(desc.format, 1, 1) == 0) {
+        error = "unsupported format";
+        return false;
+    }
+    if (desc.width == 0 || desc.height == 0) {
+        error = "empty image";
+        return false;
+    }
+
+    uint32_t maxLevels = 1;
+    while ((std::max(desc.width, desc.height) >> maxLevels) > 0) maxLevels++;
+    if (desc.levels.size() > maxLevels) {
+        error = "more mip levels than the image has";
+        return false;
+    }
+
+    for (uint32_t i = 0; i < desc.levels.size(); ++i) {
+        const Level& level = desc.levels[i];
+        if (level.size != getLevelSize(desc.format, std::max(desc.width >> i, 1u), std::max(desc.height >> i, 1u))) {
+            error = "level size does not match the format";
+            return false;
+        }
+        if (level.offset > size || level.size > size - level.offset) {
+            error = "levels outside the file";
+            return false;
+        }
+    }
+    return true;
+}
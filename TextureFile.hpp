@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Read-only view of a KTX2 or DDS texture container. The file is
+// memory-mapped and its mip levels are handed to the GPU upload as they are
+// stored, block-compressed formats included. Only single 2D images are
+// accepted: no arrays, cube maps, volumes or supercompression.
+//
+// generateMips is set for files that leave the mip chain to the loader: DDS
+// files with a single level and KTX2 files with a level count of 0.
+class TextureFile {
+    public:
+        struct Level {
+            uint64_t offset;
+            uint64_t size;
+        };
+
+        struct Desc {
+            VkFormat format = VK_FORMAT_UNDEFINED;
+            uint32_t width = 0;
+            uint32_t height = 0;
+            bool generateMips = false;
+            std::vector<Level> levels = {};     // level 0 is the largest
+        };
+
+    private:
+        int fd = -1;
+        void* data = NULL;
+        size_t size = 0;
+        Desc desc;
+
+        bool parseKtx2(const char*& error);
+        bool parseDds(const char*& error);
+        bool validateLevels(const char*& error) const;
+
+    public:
+        ~TextureFile() {
+            close();
+        }
+
+        // Maps the file and parses its header; the levels stay valid until
+        // close().
+        bool open(const std::string& path);
+        void close();
+
+        const Desc& getDesc() const {
+            return desc;
+        }
+        const void* getLevelData(uint32_t level) const {
+            return (const char*)data + desc.levels[level].offset;
+        }
+
+        // Size in bytes of one level, 0 for formats the containers cannot
+        // carry here.
+        static uint64_t getLevelSize(VkFormat format, uint32_t width, uint32_t height);
+        static bool isBlockCompressed(VkFormat format);
+        static const char* getFormatName(VkFormat format);
+};
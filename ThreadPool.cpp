@@ -0,0 +1,152 @@
+#include "ThreadPool.hpp"
+#include <iostream>
+
+ThreadPool::ThreadPool() : pendingBatches(0), stolenBatches(0) {
+}
+
+uint32_t ThreadPool::getDefaultThreadCount() {
+    uint32_t count = std::thread::hardware_concurrency();
+    if (count < 1) count = 1;
+    if (count > 8) count = 8;
+    return count;
+}
+
+bool ThreadPool::init(uint32_t threadCount) {
+    if (threadCount < 1) threadCount = 1;
+
+    stopping = false;
+    queues.resize(threadCount);
+    for (uint32_t i = 0; i < threadCount; ++i) {
+        queues[i] = new Queue();
+    }
+
+    try {
+        for (uint32_t i = 1; i < threadCount; ++i) {
+            workers.push_back(std::thread(&ThreadPool::workerMain, this, i));
+        }
+    } catch (const std::system_error& error) {
+        std::cout << "Failed to start worker thread: " << error.what() << std::endl;
+        destroy();
+        return false;
+    }
+
+    return true;
+}
+
+void ThreadPool::destroy() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (std::thread& worker: workers) {
+        worker.join();
+    }
+    workers.clear();
+
+    for (Queue* queue: queues) {
+        delete(queue);
+    }
+    queues.clear();
+}
+
+bool ThreadPool::runBatch(uint32_t threadIndex) {
+    Batch batch;
+    bool found = false;
+
+    // Own queue first, newest batch, it is the most likely to be hot.
+    {
+        Queue* queue = queues[threadIndex];
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        if (!queue->batches.empty()) {
+            batch = queue->batches.back();
+            queue->batches.pop_back();
+            found = true;
+        }
+    }
+
+    // Then steal the oldest batch of the next non-empty queue.
+    for (uint32_t i = 1; !found && i < queues.size(); ++i) {
+        Queue* queue = queues[(threadIndex + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        if (!queue->batches.empty()) {
+            batch = queue->batches.front();
+            queue->batches.pop_front();
+            found = true;
+            stolenBatches++;
+        }
+    }
+
+    if (!found) return false;
+
+    (*task)(threadIndex, batch.begin, batch.end);
+
+    if (--pendingBatches == 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        done.notify_all();
+    }
+    return true;
+}
+
+void ThreadPool::workerMain(uint32_t threadIndex) {
+    uint64_t seenGeneration = 0;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seenGeneration; });
+            if (stopping) return;
+
+            seenGeneration = generation;
+            activeWorkers++;
+        }
+
+        while (runBatch(threadIndex)) {}
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            activeWorkers--;
+        }
+        done.notify_all();
+    }
+}
+
+void ThreadPool::parallelFor(uint32_t count, uint32_t batchSize, const RangeTask& task) {
+    if (count == 0) return;
+    if (batchSize < 1) batchSize = 1;
+
+    // Nothing to share, skip the hand-off.
+    if (queues.size() <= 1 || count <= batchSize) {
+        task(0, 0, count);
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        // A worker that woke up late for the previous job may still be
+        // looking at the queues, let it leave before they are refilled.
+        done.wait(lock, [&] { return activeWorkers == 0; });
+
+        uint32_t batchCount = 0;
+        for (uint32_t begin = 0; begin < count; begin += batchSize) {
+            uint32_t end = begin + batchSize < count ? begin + batchSize : count;
+            Queue* queue = queues[batchCount % queues.size()];
+            std::lock_guard<std::mutex> queueLock(queue->mutex);
+            queue->batches.push_back({ begin, end });
+            batchCount++;
+        }
+
+        this->task = &task;
+        pendingBatches = batchCount;
+        generation++;
+    }
+    wake.notify_all();
+
+    while (runBatch(0)) {}
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return pendingBatches == 0 && activeWorkers == 0; });
+    this->task = NULL;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running parallelFor() jobs. A job is split
+// into batches that are dealt out to per-thread queues; each thread drains
+// its own queue from the back and steals from the front of the others once
+// it runs dry, so uneven batches still keep every thread busy.
+//
+// The calling thread takes part in every job as thread index 0, workers use
+// indices 1..getThreadCount()-1. Per-thread resources can be indexed by it.
+class ThreadPool {
+    public:
+        typedef std::function<void(uint32_t threadIndex, uint32_t begin, uint32_t end)> RangeTask;
+
+    private:
+        struct Batch {
+            uint32_t begin;
+            uint32_t end;
+        };
+
+        struct Queue {
+            std::mutex mutex;
+            std::deque<Batch> batches;
+        };
+
+        std::vector<std::thread> workers = {};
+        std::vector<Queue*> queues = {};
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable done;
+        const RangeTask* task = NULL;
+        uint64_t generation = 0;
+        uint32_t activeWorkers = 0;
+        bool stopping = false;
+
+        std::atomic<uint32_t> pendingBatches;
+        std::atomic<uint64_t> stolenBatches;
+
+        void workerMain(uint32_t threadIndex);
+        bool runBatch(uint32_t threadIndex);
+
+    public:
+        ThreadPool();
+
+        // threadCount includes the calling thread, 1 runs everything inline.
+        bool init(uint32_t threadCount);
+        void destroy();
+
+        // Runs task over [0, count) in batches of at most batchSize and
+        // returns once every batch has finished.
+        void parallelFor(uint32_t count, uint32_t batchSize, const RangeTask& task);
+
+        uint32_t getThreadCount() const {
+            return (uint32_t)queues.size();
+        }
+        uint64_t getStolenBatches() const {
+            return stolenBatches.load();
+        }
+
+        static uint32_t getDefaultThreadCount();
+};
@@ -0,0 +1,41 @@
+#include "VulkanError.hpp"
+
+std::string getVulkanErrorString(VkResult result) {
+    switch(result) {
+        case VK_ERROR_OUT_OF_HOST_MEMORY: 
+            return "VK_ERROR_OUT_OF_HOST_MEMORY"; 
+            break;
+        case VK_ERROR_OUT_OF_DEVICE_MEMORY: 
+            return "VK_ERROR_OUT_OF_DEVICE_MEMORY"; 
+            break;
+        case VK_ERROR_INITIALIZATION_FAILED: 
+            return "VK_ERROR_INITIALIZATION_FAILED"; 
+            break;
+        case VK_ERROR_DEVICE_LOST: 
+            return "VK_ERROR_DEVICE_LOST"; 
+            break;
+        case VK_ERROR_MEMORY_MAP_FAILED: 
+            return "VK_ERROR_MEMORY_MAP_FAILED"; 
+            break;
+        case VK_ERROR_LAYER_NOT_PRESENT: 
+            return "VK_ERROR_LAYER_NOT_PRESENT"; 
+            break;
+        case VK_ERROR_EXTENSION_NOT_PRESENT: 
+            return "VK_ERROR_EXTENSION_NOT_PRESENT"; 
+            break;
+        case VK_ERROR_FEATURE_NOT_PRESENT: 
+            return "VK_ERROR_FEATURE_NOT_PRESENT"; 
+            break;
+        case VK_ERROR_INCOMPATIBLE_DRIVER: 
+            return "VK_ERROR_INCOMPATIBLE_DRIVER"; 
+            break;
+        case VK_ERROR_TOO_MANY_OBJECTS: 
+            return "VK_ERROR_TOO_MANY_OBJECTS"; 
+            break;
+        case VK_ERROR_FORMAT_NOT_SUPPORTED: 
+            return "VK_ERROR_FORMAT_NOT_SUPPORTED"; 
+            break;
+        default: 
+            return "No error, code: " +  std::to_string(result);
+    }
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <string>
+
+// The name of a VkResult for error messages, every module prints failed
+// calls through it.
+std::string getVulkanErrorString(VkResult result);
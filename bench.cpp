@@ -0,0 +1,649 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+#include <GLFW/glfw3.h>
+
+#include "Percentiles.hpp"
+#include "Renderer.hpp"
+
+// Frame benchmark: runs a fixed number of frames after a warm-up and
+// reports throughput and CPU/GPU frame time percentiles, optionally as JSON.
+namespace Bench {
+    struct Options {
+        uint32_t width = 640;
+        uint32_t height = 480;
+        uint32_t framesInFlight = 2;
+        uint32_t warmupFrames = 100;
+        uint32_t frames = 1000;
+        uint32_t threads = 0;           // 0: renderer default
+        uint32_t instances = 1024;
+        uint32_t instancesPerDraw = 0;  // 0: one draw for everything
+        uint32_t animated = 0;
+        CullingMode culling = CULLING_CPU;
+        ShadingMode shading = SHADING_COLOR;
+        bool asyncCompute = true;       // where the device has a second queue
+        PresentPolicy present;
+        float zoom = 1.0f;
+        bool scaling = false;
+        bool compareCulling = false;
+        bool windowed = false;
+        RenderBackend backend = BACKEND_AUTO;
+        std::string meshPath = "";      // empty: renderer default
+        std::string streamMeshPath = "";
+        std::vector<std::string> texturePaths = {};
+        uint32_t textureBudget = 0;     // MiB, 0: unlimited
+        bool captureFrames = false;
+        FrameCapture::Settings capture;
+        std::string recordPath = "";    // command stream of the measured frames
+        std::string jsonPath = "";
+        std::string tracePath = "";
+    };
+
+    void print(const char* name, const Percentiles& p) {
+        std::cout << name
+            << " mean " << p.mean
+            << " ms, p50 " << p.p50
+            << " ms, p95 " << p.p95
+            << " ms, p99 " << p.p99
+            << " ms, max " << p.max << " ms" << std::endl;
+    }
+
+    bool parseOptions(int argc, char** argv, Options& options) {
+        for (int i = 1; i < argc; ++i) {
+            bool hasValue = i + 1 < argc;
+            if (strcmp(argv[i], "--frames") == 0 && hasValue) {
+                options.frames = (uint32_t)atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--warmup") == 0 && hasValue) {
+                options.warmupFrames = (uint32_t)atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--width") == 0 && hasValue) {
+                options.width = (uint32_t)atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--height") == 0 && hasValue) {
+                options.height = (uint32_t)atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--frames-in-flight") == 0 && hasValue) {
+                options.framesInFlight = (uint32_t)atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--json") == 0 && hasValue) {
+                options.jsonPath = argv[++i];
+            } else if (strcmp(argv[i], "--trace") == 0 && hasValue) {
+                options.tracePath = argv[++i];
+            } else if (strcmp(argv[i], "--threads") == 0 && hasValue) {
+                options.threads = (uint32_t)atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--instances") == 0 && hasValue) {
+                options.instances = (uint32_t)atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--instances-per-draw") == 0 && hasValue) {
+                options.instancesPerDraw = (uint32_t)atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--animated") == 0 && hasValue) {
+                options.animated = (uint32_t)atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--culling") == 0 && hasValue) {
+                if (!Renderer::parseCullingMode(argv[++i], options.culling)) {
+                    std::cout << "Unknown culling mode " << argv[i] << ", expected none, cpu or gpu" << std::endl;
+                    return false;
+                }
+            } else if (strcmp(argv[i], "--shading") == 0 && hasValue) {
+                if (!Renderer::parseShadingMode(argv[++i], options.shading)) {
+                    std::cout << "Unknown shading mode " << argv[i] << ", expected color or instance" << std::endl;
+                    return false;
+                }
+            } else if (strcmp(argv[i], "--async-compute") == 0 && hasValue) {
+                ++i;
+                if (strcmp(argv[i], "on") == 0 || strcmp(argv[i], "off") == 0) {
+                    options.asyncCompute = strcmp(argv[i], "on") == 0;
+                } else {
+                    std::cout << "Unknown async compute setting " << argv[i] << ", expected on or off" << std::endl;
+                    return false;
+                }
+            } else if (strcmp(argv[i], "--present-mode") == 0 && hasValue) {
+                if (!Renderer::parsePresentMode(argv[++i], options.present.mode)) {
+                    std::cout << "Unknown present mode " << argv[i] << ", expected immediate, mailbox, fifo or fifo_relaxed" << std::endl;
+                    return false;
+                }
+            } else if (strcmp(argv[i], "--swapchain-images") == 0 && hasValue) {
+                options.present.imageCount = (uint32_t)atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--fps") == 0 && hasValue) {
+                options.present.targetFps = atof(argv[++i]);
+            } else if (strcmp(argv[i], "--zoom") == 0 && hasValue) {
+                options.zoom = (float)atof(argv[++i]);
+            } else if (strcmp(argv[i], "--compare-culling") == 0) {
+                options.compareCulling = true;
+            } else if (strcmp(argv[i], "--mesh") == 0 && hasValue) {
+                options.meshPath = argv[++i];
+            } else if (strcmp(argv[i], "--stream-mesh") == 0 && hasValue) {
+                options.streamMeshPath = argv[++i];
+            } else if (strcmp(argv[i], "--texture") == 0 && hasValue) {
+                options.texturePaths.push_back(argv[++i]);
+            } else if (strcmp(argv[i], "--texture-budget") == 0 && hasValue) {
+                options.textureBudget = (uint32_t)atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--capture") == 0 && hasValue) {
+                options.captureFrames = true;
+                options.capture.path = argv[++i];
+            } else if (strcmp(argv[i], "--capture-format") == 0 && hasValue) {
+                if (!FrameCapture::parseFormat(argv[++i], options.capture.format)) {
+                    std::cout << "Unknown capture format " << argv[i] << ", expected png or raw" << std::endl;
+                    return false;
+                }
+            } else if (strcmp(argv[i], "--capture-every") == 0 && hasValue) {
+                options.capture.interval = (uint32_t)atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--capture-threads") == 0 && hasValue) {
+                options.capture.threads = (uint32_t)atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--record") == 0 && hasValue) {
+                options.recordPath = argv[++i];
+            } else if (strcmp(argv[i], "--scaling") == 0) {
+                options.scaling = true;
+            } else if (strcmp(argv[i], "--windowed") == 0) {
+                options.windowed = true;
+            } else if (strcmp(argv[i], "--backend") == 0 && hasValue) {
+                if (!Renderer::parseBackend(argv[++i], options.backend)) {
+                    std::cout << "Unknown backend " << argv[i] << ", expected auto, vulkan or software" << std::endl;
+                    return false;
+                }
+            } else {
+                std::cout << "Usage: bench [--frames N] [--warmup N] [--width W] [--height H]" << std::endl
+                          << "             [--frames-in-flight N] [--threads N] [--scaling]" << std::endl
+                          << "             [--instances N] [--instances-per-draw N] [--animated N]" << std::endl
+                          << "             [--culling none|cpu|gpu] [--compare-culling] [--zoom F]" << std::endl
+                          << "             [--shading color|instance] [--async-compute on|off]" << std::endl
+                          << "             [--present-mode immediate|mailbox|fifo|fifo_relaxed]" << std::endl
+                          << "             [--swapchain-images N] [--fps F]" << std::endl
+                          << "             [--mesh FILE] [--stream-mesh FILE] [--windowed]" << std::endl
+                          << "             [--backend auto|vulkan|software]" << std::endl
+                          << "             [--texture FILE]... [--texture-budget MIB]" << std::endl
+                          << "             [--capture PATH] [--capture-format png|raw] [--capture-every N]" << std::endl
+                          << "             [--capture-threads N] [--record FILE]" << std::endl
+                          << "             [--json FILE] [--trace FILE]" << std::endl;
+                return false;
+            }
+        }
+
+        if (options.frames == 0) options.frames = 1;
+        if (options.zoom <= 0.0f) options.zoom = 1.0f;
+        return true;
+    }
+
+    struct Samples {
+        std::vector<double> cpuTimes;
+        std::vector<double> gpuTimes;
+        std::vector<double> recordTimes;
+        std::vector<double> cullTimes;
+        std::vector<double> inputToSubmit;
+        std::vector<double> inputToPresent;
+        uint64_t uploadedInstances = 0;
+        uint64_t descriptorSets = 0;
+        uint64_t uniformBytes = 0;
+        uint64_t barrierCalls = 0;
+        uint64_t visibleInstances = 0;
+        double seconds = 0.0;
+
+        // Frame in which a mesh streamed during the run was swapped in.
+        int64_t meshResidentFrame = -1;
+        double meshResidentMs = 0.0;
+    };
+
+    Samples measure(Renderer* renderer, const Options& options) {
+        Samples samples;
+        samples.cpuTimes.reserve(options.frames);
+        samples.gpuTimes.reserve(options.frames);
+        samples.recordTimes.reserve(options.frames);
+        samples.cullTimes.reserve(options.frames);
+        samples.inputToSubmit.reserve(options.frames);
+        samples.inputToPresent.reserve(options.frames);
+
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point begin = Clock::now();
+        bool streaming = renderer->isMeshStreaming();
+
+        for (uint32_t i = 0; i < options.frames; ++i) {
+            Clock::time_point frameBegin = Clock::now();
+            renderer->pollEvents();
+            renderer->update();
+            renderer->cull();
+            renderer->draw();
+            Clock::time_point frameEnd = Clock::now();
+
+            const FramePacer::Sample& latency = renderer->getFramePacer().getLastSample();
+            samples.inputToSubmit.push_back(latency.inputToSubmit);
+            samples.inputToPresent.push_back(latency.inputToPresent);
+
+            samples.cpuTimes.push_back(std::chrono::duration<double, std::milli>(frameEnd - frameBegin).count());
+            samples.recordTimes.push_back(renderer->getLastRecordTime());
+            samples.cullTimes.push_back(renderer->getLastCullTime());
+            samples.uploadedInstances += renderer->getLastUploadedInstanceCount();
+            samples.descriptorSets += renderer->getLastDescriptorSetCount();
+            samples.uniformBytes += renderer->getLastUniformBytes();
+            samples.barrierCalls += renderer->getRenderGraph().getStats().barrierCalls;
+            samples.visibleInstances += renderer->getVisibleInstanceCount();
+
+            if (streaming && samples.meshResidentFrame < 0 && !renderer->isMeshStreaming()) {
+                samples.meshResidentFrame = i;
+                samples.meshResidentMs = std::chrono::duration<double, std::milli>(frameEnd - begin).count();
+            }
+
+            // Each draw() resolves the timestamps of the frame that last used
+            // its slot; skip the ones that still belong to the warm-up.
+            if (i >= options.framesInFlight && renderer->getLastGpuFrameTime() >= 0.0) {
+                samples.gpuTimes.push_back(renderer->getLastGpuFrameTime());
+            }
+        }
+
+        renderer->waitReady();
+        samples.seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+        return samples;
+    }
+
+    void warmUp(Renderer* renderer, const Options& options) {
+        for (uint32_t i = 0; i < options.warmupFrames; ++i) {
+            renderer->pollEvents();
+            renderer->update();
+            renderer->cull();
+            renderer->draw();
+        }
+        renderer->waitReady();
+    }
+
+    // Record time for 1, 2, 4, ... threads up to --threads, or the default
+    // thread count.
+    std::string runScaling(Renderer* renderer, const Options& options) {
+        std::vector<uint32_t> threadCounts;
+        uint32_t maxThreads = options.threads > 0 ? options.threads : ThreadPool::getDefaultThreadCount();
+        for (uint32_t threads = 1; threads < maxThreads; threads *= 2) {
+            threadCounts.push_back(threads);
+        }
+        threadCounts.push_back(maxThreads);
+
+        std::ostringstream json;
+        double baseline = 0.0;
+
+        std::cout << "Record scaling, " << renderer->getDrawCount() << " draws:" << std::endl;
+        for (uint32_t i = 0; i < threadCounts.size(); ++i) {
+            if (!renderer->setRecordThreadCount(threadCounts[i])) break;
+
+            warmUp(renderer, options);
+            Percentiles record = percentiles(measure(renderer, options).recordTimes);
+            if (i == 0) baseline = record.p50;
+
+            std::cout << "  " << threadCounts[i] << " threads: p50 " << record.p50
+                      << " ms, p95 " << record.p95 << " ms, speed-up "
+                      << (record.p50 > 0.0 ? baseline / record.p50 : 0.0) << "x" << std::endl;
+
+            json << (i == 0 ? "" : ", ") << "{\"threads\": " << threadCounts[i]
+                 << ", \"record_ms\": " << toJson(record) << "}";
+        }
+
+        return "[" + json.str() + "]";
+    }
+
+    // Throughput and frame times of every culling mode on the same scene.
+    std::string runCullingComparison(Renderer* renderer, const Options& options) {
+        std::ostringstream json;
+
+        std::cout << "Culling comparison, " << renderer->getInstanceCount() << " instances:" << std::endl;
+        for (int mode = CULLING_NONE; mode <= CULLING_GPU; ++mode) {
+            renderer->setCullingMode((CullingMode)mode);
+
+            warmUp(renderer, options);
+            Samples samples = measure(renderer, options);
+            double fps = (double)options.frames / samples.seconds;
+            Percentiles cpu = percentiles(samples.cpuTimes);
+            Percentiles gpu = percentiles(samples.gpuTimes);
+            double visible = (double)renderer->getVisibleInstanceCount();
+
+            std::cout << "  " << Renderer::getCullingModeName((CullingMode)mode) << ": " << fps
+                      << " frames/s, CPU p50 " << cpu.p50 << " ms, GPU p50 " << gpu.p50
+                      << " ms, " << visible << " visible" << std::endl;
+
+            json << (mode == CULLING_NONE ? "" : ", ") << "{\"culling\": \"" << Renderer::getCullingModeName((CullingMode)mode)
+                 << "\", \"fps\": " << fps
+                 << ", \"visible_instances\": " << visible
+                 << ", \"cpu_frame_ms\": " << toJson(cpu)
+                 << ", \"gpu_frame_ms\": " << (samples.gpuTimes.empty() ? "null" : toJson(gpu)) << "}";
+        }
+
+        renderer->setCullingMode(options.culling);
+        return "[" + json.str() + "]";
+    }
+
+    int run(const Options& options) {
+        GLFWwindow* window = NULL;
+        Renderer* renderer;
+
+        if (options.windowed) {
+            if (!glfwInit()) return 1;
+
+            glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+            window = glfwCreateWindow(options.width, options.height, "bench", NULL, NULL);
+            renderer = new Renderer(window, options.framesInFlight, options.backend);
+        } else {
+            renderer = new Renderer(options.width, options.height, options.framesInFlight, options.backend);
+        }
+
+        if (!options.meshPath.empty()) {
+            renderer->loadMesh(options.meshPath);
+        }
+        renderer->getTextureCache().setBudget((VkDeviceSize)options.textureBudget << 20);
+        for (const std::string& path: options.texturePaths) {
+            renderer->getTextureCache().load(path);
+        }
+        renderer->setInstanceCount(options.instances);
+        if (options.instancesPerDraw > 0) {
+            renderer->setInstancesPerDraw(options.instancesPerDraw);
+        }
+        renderer->setAnimatedInstanceCount(options.animated);
+        renderer->setCullingMode(options.culling);
+        renderer->setShadingMode(options.shading);
+        renderer->setAsyncCompute(options.asyncCompute);
+        renderer->setPresentPolicy(options.present);
+
+        // Zooming into the clip space grid pushes all but 1/zoom^2 of the
+        // instances out of the frustum.
+        renderer->setViewProjection(Math::scaling(Math::Vec3(options.zoom, options.zoom, 1.0f)) *
+            renderer->getViewProjection());
+        if (options.threads > 0) {
+            renderer->setRecordThreadCount(options.threads);
+        }
+
+        std::string scaling = "null";
+        if (options.scaling) {
+            scaling = runScaling(renderer, options);
+            renderer->setRecordThreadCount(options.threads > 0 ? options.threads : ThreadPool::getDefaultThreadCount());
+        }
+
+        std::string cullingComparison = "null";
+        if (options.compareCulling) {
+            cullingComparison = runCullingComparison(renderer, options);
+        }
+
+        warmUp(renderer, options);
+        renderer->getProfiler().setTracing(!options.tracePath.empty());
+
+        // The mesh is loaded and uploaded while the measured frames run, so
+        // any hitch it causes shows up in the frame times.
+        if (!options.streamMeshPath.empty()) {
+            renderer->loadMeshAsync(options.streamMeshPath);
+        }
+
+        // Capture covers the measured frames only, so its overhead shows
+        // up in the frame times. So does recording, which replay runs again.
+        bool capturing = options.captureFrames && renderer->startCapture(options.capture);
+        bool recording = !options.recordPath.empty() && renderer->startRecording(options.recordPath);
+        Samples samples = measure(renderer, options);
+        if (recording) {
+            renderer->stopRecording();
+        }
+        if (capturing) {
+            renderer->stopCapture();
+        }
+        FrameCapture::Stats capture = renderer->getFrameCapture().getStats();
+        const std::vector<double>& gpuTimes = samples.gpuTimes;
+
+        double seconds = samples.seconds;
+        double fps = (double)options.frames / seconds;
+        Percentiles cpu = percentiles(samples.cpuTimes);
+        Percentiles gpu = percentiles(gpuTimes);
+        Percentiles record = percentiles(samples.recordTimes);
+        Percentiles cullTime = percentiles(samples.cullTimes);
+        Percentiles inputToSubmit = percentiles(samples.inputToSubmit);
+        Percentiles inputToPresent = percentiles(samples.inputToPresent);
+        double visiblePerFrame = (double)samples.visibleInstances / options.frames;
+
+        std::cout << "Frames: " << options.frames << " (" << options.warmupFrames << " warm-up), "
+                  << options.width << "x" << options.height << ", "
+                  << (options.windowed ? "windowed" : "headless") << ", "
+                  << renderer->getInstanceCount() << " instances in " << renderer->getDrawCount() << " draws on "
+                  << renderer->getRecordThreadCount() << " threads" << std::endl;
+        // Rasterizer stats are of the last frame.
+        bool software = renderer->getBackend() == BACKEND_SOFTWARE;
+        const SoftwareRasterizer::Stats& raster = renderer->getSoftwareRasterizer().getStats();
+        std::cout << "Backend: " << Renderer::getBackendName(renderer->getBackend());
+        if (software) {
+            std::cout << ", " << raster.triangles << " triangles, " << raster.culled << " culled, "
+                      << raster.clipped << " clipped, " << raster.binned << " tile bins in " << raster.passes
+                      << (raster.passes == 1 ? " pass" : " passes") << ", setup " << raster.setupTime
+                      << " ms, raster " << raster.rasterTime << " ms";
+        }
+        std::cout << std::endl;
+        const InitGraph& startup = renderer->getStartup();
+        std::vector<InitGraph::Task> criticalPath = startup.getCriticalPath();
+        std::cout << "Startup: " << startup.getTotalTime() << " ms, " << startup.getWorkTime() << " ms of work in "
+                  << startup.getTimings().size() << " tasks on " << startup.getThreadCount()
+                  << " threads, first frame after " << renderer->getTimeToFirstFrame() << " ms" << std::endl;
+        std::cout << "Mesh: " << renderer->getMeshPath() << ", " << renderer->getMeshVertexCount() << " vertices, "
+                  << renderer->getMeshIndexCount() / 3 << " triangles, "
+                  << MeshFile::getVertexFormatName(renderer->getMeshVertexFormat()) << " positions" << std::endl;
+        std::cout << "Throughput: " << fps << " frames/s" << std::endl;
+        print("CPU frame time:", cpu);
+        print("CPU cull time:", cullTime);
+        print("CPU record time:", record);
+        if (options.windowed) {
+            std::cout << "Present: " << Renderer::getPresentModeName(renderer->getPresentMode()) << ", "
+                      << renderer->getSwapchainImageCount() << " swapchain images";
+        } else {
+            std::cout << "Present: headless";
+        }
+        if (options.present.targetFps > 0.0) {
+            std::cout << ", limited to " << options.present.targetFps << " fps";
+        }
+        std::cout << std::endl;
+        print("Input to submit:", inputToSubmit);
+        print("Input to present:", inputToPresent);
+        std::cout << "Visible instances: " << visiblePerFrame << " per frame"
+                  << " (" << Renderer::getCullingModeName(renderer->getCullingMode()) << " culling)" << std::endl;
+        // Only GPU culling runs on the compute queue.
+        std::cout << "Async compute: " << (renderer->getAsyncCompute() ? "on" : "off");
+        if (!renderer->isAsyncComputeSupported()) {
+            std::cout << " (no second queue)";
+        } else if (renderer->getAsyncCompute() && options.culling != CULLING_GPU) {
+            std::cout << " (unused without gpu culling)";
+        }
+        std::cout << std::endl;
+        std::cout << "Streamed instances: " << (double)samples.uploadedInstances / options.frames << " per frame" << std::endl;
+        std::cout << "Per-frame bindings: " << (double)samples.descriptorSets / options.frames << " descriptor sets, "
+                  << (double)samples.uniformBytes / options.frames << " uniform bytes, "
+                  << renderer->getDescriptorPoolCount() << " descriptor pools" << std::endl;
+        RenderGraph::Stats graph = renderer->getRenderGraph().getStats();
+        renderer->getRenderGraph().printStats();
+        ShaderCache::Stats shaders = renderer->getShaderCache().getStats();
+        renderer->getShaderCache().printStats();
+        std::cout << "Barriers: " << (double)samples.barrierCalls / options.frames << " pipeline barriers per frame" << std::endl;
+        Streamer::Stats streaming = renderer->getStreamer().getStats();
+        if (!options.streamMeshPath.empty()) {
+            if (software) {
+                std::cout << "Streamed mesh: " << renderer->getMeshPath() << " loaded synchronously by the software backend" << std::endl;
+            } else if (streaming.failed > 0) {
+                std::cout << "Streamed mesh: failed to load " << options.streamMeshPath << std::endl;
+            } else if (samples.meshResidentFrame >= 0) {
+                std::cout << "Streamed mesh: " << renderer->getMeshPath() << " in use from frame " << samples.meshResidentFrame
+                          << " (" << samples.meshResidentMs << " ms), " << streaming.uploadedBytes << " bytes in "
+                          << streaming.batches << " batches" << std::endl;
+            } else {
+                std::cout << "Streamed mesh: not resident by the end of the run" << std::endl;
+            }
+        }
+        if (gpuTimes.empty()) {
+            std::cout << "GPU frame time: unavailable" << std::endl;
+        } else {
+            print("GPU frame time:", gpu);
+
+            for (const Profiler::RegionTiming& region: renderer->getProfiler().getLastGpuRegions()) {
+                std::cout << "  " << std::string(region.depth * 2, ' ') << region.name
+                          << ": " << region.duration << " ms" << std::endl;
+            }
+        }
+
+        if (recording) {
+            std::cout << "Recorded: " << options.frames << " frames to " << options.recordPath << std::endl;
+        }
+
+        std::string captureJson = "null";
+        if (capturing) {
+            std::ostringstream out;
+            out << "{\"format\": \"" << (options.capture.format == FrameCapture::FORMAT_RAW ? "raw" : "png")
+                << "\", \"interval\": " << options.capture.interval
+                << ", \"captured\": " << capture.captured
+                << ", \"dropped\": " << capture.dropped
+                << ", \"written\": " << capture.written
+                << ", \"failed\": " << capture.failed
+                << ", \"bytes_written\": " << capture.bytesWritten
+                << ", \"render_thread_ms_per_frame\": " << capture.renderThreadTime / options.frames
+                << ", \"encode_ms_per_written_frame\": " << (capture.written > 0 ? capture.encodeTime / capture.written : 0.0)
+                << "}";
+            captureJson = out.str();
+
+            std::cout << "Capture: " << capture.captured << " of " << capture.frames << " frames to "
+                      << options.capture.path << (options.capture.format == FrameCapture::FORMAT_RAW ? " (raw)" : " (png)")
+                      << ", " << capture.dropped << " dropped, " << capture.failed << " failed, "
+                      << capture.bytesWritten << " bytes written through " << capture.buffers << " buffers" << std::endl;
+            std::cout << "Capture overhead: " << capture.renderThreadTime / options.frames
+                      << " ms per frame on the render thread, "
+                      << (capture.written > 0 ? capture.encodeTime / capture.written : 0.0)
+                      << " ms per written frame on " << options.capture.threads << " workers" << std::endl;
+        }
+
+        std::string startupJson;
+        {
+            std::ostringstream out;
+            out << "{\"ms\": " << startup.getTotalTime()
+                << ", \"work_ms\": " << startup.getWorkTime()
+                << ", \"threads\": " << startup.getThreadCount()
+                << ", \"first_frame_ms\": " << renderer->getTimeToFirstFrame()
+                << ", \"critical_path\": [";
+            for (size_t i = 0; i < criticalPath.size(); ++i) {
+                out << (i == 0 ? "" : ", ") << "\"" << startup.getTimings()[criticalPath[i]].name << "\"";
+            }
+            out << "], \"tasks\": [";
+            for (size_t i = 0; i < startup.getTimings().size(); ++i) {
+                const InitGraph::Timing& timing = startup.getTimings()[i];
+                out << (i == 0 ? "" : ", ") << "{\"name\": \"" << timing.name
+                    << "\", \"thread\": " << timing.thread
+                    << ", \"begin_ms\": " << timing.begin
+                    << ", \"ms\": " << timing.end - timing.begin << "}";
+            }
+            out << "]}";
+            startupJson = out.str();
+        }
+
+        std::string softwareJson = "null";
+        if (software) {
+            std::ostringstream out;
+            out << "{\"triangles\": " << raster.triangles
+                << ", \"culled\": " << raster.culled
+                << ", \"clipped\": " << raster.clipped
+                << ", \"tile_bins\": " << raster.binned
+                << ", \"passes\": " << raster.passes
+                << ", \"setup_ms\": " << raster.setupTime
+                << ", \"raster_ms\": " << raster.rasterTime
+                << ", \"tile_size\": " << SoftwareRasterizer::TILE_SIZE
+                << ", \"simd\": \"" << Math::getSimdLevelName(Math::getSimdLevel()) << "\"}";
+            softwareJson = out.str();
+        }
+
+        TextureCache::Stats textures = renderer->getTextureCache().getStats();
+        if (!options.texturePaths.empty()) {
+            renderer->getTextureCache().printStats();
+        }
+
+        Allocator::Stats memory = renderer->getAllocator().getStats();
+        renderer->getAllocator().printStats();
+
+        if (!options.jsonPath.empty()) {
+            std::ofstream json(options.jsonPath);
+            json << "{" << std::endl
+                 << "  \"frames\": " << options.frames << "," << std::endl
+                 << "  \"warmup_frames\": " << options.warmupFrames << "," << std::endl
+                 << "  \"width\": " << options.width << "," << std::endl
+                 << "  \"height\": " << options.height << "," << std::endl
+                 << "  \"frames_in_flight\": " << options.framesInFlight << "," << std::endl
+                 << "  \"instances\": " << renderer->getInstanceCount() << "," << std::endl
+                 << "  \"animated_instances\": " << options.animated << "," << std::endl
+                 << "  \"mesh\": \"" << renderer->getMeshPath() << "\"," << std::endl
+                 << "  \"mesh_vertices\": " << renderer->getMeshVertexCount() << "," << std::endl
+                 << "  \"mesh_triangles\": " << renderer->getMeshIndexCount() / 3 << "," << std::endl
+                 << "  \"mesh_vertex_format\": \"" << MeshFile::getVertexFormatName(renderer->getMeshVertexFormat()) << "\"," << std::endl
+                 << "  \"culling\": \"" << Renderer::getCullingModeName(options.culling) << "\"," << std::endl
+                 << "  \"shading\": \"" << Renderer::getShadingModeName(options.shading) << "\"," << std::endl
+                 << "  \"async_compute\": " << (renderer->getAsyncCompute() ? "true" : "false") << "," << std::endl
+                 << "  \"zoom\": " << options.zoom << "," << std::endl
+                 << "  \"visible_instances_per_frame\": " << visiblePerFrame << "," << std::endl
+                 << "  \"draws\": " << renderer->getDrawCount() << "," << std::endl
+                 << "  \"record_threads\": " << renderer->getRecordThreadCount() << "," << std::endl
+                 << "  \"headless\": " << (options.windowed ? "false" : "true") << "," << std::endl
+                 << "  \"backend\": \"" << Renderer::getBackendName(renderer->getBackend()) << "\"," << std::endl
+                 << "  \"seconds\": " << seconds << "," << std::endl
+                 << "  \"fps\": " << fps << "," << std::endl
+                 << "  \"cpu_frame_ms\": " << toJson(cpu) << "," << std::endl
+                 << "  \"gpu_frame_ms\": " << (gpuTimes.empty() ? "null" : toJson(gpu)) << "," << std::endl
+                 << "  \"cull_ms\": " << toJson(cullTime) << "," << std::endl
+                 << "  \"record_ms\": " << toJson(record) << "," << std::endl
+                 << "  \"uploaded_instances_per_frame\": " << (double)samples.uploadedInstances / options.frames << "," << std::endl
+                 << "  \"descriptor_sets_per_frame\": " << (double)samples.descriptorSets / options.frames << "," << std::endl
+                 << "  \"uniform_bytes_per_frame\": " << (double)samples.uniformBytes / options.frames << "," << std::endl
+                 << "  \"descriptor_pools\": " << renderer->getDescriptorPoolCount() << "," << std::endl
+                 << "  \"present\": {\"mode\": \"" << (options.windowed ? Renderer::getPresentModeName(renderer->getPresentMode()) : "headless")
+                 << "\", \"swapchain_images\": " << renderer->getSwapchainImageCount()
+                 << ", \"target_fps\": " << options.present.targetFps
+                 << ", \"input_to_submit_ms\": " << toJson(inputToSubmit)
+                 << ", \"input_to_present_ms\": " << toJson(inputToPresent) << "}," << std::endl
+                 << "  \"shaders\": {\"modules\": " << shaders.modules
+                 << ", \"variants\": " << shaders.variants
+                 << ", \"prewarmed\": " << shaders.prewarmed
+                 << ", \"prewarm_ms\": " << shaders.prewarmTime
+                 << ", \"created_on_first_use\": " << shaders.lazy
+                 << ", \"first_use_ms\": " << shaders.lazyTime << "}," << std::endl
+                 << "  \"render_graph\": {\"passes\": " << graph.passes
+                 << ", \"culled_passes\": " << graph.culledPasses
+                 << ", \"barrier_calls_per_frame\": " << (double)samples.barrierCalls / options.frames
+                 << ", \"transient_bytes\": " << graph.transientBytes
+                 << ", \"allocated_bytes\": " << graph.allocatedBytes << "}," << std::endl
+                 << "  \"record_scaling\": " << scaling << "," << std::endl
+                 << "  \"culling_comparison\": " << cullingComparison << "," << std::endl
+                 << "  \"streaming\": {\"resident_frame\": " << samples.meshResidentFrame
+                 << ", \"resident_ms\": " << samples.meshResidentMs
+                 << ", \"uploaded_bytes\": " << streaming.uploadedBytes
+                 << ", \"batches\": " << streaming.batches
+                 << ", \"failed\": " << streaming.failed
+                 << ", \"ring_high_water_bytes\": " << streaming.ringHighWater << "}," << std::endl
+                 << "  \"textures\": {\"resident\": " << textures.textures
+                 << ", \"bytes\": " << textures.bytes
+                 << ", \"budget_bytes\": " << textures.budget
+                 << ", \"generated_levels\": " << textures.generatedLevels
+                 << ", \"uploaded_bytes\": " << textures.uploadedBytes
+                 << ", \"refused\": " << textures.refused << "}," << std::endl
+                 << "  \"capture\": " << captureJson << "," << std::endl
+                 << "  \"software\": " << softwareJson << "," << std::endl
+                 << "  \"startup\": " << startupJson << "," << std::endl
+                 << "  \"memory\": {\"reserved_bytes\": " << memory.reservedBytes
+                 << ", \"used_bytes\": " << memory.usedBytes
+                 << ", \"device_allocations\": " << memory.deviceAllocationCount
+                 << ", \"live_allocations\": " << memory.allocationCount
+                 << ", \"fragmentation\": " << memory.fragmentation << "}" << std::endl
+                 << "}" << std::endl;
+
+            if (!json) {
+                std::cout << "Failed to write " << options.jsonPath << std::endl;
+            }
+        }
+
+        if (!options.tracePath.empty()) {
+            renderer->getProfiler().writeChromeTrace(options.tracePath);
+        }
+
+        delete(renderer);
+        if (window != NULL) {
+            glfwDestroyWindow(window);
+            glfwTerminate();
+        }
+
+        return 0;
+    }
+};
+
+int main(int argc, char** argv) {
+    Bench::Options options;
+    if (!Bench::parseOptions(argc, argv, options)) return 1;
+
+    return Bench::run(options);
+}
@@ -0,0 +1,164 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <vector>
+
+#include "Culling.hpp"
+#include "Math.hpp"
+#include "ThreadPool.hpp"
+
+// Frustum culling benchmark: a field of random boxes is culled by brute
+// force (boxes and bounding spheres) and through the BVH, at every SIMD
+// level the CPU supports and with 1 up to --threads threads.
+namespace CullBench {
+    struct Options {
+        size_t count = 1 << 20;
+        uint32_t iterations = 10;
+        uint32_t threads = 0;
+    };
+
+    bool parseOptions(int argc, char** argv, Options& options) {
+        for (int i = 1; i < argc; ++i) {
+            bool hasValue = i + 1 < argc;
+            if (strcmp(argv[i], "--count") == 0 && hasValue) {
+                options.count = (size_t)atol(argv[++i]);
+            } else if (strcmp(argv[i], "--iterations") == 0 && hasValue) {
+                options.iterations = (uint32_t)atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--threads") == 0 && hasValue) {
+                options.threads = (uint32_t)atoi(argv[++i]);
+            } else {
+                std::cout << "Usage: cullbench [--count N] [--iterations N] [--threads N]" << std::endl;
+                return false;
+            }
+        }
+
+        if (options.count == 0) options.count = 1;
+        if (options.iterations == 0) options.iterations = 1;
+        if (options.threads == 0) options.threads = ThreadPool::getDefaultThreadCount();
+        return true;
+    }
+
+    typedef std::chrono::steady_clock Clock;
+
+    double elapsedMs(Clock::time_point begin) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+    }
+
+    // Best of all iterations, in milliseconds.
+    double measure(const Options& options, const std::function<void()>& kernel) {
+        double best = 1e30;
+        for (uint32_t i = 0; i < options.iterations; ++i) {
+            Clock::time_point begin = Clock::now();
+            kernel();
+            best = std::min(best, elapsedMs(begin));
+        }
+        return best;
+    }
+
+    float random(float min, float max) {
+        return min + (max - min) * (float)rand() / (float)RAND_MAX;
+    }
+
+    // Objects found by one list but not the other.
+    size_t countMismatches(std::vector<uint32_t> a, std::vector<uint32_t> b) {
+        std::sort(a.begin(), a.end());
+        std::sort(b.begin(), b.end());
+        std::vector<uint32_t> difference;
+        std::set_symmetric_difference(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(difference));
+        return difference.size();
+    }
+
+    int run(const Options& options) {
+        size_t count = options.count;
+        srand(1);
+
+        Culling::BoundsArrays boxes;
+        Culling::SphereArrays spheres;
+        boxes.resize(count);
+        spheres.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            Math::Vec3 center(random(-500.0f, 500.0f), random(-500.0f, 500.0f), random(-500.0f, 500.0f));
+            Math::Vec3 extent(random(0.25f, 2.0f), random(0.25f, 2.0f), random(0.25f, 2.0f));
+            boxes.set(i, center - extent, center + extent);
+            spheres.set(i, center, Math::length(extent));
+        }
+
+        Math::Mat4 viewProjection = Math::perspective(1.0f, 16.0f / 9.0f, 0.1f, 400.0f) *
+            Math::lookAt(Math::Vec3(0.0f, 0.0f, 0.0f), Math::Vec3(1.0f, 0.2f, 0.5f), Math::Vec3(0.0f, 1.0f, 0.0f));
+        Culling::Frustum frustum = Culling::Frustum::fromMatrix(viewProjection);
+
+        std::cout << "Frustum culling, " << count << " objects, best of " << options.iterations << " runs" << std::endl;
+
+        Culling::Bvh bvh;
+        Clock::time_point begin = Clock::now();
+        bvh.build(boxes);
+        std::cout << "BVH build: " << elapsedMs(begin) << " ms, " << bvh.getNodeCount() << " nodes" << std::endl;
+        std::cout << "BVH refit: " << measure(options, [&] { bvh.refit(boxes); }) << " ms" << std::endl;
+
+        // Move one object in a hundred, as an animated scene would.
+        std::vector<uint32_t> changed;
+        for (size_t i = 0; i < count; i += 100) {
+            Math::Vec3 offset(random(-2.0f, 2.0f), random(-2.0f, 2.0f), random(-2.0f, 2.0f));
+            Math::Vec3 min(boxes.minX[i], boxes.minY[i], boxes.minZ[i]);
+            Math::Vec3 max(boxes.maxX[i], boxes.maxY[i], boxes.maxZ[i]);
+            boxes.set(i, min + offset, max + offset);
+            spheres.set(i, Math::Vec3(spheres.centerX[i], spheres.centerY[i], spheres.centerZ[i]) + offset, spheres.radius[i]);
+            changed.push_back((uint32_t)i);
+        }
+        std::cout << "BVH refit, " << changed.size() << " changed: "
+                  << measure(options, [&] { bvh.refit(boxes, changed); }) << " ms" << std::endl;
+
+        std::vector<uint32_t> visibleBoxes(count), visibleSpheres(count), visible;
+        size_t boxCount = 0;
+        size_t sphereCount = 0;
+
+        ThreadPool pool;
+        if (!pool.init(options.threads)) return 1;
+
+        Math::SimdLevel supported = Math::getSupportedSimdLevel();
+        for (int level = Math::SIMD_SCALAR; level <= supported; ++level) {
+            Math::setSimdLevel((Math::SimdLevel)level);
+            std::cout << Math::getSimdLevelName((Math::SimdLevel)level) << ":" << std::endl;
+
+            double boxTime = measure(options, [&] {
+                boxCount = Culling::cullBoxes(frustum, boxes, 0, count, NULL, visibleBoxes.data());
+            });
+            double sphereTime = measure(options, [&] {
+                sphereCount = Culling::cullSpheres(frustum, spheres, 0, count, NULL, visibleSpheres.data());
+            });
+            std::cout << "  brute force boxes: " << boxTime << " ms, " << boxCount << " visible" << std::endl;
+            std::cout << "  brute force spheres: " << sphereTime << " ms, " << sphereCount << " visible" << std::endl;
+            visibleBoxes.resize(boxCount);
+
+            double serialTime = measure(options, [&] { bvh.cull(frustum, NULL, visible); });
+            std::cout << "  bvh, 1 thread: " << serialTime << " ms, " << visible.size() << " visible, "
+                      << countMismatches(visible, visibleBoxes) << " mismatches" << std::endl;
+
+            for (uint32_t threads = 2; threads <= options.threads; threads *= 2) {
+                pool.destroy();
+                if (!pool.init(threads)) return 1;
+
+                double time = measure(options, [&] { bvh.cull(frustum, &pool, visible); });
+                std::cout << "  bvh, " << threads << " threads: " << time << " ms, speed-up "
+                          << serialTime / time << "x, " << countMismatches(visible, visibleBoxes)
+                          << " mismatches" << std::endl;
+            }
+            visibleBoxes.resize(count);
+        }
+
+        pool.destroy();
+        Math::setSimdLevel(supported);
+        return 0;
+    }
+};
+
+int main(int argc, char** argv) {
+    CullBench::Options options;
+    if (!CullBench::parseOptions(argc, argv, options)) return 1;
+
+    return CullBench::run(options);
+}
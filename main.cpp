@@ -1,4 +1,7 @@
 #include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <string>
 
 #include <vulkan/vulkan.h>
 #include <GLFW/glfw3.h>
@@ -6,36 +9,136 @@
 #include "Renderer.hpp"
 
 namespace App {
-    GLFWwindow* window;
+    GLFWwindow* window = NULL;
     
     Renderer* renderer;
     
-    void init(int width, int height) {
+    bool headless = false;
+    uint32_t headlessFrames = 600;
+    
+    std::string tracePath = "";
+    std::string recordPath = "";
+    uint32_t recordThreads = 0;
+    uint32_t instances = 0;
+    CullingMode culling = CULLING_CPU;
+    RenderBackend backend = BACKEND_AUTO;
+    PresentPolicy present;
+    std::string meshPath = "";
+    std::string streamMeshPath = "";
+    
+    void init(int width, int height, uint32_t framesInFlight) {
+        if (headless) {
+            renderer = new Renderer((uint32_t)width, (uint32_t)height, framesInFlight, backend);
+            return;
+        }
+        
         if (!glfwInit()) exit(1);
         
         glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
         window = glfwCreateWindow(width, height, "test1", NULL, NULL);
         
-        renderer = new Renderer(window);
+        renderer = new Renderer(window, framesInFlight, backend);
     }
 
     void destroy() {
+        renderer->stopRecording();
+        if (!tracePath.empty()) {
+            renderer->getProfiler().writeChromeTrace(tracePath);
+        }
+        renderer->getFramePacer().printStats();
+        
         delete(renderer);
-        glfwDestroyWindow(window);
-        glfwTerminate();
+        
+        if (window != NULL) {
+            glfwDestroyWindow(window);
+            glfwTerminate();
+        }
     }
 
     void start() {
+        if (!meshPath.empty()) {
+            renderer->loadMesh(meshPath);
+        }
+        if (!streamMeshPath.empty()) {
+            renderer->loadMeshAsync(streamMeshPath);
+        }
+        if (recordThreads > 0) {
+            renderer->setRecordThreadCount(recordThreads);
+        }
+        if (instances > 0) {
+            renderer->setInstanceCount(instances);
+        }
+        renderer->setCullingMode(culling);
+        renderer->setPresentPolicy(present);
+        renderer->getProfiler().setTracing(!tracePath.empty());
+        if (!recordPath.empty()) {
+            renderer->startRecording(recordPath);
+        }
+        
+        if (headless) {
+            for (uint32_t i = 0; i < headlessFrames; ++i) {
+                renderer->pollEvents();
+                renderer->update();
+                renderer->cull();
+                renderer->draw();
+            }
+            return;
+        }
+        
         while (!glfwWindowShouldClose(window)) {
+            renderer->pollEvents();
             renderer->update();
+            renderer->cull();
             renderer->draw();
-            renderer->waitReady();
         }
     }
 };
 
-int main() {
-    App::init(640, 480);
+int main(int argc, char** argv) {
+    uint32_t framesInFlight = 2;
+    
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc) {
+            framesInFlight = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            App::headless = true;
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            App::headlessFrames = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            App::tracePath = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            App::recordPath = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            App::recordThreads = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc) {
+            App::instances = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--mesh") == 0 && i + 1 < argc) {
+            App::meshPath = argv[++i];
+        } else if (strcmp(argv[i], "--stream-mesh") == 0 && i + 1 < argc) {
+            App::streamMeshPath = argv[++i];
+        } else if (strcmp(argv[i], "--present-mode") == 0 && i + 1 < argc) {
+            if (!Renderer::parsePresentMode(argv[++i], App::present.mode)) {
+                std::cout << "Unknown present mode " << argv[i] << ", expected immediate, mailbox, fifo or fifo_relaxed" << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--swapchain-images") == 0 && i + 1 < argc) {
+            App::present.imageCount = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            App::present.targetFps = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--culling") == 0 && i + 1 < argc) {
+            if (!Renderer::parseCullingMode(argv[++i], App::culling)) {
+                std::cout << "Unknown culling mode " << argv[i] << ", expected none, cpu or gpu" << std::endl;
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc) {
+            if (!Renderer::parseBackend(argv[++i], App::backend)) {
+                std::cout << "Unknown backend " << argv[i] << ", expected auto, vulkan or software" << std::endl;
+                return 1;
+            }
+        }
+    }
+    
+    App::init(640, 480, framesInFlight);
     App::start();
     App::destroy();
 }
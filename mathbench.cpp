@@ -0,0 +1,142 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include "Math.hpp"
+
+// Micro-benchmarks for the batch math kernels: every SIMD level the CPU
+// supports is timed on the same data and checked against the scalar result.
+namespace MathBench {
+    struct Options {
+        size_t count = 1 << 20;
+        uint32_t iterations = 20;
+    };
+
+    bool parseOptions(int argc, char** argv, Options& options) {
+        for (int i = 1; i < argc; ++i) {
+            bool hasValue = i + 1 < argc;
+            if (strcmp(argv[i], "--count") == 0 && hasValue) {
+                options.count = (size_t)atol(argv[++i]);
+            } else if (strcmp(argv[i], "--iterations") == 0 && hasValue) {
+                options.iterations = (uint32_t)atoi(argv[++i]);
+            } else {
+                std::cout << "Usage: mathbench [--count N] [--iterations N]" << std::endl;
+                return false;
+            }
+        }
+
+        if (options.count == 0) options.count = 1;
+        if (options.iterations == 0) options.iterations = 1;
+        return true;
+    }
+
+    // Best of all iterations, in nanoseconds per element.
+    double measure(const Options& options, const std::function<void()>& kernel) {
+        typedef std::chrono::steady_clock Clock;
+
+        double best = 1e30;
+        for (uint32_t i = 0; i < options.iterations; ++i) {
+            Clock::time_point begin = Clock::now();
+            kernel();
+            double ns = std::chrono::duration<double, std::nano>(Clock::now() - begin).count();
+            best = std::min(best, ns);
+        }
+        return best / (double)options.count;
+    }
+
+    double maxDifference(const std::vector<float>& a, const std::vector<float>& b) {
+        double result = 0.0;
+        for (size_t i = 0; i < a.size(); ++i) {
+            result = std::max(result, (double)std::fabs(a[i] - b[i]));
+        }
+        return result;
+    }
+
+    float random(float min, float max) {
+        return min + (max - min) * (float)rand() / (float)RAND_MAX;
+    }
+
+    int run(const Options& options) {
+        size_t count = options.count;
+        srand(1);
+
+        std::vector<float> pointsX(count), pointsY(count), pointsZ(count);
+        Math::TransformArrays transforms;
+        transforms.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            pointsX[i] = random(-10.0f, 10.0f);
+            pointsY[i] = random(-10.0f, 10.0f);
+            pointsZ[i] = random(-10.0f, 10.0f);
+
+            Math::Vec3 axis(random(-1.0f, 1.0f), random(-1.0f, 1.0f), random(-1.0f, 1.0f) + 2.0f);
+            transforms.set(i, Math::Vec3(pointsX[i], pointsY[i], pointsZ[i]),
+                Math::fromAxisAngle(axis, random(0.0f, 6.28f)), random(0.5f, 2.0f));
+        }
+
+        Math::Mat4 viewProjection = Math::perspective(1.0f, 16.0f / 9.0f, 0.1f, 100.0f) *
+            Math::lookAt(Math::Vec3(0.0f, 5.0f, 20.0f), Math::Vec3(), Math::Vec3(0.0f, 1.0f, 0.0f));
+
+        std::vector<float> outX(count), outY(count), outZ(count);
+        std::vector<float> matrices(count * 16), products(count * 16);
+
+        std::vector<float> referencePoints, referenceMatrices, referenceProducts;
+        double baseline[3] = {};
+
+        std::cout << "Batch math, " << count << " elements, best of " << options.iterations << " runs" << std::endl;
+
+        Math::SimdLevel supported = Math::getSupportedSimdLevel();
+        for (int level = Math::SIMD_SCALAR; level <= supported; ++level) {
+            Math::setSimdLevel((Math::SimdLevel)level);
+
+            double times[3];
+            times[0] = measure(options, [&] {
+                Math::transformPoints(viewProjection, pointsX.data(), pointsY.data(), pointsZ.data(),
+                    outX.data(), outY.data(), outZ.data(), count);
+            });
+            times[1] = measure(options, [&] {
+                Math::composeTransforms(transforms, 0, count, matrices.data(), 16);
+            });
+            times[2] = measure(options, [&] {
+                Math::multiplyMatrices(viewProjection, matrices.data(), 16, products.data(), 16, count);
+            });
+
+            std::vector<float> points(outX);
+            points.insert(points.end(), outY.begin(), outY.end());
+            points.insert(points.end(), outZ.begin(), outZ.end());
+
+            double errors[3] = {};
+            if (level == Math::SIMD_SCALAR) {
+                referencePoints = points;
+                referenceMatrices = matrices;
+                referenceProducts = products;
+                for (int i = 0; i < 3; ++i) baseline[i] = times[i];
+            } else {
+                errors[0] = maxDifference(points, referencePoints);
+                errors[1] = maxDifference(matrices, referenceMatrices);
+                errors[2] = maxDifference(products, referenceProducts);
+            }
+
+            const char* names[3] = { "transformPoints", "composeTransforms", "multiplyMatrices" };
+            std::cout << Math::getSimdLevelName((Math::SimdLevel)level) << ":" << std::endl;
+            for (int i = 0; i < 3; ++i) {
+                std::cout << "  " << names[i] << ": " << times[i] << " ns/element, speed-up "
+                          << baseline[i] / times[i] << "x, max error " << errors[i] << std::endl;
+            }
+        }
+
+        Math::setSimdLevel(supported);
+        return 0;
+    }
+};
+
+int main(int argc, char** argv) {
+    MathBench::Options options;
+    if (!MathBench::parseOptions(argc, argv, options)) return 1;
+
+    return MathBench::run(options);
+}
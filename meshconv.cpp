@@ -0,0 +1,567 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "MeshFile.hpp"
+#include "MeshOptimizer.hpp"
+
+// Offline converter from OBJ and glTF 2.0 (.gltf or .glb) to the MeshFile
+// format. Only positions and triangle indices are kept; glTF node transforms
+// are not applied, every primitive is taken in mesh space. The mesh is welded
+// and reordered for the vertex cache and fetch unless --no-optimize is given,
+// --half stores half float positions. With --bench the source is parsed and
+// the converted file mapped repeatedly to compare load times.
+namespace MeshConv {
+    typedef MeshOptimizer::Mesh Mesh;
+
+    bool readFile(const std::string& path, std::string& data) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file) {
+            std::cout << "Failed to open " << path << std::endl;
+            return false;
+        }
+        std::ostringstream contents;
+        contents << file.rdbuf();
+        data = contents.str();
+        return true;
+    }
+
+    bool endsWith(const std::string& s, const char* suffix) {
+        size_t length = strlen(suffix);
+        return s.size() >= length && s.compare(s.size() - length, length, suffix) == 0;
+    }
+
+    // OBJ: "v x y z" and "f a b c ...", polygons are split into fans and
+    // negative indices count back from the last vertex. Texture coordinate
+    // and normal indices are skipped.
+    bool loadObj(const std::string& path, Mesh& mesh) {
+        std::string data;
+        if (!readFile(path, data)) return false;
+
+        const char* p = data.c_str();
+        const char* end = p + data.size();
+        std::vector<uint32_t> face;
+
+        while (p < end) {
+            while (p < end && (*p == ' ' || *p == '\t')) p++;
+
+            if (p + 1 < end && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+                char* next;
+                p += 2;
+                for (int c = 0; c < 3; ++c) {
+                    mesh.positions.push_back(strtof(p, &next));
+                    p = next;
+                }
+            } else if (p + 1 < end && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+                p += 2;
+                face.clear();
+                while (p < end && *p != '\n' && *p != '\r') {
+                    while (p < end && (*p == ' ' || *p == '\t')) p++;
+                    if (p >= end || *p == '\n' || *p == '\r') break;
+
+                    char* next;
+                    long index = strtol(p, &next, 10);
+                    if (next == p) {
+                        std::cout << path << ": malformed face" << std::endl;
+                        return false;
+                    }
+                    p = next;
+                    while (p < end && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') p++;
+
+                    long vertexCount = (long)(mesh.positions.size() / 3);
+                    index = index < 0 ? vertexCount + index : index - 1;
+                    if (index < 0 || index >= vertexCount) {
+                        std::cout << path << ": face index out of range" << std::endl;
+                        return false;
+                    }
+                    face.push_back((uint32_t)index);
+                }
+
+                for (size_t i = 2; i < face.size(); ++i) {
+                    mesh.indices.push_back(face[0]);
+                    mesh.indices.push_back(face[i - 1]);
+                    mesh.indices.push_back(face[i]);
+                }
+            }
+
+            while (p < end && *p != '\n') p++;
+            p++;
+        }
+
+        return true;
+    }
+
+    // Just enough JSON for glTF: numbers are kept as doubles, objects as
+    // key/value lists.
+    struct Json {
+        enum Type { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT };
+
+        Type type = NUL;
+        double number = 0.0;
+        std::string string = "";
+        std::vector<Json> items = {};
+        std::vector<std::string> keys = {};
+
+        const Json* get(const char* key) const {
+            for (size_t i = 0; i < keys.size(); ++i) {
+                if (keys[i] == key) return &items[i];
+            }
+            return NULL;
+        }
+        const Json* at(size_t index) const {
+            return type == ARRAY && index < items.size() ? &items[index] : NULL;
+        }
+        double getNumber(const char* key, double fallback) const {
+            const Json* value = get(key);
+            return value != NULL && value->type == NUMBER ? value->number : fallback;
+        }
+        // Indices, counts and byte offsets: fallback if the key is missing,
+        // SIZE_MAX if it is not a non-negative integer. Casting a negative
+        // or huge double to size_t is undefined.
+        size_t getIndex(const char* key, size_t fallback) const {
+            if (get(key) == NULL) return fallback;
+            double value = getNumber(key, -1.0);
+            if (!(value >= 0.0 && value < 9007199254740992.0) || value != std::floor(value)) return SIZE_MAX;
+            return (size_t)value;
+        }
+    };
+
+    struct JsonParser {
+        const char* p;
+        const char* end;
+
+        void skipSpace() {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+        }
+
+        bool parseString(std::string& out) {
+            if (p >= end || *p != '"') return false;
+            p++;
+            while (p < end && *p != '"') {
+                if (*p == '\\' && p + 1 < end) {
+                    p++;
+                    switch (*p) {
+                        case 'n': out += '\n'; break;
+                        case 't': out += '\t'; break;
+                        case 'r': out += '\r'; break;
+                        case 'b': out += '\b'; break;
+                        case 'f': out += '\f'; break;
+                        case 'u': out += '?'; p += std::min<ptrdiff_t>(4, end - p - 1); break;
+                        default: out += *p; break;
+                    }
+                } else {
+                    out += *p;
+                }
+                p++;
+            }
+            if (p >= end) return false;
+            p++;
+            return true;
+        }
+
+        bool parse(Json& value) {
+            skipSpace();
+            if (p >= end) return false;
+
+            if (*p == '{') {
+                value.type = Json::OBJECT;
+                p++;
+                skipSpace();
+                if (p < end && *p == '}') {
+                    p++;
+                    return true;
+                }
+                while (p < end) {
+                    skipSpace();
+                    std::string key;
+                    if (!parseString(key)) return false;
+                    skipSpace();
+                    if (p >= end || *p != ':') return false;
+                    p++;
+                    value.keys.push_back(key);
+                    value.items.push_back(Json());
+                    if (!parse(value.items.back())) return false;
+                    skipSpace();
+                    if (p < end && *p == ',') {
+                        p++;
+                    } else if (p < end && *p == '}') {
+                        p++;
+                        return true;
+                    } else {
+                        return false;
+                    }
+                }
+                return false;
+            }
+
+            if (*p == '[') {
+                value.type = Json::ARRAY;
+                p++;
+                skipSpace();
+                if (p < end && *p == ']') {
+                    p++;
+                    return true;
+                }
+                while (p < end) {
+                    value.items.push_back(Json());
+                    if (!parse(value.items.back())) return false;
+                    skipSpace();
+                    if (p < end && *p == ',') {
+                        p++;
+                    } else if (p < end && *p == ']') {
+                        p++;
+                        return true;
+                    } else {
+                        return false;
+                    }
+                }
+                return false;
+            }
+
+            if (*p == '"') {
+                value.type = Json::STRING;
+                return parseString(value.string);
+            }
+
+            if (end - p >= 4 && strncmp(p, "true", 4) == 0) {
+                value.type = Json::BOOLEAN;
+                value.number = 1.0;
+                p += 4;
+                return true;
+            }
+            if (end - p >= 5 && strncmp(p, "false", 5) == 0) {
+                value.type = Json::BOOLEAN;
+                p += 5;
+                return true;
+            }
+            if (end - p >= 4 && strncmp(p, "null", 4) == 0) {
+                p += 4;
+                return true;
+            }
+
+            char* next;
+            value.type = Json::NUMBER;
+            value.number = strtod(p, &next);
+            if (next == p) return false;
+            p = next;
+            return true;
+        }
+    };
+
+    bool decodeBase64(const std::string& text, std::vector<char>& out) {
+        static const std::string alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+        uint32_t bits = 0;
+        int bitCount = 0;
+        for (char c: text) {
+            if (c == '=') break;
+            size_t value = alphabet.find(c);
+            if (value == std::string::npos) return false;
+
+            bits = (bits << 6) | (uint32_t)value;
+            bitCount += 6;
+            if (bitCount >= 8) {
+                bitCount -= 8;
+                out.push_back((char)((bits >> bitCount) & 0xFF));
+            }
+        }
+        return true;
+    }
+
+    // Returns a pointer to the data of an accessor and its element stride.
+    const char* accessorData(const Json& root, const std::vector<std::vector<char>>& buffers,
+            const Json& accessor, size_t elementSize, size_t& stride, size_t& count) {
+        const Json* views = root.get("bufferViews");
+        const Json* view = views != NULL ? views->at(accessor.getIndex("bufferView", SIZE_MAX)) : NULL;
+        if (view == NULL) return NULL;
+
+        size_t bufferIndex = view->getIndex("buffer", 0);
+        if (bufferIndex >= buffers.size()) return NULL;
+        const std::vector<char>& buffer = buffers[bufferIndex];
+
+        size_t viewOffset = view->getIndex("byteOffset", 0);
+        size_t accessorOffset = accessor.getIndex("byteOffset", 0);
+        stride = view->getIndex("byteStride", elementSize);
+        count = accessor.getIndex("count", 0);
+        if (viewOffset > buffer.size() || accessorOffset > buffer.size() - viewOffset ||
+                stride == SIZE_MAX || count == SIZE_MAX) return NULL;
+
+        // Written so that nothing can wrap around.
+        size_t offset = viewOffset + accessorOffset;
+        size_t available = buffer.size() - offset;
+        if (count > 0 && (elementSize > available ||
+                (stride > 0 && count - 1 > (available - elementSize) / stride))) return NULL;
+        return buffer.data() + offset;
+    }
+
+    bool loadGltf(const std::string& path, Mesh& mesh) {
+        std::string data;
+        if (!readFile(path, data)) return false;
+
+        std::string directory = path.substr(0, path.find_last_of('/') + 1);
+        std::string jsonText;
+        std::vector<char> binaryChunk;
+
+        // .glb: 12 byte header, a JSON chunk and an optional BIN chunk.
+        if (data.size() >= 12 && memcmp(data.data(), "glTF", 4) == 0) {
+            size_t offset = 12;
+            while (offset + 8 <= data.size()) {
+                uint32_t chunkLength, chunkType;
+                memcpy(&chunkLength, data.data() + offset, 4);
+                memcpy(&chunkType, data.data() + offset + 4, 4);
+                offset += 8;
+                if (offset + chunkLength > data.size()) break;
+
+                if (chunkType == 0x4E4F534A) {
+                    jsonText.assign(data.data() + offset, chunkLength);
+                } else if (chunkType == 0x004E4942) {
+                    binaryChunk.assign(data.data() + offset, data.data() + offset + chunkLength);
+                }
+                offset += (chunkLength + 3) & ~3u;
+            }
+        } else {
+            jsonText = data;
+        }
+
+        Json root;
+        JsonParser parser { jsonText.c_str(), jsonText.c_str() + jsonText.size() };
+        if (!parser.parse(root) || root.type != Json::OBJECT) {
+            std::cout << path << ": malformed JSON" << std::endl;
+            return false;
+        }
+
+        std::vector<std::vector<char>> buffers;
+        const Json* bufferList = root.get("buffers");
+        for (size_t i = 0; bufferList != NULL && i < bufferList->items.size(); ++i) {
+            const Json* uri = bufferList->items[i].get("uri");
+            buffers.push_back(std::vector<char>());
+
+            if (uri == NULL) {
+                buffers.back() = binaryChunk;
+            } else if (uri->string.compare(0, 5, "data:") == 0) {
+                size_t comma = uri->string.find(',');
+                if (comma == std::string::npos || !decodeBase64(uri->string.substr(comma + 1), buffers.back())) {
+                    std::cout << path << ": bad data URI" << std::endl;
+                    return false;
+                }
+            } else {
+                std::string contents;
+                if (!readFile(directory + uri->string, contents)) return false;
+                buffers.back().assign(contents.begin(), contents.end());
+            }
+        }
+
+        const Json* accessors = root.get("accessors");
+        const Json* meshes = root.get("meshes");
+        if (accessors == NULL || meshes == NULL) {
+            std::cout << path << ": no meshes" << std::endl;
+            return false;
+        }
+
+        for (const Json& gltfMesh: meshes->items) {
+            const Json* primitives = gltfMesh.get("primitives");
+            for (size_t p = 0; primitives != NULL && p < primitives->items.size(); ++p) {
+                const Json& primitive = primitives->items[p];
+                if (primitive.getNumber("mode", 4) != 4) {
+                    std::cout << path << ": skipping a primitive that is not a triangle list" << std::endl;
+                    continue;
+                }
+
+                const Json* attributes = primitive.get("attributes");
+                const Json* position = attributes != NULL ? accessors->at(attributes->getIndex("POSITION", SIZE_MAX)) : NULL;
+                if (position == NULL || position->getNumber("componentType", 0) != 5126) {
+                    std::cout << path << ": primitive without float positions" << std::endl;
+                    return false;
+                }
+
+                size_t stride, count;
+                const char* positions = accessorData(root, buffers, *position, 3 * sizeof(float), stride, count);
+                if (positions == NULL) {
+                    std::cout << path << ": position accessor out of range" << std::endl;
+                    return false;
+                }
+
+                uint32_t baseVertex = (uint32_t)(mesh.positions.size() / 3);
+                for (size_t i = 0; i < count; ++i) {
+                    float xyz[3];
+                    memcpy(xyz, positions + i * stride, sizeof(xyz));
+                    mesh.positions.insert(mesh.positions.end(), xyz, xyz + 3);
+                }
+
+                const Json* indexAccessor = primitive.get("indices") != NULL ?
+                    accessors->at(primitive.getIndex("indices", SIZE_MAX)) : NULL;
+                if (indexAccessor == NULL) {
+                    for (size_t i = 0; i < count; ++i) {
+                        mesh.indices.push_back(baseVertex + (uint32_t)i);
+                    }
+                    continue;
+                }
+
+                int componentType = (int)indexAccessor->getNumber("componentType", 0);
+                size_t indexSize = componentType == 5121 ? 1 : componentType == 5123 ? 2 : componentType == 5125 ? 4 : 0;
+                size_t indexStride, indexCount;
+                const char* indices = indexSize > 0 ?
+                    accessorData(root, buffers, *indexAccessor, indexSize, indexStride, indexCount) : NULL;
+                if (indices == NULL) {
+                    std::cout << path << ": bad index accessor" << std::endl;
+                    return false;
+                }
+
+                for (size_t i = 0; i < indexCount; ++i) {
+                    uint32_t index = 0;
+                    memcpy(&index, indices + i * indexStride, indexSize);
+                    if (index >= count) {
+                        std::cout << path << ": index out of range" << std::endl;
+                        return false;
+                    }
+                    mesh.indices.push_back(baseVertex + index);
+                }
+            }
+        }
+
+        return true;
+    }
+
+    bool load(const std::string& path, Mesh& mesh) {
+        if (endsWith(path, ".obj")) return loadObj(path, mesh);
+        if (endsWith(path, ".gltf") || endsWith(path, ".glb")) return loadGltf(path, mesh);
+
+        std::cout << path << ": unknown format, expected .obj, .gltf or .glb" << std::endl;
+        return false;
+    }
+
+    typedef std::chrono::steady_clock Clock;
+
+    double elapsedMs(Clock::time_point begin) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+    }
+
+    // Parsing the source against mapping the converted file and copying
+    // its streams into a buffer that stands in for staging memory. Both
+    // read from the page cache after the first run.
+    void bench(const std::string& input, const std::string& output, uint32_t iterations) {
+        double parseBest = 1e30;
+        double mapBest = 1e30;
+        std::vector<char> staging;
+
+        for (uint32_t i = 0; i < iterations; ++i) {
+            Clock::time_point begin = Clock::now();
+            Mesh mesh;
+            load(input, mesh);
+            parseBest = std::min(parseBest, elapsedMs(begin));
+
+            begin = Clock::now();
+            MeshFile file;
+            if (!file.open(output)) return;
+            const MeshFile::Header& header = file.getHeader();
+            staging.resize(header.vertexBytes + header.indexBytes);
+            memcpy(staging.data(), file.getVertexData(), header.vertexBytes);
+            memcpy(staging.data() + header.vertexBytes, file.getIndexData(), header.indexBytes);
+            file.close();
+            mapBest = std::min(mapBest, elapsedMs(begin));
+        }
+
+        std::cout << "Load time, best of " << iterations << " runs:" << std::endl
+                  << "  parse " << input << ": " << parseBest << " ms" << std::endl
+                  << "  map " << output << " into staging: " << mapBest << " ms" << std::endl
+                  << "  speed-up: " << parseBest / mapBest << "x" << std::endl;
+    }
+
+    // Sizes and modelled cache behaviour of the mesh as loaded, fully
+    // expanded and after processing.
+    void report(const Mesh& source, const Mesh& output, uint32_t vertexFormat, double optimizeTime) {
+        size_t triangleCount = source.indices.size() / 3;
+        uint32_t stride = MeshFile::getVertexStride(vertexFormat);
+        size_t indexSize = output.getVertexCount() <= 65536 ? 2 : 4;
+
+        size_t expandedBytes = source.indices.size() * 3 * sizeof(float);
+        size_t sourceBytes = source.positions.size() * sizeof(float) + source.indices.size() * sizeof(uint32_t);
+        size_t outputBytes = output.getVertexCount() * stride + output.indices.size() * indexSize;
+
+        MeshOptimizer::CacheStats cacheBefore = MeshOptimizer::analyzeVertexCache(
+            source.indices.data(), source.indices.size(), source.getVertexCount());
+        MeshOptimizer::CacheStats cacheAfter = MeshOptimizer::analyzeVertexCache(
+            output.indices.data(), output.indices.size(), output.getVertexCount());
+        MeshOptimizer::FetchStats fetchBefore = MeshOptimizer::analyzeVertexFetch(
+            source.indices.data(), source.indices.size(), source.getVertexCount(), 3 * sizeof(float));
+        MeshOptimizer::FetchStats fetchAfter = MeshOptimizer::analyzeVertexFetch(
+            output.indices.data(), output.indices.size(), output.getVertexCount(), stride);
+
+        std::cout << "  vertices: " << triangleCount * 3 << " expanded, " << source.getVertexCount() << " loaded, "
+                  << output.getVertexCount() << " written" << std::endl
+                  << "  bytes: " << expandedBytes << " expanded, " << sourceBytes << " loaded, "
+                  << outputBytes << " written (" << (double)expandedBytes / (double)outputBytes << "x smaller than expanded)" << std::endl
+                  << "  vertex cache ACMR: " << cacheBefore.acmr << " -> " << cacheAfter.acmr
+                  << ", ATVR: " << cacheBefore.atvr << " -> " << cacheAfter.atvr << std::endl
+                  << "  vertex fetch overfetch: " << fetchBefore.overfetch << " -> " << fetchAfter.overfetch << std::endl
+                  << "  processed in " << optimizeTime << " ms" << std::endl;
+    }
+
+    int run(int argc, char** argv) {
+        uint32_t benchIterations = 0;
+        uint32_t vertexFormat = MeshFile::FORMAT_FLOAT3;
+        bool optimize = true;
+        std::vector<std::string> paths;
+
+        for (int i = 1; i < argc; ++i) {
+            if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+                benchIterations = (uint32_t)atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--half") == 0) {
+                vertexFormat = MeshFile::FORMAT_HALF4;
+            } else if (strcmp(argv[i], "--no-optimize") == 0) {
+                optimize = false;
+            } else {
+                paths.push_back(argv[i]);
+            }
+        }
+
+        if (paths.size() != 2) {
+            std::cout << "Usage: meshconv [--half] [--no-optimize] [--bench N] input.(obj|gltf|glb) output.mesh" << std::endl;
+            return 1;
+        }
+
+        Clock::time_point begin = Clock::now();
+        Mesh mesh;
+        if (!load(paths[0], mesh)) return 1;
+        double parseTime = elapsedMs(begin);
+
+        if (mesh.indices.size() % 3 != 0) {
+            std::cout << paths[0] << ": index count is not a multiple of 3" << std::endl;
+            return 1;
+        }
+
+        begin = Clock::now();
+        Mesh output = mesh;
+        if (optimize) {
+            MeshOptimizer::optimize(output);
+        }
+        double optimizeTime = elapsedMs(begin);
+
+        uint32_t vertexCount = (uint32_t)output.getVertexCount();
+        if (!MeshFile::write(paths[1], output.positions.data(), vertexCount, output.indices.data(),
+                (uint32_t)output.indices.size(), vertexFormat)) {
+            return 1;
+        }
+
+        std::cout << paths[0] << " -> " << paths[1] << ": " << vertexCount << " vertices, "
+                  << output.indices.size() / 3 << " triangles, parsed in " << parseTime << " ms" << std::endl;
+        report(mesh, output, vertexFormat, optimizeTime);
+
+        if (benchIterations > 0) {
+            bench(paths[0], paths[1], benchIterations);
+        }
+        return 0;
+    }
+};
+
+int main(int argc, char** argv) {
+    return MeshConv::run(argc, argv);
+}
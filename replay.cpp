@@ -0,0 +1,234 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+#include <GLFW/glfw3.h>
+
+#include "CommandStream.hpp"
+#include "Percentiles.hpp"
+#include "Renderer.hpp"
+
+// Replays a command stream recorded with --record on a headless renderer,
+// as fast as the renderer goes, and reports frame times for every run. The
+// stream restores its snapshot at the start of each run, so all runs do the
+// same work; a hash of the resulting state shows whether they did.
+namespace Replay {
+    struct Options {
+        std::string streamPath = "";
+        uint32_t repeat = 3;
+        uint32_t threads = 0;           // 0: renderer default
+        RenderBackend backend = BACKEND_AUTO;
+        std::string jsonPath = "";
+        std::string tracePath = "";
+    };
+
+    bool parseOptions(int argc, char** argv, Options& options) {
+        for (int i = 1; i < argc; ++i) {
+            bool hasValue = i + 1 < argc;
+            if (strcmp(argv[i], "--repeat") == 0 && hasValue) {
+                options.repeat = (uint32_t)atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--threads") == 0 && hasValue) {
+                options.threads = (uint32_t)atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--backend") == 0 && hasValue) {
+                if (!Renderer::parseBackend(argv[++i], options.backend)) {
+                    std::cout << "Unknown backend " << argv[i] << ", expected auto, vulkan or software" << std::endl;
+                    return false;
+                }
+            } else if (strcmp(argv[i], "--json") == 0 && hasValue) {
+                options.jsonPath = argv[++i];
+            } else if (strcmp(argv[i], "--trace") == 0 && hasValue) {
+                options.tracePath = argv[++i];
+            } else if (argv[i][0] != '-' && options.streamPath.empty()) {
+                options.streamPath = argv[i];
+            } else {
+                options.streamPath = "";
+                break;
+            }
+        }
+
+        if (options.streamPath.empty()) {
+            std::cout << "Usage: replay STREAM [--repeat N] [--threads N] [--backend auto|vulkan|software]" << std::endl
+                      << "              [--json FILE] [--trace FILE]" << std::endl;
+            return false;
+        }
+        if (options.repeat == 0) options.repeat = 1;
+        return true;
+    }
+
+    // FNV-1a, 64 bits.
+    uint64_t hash(uint64_t value, const void* data, size_t size) {
+        const uint8_t* bytes = (const uint8_t*)data;
+        for (size_t i = 0; i < size; ++i) {
+            value = (value ^ bytes[i]) * 1099511628211ull;
+        }
+        return value;
+    }
+
+    struct Run {
+        uint64_t frames = 0;
+        double seconds = 0.0;
+        std::vector<double> cpuTimes;
+        std::vector<double> gpuTimes;
+        uint64_t stateHash = 14695981039346656037ull;
+    };
+
+    // The final instances, the camera and, where they are computed on the
+    // CPU, the visible instance counts of every frame. With the software
+    // backend also the last frame's depth; its colour includes a clear
+    // colour that keeps changing from run to run.
+    bool replay(Renderer* renderer, CommandStream& stream, Run& run) {
+        typedef std::chrono::steady_clock Clock;
+
+        stream.rewind();
+        Clock::time_point begin = Clock::now();
+        for (;;) {
+            Clock::time_point frameBegin = Clock::now();
+            if (!renderer->replayFrame(stream)) break;
+            run.cpuTimes.push_back(std::chrono::duration<double, std::milli>(Clock::now() - frameBegin).count());
+
+            if (run.frames >= stream.getHeader().framesInFlight && renderer->getLastGpuFrameTime() >= 0.0) {
+                run.gpuTimes.push_back(renderer->getLastGpuFrameTime());
+            }
+            if (renderer->getCullingMode() != CULLING_GPU) {
+                uint32_t visible = renderer->getVisibleInstanceCount();
+                run.stateHash = hash(run.stateHash, &visible, sizeof(visible));
+            }
+            run.frames++;
+        }
+        renderer->waitReady();
+        run.seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+
+        for (uint32_t i = 0; i < renderer->getInstanceCount(); ++i) {
+            run.stateHash = hash(run.stateHash, &renderer->getInstance(i), sizeof(InstanceData));
+        }
+        run.stateHash = hash(run.stateHash, renderer->getViewProjection().m, sizeof(Math::Mat4::m));
+        if (renderer->getBackend() == BACKEND_SOFTWARE) {
+            const SoftwareRasterizer& rasterizer = renderer->getSoftwareRasterizer();
+            for (uint32_t y = 0; y < rasterizer.getHeight(); ++y) {
+                run.stateHash = hash(run.stateHash, rasterizer.getDepth() + (size_t)y * rasterizer.getStride(),
+                    rasterizer.getWidth() * sizeof(float));
+            }
+        }
+
+        return !stream.hasFailed();
+    }
+
+    int run(const Options& options) {
+        CommandStream stream;
+        if (!stream.load(options.streamPath)) return 1;
+        const CommandStream::Header& header = stream.getHeader();
+
+        Renderer* renderer = new Renderer(header.width, header.height, header.framesInFlight, options.backend);
+        if (options.threads > 0) {
+            renderer->setRecordThreadCount(options.threads);
+        }
+
+        std::cout << "Stream: " << options.streamPath << ", " << header.frames << " frames, "
+                  << header.width << "x" << header.height << ", " << header.framesInFlight << " frames in flight, "
+                  << header.commandBytes << " bytes of commands ("
+                  << (double)header.commandBytes / std::max(header.frames, (uint64_t)1) << " per frame)" << std::endl;
+        std::cout << "Backend: " << Renderer::getBackendName(renderer->getBackend()) << std::endl;
+
+        std::vector<Run> runs(options.repeat);
+        bool failed = false;
+        for (uint32_t i = 0; i < options.repeat && !failed; ++i) {
+            // Only the last run is traced.
+            renderer->getProfiler().setTracing(!options.tracePath.empty() && i + 1 == options.repeat);
+
+            Run& run = runs[i];
+            failed = !replay(renderer, stream, run);
+            Percentiles cpu = percentiles(run.cpuTimes);
+            Percentiles gpu = percentiles(run.gpuTimes);
+
+            std::cout << "Run " << i + 1 << ": " << run.frames << " frames, "
+                      << (double)run.frames / run.seconds << " frames/s, CPU p50 " << cpu.p50 << " ms, p95 "
+                      << cpu.p95 << " ms, GPU p50 ";
+            if (run.gpuTimes.empty()) {
+                std::cout << "unavailable";
+            } else {
+                std::cout << gpu.p50 << " ms";
+            }
+            std::cout << ", state " << std::hex << run.stateHash << std::dec << std::endl;
+        }
+
+        if (failed) {
+            delete(renderer);
+            return 1;
+        }
+
+        // The first run also pays for pipelines and uploads a fresh
+        // renderer has not done yet; it is reported but left out here.
+        std::vector<double> cpuTimes;
+        std::vector<double> gpuTimes;
+        uint32_t first = options.repeat > 1 ? 1 : 0;
+        bool deterministic = true;
+        for (uint32_t i = first; i < options.repeat; ++i) {
+            cpuTimes.insert(cpuTimes.end(), runs[i].cpuTimes.begin(), runs[i].cpuTimes.end());
+            gpuTimes.insert(gpuTimes.end(), runs[i].gpuTimes.begin(), runs[i].gpuTimes.end());
+        }
+        for (const Run& run: runs) {
+            deterministic = deterministic && run.stateHash == runs[0].stateHash && run.frames == runs[0].frames;
+        }
+        Percentiles cpu = percentiles(cpuTimes);
+        Percentiles gpu = percentiles(gpuTimes);
+
+        std::cout << "CPU frame time" << (first > 0 ? " (without run 1):" : ":")
+                  << " mean " << cpu.mean << " ms, p50 " << cpu.p50 << " ms, p95 " << cpu.p95
+                  << " ms, p99 " << cpu.p99 << " ms, max " << cpu.max << " ms" << std::endl;
+        if (!gpuTimes.empty()) {
+            std::cout << "GPU frame time: mean " << gpu.mean << " ms, p50 " << gpu.p50 << " ms, p95 " << gpu.p95
+                      << " ms, p99 " << gpu.p99 << " ms, max " << gpu.max << " ms" << std::endl;
+        }
+        std::cout << (deterministic ? "All runs ended in the same state" : "Runs ended in different states") << std::endl;
+
+        if (!options.jsonPath.empty()) {
+            std::ofstream json(options.jsonPath);
+            json << "{" << std::endl
+                 << "  \"stream\": \"" << options.streamPath << "\"," << std::endl
+                 << "  \"frames\": " << header.frames << "," << std::endl
+                 << "  \"width\": " << header.width << "," << std::endl
+                 << "  \"height\": " << header.height << "," << std::endl
+                 << "  \"frames_in_flight\": " << header.framesInFlight << "," << std::endl
+                 << "  \"command_bytes\": " << header.commandBytes << "," << std::endl
+                 << "  \"record_threads\": " << renderer->getRecordThreadCount() << "," << std::endl
+                 << "  \"backend\": \"" << Renderer::getBackendName(renderer->getBackend()) << "\"," << std::endl
+                 << "  \"deterministic\": " << (deterministic ? "true" : "false") << "," << std::endl
+                 << "  \"cpu_frame_ms\": " << toJson(cpu) << "," << std::endl
+                 << "  \"gpu_frame_ms\": " << (gpuTimes.empty() ? "null" : toJson(gpu)) << "," << std::endl
+                 << "  \"runs\": [";
+            for (uint32_t i = 0; i < options.repeat; ++i) {
+                const Run& run = runs[i];
+                json << (i == 0 ? "" : ", ") << "{\"frames\": " << run.frames
+                     << ", \"fps\": " << (double)run.frames / run.seconds
+                     << ", \"cpu_frame_ms\": " << toJson(percentiles(run.cpuTimes))
+                     << ", \"gpu_frame_ms\": " << (run.gpuTimes.empty() ? "null" : toJson(percentiles(run.gpuTimes)))
+                     << ", \"state\": \"" << std::hex << run.stateHash << std::dec << "\"}";
+            }
+            json << "]" << std::endl
+                 << "}" << std::endl;
+
+            if (!json) {
+                std::cout << "Failed to write " << options.jsonPath << std::endl;
+            }
+        }
+
+        if (!options.tracePath.empty()) {
+            renderer->getProfiler().writeChromeTrace(options.tracePath);
+        }
+
+        delete(renderer);
+        return deterministic ? 0 : 1;
+    }
+};
+
+int main(int argc, char** argv) {
+    Replay::Options options;
+    if (!Replay::parseOptions(argc, argv, options)) return 1;
+
+    return Replay::run(options);
+}
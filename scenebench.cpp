@@ -0,0 +1,186 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include "Math.hpp"
+#include "Scene.hpp"
+
+// Scene update benchmark: a forest of small binary trees, of which a few
+// percent of the entities move every frame. Incremental propagation is
+// compared with recomputing every world matrix, and both are checked to
+// agree.
+namespace SceneBench {
+    struct Options {
+        size_t count = 1 << 20;
+        uint32_t objectSize = 16;
+        double moving = 1.0;            // percent of the entities per frame
+        uint32_t frames = 100;
+    };
+
+    bool parseOptions(int argc, char** argv, Options& options) {
+        for (int i = 1; i < argc; ++i) {
+            bool hasValue = i + 1 < argc;
+            if (strcmp(argv[i], "--count") == 0 && hasValue) {
+                options.count = (size_t)atol(argv[++i]);
+            } else if (strcmp(argv[i], "--object-size") == 0 && hasValue) {
+                options.objectSize = (uint32_t)atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--moving") == 0 && hasValue) {
+                options.moving = atof(argv[++i]);
+            } else if (strcmp(argv[i], "--frames") == 0 && hasValue) {
+                options.frames = (uint32_t)atoi(argv[++i]);
+            } else {
+                std::cout << "Usage: scenebench [--count N] [--object-size N] [--moving PERCENT] [--frames N]" << std::endl;
+                return false;
+            }
+        }
+
+        if (options.count == 0) options.count = 1;
+        if (options.objectSize == 0) options.objectSize = 1;
+        if (options.frames == 0) options.frames = 1;
+        options.moving = std::min(std::max(options.moving, 0.0), 100.0);
+        return true;
+    }
+
+    typedef std::chrono::steady_clock Clock;
+
+    double elapsedMs(Clock::time_point begin) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+    }
+
+    float random(float min, float max) {
+        return min + (max - min) * (float)rand() / (float)RAND_MAX;
+    }
+
+    Math::Quat randomRotation() {
+        Math::Vec3 axis = Math::normalize(Math::Vec3(random(-1.0f, 1.0f), random(-1.0f, 1.0f), random(-1.0f, 1.0f)));
+        return Math::fromAxisAngle(axis, random(0.0f, 6.2831853f));
+    }
+
+    // Mean and worst of the per-frame times, in milliseconds.
+    struct Timing {
+        double mean = 0.0;
+        double max = 0.0;
+        double updated = 0.0;           // entities recomputed per frame
+    };
+
+    Timing runFrames(Scene& scene, const Options& options, const std::function<void()>& change) {
+        Timing timing;
+        for (uint32_t frame = 0; frame < options.frames; ++frame) {
+            change();
+            Clock::time_point begin = Clock::now();
+            size_t updated = scene.update();
+            double time = elapsedMs(begin);
+            timing.mean += time;
+            timing.max = std::max(timing.max, time);
+            timing.updated += (double)updated;
+        }
+        timing.mean /= options.frames;
+        timing.updated /= options.frames;
+        return timing;
+    }
+
+    int run(const Options& options) {
+        size_t count = options.count;
+        uint32_t objectSize = options.objectSize;
+        size_t movingCount = (size_t)((double)count * options.moving / 100.0);
+        srand(1);
+
+        std::vector<Scene::Entity> entities(count);
+        Scene scene;
+        scene.reserve(count);
+
+        // Objects are binary trees: entity k of an object hangs below entity
+        // (k - 1) / 2. Roots are spread over a cube, children sit close to
+        // their parent.
+        Clock::time_point begin = Clock::now();
+        for (size_t i = 0; i < count; ++i) {
+            size_t k = i % objectSize;
+            Scene::Entity parent = k == 0 ? Scene::INVALID_ENTITY : entities[i - k + (k - 1) / 2];
+            Scene::Entity entity = scene.create(parent);
+            entities[i] = entity;
+
+            Math::Vec3 position = k == 0 ?
+                Math::Vec3(random(-500.0f, 500.0f), random(-500.0f, 500.0f), random(-500.0f, 500.0f)) :
+                Math::Vec3(random(-2.0f, 2.0f), random(-2.0f, 2.0f), random(-2.0f, 2.0f));
+            scene.setLocalTransform(entity, position, randomRotation(), k == 0 ? 1.0f : 0.75f);
+            scene.setLocalBounds(entity, Math::Vec3(-0.5f, -0.5f, -0.5f), Math::Vec3(0.5f, 0.5f, 0.5f));
+            scene.setMesh(entity, (uint32_t)(i % 4));
+            scene.setMaterial(entity, (uint32_t)(i % 16));
+        }
+        double createTime = elapsedMs(begin);
+
+        begin = Clock::now();
+        scene.update();
+        double firstUpdateTime = elapsedMs(begin);
+        Scene::Stats stats = scene.getStats();
+
+        std::cout << "Scene: " << stats.entities << " entities, " << stats.roots << " roots, depth "
+                  << stats.depth << ", " << options.moving << "% (" << movingCount << ") moving per frame, "
+                  << options.frames << " frames, " << Math::getSimdLevelName(Math::getSimdLevel()) << std::endl;
+        std::cout << "Create: " << createTime << " ms, first update (sort and propagate): "
+                  << firstUpdateTime << " ms" << std::endl;
+
+        Timing incremental = runFrames(scene, options, [&] {
+            for (size_t i = 0; i < movingCount; ++i) {
+                size_t index = (size_t)rand() % count;
+                bool root = index % objectSize == 0;
+                Math::Vec3 position = root ?
+                    Math::Vec3(random(-500.0f, 500.0f), random(-500.0f, 500.0f), random(-500.0f, 500.0f)) :
+                    Math::Vec3(random(-2.0f, 2.0f), random(-2.0f, 2.0f), random(-2.0f, 2.0f));
+                scene.setLocalTransform(entities[index], position, randomRotation(), root ? 1.0f : 0.75f);
+            }
+        });
+        stats = scene.getStats();
+        std::cout << "Incremental update: " << incremental.mean << " ms mean, " << incremental.max << " ms max, "
+                  << incremental.updated << " entities recomputed per frame (last frame: " << stats.dirtyEntities
+                  << " dirty in " << stats.updatedSubtrees << " subtrees, " << scene.getChangedRanges().size()
+                  << " changed ranges)" << std::endl;
+
+        std::vector<Math::Mat4> incrementalWorld = scene.getWorldMatrices();
+
+        Timing full = runFrames(scene, options, [&] { scene.invalidate(); });
+        std::cout << "Full update: " << full.mean << " ms mean, " << full.max << " ms max, "
+                  << full.updated << " entities recomputed per frame, "
+                  << full.mean / std::max(incremental.mean, 1e-9) << "x the incremental time" << std::endl;
+
+        size_t mismatches = 0;
+        const std::vector<Math::Mat4>& fullWorld = scene.getWorldMatrices();
+        for (size_t i = 0; i < fullWorld.size(); ++i) {
+            for (int j = 0; j < 16; ++j) {
+                if (std::fabs(fullWorld[i].m[j] - incrementalWorld[i].m[j]) > 1e-3f) {
+                    mismatches++;
+                    break;
+                }
+            }
+        }
+        std::cout << "Incremental and full update disagree on " << mismatches << " world matrices" << std::endl;
+
+        // Structural changes are batched into one reorder per update().
+        size_t reparented = std::max(movingCount / 10, (size_t)1);
+        begin = Clock::now();
+        for (size_t i = 0; i < reparented; ++i) {
+            size_t index = (size_t)rand() % count;
+            if (index % objectSize == 0) continue;
+            size_t target = ((size_t)rand() % (count / objectSize)) * objectSize;
+            scene.setParent(entities[index], entities[target]);
+        }
+        scene.update();
+        stats = scene.getStats();
+        std::cout << "Reparent " << reparented << " entities and update: " << elapsedMs(begin) << " ms, depth "
+                  << stats.depth << ", " << stats.updatedEntities << " entities recomputed" << std::endl;
+
+        return mismatches == 0 ? 0 : 1;
+    }
+};
+
+int main(int argc, char** argv) {
+    SceneBench::Options options;
+    if (!SceneBench::parseOptions(argc, argv, options)) return 1;
+
+    return SceneBench::run(options);
+}
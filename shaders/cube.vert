@@ -0,0 +1,38 @@
+#version 450
+
+layout(location = 0) in vec3 inPosition;
+
+// Per-instance attribute: which entry of the instance buffer to draw. The
+// culling stage writes the indices of the visible instances only.
+layout(location = 1) in uint inInstanceIndex;
+
+struct InstanceData {
+    mat4 model;
+    vec4 color;
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer Instances {
+    InstanceData instances[];
+};
+
+// Written into the uniform ring every frame, bound with a dynamic offset.
+layout(std140, set = 0, binding = 1) uniform Frame {
+    mat4 viewProjection;
+} frame;
+
+// Specialization constant: 0 shades with the instance colour, 1 with a
+// colour hashed from the instance index (ShadingMode).
+layout(constant_id = 0) const uint SHADING_MODE = 0;
+
+layout(location = 0) out vec3 outColor;
+
+void main() {
+    InstanceData instance = instances[inInstanceIndex];
+    gl_Position = frame.viewProjection * instance.model * vec4(inPosition, 1.0);
+    vec3 color = instance.color.rgb;
+    if (SHADING_MODE == 1) {
+        uint hash = inInstanceIndex * 2654435761u;
+        color = vec3((hash >> 8) & 255u, (hash >> 16) & 255u, (hash >> 24) & 255u) / 255.0;
+    }
+    outColor = color * (0.75 + 0.25 * inPosition.z);
+}